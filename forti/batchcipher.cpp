@@ -0,0 +1,290 @@
+#include "batchcipher.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QThread>
+#include <QThreadPool>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "filewalker.h"
+#include "sparsereader.h"
+
+namespace {
+
+// Ключ одиночных команд "Зашифровать" и "Расшифровать"
+const char KEY[] = "simplekey";
+const int KEY_SIZE = int(sizeof(KEY) - 1);
+
+const char ENCRYPTED_SUFFIX[] = ".enc";
+const char DECRYPTED_SUFFIX[] = ".dec";
+
+const int WALK_PROGRESS_STEP = 1000;
+const int PROGRESS_INTERVAL_MS = 100;
+
+bool writeAll(int fd, const char *data, qint64 size)
+{
+    while (size > 0) {
+        const ssize_t n = ::write(fd, data, size_t(size));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+} // namespace
+
+BatchCipher::BatchCipher(Mode mode)
+    : m_mode(mode)
+    , m_threads(0)
+{
+}
+
+void BatchCipher::transform(char *data, qint64 size, qint64 offset)
+{
+    int k = int(offset % KEY_SIZE);
+    for (qint64 i = 0; i < size; ++i) {
+        data[i] ^= KEY[k];
+        if (++k == KEY_SIZE)
+            k = 0;
+    }
+}
+
+QByteArray BatchCipher::outputPath(const QByteArray &path) const
+{
+    if (m_mode == Encrypt)
+        return path + ENCRYPTED_SUFFIX;
+    if (path.endsWith(ENCRYPTED_SUFFIX))
+        return path.left(path.size() - int(sizeof(ENCRYPTED_SUFFIX) - 1));
+    return path + DECRYPTED_SUFFIX;
+}
+
+// В каталогах шифруются еще не зашифрованные файлы, расшифровываются
+// только зашифрованные
+bool BatchCipher::wanted(const QByteArray &path) const
+{
+    return path.endsWith(ENCRYPTED_SUFFIX) == (m_mode == Decrypt);
+}
+
+bool BatchCipher::collect(const QStringList &inputs, const ProgressCallback &progress)
+{
+    bool canceled = false;
+    for (const QString &input : inputs) {
+        const QFileInfo info(input);
+        if (info.isFile()) {
+            m_items.append(Item{ QFile::encodeName(info.absoluteFilePath()), info.size() });
+            continue;
+        }
+        if (!info.isDir()) {
+            m_errors.append(CipherError{ QFile::encodeName(input), QString("не найден") });
+            continue;
+        }
+        FileWalker walker;
+        walker.setNeedSize(true);
+        walker.walk(input, [&](const WalkEntry &entry) {
+            if (!wanted(entry.path))
+                return true;
+            m_items.append(Item{ entry.path, entry.size });
+            if (progress && m_items.size() % WALK_PROGRESS_STEP == 0
+                && !progress(Collecting, m_items.size(), 0)) {
+                canceled = true;
+                return false;
+            }
+            return true;
+        });
+        if (canceled)
+            return false;
+    }
+    return true;
+}
+
+// Крупный файл - отдельное задание, подряд идущие мелкие - одно задание
+QVector<BatchCipher::Task> BatchCipher::plan() const
+{
+    QVector<Task> tasks;
+    Task batch{ 0, 0 };
+    qint64 batchBytes = 0;
+    for (int i = 0; i < m_items.size(); ++i) {
+        if (m_items[i].size >= SmallFileSize) {
+            tasks.append(Task{ i, 1 });
+            continue;
+        }
+        if (batch.count > 0 && (batch.first + batch.count != i || batch.count == BatchFiles
+                                || batchBytes + m_items[i].size > BatchBytes)) {
+            tasks.append(batch);
+            batch.count = 0;
+        }
+        if (batch.count == 0) {
+            batch.first = i;
+            batchBytes = 0;
+        }
+        ++batch.count;
+        batchBytes += m_items[i].size;
+    }
+    if (batch.count > 0)
+        tasks.append(batch);
+    return tasks;
+}
+
+bool BatchCipher::processFile(const Item &item, char *buffer, const QAtomicInt &canceled,
+                              QAtomicInteger<qint64> &doneBytes, QString *error) const
+{
+    const int in = ::open(item.path.constData(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (in < 0 || ::fstat(in, &st) != 0) {
+        *error = QString::fromLocal8Bit(strerror(errno));
+        if (in >= 0)
+            ::close(in);
+        return false;
+    }
+    ::posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Результат пишется во временный файл рядом и заменяет цель только
+    // целиком: существующий файл с тем же именем (расшифровка foo.enc при
+    // живом foo) не теряется при ошибке или отмене. Права - исходного
+    // файла: зашифрованная копия закрытого файла не должна оказаться
+    // доступной всем
+    const QByteArray outPath = outputPath(item.path);
+    QByteArray tempPath = outPath + ".XXXXXX";
+    const int out = ::mkostemp(tempPath.data(), O_CLOEXEC);
+    if (out < 0 || ::fchmod(out, st.st_mode & 0777) != 0) {
+        *error = QString("не удалось создать %1: %2")
+                     .arg(QFile::decodeName(outPath), QString::fromLocal8Bit(strerror(errno)));
+        if (out >= 0) {
+            ::close(out);
+            ::unlink(tempPath.constData());
+        }
+        ::close(in);
+        return false;
+    }
+
+    // Дыры исходного файла не читаются с диска: буфер заполняется нулями.
+    // Результат всегда плотный: после наложения ключа нулевые байты
+    // становятся байтами ключа, и дыры записываются целиком
+    bool ok = true;
+    qint64 offset = 0;
+    qint64 holeLeft = 0;
+    SparseReader reader(in);
+    for (;;) {
+        if (canceled.loadRelaxed()) {
+            *error = QString("отменено");
+            ok = false;
+            break;
+        }
+        qint64 got;
+        if (holeLeft > 0) {
+            got = qMin<qint64>(holeLeft, ChunkSize);
+            memset(buffer, 0, size_t(got));
+            holeLeft -= got;
+        } else {
+            bool hole = false;
+            got = reader.next(buffer, ChunkSize, &hole);
+            if (got < 0) {
+                *error = QString("ошибка чтения: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+                ok = false;
+                break;
+            }
+            if (got == 0)
+                break;
+            if (hole) {
+                holeLeft = got;
+                continue;
+            }
+        }
+        transform(buffer, got, offset);
+        if (!writeAll(out, buffer, got)) {
+            ok = false;
+            *error = QString("ошибка записи: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+            break;
+        }
+        offset += got;
+        doneBytes.fetchAndAddRelaxed(got);
+    }
+    ::close(in);
+    if (ok && ::fsync(out) != 0) {
+        *error = QString("ошибка записи: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+        ok = false;
+    }
+    if (::close(out) != 0 && ok) {
+        *error = QString("ошибка записи: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+        ok = false;
+    }
+    if (ok && ::rename(tempPath.constData(), outPath.constData()) != 0) {
+        *error = QString("не удалось заменить %1: %2")
+                     .arg(QFile::decodeName(outPath), QString::fromLocal8Bit(strerror(errno)));
+        ok = false;
+    }
+    // Неполный результат не оставляем; цель при этом не тронута
+    if (!ok)
+        ::unlink(tempPath.constData());
+    return ok;
+}
+
+bool BatchCipher::run(const QStringList &inputs, const ProgressCallback &progress)
+{
+    m_items.clear();
+    m_errors.clear();
+    m_stats = CipherStats();
+
+    if (!collect(inputs, progress))
+        return false;
+    m_stats.files = m_items.size();
+    for (const Item &item : m_items)
+        m_stats.bytes += qMax<qint64>(0, item.size);
+
+    const QVector<Task> tasks = plan();
+    m_stats.tasks = tasks.size();
+    if (tasks.isEmpty())
+        return true;
+
+    QAtomicInt next(0);
+    QAtomicInt doneFiles(0);
+    QAtomicInteger<qint64> doneBytes(0);
+    QAtomicInt canceled(0);
+    QMutex errorsMutex;
+
+    // Потоки берут задания из общего счетчика; буфер у каждого свой
+    QThreadPool pool;
+    const int threads = m_threads > 0 ? m_threads : qMax(2, QThread::idealThreadCount());
+    pool.setMaxThreadCount(threads);
+    for (int t = 0; t < qMin(threads, tasks.size()); ++t) {
+        pool.start([&] {
+            QByteArray buffer(ChunkSize, Qt::Uninitialized);
+            for (int i = next.fetchAndAddRelaxed(1); i < tasks.size() && !canceled.loadRelaxed();
+                 i = next.fetchAndAddRelaxed(1)) {
+                const Task &task = tasks[i];
+                for (int j = task.first; j < task.first + task.count && !canceled.loadRelaxed(); ++j) {
+                    QString error;
+                    if (!processFile(m_items[j], buffer.data(), canceled, doneBytes, &error)
+                        && !canceled.loadRelaxed()) {
+                        QMutexLocker lock(&errorsMutex);
+                        m_errors.append(CipherError{ m_items[j].path, error });
+                    }
+                    doneFiles.fetchAndAddRelaxed(1);
+                }
+            }
+        });
+    }
+
+    while (!pool.waitForDone(PROGRESS_INTERVAL_MS)) {
+        if (progress && !canceled.loadRelaxed()
+            && !progress(Processing, doneBytes.loadRelaxed(), m_stats.bytes))
+            canceled.storeRelaxed(1);
+    }
+    m_stats.doneFiles = doneFiles.loadRelaxed();
+    m_stats.doneBytes = doneBytes.loadRelaxed();
+    m_stats.failed = m_errors.size();
+    return !canceled.loadRelaxed();
+}
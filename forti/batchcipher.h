@@ -0,0 +1,93 @@
+#ifndef BATCHCIPHER_H
+#define BATCHCIPHER_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <functional>
+
+// Файл, который не удалось обработать
+struct CipherError {
+    QByteArray path;  // путь в кодировке ФС
+    QString message;
+};
+
+struct CipherStats {
+    qint64 files = 0;       // файлов к обработке
+    qint64 bytes = 0;       // их общий размер
+    qint64 doneFiles = 0;
+    qint64 doneBytes = 0;
+    qint64 failed = 0;
+    qint64 tasks = 0;       // заданий пула (мелкие файлы - пачками)
+};
+
+// Пакетное шифрование и расшифровка тем же XOR-ключом, что у одиночных
+// команд: файл.enc <-> файл (или файл.dec).
+//
+// Входы - файлы и каталоги (каталоги обходятся целиком; при шифровании
+// пропускаются уже зашифрованные *.enc, при расшифровке берутся только
+// они). Файлы делятся на задания: крупный файл - отдельное задание,
+// мелкие (меньше SmallFileSize) собираются в пачки до BatchBytes или
+// BatchFiles. Задания разбирает пул потоков; у каждого потока один буфер
+// ChunkSize, через который идут чтение, преобразование и запись, поэтому
+// в работе не больше потоков * ChunkSize данных независимо от размера
+// файлов. Дыры разреженных файлов не читаются с диска (SparseReader),
+// но результат всегда плотный. Результат пишется во временный файл и
+// заменяет цель только целиком; неполный (ошибка или отмена) удаляется,
+// существующий файл с тем же именем остается как был.
+class BatchCipher {
+public:
+    enum Mode { Encrypt, Decrypt };
+    enum Stage { Collecting = 1, Processing };
+
+    static const int ChunkSize = 1 << 20;
+    static const qint64 SmallFileSize = 64 * 1024;
+    static const qint64 BatchBytes = 1 << 20;
+    static const int BatchFiles = 256;
+
+    // Вызывается в потоке run(); возврат false отменяет работу. На этапе
+    // Collecting done - найдено файлов, на Processing - обработано байт
+    typedef std::function<bool(Stage stage, qint64 done, qint64 total)> ProgressCallback;
+
+    explicit BatchCipher(Mode mode);
+
+    void setThreadCount(int threads) { m_threads = threads; }
+
+    // false, если работа отменена
+    bool run(const QStringList &inputs, const ProgressCallback &progress);
+
+    const QVector<CipherError> &errors() const { return m_errors; }
+    const CipherStats &stats() const { return m_stats; }
+    // Куда записан результат для входного файла
+    QByteArray outputPath(const QByteArray &path) const;
+
+    // XOR с ключом; offset - позиция блока в файле
+    static void transform(char *data, qint64 size, qint64 offset);
+
+private:
+    struct Item {
+        QByteArray path;
+        qint64 size;
+    };
+    struct Task {
+        int first;
+        int count;
+    };
+
+    bool collect(const QStringList &inputs, const ProgressCallback &progress);
+    bool wanted(const QByteArray &path) const;
+    QVector<Task> plan() const;
+    bool processFile(const Item &item, char *buffer, const QAtomicInt &canceled,
+                     QAtomicInteger<qint64> &doneBytes, QString *error) const;
+
+    Mode m_mode;
+    int m_threads;
+    QVector<Item> m_items;
+    QVector<CipherError> m_errors;
+    CipherStats m_stats;
+};
+
+#endif // BATCHCIPHER_H
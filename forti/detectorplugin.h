@@ -0,0 +1,86 @@
+#ifndef DETECTORPLUGIN_H
+#define DETECTORPLUGIN_H
+
+#include <QByteArray>
+#include <QString>
+#include <QtPlugin>
+
+// Интерфейс подключаемых детекторов. Плагин - разделяемая библиотека
+// Qt (Q_PLUGIN_METADATA с DetectorFactory_iid) в каталоге детекторов,
+// см. DetectorRegistry. Этот заголовок - все, что нужно для сборки плагина.
+
+// Файл, который проверяется
+struct DetectorFile {
+    QByteArray path;
+    QByteArray suffix;  // расширение в нижнем регистре, без точки
+    qint64 size = -1;
+    qint64 mtime = 0;   // секунды с начала эпохи
+    quint32 mode = 0;   // st_mode
+    bool sampled = false;  // крупный файл проверяется не целиком
+    // Вложение письма: path - почтовый ящик, member - имя вложения (может
+    // быть пустым), contentType - его MIME-тип; size и mode не известны
+    QByteArray member;
+    QByteArray contentType;
+};
+
+// Вывод детектора по файлу
+struct DetectorFinding {
+    enum Level : quint8 {
+        Nothing = 0,
+        Suspicious = 1,
+        Malicious = 2
+    };
+
+    quint8 level = Nothing;
+    QByteArray detail;  // пояснение для отчета (UTF-8)
+};
+
+// Детектор. Каждый сканер (поток или процесс-обработчик) создает свой
+// экземпляр, поэтому вызовы идут из одного потока и состояние между
+// begin() и finish() можно держать в полях.
+//
+// Файл читается один раз на все детекторы и встроенные проверки:
+// детекторы получают одни и те же блоки.
+class Detector {
+public:
+    enum Input {
+        Metadata,  // путь, размер, mtime; файл не читается
+        Header,    // первые байты файла (до 512)
+        Stream     // все содержимое блоками
+    };
+
+    virtual ~Detector() {}
+
+    virtual Input input() const = 0;
+
+    // Начало файла. header - первые байты (для Metadata - пусто).
+    // false - файл детектору не нужен, feed() и finish() не вызываются
+    virtual bool begin(const DetectorFile &file, const unsigned char *header, int size) = 0;
+    // Содержимое по порядку, начиная с заголовка (только Stream). Если
+    // file.sampled - только проверяемые области, одна за другой
+    virtual void feed(const unsigned char *data, int size)
+    {
+        Q_UNUSED(data)
+        Q_UNUSED(size)
+    }
+    virtual DetectorFinding finish() = 0;
+
+    // Файлы приходят пакетами: конец пакета - место для работы, которую
+    // выгодно делать реже, чем на каждый файл
+    virtual void endBatch() {}
+};
+
+// Объект плагина
+class DetectorFactory {
+public:
+    virtual ~DetectorFactory() {}
+
+    // Имя для отчетов и замеров времени
+    virtual QString name() const = 0;
+    virtual Detector *create() = 0;
+};
+
+#define DetectorFactory_iid "org.kion85.Forti.DetectorFactory/1.0"
+Q_DECLARE_INTERFACE(DetectorFactory, DetectorFactory_iid)
+
+#endif // DETECTORPLUGIN_H
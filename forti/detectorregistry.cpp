@@ -0,0 +1,118 @@
+#include "detectorregistry.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QLibrary>
+#include <QPluginLoader>
+#include <QStandardPaths>
+
+namespace {
+
+struct Loaded {
+    QVector<DetectorFactory *> factories;
+    QStringList errors;
+};
+
+Loaded load()
+{
+    Loaded loaded;
+    if (DetectorRegistry::isDisabled())
+        return loaded;
+    QStringList dirs;
+    dirs << DetectorRegistry::pluginsDirectory();
+    const QString extra = qEnvironmentVariable("FORTI_DETECTOR_PATH");
+    if (!extra.isEmpty())
+        dirs << extra.split(':', Qt::SkipEmptyParts);
+
+    QStringList names;
+    for (const QString &dir : dirs) {
+        const QFileInfoList files = QDir(dir).entryInfoList(QDir::Files | QDir::Readable, QDir::Name);
+        for (const QFileInfo &info : files) {
+            if (!QLibrary::isLibrary(info.fileName()))
+                continue;
+            // Библиотека остается загруженной до конца процесса
+            QPluginLoader loader(info.absoluteFilePath());
+            QObject *instance = loader.instance();
+            DetectorFactory *factory = qobject_cast<DetectorFactory *>(instance);
+            if (!factory) {
+                loaded.errors << QString("%1: %2").arg(info.fileName(),
+                                                       instance ? QString("не детектор") : loader.errorString());
+                continue;
+            }
+            if (names.contains(factory->name())) {
+                loaded.errors << QString("%1: детектор \"%2\" уже загружен").arg(info.fileName(), factory->name());
+                continue;
+            }
+            names << factory->name();
+            loaded.factories << factory;
+        }
+    }
+    for (const QString &error : loaded.errors)
+        qWarning() << "Детектор не загружен:" << error;
+    return loaded;
+}
+
+} // namespace
+
+const QVector<DetectorFactory *> &DetectorRegistry::installed(QStringList *errors)
+{
+    static const Loaded loaded = load();
+    if (errors)
+        *errors = loaded.errors;
+    return loaded.factories;
+}
+
+QString DetectorRegistry::pluginsDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/detectors";
+}
+
+bool DetectorRegistry::isDisabled()
+{
+    return qEnvironmentVariableIsSet("FORTI_NO_DETECTORS");
+}
+
+QByteArray DetectorRegistry::encodeTimings(const QVector<DetectorTiming> &timings)
+{
+    QByteArray out;
+    for (const DetectorTiming &timing : timings) {
+        QByteArray name = timing.name.toUtf8();
+        name.replace('\t', ' ').replace('\n', ' ');
+        out += name + '\t' + QByteArray::number(timing.files) + '\t'
+               + QByteArray::number(timing.nanoseconds) + '\n';
+    }
+    return out;
+}
+
+void DetectorRegistry::mergeTimings(QVector<DetectorTiming> &into, const QByteArray &encoded)
+{
+    QVector<DetectorTiming> timings;
+    const QList<QByteArray> lines = encoded.split('\n');
+    for (const QByteArray &line : lines) {
+        const QList<QByteArray> fields = line.split('\t');
+        if (fields.size() != 3)
+            continue;
+        DetectorTiming timing;
+        timing.name = QString::fromUtf8(fields.at(0));
+        timing.files = fields.at(1).toULongLong();
+        timing.nanoseconds = fields.at(2).toLongLong();
+        timings << timing;
+    }
+    mergeTimings(into, timings);
+}
+
+void DetectorRegistry::mergeTimings(QVector<DetectorTiming> &into, const QVector<DetectorTiming> &timings)
+{
+    for (const DetectorTiming &timing : timings) {
+        int i = 0;
+        while (i < into.size() && into[i].name != timing.name)
+            ++i;
+        if (i == into.size()) {
+            into << timing;
+        } else {
+            into[i].files += timing.files;
+            into[i].nanoseconds += timing.nanoseconds;
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef DETECTORREGISTRY_H
+#define DETECTORREGISTRY_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "detectorplugin.h"
+
+// Время одного детектора за сканирование
+struct DetectorTiming {
+    QString name;
+    quint64 files = 0;        // файлов, которые детектор принял
+    qint64 nanoseconds = 0;   // begin, feed, finish и endBatch вместе
+};
+
+// Подключаемые детекторы: плагины Qt из каталога detectors
+// (AppDataLocation) и из каталогов FORTI_DETECTOR_PATH через ':'.
+// Плагины загружаются один раз за процесс; обработчики загружают их
+// сами, поэтому сбой плагина не роняет основной процесс.
+class DetectorRegistry {
+public:
+    static const QVector<DetectorFactory *> &installed(QStringList *errors = nullptr);
+    static QString pluginsDirectory();
+    // Отключение переменной окружения FORTI_NO_DETECTORS
+    static bool isDisabled();
+
+    // Время из обработчиков приходит текстом "имя\tфайлы\tнс\n"
+    static QByteArray encodeTimings(const QVector<DetectorTiming> &timings);
+    static void mergeTimings(QVector<DetectorTiming> &into, const QByteArray &encoded);
+    static void mergeTimings(QVector<DetectorTiming> &into, const QVector<DetectorTiming> &timings);
+};
+
+#endif // DETECTORREGISTRY_H
@@ -0,0 +1,327 @@
+#include "diskusage.h"
+
+#include <QAtomicInt>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const quint32 CACHE_MAGIC = 0x31554446;  // "FDU1"
+const quint32 CACHE_VERSION = 1;
+const int PROGRESS_INTERVAL_MS = 100;
+
+struct DirJob {
+    QByteArray path;
+    int node;
+};
+
+// Результат чтения одного каталога, собирается без блокировки
+struct DirResult {
+    quint64 dev = 0;
+    quint64 ino = 0;
+    qint64 mtimeNs = 0;
+    bool error = false;
+    bool reused = false;
+    qint64 files = 0;
+    qint64 bytes = 0;
+    qint64 allocated = 0;
+    qint64 entryErrors = 0;
+    QVector<QByteArray> subdirs;
+};
+
+QByteArray childPath(const QByteArray &parent, const QByteArray &name)
+{
+    return parent.endsWith('/') ? parent + name : parent + '/' + name;
+}
+
+DirResult readDirectory(const QByteArray &path, quint64 rootDev, const DiskUsageTree *previous,
+                        const QHash<QByteArray, int> &previousIndex)
+{
+    DirResult r;
+    const int fd = ::open(path.constData(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0) {
+        if (fd >= 0)
+            ::close(fd);
+        r.error = true;
+        return r;
+    }
+    r.dev = quint64(st.st_dev);
+    r.ino = quint64(st.st_ino);
+    r.mtimeNs = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+
+    // Точка монтирования другой ФС: каталог остается пустым
+    if (r.dev != rootDev) {
+        ::close(fd);
+        return r;
+    }
+
+    if (previous) {
+        auto it = previousIndex.constFind(path);
+        if (it != previousIndex.constEnd()) {
+            const DiskUsageNode &old = previous->node(it.value());
+            if (!old.error && old.dev == r.dev && old.ino == r.ino && old.mtimeNs == r.mtimeNs) {
+                ::close(fd);
+                r.reused = true;
+                r.files = old.files;
+                r.bytes = old.bytes;
+                r.allocated = old.allocated;
+                r.subdirs.reserve(old.children.size());
+                for (int child : old.children)
+                    r.subdirs.append(previous->node(child).name);
+                return r;
+            }
+        }
+    }
+
+    DIR *dir = ::fdopendir(fd);
+    if (!dir) {
+        ::close(fd);
+        r.error = true;
+        return r;
+    }
+    const int dfd = ::dirfd(dir);
+    while (struct dirent *e = ::readdir(dir)) {
+        const char *name = e->d_name;
+        if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+            continue;
+        struct stat est;
+        if (::fstatat(dfd, name, &est, AT_SYMLINK_NOFOLLOW) != 0) {
+            ++r.entryErrors;
+            continue;
+        }
+        if (S_ISDIR(est.st_mode)) {
+            r.subdirs.append(QByteArray(name));
+        } else if (S_ISREG(est.st_mode)) {
+            ++r.files;
+            r.bytes += est.st_size;
+            r.allocated += qint64(est.st_blocks) * 512;
+        }
+    }
+    ::closedir(dir);
+    return r;
+}
+
+} // namespace
+
+DiskUsageTree::DiskUsageTree()
+    : m_threads(0)
+{
+}
+
+QByteArray DiskUsageTree::path(int index) const
+{
+    QByteArray result = m_nodes[index].name;
+    for (int p = m_nodes[index].parent; p >= 0; p = m_nodes[p].parent)
+        result = childPath(m_nodes[p].name, result);
+    return result;
+}
+
+bool DiskUsageTree::build(const QString &root, const DiskUsageTree *previous,
+                          const ProgressCallback &progress)
+{
+    m_root = QDir(root).absolutePath();
+    m_nodes.clear();
+    m_stats = DiskUsageStats();
+
+    const QByteArray rootPath = QFile::encodeName(m_root);
+    struct stat rootStat;
+    if (::stat(rootPath.constData(), &rootStat) != 0 || !S_ISDIR(rootStat.st_mode))
+        return false;
+    const quint64 rootDev = quint64(rootStat.st_dev);
+
+    // Пути прежнего дерева; родитель в массиве всегда раньше потомка
+    QHash<QByteArray, int> previousIndex;
+    if (previous && previous->root() == m_root && !previous->isEmpty()) {
+        QVector<QByteArray> paths(previous->size());
+        for (int i = 0; i < previous->size(); ++i) {
+            const DiskUsageNode &n = previous->node(i);
+            paths[i] = n.parent < 0 ? n.name : childPath(paths[n.parent], n.name);
+            previousIndex.insert(paths[i], i);
+        }
+    } else {
+        previous = nullptr;
+    }
+
+    DiskUsageNode rootNode;
+    rootNode.name = rootPath;
+    m_nodes.append(rootNode);
+
+    QVector<DirJob> queue;
+    queue.append(DirJob{ rootPath, 0 });
+    QMutex mutex;
+    QWaitCondition wake;
+    int active = 0;
+    bool canceled = false;
+    QAtomicInt done(0);
+
+    // Узлы добавляются только под мьютексом; читает каталог поток без него
+    auto worker = [&] {
+        for (;;) {
+            DirJob job;
+            {
+                QMutexLocker lock(&mutex);
+                while (queue.isEmpty() && active > 0 && !canceled)
+                    wake.wait(&mutex);
+                if (canceled || queue.isEmpty()) {
+                    wake.wakeAll();
+                    return;
+                }
+                // С конца очереди: обход в глубину держит очередь короткой
+                job = queue.takeLast();
+                ++active;
+            }
+
+            const DirResult r = readDirectory(job.path, rootDev, previous, previousIndex);
+
+            {
+                QMutexLocker lock(&mutex);
+                DiskUsageNode &n = m_nodes[job.node];
+                n.dev = r.dev;
+                n.ino = r.ino;
+                n.mtimeNs = r.mtimeNs;
+                n.error = r.error;
+                n.files = r.files;
+                n.bytes = r.bytes;
+                n.allocated = r.allocated;
+                if (r.error)
+                    ++m_stats.errors;
+                else if (r.reused)
+                    ++m_stats.dirsReused;
+                else
+                    ++m_stats.dirsRead;
+                m_stats.errors += r.entryErrors;
+
+                for (const QByteArray &name : r.subdirs) {
+                    const int index = m_nodes.size();
+                    DiskUsageNode child;
+                    child.name = name;
+                    child.parent = job.node;
+                    m_nodes.append(child);
+                    m_nodes[job.node].children.append(index);
+                    queue.append(DirJob{ childPath(job.path, name), index });
+                }
+                --active;
+                wake.wakeAll();
+            }
+            done.fetchAndAddRelaxed(1);
+        }
+    };
+
+    QThreadPool pool;
+    const int threads = m_threads > 0 ? m_threads : qMax(2, QThread::idealThreadCount());
+    pool.setMaxThreadCount(threads);
+    for (int t = 0; t < threads; ++t)
+        pool.start(worker);
+    while (!pool.waitForDone(PROGRESS_INTERVAL_MS)) {
+        if (progress && !progress(done.loadRelaxed())) {
+            QMutexLocker lock(&mutex);
+            canceled = true;
+            wake.wakeAll();
+        }
+    }
+    if (canceled) {
+        m_nodes.clear();
+        return false;
+    }
+
+    aggregate();
+    return true;
+}
+
+void DiskUsageTree::aggregate()
+{
+    for (DiskUsageNode &n : m_nodes) {
+        n.totalFiles = n.files;
+        n.totalBytes = n.bytes;
+        n.totalAllocated = n.allocated;
+        n.totalDirs = 0;
+    }
+    for (int i = m_nodes.size() - 1; i > 0; --i) {
+        const DiskUsageNode &n = m_nodes[i];
+        DiskUsageNode &p = m_nodes[n.parent];
+        p.totalFiles += n.totalFiles;
+        p.totalBytes += n.totalBytes;
+        p.totalAllocated += n.totalAllocated;
+        p.totalDirs += n.totalDirs + 1;
+    }
+}
+
+bool DiskUsageTree::save(const QString &fileName) const
+{
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_12);
+    out << CACHE_MAGIC << CACHE_VERSION << m_root << qint32(m_nodes.size());
+    for (const DiskUsageNode &n : m_nodes) {
+        out << n.name << qint32(n.parent) << n.dev << n.ino << n.mtimeNs << n.error
+            << n.files << n.bytes << n.allocated;
+    }
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+bool DiskUsageTree::load(const QString &fileName)
+{
+    m_nodes.clear();
+    m_stats = DiskUsageStats();
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_12);
+    quint32 magic = 0;
+    quint32 version = 0;
+    qint32 count = 0;
+    in >> magic >> version >> m_root >> count;
+    if (magic != CACHE_MAGIC || version != CACHE_VERSION || count <= 0)
+        return false;
+
+    QVector<DiskUsageNode> nodes;
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        DiskUsageNode n;
+        qint32 parent = -1;
+        in >> n.name >> parent >> n.dev >> n.ino >> n.mtimeNs >> n.error
+           >> n.files >> n.bytes >> n.allocated;
+        // Родитель всегда раньше потомка, у корня родителя нет
+        if ((i == 0) != (parent < 0) || parent >= i) {
+            qWarning() << "Кэш дерева каталогов поврежден:" << fileName;
+            return false;
+        }
+        n.parent = parent;
+        if (parent >= 0)
+            nodes[parent].children.append(i);
+        nodes.append(n);
+    }
+    if (in.status() != QDataStream::Ok)
+        return false;
+    m_nodes = nodes;
+    aggregate();
+    return true;
+}
+
+QString DiskUsageTree::cachePath(const QString &root)
+{
+    const QByteArray key = QCryptographicHash::hash(QDir(root).absolutePath().toUtf8(),
+                                                    QCryptographicHash::Sha1).toHex();
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+           + "/diskusage/" + QString::fromLatin1(key) + ".fdu";
+}
@@ -0,0 +1,82 @@
+#ifndef DISKUSAGE_H
+#define DISKUSAGE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include <functional>
+
+// Каталог в дереве занятого места
+struct DiskUsageNode {
+    QByteArray name;  // имя в кодировке ФС (у корня - полный путь)
+    int parent = -1;
+    QVector<int> children;
+
+    quint64 dev = 0;
+    quint64 ino = 0;
+    qint64 mtimeNs = 0;  // mtime каталога, по нему решается, читать ли его заново
+    bool error = false;  // каталог не удалось прочитать
+
+    // Файлы непосредственно в каталоге
+    qint64 files = 0;
+    qint64 bytes = 0;      // видимый размер
+    qint64 allocated = 0;  // занято на диске (st_blocks)
+
+    // Итоги по поддереву, включая сам каталог
+    qint64 totalFiles = 0;
+    qint64 totalBytes = 0;
+    qint64 totalAllocated = 0;
+    qint64 totalDirs = 0;  // подкаталогов в поддереве
+};
+
+struct DiskUsageStats {
+    qint64 dirsRead = 0;    // каталоги, прочитанные через readdir
+    qint64 dirsReused = 0;  // каталоги, взятые из предыдущего дерева
+    qint64 errors = 0;
+};
+
+// Дерево занятого места по каталогам, как du -x: обход не выходит за
+// пределы файловой системы корня, символические ссылки не раскрываются.
+//
+// Каталоги обходятся пулом потоков с общей очередью. При обновлении
+// (previous) каталог, у которого не изменились устройство, inode и mtime,
+// не перечитывается: его файлы и имена подкаталогов берутся из прежнего
+// дерева, а каждый подкаталог проверяется одним fstat. Изменение размера
+// файла не меняет mtime каталога, поэтому такие изменения видны только
+// при полном пересчете.
+class DiskUsageTree {
+public:
+    // Вызывается в потоке build(); возврат false отменяет построение
+    typedef std::function<bool(qint64 dirsDone)> ProgressCallback;
+
+    DiskUsageTree();
+
+    void setThreadCount(int threads) { m_threads = threads; }
+
+    // false, если построение отменено или корень не открывается
+    bool build(const QString &root, const DiskUsageTree *previous = nullptr,
+               const ProgressCallback &progress = ProgressCallback());
+
+    bool isEmpty() const { return m_nodes.isEmpty(); }
+    const QString &root() const { return m_root; }
+    int size() const { return m_nodes.size(); }
+    const DiskUsageNode &node(int index) const { return m_nodes[index]; }
+    QByteArray path(int index) const;
+    const DiskUsageStats &stats() const { return m_stats; }
+
+    // Кэш дерева для последующего обновления
+    bool save(const QString &fileName) const;
+    bool load(const QString &fileName);
+    static QString cachePath(const QString &root);
+
+private:
+    void aggregate();
+
+    QString m_root;
+    QVector<DiskUsageNode> m_nodes;  // родитель всегда раньше потомков
+    DiskUsageStats m_stats;
+    int m_threads;
+};
+
+#endif // DISKUSAGE_H
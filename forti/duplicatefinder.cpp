@@ -0,0 +1,280 @@
+#include "duplicatefinder.h"
+
+#include <QAtomicInt>
+#include <QCryptographicHash>
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "filewalker.h"
+#include "sparsereader.h"
+
+namespace {
+
+const int FULL_READ_CHUNK = 256 * 1024;
+const int WALK_PROGRESS_STEP = 1000;
+const int PROGRESS_INTERVAL_MS = 100;
+
+// Открыть файл и убедиться, что размер не изменился после обхода
+int openChecked(const QByteArray &path, qint64 size, struct stat &st)
+{
+    const int fd = ::open(path.constData(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0)
+        return -1;
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size != size) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool readAt(int fd, char *buf, int size, off_t offset)
+{
+    while (size > 0) {
+        const ssize_t got = ::pread(fd, buf, size_t(size), offset);
+        if (got <= 0)
+            return false;
+        buf += got;
+        size -= int(got);
+        offset += got;
+    }
+    return true;
+}
+
+} // namespace
+
+DuplicateFinder::DuplicateFinder(const ExclusionRules &rules)
+    : m_rules(rules)
+    , m_minSize(1)
+    , m_threads(0)
+{
+}
+
+qint64 DuplicateFinder::reclaimable() const
+{
+    qint64 total = 0;
+    for (const DuplicateSet &set : m_sets)
+        total += set.reclaimable();
+    return total;
+}
+
+void DuplicateFinder::hashPartial(Item &item, qint64 &bytesRead)
+{
+    struct stat st;
+    const int fd = openChecked(item.path, item.size, st);
+    if (fd < 0)
+        return;
+    item.dev = quint64(st.st_dev);
+    item.ino = quint64(st.st_ino);
+
+    // Короткий файл читается целиком: первый и последний блоки
+    // перекрываются, полный хеш для него ничего не добавит
+    const bool complete = item.size <= 2 * BlockSize;
+    QByteArray buf(complete ? int(item.size) : 2 * BlockSize, Qt::Uninitialized);
+    const bool ok = complete
+                    ? readAt(fd, buf.data(), buf.size(), 0)
+                    : readAt(fd, buf.data(), BlockSize, 0)
+                      && readAt(fd, buf.data() + BlockSize, BlockSize, off_t(item.size - BlockSize));
+    ::close(fd);
+    if (!ok)
+        return;
+    bytesRead += buf.size();
+    item.digest = QCryptographicHash::hash(buf, QCryptographicHash::Sha256);
+    item.complete = complete;
+}
+
+void DuplicateFinder::hashFull(Item &item, qint64 &bytesRead)
+{
+    struct stat st;
+    const int fd = openChecked(item.path, item.size, st);
+    item.digest.clear();
+    if (fd < 0)
+        return;
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Дыры разреженного файла хешируются как нули, но не читаются
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    QByteArray buf(FULL_READ_CHUNK, Qt::Uninitialized);
+    SparseReader reader(fd);
+    const bool ok = reader.readAll(buf.data(), buf.size(), [&](const uchar *data, int size) {
+        hash.addData(reinterpret_cast<const char *>(data), size);
+    });
+    ::close(fd);
+    if (!ok)
+        return;
+    const qint64 total = reader.position();
+    bytesRead += total - reader.holeBytes();
+    if (total != item.size)
+        return;
+    item.digest = hash.result();
+    item.complete = true;
+}
+
+// Все элементы хешируются пулом потоков; каждый поток берет следующий
+// номер из общего счетчика и пишет только в свой элемент
+bool DuplicateFinder::hashAll(QVector<Item> &items, Stage stage, const ProgressCallback &progress)
+{
+    if (items.isEmpty())
+        return true;
+
+    Item *const data = items.data();
+    const int count = items.size();
+    QAtomicInt next(0);
+    QAtomicInt done(0);
+    QAtomicInt canceled(0);
+    QMutex statsMutex;
+
+    QThreadPool pool;
+    const int threads = m_threads > 0 ? m_threads : qMax(2, QThread::idealThreadCount());
+    pool.setMaxThreadCount(threads);
+    for (int t = 0; t < qMin(threads, count); ++t) {
+        pool.start([&, stage] {
+            qint64 bytesRead = 0;
+            for (int i = next.fetchAndAddRelaxed(1); i < count && !canceled.loadRelaxed();
+                 i = next.fetchAndAddRelaxed(1)) {
+                if (stage == PartialHash)
+                    hashPartial(data[i], bytesRead);
+                else
+                    hashFull(data[i], bytesRead);
+                done.fetchAndAddRelaxed(1);
+            }
+            QMutexLocker lock(&statsMutex);
+            m_stats.bytesRead += bytesRead;
+        });
+    }
+
+    while (!pool.waitForDone(PROGRESS_INTERVAL_MS)) {
+        if (progress && !canceled.loadRelaxed() && !progress(stage, done.loadRelaxed(), count))
+            canceled.storeRelaxed(1);
+    }
+    if (stage == FullHash)
+        m_stats.fullyHashed += count;
+    return !canceled.loadRelaxed();
+}
+
+// Группы одинаковых (размер, хеш); нечитаемые файлы и повторные жесткие
+// ссылки на тот же inode отбрасываются, одиночки тоже
+QVector<QVector<DuplicateFinder::Item>> DuplicateFinder::regroup(QVector<Item> &items)
+{
+    QHash<QByteArray, int> index;
+    QVector<QVector<Item>> groups;
+    for (Item &item : items) {
+        if (item.digest.isEmpty()) {
+            ++m_stats.errors;
+            continue;
+        }
+        QByteArray key(reinterpret_cast<const char *>(&item.size), int(sizeof(item.size)));
+        key += item.digest;
+        auto it = index.constFind(key);
+        if (it == index.constEnd()) {
+            index.insert(key, groups.size());
+            groups.append(QVector<Item>());
+            groups.last().append(item);
+        } else {
+            groups[it.value()].append(item);
+        }
+    }
+    items.clear();
+
+    QVector<QVector<Item>> result;
+    for (QVector<Item> &group : groups) {
+        std::sort(group.begin(), group.end(), [](const Item &a, const Item &b) {
+            if (a.dev != b.dev)
+                return a.dev < b.dev;
+            if (a.ino != b.ino)
+                return a.ino < b.ino;
+            return a.path < b.path;
+        });
+        int kept = 0;
+        for (int i = 0; i < group.size(); ++i) {
+            if (kept > 0 && group[kept - 1].dev == group[i].dev && group[kept - 1].ino == group[i].ino) {
+                ++m_stats.hardLinks;
+                continue;
+            }
+            group[kept++] = group[i];
+        }
+        group.resize(kept);
+        if (group.size() > 1)
+            result.append(group);
+    }
+    return result;
+}
+
+bool DuplicateFinder::run(const QString &root, const ProgressCallback &progress)
+{
+    m_sets.clear();
+    m_stats = DuplicateStats();
+
+    // Этап 1: размеры известны из обхода, файлы не открываются
+    QHash<qint64, QList<QByteArray>> bySize;
+    bool canceled = false;
+    FileWalker walker(m_rules);
+    walker.setNeedSize(true);
+    walker.walk(root, [&](const WalkEntry &entry) {
+        ++m_stats.files;
+        m_stats.totalBytes += qMax<qint64>(0, entry.size);
+        if (entry.size >= m_minSize)
+            bySize[entry.size].append(entry.path);
+        if (progress && m_stats.files % WALK_PROGRESS_STEP == 0 && !progress(Walking, m_stats.files, 0)) {
+            canceled = true;
+            return false;
+        }
+        return true;
+    });
+    m_stats.errors += walker.stats().errors;
+    if (canceled)
+        return false;
+
+    QVector<Item> items;
+    for (auto it = bySize.constBegin(); it != bySize.constEnd(); ++it) {
+        if (it.value().size() < 2)
+            continue;
+        for (const QByteArray &path : it.value()) {
+            Item item;
+            item.path = path;
+            item.size = it.key();
+            items.append(item);
+        }
+    }
+    bySize.clear();
+    m_stats.sizeCandidates = items.size();
+
+    // Этап 2: первый и последний блоки
+    if (!hashAll(items, PartialHash, progress))
+        return false;
+    QVector<QVector<Item>> groups = regroup(items);
+
+    // Этап 3: полный хеш только для оставшихся длинных файлов
+    QVector<QVector<Item>> finished;
+    for (QVector<Item> &group : groups) {
+        if (group.first().complete)
+            finished.append(group);
+        else
+            items += group;
+    }
+    groups.clear();
+    if (!hashAll(items, FullHash, progress))
+        return false;
+    finished += regroup(items);
+
+    for (const QVector<Item> &group : finished) {
+        DuplicateSet set;
+        set.size = group.first().size;
+        for (const Item &item : group)
+            set.paths.append(item.path);
+        std::sort(set.paths.begin(), set.paths.end());
+        m_sets.append(set);
+    }
+    std::sort(m_sets.begin(), m_sets.end(), [](const DuplicateSet &a, const DuplicateSet &b) {
+        if (a.reclaimable() != b.reclaimable())
+            return a.reclaimable() > b.reclaimable();
+        return a.paths.first() < b.paths.first();
+    });
+    return true;
+}
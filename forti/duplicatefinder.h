@@ -0,0 +1,84 @@
+#ifndef DUPLICATEFINDER_H
+#define DUPLICATEFINDER_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+#include <functional>
+
+#include "exclusionrules.h"
+
+// Набор файлов с одинаковым содержимым
+struct DuplicateSet {
+    qint64 size = 0;
+    QList<QByteArray> paths;  // пути в кодировке ФС
+
+    // Сколько места освободится, если оставить одну копию
+    qint64 reclaimable() const { return size * (paths.size() - 1); }
+};
+
+struct DuplicateStats {
+    qint64 files = 0;          // файлов найдено при обходе
+    qint64 totalBytes = 0;     // их общий размер
+    qint64 sizeCandidates = 0; // файлов с неуникальным размером
+    qint64 fullyHashed = 0;    // файлов, прочитанных целиком
+    qint64 hardLinks = 0;      // повторные жесткие ссылки (не дубликаты)
+    qint64 bytesRead = 0;      // байт прочитано на этапах 2 и 3
+    qint64 errors = 0;
+};
+
+// Поиск дубликатов в три этапа, каждый следующий - только по оставшимся
+// кандидатам:
+//   1. группировка по размеру при обходе дерева (без чтения файлов);
+//   2. хеш первого и последнего блоков (BlockSize);
+//   3. полный хеш содержимого.
+// Этапы 2 и 3 выполняются пулом потоков. Файлы не длиннее двух блоков
+// на втором этапе читаются целиком и третьего этапа не требуют.
+class DuplicateFinder {
+public:
+    static const int BlockSize = 4096;
+
+    enum Stage { Walking = 1, PartialHash, FullHash };
+
+    // Вызывается в потоке run(); возврат false отменяет поиск
+    typedef std::function<bool(Stage stage, qint64 done, qint64 total)> ProgressCallback;
+
+    explicit DuplicateFinder(const ExclusionRules &rules = ExclusionRules());
+
+    // Файлы меньше minSize не рассматриваются (по умолчанию пустые)
+    void setMinSize(qint64 minSize) { m_minSize = minSize; }
+    void setThreadCount(int threads) { m_threads = threads; }
+
+    // false, если поиск отменен
+    bool run(const QString &root, const ProgressCallback &progress);
+
+    // Наборы по убыванию освобождаемого места
+    const QVector<DuplicateSet> &sets() const { return m_sets; }
+    const DuplicateStats &stats() const { return m_stats; }
+    qint64 reclaimable() const;
+
+private:
+    struct Item {
+        QByteArray path;
+        qint64 size;
+        QByteArray digest;  // пустой - файл не прочитан
+        quint64 dev = 0;
+        quint64 ino = 0;
+        bool complete = false;  // digest покрывает все содержимое
+    };
+
+    bool hashAll(QVector<Item> &items, Stage stage, const ProgressCallback &progress);
+    static void hashPartial(Item &item, qint64 &bytesRead);
+    static void hashFull(Item &item, qint64 &bytesRead);
+    QVector<QVector<Item>> regroup(QVector<Item> &items);
+
+    ExclusionRules m_rules;
+    qint64 m_minSize;
+    int m_threads;
+    QVector<DuplicateSet> m_sets;
+    DuplicateStats m_stats;
+};
+
+#endif // DUPLICATEFINDER_H
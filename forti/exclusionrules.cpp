@@ -0,0 +1,477 @@
+#include "exclusionrules.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QTextStream>
+
+#include <fnmatch.h>
+#include <string.h>
+
+// ---------------------------------------------------------------------
+// GlobRuleSet
+
+bool GlobRuleSet::hasWildcards(const QByteArray &s)
+{
+    for (char c : s) {
+        if (c == '*' || c == '?' || c == '[' || c == '\\')
+            return true;
+    }
+    return false;
+}
+
+bool GlobRuleSet::matchPart(const QByteArray &pattern, const char *name)
+{
+    return fnmatch(pattern.constData(), name, 0) == 0;
+}
+
+bool GlobRuleSet::addPattern(const QByteArray &line)
+{
+    QByteArray p = line;
+    // Завершающие пробелы не значимы (как в .gitignore)
+    while (!p.isEmpty() && (p.endsWith(' ') || p.endsWith('\t') || p.endsWith('\r')))
+        p.chop(1);
+    if (p.isEmpty() || p.startsWith('#'))
+        return false;
+
+    Rule rule;
+    rule.negated = false;
+    rule.dirOnly = false;
+    if (p.startsWith('!')) {
+        rule.negated = true;
+        p.remove(0, 1);
+    } else if (p.startsWith("\\!") || p.startsWith("\\#")) {
+        p.remove(0, 1);
+    }
+    if (p.endsWith('/')) {
+        rule.dirOnly = true;
+        while (p.endsWith('/'))
+            p.chop(1);
+    }
+    if (p.isEmpty())
+        return false;
+
+    // Шаблон со слешем в начале или середине привязан к корню
+    bool anchored = p.contains('/');
+    while (p.startsWith('/'))
+        p.remove(0, 1);
+    if (p.startsWith("**/") && !p.mid(3).contains('/')) {
+        p.remove(0, 3);
+        anchored = false;
+    }
+
+    for (const QByteArray &part : p.split('/')) {
+        if (!part.isEmpty())
+            rule.parts.append(part);
+    }
+    if (rule.parts.isEmpty() || rule.parts.size() > 255)
+        return false;
+
+    const int index = m_rules.size();
+    m_rules.append(rule);
+
+    if (anchored) {
+        m_anchored.append(index);
+        return true;
+    }
+
+    const QByteArray &name = rule.parts.first();
+    if (!hasWildcards(name)) {
+        if (rule.dirOnly)
+            m_literalDirs.insert(name, index);
+        else
+            m_literalNames.insert(name, index);
+    } else if (!rule.dirOnly && name.startsWith("*.") && !hasWildcards(name.mid(1))) {
+        m_suffixes.insert(name.mid(1), index);
+    } else {
+        m_genericNames.append(index);
+    }
+    return true;
+}
+
+void GlobRuleSet::closure(State &state) const
+{
+    // "**" может совпасть с пустой последовательностью каталогов
+    for (int i = 0; i < state.size(); ++i) {
+        const quint32 rule = state[i] >> 8;
+        const quint32 part = state[i] & 0xff;
+        const Rule &r = m_rules[int(rule)];
+        if (r.parts[int(part)] == "**" && int(part) + 1 < r.parts.size()) {
+            const quint32 next = (rule << 8) | (part + 1);
+            if (!state.contains(next))
+                state.append(next);
+        }
+    }
+}
+
+GlobRuleSet::State GlobRuleSet::initialState() const
+{
+    State state;
+    state.reserve(m_anchored.size());
+    for (int index : m_anchored)
+        state.append(quint32(index) << 8);
+    closure(state);
+    return state;
+}
+
+GlobRuleSet::State GlobRuleSet::childState(const State &state, const char *name) const
+{
+    State next;
+    for (quint32 s : state) {
+        const int rule = int(s >> 8);
+        const int part = int(s & 0xff);
+        const Rule &r = m_rules[rule];
+        const QByteArray &pattern = r.parts[part];
+        if (pattern == "**") {
+            if (!next.contains(s))
+                next.append(s);
+        } else if (part + 1 < r.parts.size() && matchPart(pattern, name)) {
+            const quint32 advanced = (quint32(rule) << 8) | quint32(part + 1);
+            if (!next.contains(advanced))
+                next.append(advanced);
+        }
+    }
+    closure(next);
+    return next;
+}
+
+GlobRuleSet::Match GlobRuleSet::match(const State &state, const char *name, bool isDir) const
+{
+    if (m_rules.isEmpty())
+        return NoMatch;
+
+    // Побеждает последнее совпавшее правило, как в .gitignore
+    int best = -1;
+    const QByteArray key = QByteArray::fromRawData(name, int(strlen(name)));
+
+    auto literal = m_literalNames.constFind(key);
+    if (literal != m_literalNames.constEnd())
+        updateBest(best, literal.value());
+    if (isDir) {
+        auto dir = m_literalDirs.constFind(key);
+        if (dir != m_literalDirs.constEnd())
+            updateBest(best, dir.value());
+    }
+
+    if (!m_suffixes.isEmpty()) {
+        for (const char *dot = strchr(name, '.'); dot; dot = strchr(dot + 1, '.')) {
+            auto suffix = m_suffixes.constFind(QByteArray::fromRawData(dot, int(strlen(dot))));
+            if (suffix != m_suffixes.constEnd())
+                updateBest(best, suffix.value());
+        }
+    }
+
+    for (int index : m_genericNames) {
+        if (index <= best)
+            continue;
+        const Rule &r = m_rules[index];
+        if ((!r.dirOnly || isDir) && matchPart(r.parts.first(), name))
+            best = index;
+    }
+
+    for (quint32 s : state) {
+        const int index = int(s >> 8);
+        if (index <= best)
+            continue;
+        const int part = int(s & 0xff);
+        const Rule &r = m_rules[index];
+        if (r.dirOnly && !isDir)
+            continue;
+        const QByteArray &pattern = r.parts[part];
+        if (part + 1 == r.parts.size()) {
+            if (pattern == "**" || matchPart(pattern, name))
+                best = index;
+        }
+    }
+
+    if (best < 0)
+        return NoMatch;
+    return m_rules[best].negated ? Included : Excluded;
+}
+
+QSharedPointer<GlobRuleSet> GlobRuleSet::fromFile(const QByteArray &path)
+{
+    QSharedPointer<GlobRuleSet> set(new GlobRuleSet);
+    QFile file(QFile::decodeName(path));
+    if (!file.open(QIODevice::ReadOnly))
+        return set;
+    while (!file.atEnd()) {
+        QByteArray line = file.readLine();
+        if (line.endsWith('\n'))
+            line.chop(1);
+        set->addPattern(line);
+    }
+    return set;
+}
+
+// ---------------------------------------------------------------------
+// ExclusionRules
+
+namespace {
+
+struct FsTypeName {
+    const char *name;
+    qint64 magic;
+};
+
+// Значения f_type из statfs(2)
+const FsTypeName FS_TYPES[] = {
+    { "proc",       0x9fa0 },
+    { "sysfs",      0x62656572 },
+    { "devpts",     0x1cd1 },
+    { "tmpfs",      0x01021994 },
+    { "cgroup",     0x27e0eb },
+    { "cgroup2",    0x63677270 },
+    { "debugfs",    0x64626720 },
+    { "tracefs",    0x74726163 },
+    { "securityfs", 0x73636673 },
+    { "pstore",     0x6165676c },
+    { "bpf",        0xcafe4a11 },
+    { "overlay",    0x794c7630 },
+    { "nfs",        0x6969 },
+    { "smb2",       0xfe534d42 },
+    { "cifs",       0xff534d42 },
+    { "fuse",       0x65735546 },
+    { "squashfs",   0x73717368 },
+    { "autofs",     0x0187 },
+    { "mqueue",     0x19800202 },
+    { "hugetlbfs",  0x958458f6 },
+};
+
+} // namespace
+
+ExclusionRules::ExclusionRules()
+    : m_globs(new GlobRuleSet)
+    , m_trie(1)
+    , m_maxFileSize(0)
+{
+}
+
+qint64 ExclusionRules::parseSize(const QString &text, bool *ok)
+{
+    QString t = text.trimmed().toUpper();
+    if (t.endsWith('B'))
+        t.chop(1);
+    qint64 mul = 1;
+    if (t.endsWith('K')) mul = 1024LL;
+    else if (t.endsWith('M')) mul = 1024LL * 1024;
+    else if (t.endsWith('G')) mul = 1024LL * 1024 * 1024;
+    else if (t.endsWith('T')) mul = 1024LL * 1024 * 1024 * 1024;
+    if (mul != 1)
+        t.chop(1);
+    const double value = t.toDouble(ok);
+    return *ok ? qint64(value * mul) : 0;
+}
+
+void ExclusionRules::addPrefix(const QByteArray &absolutePath)
+{
+    int node = 0;
+    for (const QByteArray &part : absolutePath.split('/')) {
+        if (part.isEmpty())
+            continue;
+        int child = m_trie[node].children.value(part, -1);
+        if (child < 0) {
+            child = m_trie.size();
+            m_trie.append(TrieNode());
+            m_trie[node].children.insert(part, child);
+        }
+        node = child;
+    }
+    m_trie[node].terminal = true;
+}
+
+bool ExclusionRules::addRule(const QString &line)
+{
+    const QString t = line.trimmed();
+    if (t.isEmpty() || t.startsWith('#'))
+        return false;
+
+    if (t.startsWith("path:")) {
+        const QString path = QDir::cleanPath(t.mid(5).trimmed());
+        if (!path.startsWith('/'))
+            return false;
+        addPrefix(QFile::encodeName(path));
+        return true;
+    }
+    if (t.startsWith("size:")) {
+        QString value = t.mid(5).trimmed();
+        if (value.startsWith('>'))
+            value.remove(0, 1);
+        bool ok = false;
+        const qint64 size = parseSize(value, &ok);
+        if (!ok || size <= 0)
+            return false;
+        m_maxFileSize = m_maxFileSize > 0 ? qMin(m_maxFileSize, size) : size;
+        return true;
+    }
+    if (t.startsWith("fstype:")) {
+        const QString name = t.mid(7).trimmed().toLower();
+        bool ok = false;
+        const qint64 magic = name.toLongLong(&ok, 0);
+        if (ok) {
+            m_fsTypes.insert(magic);
+            return true;
+        }
+        for (const FsTypeName &fs : FS_TYPES) {
+            if (name == QLatin1String(fs.name)) {
+                m_fsTypes.insert(fs.magic);
+                return true;
+            }
+        }
+        return false;
+    }
+    return m_globs->addPattern(QFile::encodeName(line));
+}
+
+void ExclusionRules::parse(const QString &text)
+{
+    for (const QString &line : text.split('\n'))
+        addRule(line);
+}
+
+int ExclusionRules::prefixRootFor(const QByteArray &absolutePath) const
+{
+    if (m_trie[0].terminal)
+        return ExcludedPrefixNode;
+    int node = 0;
+    for (const QByteArray &part : absolutePath.split('/')) {
+        if (part.isEmpty())
+            continue;
+        node = prefixChild(node, part.constData());
+        if (node < 0)
+            return node;
+    }
+    return node;
+}
+
+int ExclusionRules::prefixChild(int node, const char *name) const
+{
+    if (node < 0)
+        return node;
+    const int child = m_trie[node].children.value(
+        QByteArray::fromRawData(name, int(strlen(name))), NoPrefixNode);
+    if (child >= 0 && m_trie[child].terminal)
+        return ExcludedPrefixNode;
+    return child;
+}
+
+QString ExclusionRules::configPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppConfigLocation)
+           + "/exclusions.conf";
+}
+
+QString ExclusionRules::defaultRulesText()
+{
+    return QStringLiteral(
+        "# Правила исключения FortiScan\n"
+        "# glob в стиле .gitignore, path:/префикс, size:>размер, fstype:тип\n"
+        ".git/\n"
+        ".hg/\n"
+        ".svn/\n"
+        "node_modules/\n"
+        "path:/proc\n"
+        "path:/sys\n"
+        "path:/var/lib/docker/overlay2\n"
+        "path:/var/lib/containers/storage/overlay\n"
+        "fstype:proc\n"
+        "fstype:sysfs\n"
+        "fstype:devpts\n"
+        "fstype:mqueue\n"
+        "fstype:cgroup\n"
+        "fstype:cgroup2\n"
+        "fstype:debugfs\n"
+        "fstype:tracefs\n"
+        "fstype:securityfs\n"
+        "fstype:overlay\n");
+}
+
+QString ExclusionRules::loadText()
+{
+    QFile file(configPath());
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return defaultRulesText();
+    QTextStream in(&file);
+    in.setCodec("UTF-8");
+    return in.readAll();
+}
+
+ExclusionRules ExclusionRules::load()
+{
+    ExclusionRules rules;
+    rules.parse(loadText());
+    return rules;
+}
+
+bool ExclusionRules::save(const QString &text)
+{
+    QDir().mkpath(QFileInfo(configPath()).absolutePath());
+    QFile file(configPath());
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+        return false;
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
+    out << text;
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ExclusionMatcher
+
+ExclusionMatcher::ExclusionMatcher(const ExclusionRules &rules, const QByteArray &root)
+    : m_rules(rules)
+    , m_root(root)
+{
+    m_rootState.state = m_rules.globs()->initialState();
+    m_rootState.prefixNode = m_rules.hasPrefixes() ? m_rules.prefixRootFor(root)
+                                                   : int(ExclusionRules::NoPrefixNode);
+    m_rootState.excluded = m_rootState.prefixNode == ExclusionRules::ExcludedPrefixNode;
+}
+
+bool ExclusionMatcher::isEmpty() const
+{
+    return m_rules.globs()->isEmpty() && !m_rules.hasPrefixes() && m_rules.maxFileSize() <= 0;
+}
+
+ExclusionMatcher::DirState ExclusionMatcher::stateFor(const QByteArray &dir)
+{
+    if (dir.size() <= m_root.size())
+        return m_rootState;
+    auto it = m_dirs.constFind(dir);
+    if (it != m_dirs.constEnd())
+        return it.value();
+
+    const int slash = dir.lastIndexOf('/');
+    const DirState parent = stateFor(dir.left(slash));
+    const char *name = dir.constData() + slash + 1;
+    DirState state;
+    state.prefixNode = m_rules.prefixChild(parent.prefixNode, name);
+    state.excluded = parent.excluded || state.prefixNode == ExclusionRules::ExcludedPrefixNode
+                     || m_rules.globs()->match(parent.state, name, true) == GlobRuleSet::Excluded;
+    if (!state.excluded)
+        state.state = m_rules.globs()->childState(parent.state, name);
+
+    // После сброса цепочка родителей восстанавливается от корня
+    if (m_dirs.size() >= MaxCachedDirs)
+        m_dirs.clear();
+    m_dirs.insert(dir, state);
+    return state;
+}
+
+bool ExclusionMatcher::excludesDirectory(const QByteArray &path)
+{
+    return stateFor(path).excluded;
+}
+
+bool ExclusionMatcher::excludesFile(const QByteArray &dir, const char *name, qint64 size)
+{
+    const DirState state = stateFor(dir);
+    if (state.excluded)
+        return true;
+    if (m_rules.maxFileSize() > 0 && size > m_rules.maxFileSize())
+        return true;
+    if (m_rules.prefixChild(state.prefixNode, name) == ExclusionRules::ExcludedPrefixNode)
+        return true;
+    return m_rules.globs()->match(state.state, name, false) == GlobRuleSet::Excluded;
+}
@@ -0,0 +1,141 @@
+#ifndef EXCLUSIONRULES_H
+#define EXCLUSIONRULES_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QSharedPointer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// Набор glob-правил в стиле .gitignore.
+// Правила компилируются в автомат по компонентам пути: имена без
+// шаблонов и суффиксы вида "*.ext" ищутся по хешу, якорные правила
+// ("a/b/*", "/build", "**/tmp") продвигаются покаталожно, поэтому при
+// обходе каждый элемент проверяется без сборки и разбора полного пути.
+class GlobRuleSet {
+public:
+    // Состояние автомата для каталога: пары (правило << 8 | компонент)
+    typedef QVector<quint32> State;
+
+    // Результат проверки: более глубокий .fortiignore может вернуть
+    // Included ("!шаблон") и тем самым отменить правило уровнем выше.
+    enum Match { NoMatch, Excluded, Included };
+
+    bool addPattern(const QByteArray &line);
+    bool isEmpty() const { return m_rules.isEmpty(); }
+    int size() const { return m_rules.size(); }
+
+    State initialState() const;
+    State childState(const State &state, const char *name) const;
+    Match match(const State &state, const char *name, bool isDir) const;
+
+    static QSharedPointer<GlobRuleSet> fromFile(const QByteArray &path);
+
+private:
+    struct Rule {
+        QVector<QByteArray> parts;
+        bool negated;
+        bool dirOnly;
+    };
+
+    static bool hasWildcards(const QByteArray &s);
+    static bool matchPart(const QByteArray &pattern, const char *name);
+    void closure(State &state) const;
+    static void updateBest(int &best, int candidate) { if (candidate > best) best = candidate; }
+
+    QVector<Rule> m_rules;
+    QHash<QByteArray, int> m_literalNames;   // имя -> последнее правило
+    QHash<QByteArray, int> m_literalDirs;    // то же, только для каталогов
+    QHash<QByteArray, int> m_suffixes;       // ".ext" -> последнее правило
+    QVector<int> m_genericNames;             // неякорные правила с шаблонами
+    QVector<int> m_anchored;                 // правила, привязанные к корню
+};
+
+// Правила исключения для сканирования: glob-шаблоны (относительно
+// корня сканирования), префиксы абсолютных путей, ограничение размера
+// файла и типы файловых систем.
+//
+// Формат (по одному правилу в строке, '#' - комментарий):
+//   node_modules/            glob в стиле .gitignore
+//   path:/var/lib/docker     префикс абсолютного пути
+//   size:>4G                 пропускать файлы больше указанного размера
+//   fstype:proc              пропускать точки монтирования этого типа
+class ExclusionRules {
+public:
+    ExclusionRules();
+
+    void parse(const QString &text);
+    bool addRule(const QString &line);
+
+    const QSharedPointer<GlobRuleSet> &globs() const { return m_globs; }
+
+    // Префиксное дерево абсолютных путей. Узел -1 - вне дерева.
+    enum { NoPrefixNode = -1, ExcludedPrefixNode = -2 };
+    int prefixRootFor(const QByteArray &absolutePath) const;
+    int prefixChild(int node, const char *name) const;
+    bool hasPrefixes() const { return m_trie.size() > 1; }
+
+    qint64 maxFileSize() const { return m_maxFileSize; }
+    bool hasFsTypes() const { return !m_fsTypes.isEmpty(); }
+    bool excludesFsType(qint64 magic) const { return m_fsTypes.contains(magic); }
+
+    QString ignoreFileName() const { return QStringLiteral(".fortiignore"); }
+
+    static QString configPath();
+    static QString defaultRulesText();
+    static ExclusionRules load();
+    static bool save(const QString &text);
+    static QString loadText();
+
+    static qint64 parseSize(const QString &text, bool *ok);
+
+private:
+    struct TrieNode {
+        QHash<QByteArray, int> children;
+        bool terminal = false;
+    };
+
+    void addPrefix(const QByteArray &absolutePath);
+
+    QSharedPointer<GlobRuleSet> m_globs;
+    QVector<TrieNode> m_trie;
+    qint64 m_maxFileSize;
+    QSet<qint64> m_fsTypes;
+};
+
+// Проверка правил по полным путям для обходов, где у разных корней свои
+// правила (задания очереди сканирования идут одним обходом). Состояние
+// каталога выводится из состояния родителя и запоминается, поэтому при
+// обходе сверху вниз каждый каталог разбирается один раз. Glob-шаблоны
+// отсчитываются от root, правила fstype: здесь не действуют.
+class ExclusionMatcher {
+public:
+    ExclusionMatcher(const ExclusionRules &rules, const QByteArray &root);
+
+    // Пути внутри root, в кодировке ФС, без '/' в конце
+    bool excludesDirectory(const QByteArray &path);
+    bool excludesFile(const QByteArray &dir, const char *name, qint64 size);
+
+    bool isEmpty() const;
+    bool needsSize() const { return m_rules.maxFileSize() > 0; }
+
+private:
+    struct DirState {
+        GlobRuleSet::State state;
+        int prefixNode;
+        bool excluded;
+    };
+
+    static const int MaxCachedDirs = 65536;
+
+    DirState stateFor(const QByteArray &dir);
+
+    ExclusionRules m_rules;
+    QByteArray m_root;
+    DirState m_rootState;
+    QHash<QByteArray, DirState> m_dirs;
+};
+
+#endif // EXCLUSIONRULES_H
@@ -0,0 +1,590 @@
+#include "filescanner.h"
+
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QSet>
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mailscanner.h"
+#include "packageallowlist.h"
+#include "rulematcher.h"
+#include "similaritydigest.h"
+#include "sparsereader.h"
+
+namespace {
+
+// Расширения, которые сами по себе считаются подозрительными
+const char *const SUSPICIOUS_EXTENSIONS[] = {
+    "exe", "dll", "scr", "bat", "cmd", "js", "vbs"
+};
+
+// Расширения, для которых PE-заголовок ожидаем
+const char *const PE_EXTENSIONS[] = {
+    "exe", "dll", "scr", "sys", "ocx", "cpl", "com", "drv", "efi", "mui", "msi", "ax"
+};
+
+// Типы, для которых считается нечеткий дайджест: исполняемые файлы
+// и сценарии. Остальные файлы тоже, если заголовок MZ, ELF или "#!"
+const char *const DIGEST_EXTENSIONS[] = {
+    "exe", "dll", "scr", "sys", "so", "sh", "py", "pl", "js", "vbs", "ps1", "bat", "cmd", "php"
+};
+
+const int HEADER_SIZE = 512;
+const int READ_CHUNK = 64 * 1024;
+
+} // namespace
+
+QString ScanVerdict::reasonText(quint8 reason)
+{
+    switch (reason) {
+    case SuspiciousExtension: return QString("подозрительное расширение");
+    case DisguisedExecutable: return QString("исполняемый файл под чужим расширением");
+    case ReadError:           return QString("ошибка чтения");
+    case ParserCrash:         return QString("сбой обработчика при разборе");
+    case ParserTimeout:       return QString("превышено время разбора");
+    case RuleMatch:           return QString("сработало правило");
+    case SimilarToKnown:      return QString("похож на известный образец");
+    case ObfuscatedScript:    return QString("обфусцированный сценарий");
+    case PackageFile:         return QString("файл пакета, сумма совпала с базой");
+    case DetectorMatch:       return QString("сработал детектор");
+    case MailAttachment:      return QString("вложение письма");
+    default:                  return QString();
+    }
+}
+
+QString ScanVerdict::describe() const
+{
+    QString text = reasonText(reason);
+    if (!detail.isEmpty())
+        text += (text.isEmpty() ? QString() : QString(": ")) + QString::fromUtf8(detail);
+    if (coverage != LargeFilePolicy::Full)
+        text += QString(" (проверено: %1)").arg(LargeFilePolicy::modeText(coverage));
+    return text;
+}
+
+FileScanner::FileScanner(const QSharedPointer<const CompiledRules> &rules,
+                         const QSharedPointer<const SimilarityIndex> &similarity,
+                         const QSharedPointer<const PackageAllowlist> &packages,
+                         const QVector<DetectorFactory *> &detectors)
+    : m_packages(packages)
+    , m_maxDistance(SimilarityIndex::defaultMaxDistance())
+    , m_scriptThreshold(ScriptAnalyzer::threshold())
+{
+    if (similarity && similarity->count() > 0)
+        m_similarity = similarity;
+    if (rules && !rules->isEmpty())
+        m_matcher.reset(new RuleMatcher(rules));
+    for (DetectorFactory *factory : detectors) {
+        DetectorSlot slot;
+        slot.detector.reset(factory->create());
+        if (!slot.detector)
+            continue;
+        slot.input = slot.detector->input();
+        slot.timing.name = factory->name();
+        m_detectors.append(slot);
+    }
+    if (!MailScanner::isDisabled())
+        m_mail.reset(new MailScanner);
+}
+
+void FileScanner::setLargeFilePolicy(const QSharedPointer<const LargeFilePolicy> &policy,
+                                     const QSharedPointer<const CoverageSchedule> &schedule)
+{
+    m_largeFiles = policy && !policy->isEmpty() ? policy : QSharedPointer<const LargeFilePolicy>();
+    m_schedule = schedule;
+}
+
+// Расширение в нижнем регистре без выделения памяти на каждый файл
+const QByteArray &FileScanner::lowerSuffix(const QByteArray &path)
+{
+    const int slash = path.lastIndexOf('/');
+    const int dot = path.lastIndexOf('.');
+    const int length = dot <= slash + 1 ? 0 : path.size() - dot - 1;
+    m_suffix.resize(length);
+    char *out = m_suffix.data();
+    for (int i = 0; i < length; ++i) {
+        const char c = path.at(dot + 1 + i);
+        out[i] = (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c;
+    }
+    return m_suffix;
+}
+
+bool FileScanner::looksLikePe(const unsigned char *header, int size)
+{
+    if (size < 0x40 || header[0] != 'M' || header[1] != 'Z')
+        return false;
+    quint32 peOffset;
+    memcpy(&peOffset, header + 0x3c, sizeof(peOffset));
+    if (peOffset + 4 > quint32(size))
+        return false;
+    return memcmp(header + peOffset, "PE\0\0", 4) == 0;
+}
+
+QByteArray FileScanner::hashContent(int fd)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    char buf[READ_CHUNK];
+    SparseReader reader(fd);
+    reader.readAll(buf, sizeof(buf), [&](const uchar *data, int size) {
+        hash.addData(reinterpret_cast<const char *>(data), size);
+    });
+    return hash.result().left(16);
+}
+
+bool FileScanner::wantsDigest(const QByteArray &ext, const unsigned char *header, int size)
+{
+    static const QSet<QByteArray> types = [] {
+        QSet<QByteArray> set;
+        for (const char *e : DIGEST_EXTENSIONS)
+            set.insert(e);
+        return set;
+    }();
+    if (types.contains(ext))
+        return true;
+    return size >= 4 && (memcmp(header, "MZ", 2) == 0 || memcmp(header, "\x7f" "ELF", 4) == 0
+                         || memcmp(header, "#!", 2) == 0);
+}
+
+// Один проход по файлу: автомат всех правил, нечеткий дайджест и разбор
+// сценария получают одни и те же блоки
+bool FileScanner::scanContent(int fd, const unsigned char *header, int headerSize,
+                              bool digest, bool script, ScanVerdict &verdict)
+{
+    SimilarityDigestBuilder builder;
+    beginContent(header, headerSize, digest, script, builder);
+    const bool stream = !m_streaming.isEmpty();
+
+    const bool rules = m_matcher && m_matcher->needsContent();
+    // Сценарий разбирается только сплошным началом: после первого
+    // пропуска разбор прекращается
+    bool scriptOpen = script;
+    if ((rules || digest || script || stream) && headerSize == HEADER_SIZE) {
+        unsigned char buf[READ_CHUNK];
+        // Крупный файл по политике читается областями m_regions, между
+        // ними автомат правил только сдвигает позицию
+        const int regions = m_regions.isEmpty() ? 1 : m_regions.size();
+        qint64 pos = headerSize;
+        for (int r = 0; r < regions; ++r) {
+            qint64 length = -1;
+            if (!m_regions.isEmpty()) {
+                const LargeFilePolicy::Region &region = m_regions[r];
+                const qint64 offset = qMax(region.offset, pos);
+                length = region.offset + region.length - offset;
+                if (length <= 0)
+                    continue;
+                if (offset > pos) {
+                    if (rules)
+                        m_matcher->skip(offset - pos);
+                    scriptOpen = false;
+                    pos = offset;
+                }
+            }
+            // Дыры разреженного файла не читаются. Автомату правил хватает
+            // начала дыры, остальным проверкам нули подаются из памяти
+            SparseReader reader(fd, pos, length);
+            // Только для сценария файл дочитывается до предела разбора
+            while (rules || digest || stream || (scriptOpen && !m_script.isFull())) {
+                bool hole = false;
+                const qint64 got = reader.next(buf, sizeof(buf), &hole);
+                if (got < 0)
+                    return false;
+                if (got == 0)
+                    break;
+                if (!hole) {
+                    if (rules)
+                        m_matcher->feed(buf, int(got));
+                    if (digest)
+                        builder.add(buf, int(got));
+                    if (scriptOpen)
+                        m_script.feed(buf, int(got));
+                    if (stream)
+                        feedDetectors(buf, int(got));
+                    continue;
+                }
+                if (rules)
+                    m_matcher->feedZeros(got);
+                if (digest || stream || (scriptOpen && !m_script.isFull())) {
+                    // Сценарию нужны нули только до предела разбора
+                    const qint64 zeros = digest || stream ? got : qMin(got, qint64(ScriptAnalyzer::MaxBytes));
+                    SparseReader::feedZeros(zeros, [&](const uchar *data, int size) {
+                        if (digest)
+                            builder.add(data, size);
+                        if (scriptOpen && !m_script.isFull())
+                            m_script.feed(data, size);
+                        if (stream)
+                            feedDetectors(data, size);
+                    });
+                }
+            }
+            pos = reader.position();
+        }
+    }
+
+    finishContent(builder, digest, script, verdict);
+    return true;
+}
+
+void FileScanner::beginContent(const unsigned char *header, int size, bool digest, bool script,
+                               SimilarityDigestBuilder &builder)
+{
+    if (m_matcher) {
+        m_matcher->reset();
+        m_matcher->feed(header, size);
+    }
+    if (digest)
+        builder.add(header, size);
+    if (script)
+        m_script.feed(header, size);
+    if (!m_streaming.isEmpty())
+        feedDetectors(header, size);
+}
+
+void FileScanner::finishContent(const SimilarityDigestBuilder &builder, bool digest, bool script,
+                                ScanVerdict &verdict)
+{
+    ScriptScore score;
+    if (script) {
+        score = m_script.finish();
+        applyScript(score, verdict);
+    }
+    if (m_matcher)
+        applyRules(m_matcher->finish(verdict.size, score.score), verdict);
+    if (digest)
+        applySimilarity(builder.finish(), verdict);
+}
+
+// Флаги по расширению и заголовку, до разбора содержимого
+void FileScanner::classify(const QByteArray &ext, const unsigned char *header, int size,
+                           ScanVerdict &verdict)
+{
+    static const QSet<QByteArray> suspicious = [] {
+        QSet<QByteArray> set;
+        for (const char *e : SUSPICIOUS_EXTENSIONS)
+            set.insert(e);
+        return set;
+    }();
+    static const QSet<QByteArray> peTypes = [] {
+        QSet<QByteArray> set;
+        for (const char *e : PE_EXTENSIONS)
+            set.insert(e);
+        return set;
+    }();
+
+    if (suspicious.contains(ext)) {
+        verdict.level = ScanVerdict::Suspicious;
+        verdict.reason = ScanVerdict::SuspiciousExtension;
+    } else if (!peTypes.contains(ext) && looksLikePe(header, size)) {
+        verdict.level = ScanVerdict::Suspicious;
+        verdict.reason = ScanVerdict::DisguisedExecutable;
+    }
+}
+
+// Оценка ниже порога не меняет вердикт, но поясняет флаг по расширению
+void FileScanner::applyScript(const ScriptScore &score, ScanVerdict &verdict) const
+{
+    if (score.score >= m_scriptThreshold && verdict.level <= ScanVerdict::Suspicious) {
+        verdict.level = ScanVerdict::Suspicious;
+        verdict.reason = ScanVerdict::ObfuscatedScript;
+        verdict.detail = score.describe();
+    } else if (verdict.reason == ScanVerdict::SuspiciousExtension && score.score > 0) {
+        verdict.detail = score.describe();
+    }
+}
+
+void FileScanner::applyRules(const QVector<int> &matched, ScanVerdict &verdict) const
+{
+    if (matched.isEmpty())
+        return;
+    const CompiledRules &rules = *m_matcher->rules();
+    QByteArrayList names;
+    quint8 level = ScanVerdict::Clean;
+    for (int index : matched) {
+        names << rules.rules[index].name;
+        level = qMax(level, rules.rules[index].level);
+    }
+    if (level >= verdict.level) {
+        verdict.level = level;
+        verdict.reason = ScanVerdict::RuleMatch;
+        verdict.detail = names.join(", ");
+    }
+}
+
+// Похожесть сообщает больше, чем расширение, но правило точнее ее
+void FileScanner::applySimilarity(const SimilarityDigest &digest, ScanVerdict &verdict) const
+{
+    if (verdict.level > ScanVerdict::Suspicious || verdict.reason == ScanVerdict::RuleMatch)
+        return;
+    SimilarityIndex::Match match;
+    if (!m_similarity->nearest(digest, m_maxDistance, &match))
+        return;
+    verdict.level = ScanVerdict::Suspicious;
+    verdict.reason = ScanVerdict::SimilarToKnown;
+    verdict.detail = QString("семейство %1, сходство %2%").arg(match.family).arg(match.score).toUtf8();
+}
+
+// Детекторы Metadata и Header отвечают сразу, Stream - запоминаются до
+// finishDetectors()
+void FileScanner::runDetectors(Detector::Input input, const DetectorFile &file,
+                               const unsigned char *header, int size, ScanVerdict &verdict)
+{
+    QElapsedTimer timer;
+    for (int i = 0; i < m_detectors.size(); ++i) {
+        DetectorSlot &slot = m_detectors[i];
+        if (slot.input != input)
+            continue;
+        timer.start();
+        if (slot.detector->begin(file, header, size)) {
+            ++slot.timing.files;
+            if (input == Detector::Stream)
+                m_streaming.append(i);
+            else
+                applyDetector(slot, slot.detector->finish(), verdict);
+        }
+        slot.timing.nanoseconds += timer.nsecsElapsed();
+    }
+}
+
+void FileScanner::feedDetectors(const unsigned char *data, int size)
+{
+    QElapsedTimer timer;
+    for (int index : m_streaming) {
+        DetectorSlot &slot = m_detectors[index];
+        timer.start();
+        slot.detector->feed(data, size);
+        slot.timing.nanoseconds += timer.nsecsElapsed();
+    }
+}
+
+// verdict = nullptr - файл не дочитан, выводы детекторов не учитываются
+void FileScanner::finishDetectors(ScanVerdict *verdict)
+{
+    QElapsedTimer timer;
+    for (int index : m_streaming) {
+        DetectorSlot &slot = m_detectors[index];
+        timer.start();
+        const DetectorFinding finding = slot.detector->finish();
+        slot.timing.nanoseconds += timer.nsecsElapsed();
+        if (verdict)
+            applyDetector(slot, finding, *verdict);
+    }
+    m_streaming.clear();
+}
+
+// Детектор меняет вердикт, только если находит больше встроенных проверок
+void FileScanner::applyDetector(const DetectorSlot &slot, const DetectorFinding &finding,
+                                ScanVerdict &verdict) const
+{
+    const quint8 level = qMin<quint8>(finding.level, ScanVerdict::Malicious);
+    if (level <= verdict.level)
+        return;
+    verdict.level = level;
+    verdict.reason = ScanVerdict::DetectorMatch;
+    verdict.detail = slot.timing.name.toUtf8();
+    if (!finding.detail.isEmpty())
+        verdict.detail += ": " + finding.detail;
+}
+
+void FileScanner::endBatch()
+{
+    QElapsedTimer timer;
+    for (DetectorSlot &slot : m_detectors) {
+        timer.start();
+        slot.detector->endBatch();
+        slot.timing.nanoseconds += timer.nsecsElapsed();
+    }
+}
+
+QVector<DetectorTiming> FileScanner::takeDetectorTimings()
+{
+    QVector<DetectorTiming> timings;
+    for (DetectorSlot &slot : m_detectors) {
+        timings.append(slot.timing);
+        slot.timing.files = 0;
+        slot.timing.nanoseconds = 0;
+    }
+    return timings;
+}
+
+ScanVerdict FileScanner::scan(const QByteArray &path)
+{
+    const int fd = ::open(path.constData(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) {
+        ScanVerdict verdict;
+        verdict.level = ScanVerdict::Failed;
+        verdict.reason = ScanVerdict::ReadError;
+        return verdict;
+    }
+    const ScanVerdict verdict = scan(path, fd);
+    ::close(fd);
+    return verdict;
+}
+
+ScanVerdict FileScanner::scan(const QByteArray &path, int fd)
+{
+    ScanVerdict verdict;
+    const QByteArray &ext = lowerSuffix(path);
+
+    struct stat st;
+    if (::fstat(fd, &st) == 0) {
+        verdict.size = st.st_size;
+        verdict.mtime = st.st_mtime;
+    }
+
+    // Неизмененный файл пакета не разбирается; измененный проверяется
+    // как обычно, с начала
+    if (m_packages && verdict.size >= 0 && m_packages->contains(path)) {
+        if (m_packages->verify(path, fd, verdict.size)) {
+            verdict.reason = ScanVerdict::PackageFile;
+            return verdict;
+        }
+        ::lseek(fd, 0, SEEK_SET);
+    }
+
+    unsigned char header[HEADER_SIZE];
+    const ssize_t got = ::read(fd, header, sizeof(header));
+    if (got < 0) {
+        verdict.level = ScanVerdict::Failed;
+        verdict.reason = ScanVerdict::ReadError;
+        return verdict;
+    }
+
+    // Почтовый ящик разбирается по письмам целиком, политика крупных
+    // файлов к нему не применяется
+    if (m_mail) {
+        const MailScanner::Kind kind = MailScanner::detect(path, ext, header, int(got));
+        if (kind != MailScanner::NotMail) {
+            if (!m_mail->scan(*this, fd, path, kind, header, int(got), verdict)) {
+                verdict.level = ScanVerdict::Failed;
+                verdict.reason = ScanVerdict::ReadError;
+            } else if (verdict.isFlagged()) {
+                verdict.hash = hashContent(fd);
+            }
+            return verdict;
+        }
+    }
+
+    // Крупный файл - по политике, если не подошел срок полной проверки
+    m_regions.clear();
+    if (m_largeFiles && got == HEADER_SIZE && verdict.size >= m_largeFiles->minimumSize()
+        && !(m_schedule && m_schedule->fullScanDue(path, m_largeFiles->fullEvery()))) {
+        verdict.coverage = m_largeFiles->plan(ext, fd, verdict.size, header, int(got), &m_regions);
+    }
+
+    classify(ext, header, int(got), verdict);
+
+    // Детекторы получают заголовок, уже прочитанный для встроенных проверок
+    if (!m_detectors.isEmpty()) {
+        DetectorFile file;
+        file.path = path;
+        file.suffix = ext;
+        file.size = verdict.size;
+        file.mtime = verdict.mtime;
+        file.mode = verdict.size >= 0 ? quint32(st.st_mode) : 0;
+        file.sampled = verdict.coverage != LargeFilePolicy::Full;
+        runDetectors(Detector::Metadata, file, nullptr, 0, verdict);
+        runDetectors(Detector::Header, file, header, int(got), verdict);
+        runDetectors(Detector::Stream, file, header, int(got), verdict);
+    }
+
+    // Дайджест выборки с дайджестами целых образцов не сравнивается
+    const bool digest = m_similarity && verdict.coverage == LargeFilePolicy::Full
+                        && wantsDigest(ext, header, int(got));
+    ScriptAnalyzer::Syntax syntax;
+    const bool script = ScriptAnalyzer::syntaxFor(ext, header, int(got), &syntax);
+    if (script)
+        m_script.reset(syntax);
+    if ((m_matcher || digest || script || !m_streaming.isEmpty())
+        && !scanContent(fd, header, int(got), digest, script, verdict)) {
+        finishDetectors(nullptr);
+        verdict.level = ScanVerdict::Failed;
+        verdict.reason = ScanVerdict::ReadError;
+        return verdict;
+    }
+    finishDetectors(&verdict);
+
+    // Хеш содержимого нужен для сравнения отчетов, считаем его только
+    // для найденных файлов, чтобы не читать целиком все остальные
+    if (verdict.isFlagged())
+        verdict.hash = hashContent(fd);
+    return verdict;
+}
+
+void FileScanner::beginEntry(const QByteArray &container, const QByteArray &name,
+                             const QByteArray &contentType)
+{
+    m_entry.container = container;
+    m_entry.name = name;
+    m_entry.contentType = contentType;
+    m_entry.header.resize(0);
+    m_entry.size = 0;
+    m_entry.started = false;
+    m_entry.verdict = ScanVerdict();
+}
+
+// Проверки, которым нужен заголовок, начинаются, когда он набран
+// (или вложение кончилось раньше)
+void FileScanner::startEntry()
+{
+    m_entry.started = true;
+    const unsigned char *header = reinterpret_cast<const unsigned char *>(m_entry.header.constData());
+    const int size = m_entry.header.size();
+    const QByteArray &ext = lowerSuffix(m_entry.name);
+    classify(ext, header, size, m_entry.verdict);
+
+    if (!m_detectors.isEmpty()) {
+        DetectorFile file;
+        file.path = m_entry.container;
+        file.member = m_entry.name;
+        file.contentType = m_entry.contentType;
+        file.suffix = ext;
+        runDetectors(Detector::Metadata, file, nullptr, 0, m_entry.verdict);
+        runDetectors(Detector::Header, file, header, size, m_entry.verdict);
+        runDetectors(Detector::Stream, file, header, size, m_entry.verdict);
+    }
+
+    m_entry.digest = m_similarity && wantsDigest(ext, header, size);
+    ScriptAnalyzer::Syntax syntax;
+    m_entry.script = ScriptAnalyzer::syntaxFor(ext, header, size, &syntax);
+    if (m_entry.script)
+        m_script.reset(syntax);
+    m_entry.builder = SimilarityDigestBuilder();
+    beginContent(header, size, m_entry.digest, m_entry.script, m_entry.builder);
+}
+
+void FileScanner::feedEntry(const unsigned char *data, int size)
+{
+    m_entry.size += size;
+    if (!m_entry.started) {
+        const int take = qMin(size, HEADER_SIZE - m_entry.header.size());
+        m_entry.header.append(reinterpret_cast<const char *>(data), take);
+        if (m_entry.header.size() < HEADER_SIZE)
+            return;
+        startEntry();
+        data += take;
+        size -= take;
+        if (size == 0)
+            return;
+    }
+    if (m_matcher && m_matcher->needsContent())
+        m_matcher->feed(data, size);
+    if (m_entry.digest)
+        m_entry.builder.add(data, size);
+    if (m_entry.script && !m_script.isFull())
+        m_script.feed(data, size);
+    if (!m_streaming.isEmpty())
+        feedDetectors(data, size);
+}
+
+ScanVerdict FileScanner::finishEntry()
+{
+    if (!m_entry.started)
+        startEntry();
+    m_entry.verdict.size = m_entry.size;
+    finishContent(m_entry.builder, m_entry.digest, m_entry.script, m_entry.verdict);
+    finishDetectors(&m_entry.verdict);
+    return m_entry.verdict;
+}
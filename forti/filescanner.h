@@ -0,0 +1,153 @@
+#ifndef FILESCANNER_H
+#define FILESCANNER_H
+
+#include <QByteArray>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+#include "detectorregistry.h"
+#include "largefilepolicy.h"
+#include "scriptanalyzer.h"
+#include "similarityindex.h"
+
+struct CompiledRules;
+class MailScanner;
+class PackageAllowlist;
+class RuleMatcher;
+
+// Результат проверки одного файла
+struct ScanVerdict {
+    enum Level : quint8 {
+        Clean = 0,
+        Suspicious = 1,
+        Malicious = 2,
+        Failed = 3
+    };
+
+    enum Reason : quint8 {
+        NoReason = 0,
+        SuspiciousExtension,
+        DisguisedExecutable,
+        ReadError,
+        ParserCrash,
+        ParserTimeout,
+        RuleMatch,
+        SimilarToKnown,
+        ObfuscatedScript,
+        PackageFile,       // чистый: совпал с суммой из базы пакетов
+        DetectorMatch,     // сработал подключаемый детектор
+        MailAttachment     // найдено во вложении письма (MailScanner)
+    };
+
+    quint8 level = Clean;
+    quint8 reason = NoReason;
+    qint64 size = -1;
+    qint64 mtime = 0;   // секунды с начала эпохи
+    QByteArray hash;    // 16 байт SHA-256 содержимого (только для найденных)
+    QByteArray detail;  // дополнительные сведения (UTF-8)
+    quint8 coverage = LargeFilePolicy::Full;  // режим проверки крупного файла
+
+    bool isFlagged() const { return level == Suspicious || level == Malicious; }
+    QString describe() const;
+
+    static QString reasonText(quint8 reason);
+};
+
+// Проверка одного файла. Используется и в основном процессе, и в
+// процессах-обработчиках (scanworker), поэтому не зависит от GUI.
+// С правилами обнаружения файл читается целиком за один проход;
+// кэш автомата правил живет в сканере и переиспользуется между файлами.
+// С индексом похожих образцов для исполняемых файлов и сценариев в том же
+// проходе считается нечеткий дайджест и ищется ближайший известный образец.
+// Файл из базы пакетов сначала сверяется с ее суммой и при совпадении
+// не разбирается. Подключаемые детекторы получают метаданные, заголовок
+// или те же блоки содержимого, что и встроенные проверки. Крупные файлы
+// с политикой LargeFilePolicy читаются только областями по ней.
+// Почтовый ящик (mbox, письмо Maildir) разбирает MailScanner, вложения
+// проверяются как отдельные файлы, содержимое которых приходит блоками.
+class FileScanner {
+public:
+    explicit FileScanner(const QSharedPointer<const CompiledRules> &rules = QSharedPointer<const CompiledRules>(),
+                         const QSharedPointer<const SimilarityIndex> &similarity = QSharedPointer<const SimilarityIndex>(),
+                         const QSharedPointer<const PackageAllowlist> &packages = QSharedPointer<const PackageAllowlist>(),
+                         const QVector<DetectorFactory *> &detectors = QVector<DetectorFactory *>());
+
+    ScanVerdict scan(const QByteArray &path);
+    // Уже открытый файл (например, из события fanotify), позиция - в начале
+    // файла; дескриптор не закрывается. path - для расширения и базы пакетов
+    ScanVerdict scan(const QByteArray &path, int fd);
+
+    // Политика крупных файлов; с расписанием - целиком, когда подошел срок
+    void setLargeFilePolicy(const QSharedPointer<const LargeFilePolicy> &policy,
+                            const QSharedPointer<const CoverageSchedule> &schedule = QSharedPointer<const CoverageSchedule>());
+
+    // Вложение письма: блоки по порядку, без чтения файла. Проверки те же,
+    // что у файла, кроме базы пакетов, политики крупных файлов и хеша
+    void beginEntry(const QByteArray &container, const QByteArray &name, const QByteArray &contentType);
+    void feedEntry(const unsigned char *data, int size);
+    ScanVerdict finishEntry();
+
+    bool hasDetectors() const { return !m_detectors.isEmpty(); }
+    // Конец пакета файлов для детекторов
+    void endBatch();
+    // Время детекторов с прошлого вызова
+    QVector<DetectorTiming> takeDetectorTimings();
+
+private:
+    struct EntryState {
+        QByteArray container;
+        QByteArray name;
+        QByteArray contentType;
+        QByteArray header;  // первые HEADER_SIZE байт, пока не начата проверка
+        qint64 size = 0;
+        bool started = false;
+        bool digest = false;
+        bool script = false;
+        ScanVerdict verdict;
+        SimilarityDigestBuilder builder;
+    };
+
+    struct DetectorSlot {
+        QSharedPointer<Detector> detector;
+        Detector::Input input;
+        DetectorTiming timing;
+    };
+
+    const QByteArray &lowerSuffix(const QByteArray &path);
+    static bool looksLikePe(const unsigned char *header, int size);
+    static QByteArray hashContent(int fd);
+    static bool wantsDigest(const QByteArray &ext, const unsigned char *header, int size);
+    static void classify(const QByteArray &ext, const unsigned char *header, int size, ScanVerdict &verdict);
+    bool scanContent(int fd, const unsigned char *header, int headerSize, bool digest,
+                     bool script, ScanVerdict &verdict);
+    void beginContent(const unsigned char *header, int size, bool digest, bool script,
+                      SimilarityDigestBuilder &builder);
+    void finishContent(const SimilarityDigestBuilder &builder, bool digest, bool script, ScanVerdict &verdict);
+    void startEntry();
+    void applyScript(const ScriptScore &score, ScanVerdict &verdict) const;
+    void applyRules(const QVector<int> &matched, ScanVerdict &verdict) const;
+    void applySimilarity(const SimilarityDigest &digest, ScanVerdict &verdict) const;
+    void runDetectors(Detector::Input input, const DetectorFile &file, const unsigned char *header,
+                      int size, ScanVerdict &verdict);
+    void feedDetectors(const unsigned char *data, int size);
+    void finishDetectors(ScanVerdict *verdict);
+    void applyDetector(const DetectorSlot &slot, const DetectorFinding &finding, ScanVerdict &verdict) const;
+
+    QSharedPointer<RuleMatcher> m_matcher;
+    QSharedPointer<const SimilarityIndex> m_similarity;
+    QSharedPointer<const PackageAllowlist> m_packages;
+    int m_maxDistance;
+    ScriptAnalyzer m_script;
+    int m_scriptThreshold;
+    QByteArray m_suffix;  // буфер расширения, переиспользуется между файлами
+    QVector<DetectorSlot> m_detectors;
+    QVector<int> m_streaming;  // детекторы Stream, принявшие текущий файл
+    QSharedPointer<const LargeFilePolicy> m_largeFiles;
+    QSharedPointer<const CoverageSchedule> m_schedule;
+    QVector<LargeFilePolicy::Region> m_regions;  // области текущего файла, пусто - весь
+    QSharedPointer<MailScanner> m_mail;
+    EntryState m_entry;  // текущее вложение
+};
+
+#endif // FILESCANNER_H
@@ -0,0 +1,571 @@
+#include "filetreemodel.h"
+
+#include <QApplication>
+#include <QColor>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLocale>
+#include <QStyle>
+
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <numeric>
+#include <sys/stat.h>
+
+namespace {
+
+QString badgeText(int badge, bool isDir)
+{
+    switch (badge) {
+    case ScanVerdict::Clean:
+        return isDir ? QString("проверен") : QString("чисто");
+    case ScanVerdict::Suspicious:
+        return isDir ? QString("есть подозрительные") : QString("подозрительный");
+    case ScanVerdict::Malicious:
+        return isDir ? QString("есть угрозы") : QString("угроза");
+    case ScanVerdict::Failed:
+        return QString("ошибка проверки");
+    case VerdictBadges::Changed:
+        return QString("изменен после проверки");
+    default:
+        return QString();
+    }
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------
+// VerdictBadges
+
+bool VerdictBadges::load(const QString &reportFile)
+{
+    if (!m_report.open(reportFile))
+        return false;
+    m_reportFile = reportFile;
+    m_root = QFile::encodeName(QDir::cleanPath(m_report.rootPath()));
+    m_flaggedDirs.clear();
+
+    // Уровень найденного файла поднимается по каталогам до корня отчета
+    ScanReport::Cursor cursor = m_report.cursor();
+    while (cursor.next()) {
+        const ScanReport::Entry &entry = cursor.entry();
+        if (!entry.isFlagged())
+            continue;
+        QByteArray dir = entry.path;
+        for (;;) {
+            const int slash = dir.lastIndexOf('/');
+            if (slash < 0)
+                break;
+            dir.truncate(slash > 0 ? slash : 1);
+            quint8 &level = m_flaggedDirs[dir];
+            // Выше уже отмечено не слабее
+            if (level >= entry.level)
+                break;
+            level = entry.level;
+            if (dir.size() <= m_root.size())
+                break;
+        }
+    }
+    return true;
+}
+
+bool VerdictBadges::covers(const QByteArray &path) const
+{
+    if (m_root.isEmpty())
+        return false;
+    if (m_root == "/")
+        return path.startsWith('/');
+    return path.startsWith(m_root) && (path.size() == m_root.size() || path.at(m_root.size()) == '/');
+}
+
+int VerdictBadges::fileBadge(const QByteArray &path, qint64 size, qint64 mtime,
+                             ScanReport::Entry *entry) const
+{
+    ScanReport::Entry found;
+    if (!covers(path) || !m_report.find(path, &found))
+        return NoBadge;
+    if ((size >= 0 && found.size >= 0 && size != found.size)
+        || (mtime >= 0 && found.mtime > 0 && mtime != found.mtime))
+        return Changed;
+    if (entry)
+        *entry = found;
+    return found.level;
+}
+
+int VerdictBadges::directoryBadge(const QByteArray &path) const
+{
+    if (!covers(path))
+        return NoBadge;
+    const auto it = m_flaggedDirs.constFind(path);
+    return it != m_flaggedDirs.constEnd() ? int(it.value()) : int(ScanVerdict::Clean);
+}
+
+QString VerdictBadges::latestReport(const QString &path)
+{
+    const QByteArray target = QFile::encodeName(QDir::cleanPath(path));
+    const QFileInfoList reports = QDir(ScanReport::defaultDirectory())
+                                      .entryInfoList(QStringList() << "*.fsr", QDir::Files, QDir::Time);
+    for (const QFileInfo &info : reports) {
+        ScanReport report;
+        if (!report.open(info.absoluteFilePath()))
+            continue;
+        const QByteArray root = QFile::encodeName(QDir::cleanPath(report.rootPath()));
+        auto under = [](const QByteArray &inner, const QByteArray &outer) {
+            return outer == "/" || inner == outer
+                   || (inner.startsWith(outer) && inner.at(outer.size()) == '/');
+        };
+        if (under(target, root) || under(root, target))
+            return info.absoluteFilePath();
+    }
+    return QString();
+}
+
+// ---------------------------------------------------------------------
+// FileTreeModel
+
+FileTreeModel::FileTreeModel(QObject *parent)
+    : QAbstractItemModel(parent)
+    , m_root(new Node)
+    , m_nextListing(1)
+    , m_badgeGeneration(1)
+    , m_badgeRequest(0)
+{
+    // Чтение каталогов и загрузка отчета не ждут друг друга
+    m_pool.setMaxThreadCount(2);
+    m_root->isDir = true;
+    m_dirIcon = QApplication::style()->standardIcon(QStyle::SP_DirIcon);
+    m_fileIcon = QApplication::style()->standardIcon(QStyle::SP_FileIcon);
+}
+
+FileTreeModel::~FileTreeModel()
+{
+    m_stopping.storeRelease(1);
+    m_pool.waitForDone();
+    deleteSubtree(m_root);
+}
+
+void FileTreeModel::setRootPath(const QString &path)
+{
+    beginResetModel();
+    deleteSubtree(m_root);
+    m_root = new Node;
+    m_root->name = QFile::encodeName(QDir::cleanPath(QFileInfo(path).absoluteFilePath()));
+    m_root->isDir = true;
+    endResetModel();
+    startListing(m_root);
+    loadReport();
+}
+
+QString FileTreeModel::rootPath() const
+{
+    return QFile::decodeName(m_root->name);
+}
+
+QString FileTreeModel::filePath(const QModelIndex &index) const
+{
+    return QFile::decodeName(pathOf(nodeFor(index)));
+}
+
+bool FileTreeModel::isDir(const QModelIndex &index) const
+{
+    return nodeFor(index)->isDir;
+}
+
+QModelIndex FileTreeModel::index(const QString &path) const
+{
+    Node *node = findNode(QFile::encodeName(QDir::cleanPath(path)));
+    return node ? indexFor(node) : QModelIndex();
+}
+
+void FileTreeModel::refresh(const QString &dirPath)
+{
+    Node *node = findNode(QFile::encodeName(QDir::cleanPath(dirPath)));
+    // Каталог, который не раскрывали, прочитается при раскрытии
+    if (!node || !node->isDir || (!node->listed && !node->listingId))
+        return;
+    clearChildren(node);
+    startListing(node);
+}
+
+void FileTreeModel::loadReport(const QString &reportFile)
+{
+    const quint64 request = ++m_badgeRequest;
+    const QString root = rootPath();
+    m_pool.start([this, request, root, reportFile] {
+        const QString file = reportFile.isEmpty() ? VerdictBadges::latestReport(root) : reportFile;
+        QSharedPointer<VerdictBadges> badges;
+        if (!file.isEmpty()) {
+            badges.reset(new VerdictBadges);
+            if (!badges->load(file))
+                badges.clear();
+        }
+        if (m_stopping.loadAcquire())
+            return;
+        QMetaObject::invokeMethod(this, [this, request, badges] {
+            badgesReady(request, badges);
+        }, Qt::QueuedConnection);
+    });
+}
+
+QModelIndex FileTreeModel::index(int row, int column, const QModelIndex &parent) const
+{
+    if (!hasIndex(row, column, parent))
+        return QModelIndex();
+    return createIndex(row, column, nodeFor(parent)->children.at(row));
+}
+
+QModelIndex FileTreeModel::parent(const QModelIndex &child) const
+{
+    if (!child.isValid())
+        return QModelIndex();
+    return indexFor(nodeFor(child)->parent);
+}
+
+int FileTreeModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.column() > 0)
+        return 0;
+    return nodeFor(parent)->children.size();
+}
+
+int FileTreeModel::columnCount(const QModelIndex &) const
+{
+    return ColumnCount;
+}
+
+bool FileTreeModel::hasChildren(const QModelIndex &parent) const
+{
+    if (parent.column() > 0)
+        return false;
+    const Node *node = nodeFor(parent);
+    // Пока каталог не прочитан, считается непустым: иначе его нельзя раскрыть
+    return node->isDir && (!node->listed || !node->children.isEmpty());
+}
+
+QVariant FileTreeModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid())
+        return QVariant();
+    Node *node = nodeFor(index);
+
+    switch (role) {
+    case Qt::DisplayRole:
+        if (index.column() == NameColumn)
+            return QFile::decodeName(node->name);
+        if (index.column() == SizeColumn) {
+            if (node->isDir)
+                return QVariant();
+            statNode(node);
+            return node->size >= 0 ? QLocale().formattedDataSize(node->size) : QVariant();
+        }
+        if (index.column() == VerdictColumn)
+            return badgeText(badgeOf(node), node->isDir);
+        break;
+    case Qt::DecorationRole:
+        if (index.column() == NameColumn)
+            return node->isDir ? m_dirIcon : m_fileIcon;
+        break;
+    case Qt::ForegroundRole:
+        if (index.column() == NameColumn || index.column() == VerdictColumn) {
+            const int badge = badgeOf(node);
+            if (badge == ScanVerdict::Malicious)
+                return QColor(Qt::red);
+            if (badge == ScanVerdict::Suspicious)
+                return QColor(0xc0, 0x60, 0x00);
+            if (badge == VerdictBadges::Changed || badge == ScanVerdict::Failed)
+                return QColor(Qt::gray);
+        }
+        break;
+    case Qt::ToolTipRole:
+        if (!node->isDir && m_badges) {
+            statNode(node);
+            ScanReport::Entry entry;
+            const int badge = m_badges->fileBadge(pathOf(node), node->size, node->mtime, &entry);
+            if (badge != ScanVerdict::Clean && badge >= 0)
+                return entry.describe();
+        }
+        break;
+    case Qt::TextAlignmentRole:
+        if (index.column() == SizeColumn)
+            return int(Qt::AlignRight | Qt::AlignVCenter);
+        break;
+    }
+    return QVariant();
+}
+
+QVariant FileTreeModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+        return QVariant();
+    switch (section) {
+    case NameColumn:
+        return QString("Имя");
+    case SizeColumn:
+        return QString("Размер");
+    case VerdictColumn:
+        return QString("Проверка");
+    }
+    return QVariant();
+}
+
+bool FileTreeModel::canFetchMore(const QModelIndex &parent) const
+{
+    const Node *node = nodeFor(parent);
+    if (!node->isDir)
+        return false;
+    return (!node->listed && !node->listingId) || node->pendingPos < node->pending.size();
+}
+
+void FileTreeModel::fetchMore(const QModelIndex &parent)
+{
+    Node *node = nodeFor(parent);
+    if (!node->isDir)
+        return;
+    if (!node->listed) {
+        if (!node->listingId)
+            startListing(node);
+        return;
+    }
+    showPending(node, FetchChunk);
+}
+
+void FileTreeModel::release(const QModelIndex &index)
+{
+    if (index.isValid())
+        clearChildren(nodeFor(index));
+}
+
+FileTreeModel::Node *FileTreeModel::nodeFor(const QModelIndex &index) const
+{
+    return index.isValid() ? static_cast<Node *>(index.internalPointer()) : m_root;
+}
+
+QModelIndex FileTreeModel::indexFor(Node *node, int column) const
+{
+    if (!node || node == m_root)
+        return QModelIndex();
+    return createIndex(node->row, column, node);
+}
+
+QByteArray FileTreeModel::pathOf(const Node *node) const
+{
+    QVector<const Node *> chain;
+    for (; node && node != m_root; node = node->parent)
+        chain.append(node);
+    QByteArray path = m_root->name;
+    for (int i = chain.size() - 1; i >= 0; --i) {
+        if (!path.endsWith('/'))
+            path.append('/');
+        path.append(chain[i]->name);
+    }
+    return path;
+}
+
+FileTreeModel::Node *FileTreeModel::findNode(const QByteArray &path) const
+{
+    const QByteArray &root = m_root->name;
+    if (path == root)
+        return m_root;
+    const int start = root.endsWith('/') ? root.size() : root.size() + 1;
+    if (!path.startsWith(root) || path.size() <= start || path.at(start - 1) != '/')
+        return nullptr;
+
+    Node *node = m_root;
+    const QList<QByteArray> parts = path.mid(start).split('/');
+    for (const QByteArray &part : parts) {
+        Node *next = nullptr;
+        for (Node *child : node->children) {
+            if (child->name == part) {
+                next = child;
+                break;
+            }
+        }
+        if (!next)
+            return nullptr;
+        node = next;
+    }
+    return node;
+}
+
+void FileTreeModel::statNode(Node *node) const
+{
+    if (node->statDone)
+        return;
+    node->statDone = true;
+    struct stat st;
+    if (::stat(pathOf(node).constData(), &st) == 0) {
+        node->size = st.st_size;
+        node->mtime = st.st_mtime;
+    }
+}
+
+int FileTreeModel::badgeOf(Node *node) const
+{
+    if (!m_badges)
+        return VerdictBadges::NoBadge;
+    if (node->badgeGeneration != m_badgeGeneration) {
+        node->badgeGeneration = m_badgeGeneration;
+        if (node->isDir) {
+            node->badge = m_badges->directoryBadge(pathOf(node));
+        } else {
+            statNode(node);
+            node->badge = m_badges->fileBadge(pathOf(node), node->size, node->mtime);
+        }
+    }
+    return node->badge;
+}
+
+void FileTreeModel::startListing(Node *node)
+{
+    const quint64 id = m_nextListing++;
+    node->listingId = id;
+    m_listings.insert(id, node);
+    const QByteArray path = pathOf(node);
+
+    m_pool.start([this, id, path] {
+        // Показывается все содержимое каталога, как в файловом менеджере:
+        // без правил исключения, вместе со ссылками, каналами и
+        // устройствами. Ссылка - лист дерева (удалить или переименовать
+        // можно ее саму), раскрываются только настоящие каталоги.
+        // Корень, который сам является ссылкой, открывается по ней
+        Listing items;
+        DIR *dir = ::opendir(path.constData());
+        if (dir) {
+            const int fd = ::dirfd(dir);
+            while (struct dirent *e = ::readdir(dir)) {
+                if (m_stopping.loadAcquire())
+                    break;
+                const char *name = e->d_name;
+                if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+                    continue;
+                bool isDir = e->d_type == DT_DIR;
+                if (e->d_type == DT_UNKNOWN) {
+                    struct stat st;
+                    isDir = ::fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+                }
+                items.append(Item{ QByteArray(name), isDir });
+            }
+            ::closedir(dir);
+        }
+        if (m_stopping.loadAcquire())
+            return;
+
+        // Каталоги первыми, затем по имени без учета регистра
+        QVector<QString> keys;
+        keys.reserve(items.size());
+        for (const Item &item : items)
+            keys.append(QFile::decodeName(item.name));
+        QVector<int> order(items.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](int a, int b) {
+            if (items[a].isDir != items[b].isDir)
+                return items[a].isDir;
+            const int cmp = keys[a].compare(keys[b], Qt::CaseInsensitive);
+            return cmp != 0 ? cmp < 0 : items[a].name < items[b].name;
+        });
+        QSharedPointer<Listing> sorted(new Listing);
+        sorted->reserve(items.size());
+        for (int i : order)
+            sorted->append(items[i]);
+
+        QMetaObject::invokeMethod(this, [this, id, sorted] {
+            listingReady(id, sorted);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void FileTreeModel::listingReady(quint64 id, const QSharedPointer<Listing> &listing)
+{
+    Node *node = m_listings.take(id);
+    // Каталог свернут или перечитывается заново
+    if (!node)
+        return;
+    node->listingId = 0;
+    node->listed = true;
+    node->pending.swap(*listing);
+    node->pendingPos = 0;
+    if (node->pending.isEmpty()) {
+        // Стрелка раскрытия у пустого каталога больше не нужна
+        const QModelIndex index = indexFor(node);
+        if (index.isValid())
+            emit dataChanged(index, index);
+        return;
+    }
+    showPending(node, FetchChunk);
+}
+
+void FileTreeModel::showPending(Node *node, int count)
+{
+    const int n = qMin(count, node->pending.size() - node->pendingPos);
+    if (n <= 0)
+        return;
+    const int first = node->children.size();
+    beginInsertRows(indexFor(node), first, first + n - 1);
+    node->children.reserve(first + n);
+    for (int i = 0; i < n; ++i) {
+        const Item &item = node->pending.at(node->pendingPos + i);
+        Node *child = new Node;
+        child->name = item.name;
+        child->isDir = item.isDir;
+        child->parent = node;
+        child->row = node->children.size();
+        node->children.append(child);
+    }
+    node->pendingPos += n;
+    if (node->pendingPos == node->pending.size()) {
+        node->pending = Listing();
+        node->pendingPos = 0;
+    }
+    endInsertRows();
+}
+
+void FileTreeModel::clearChildren(Node *node)
+{
+    if (node->listingId) {
+        m_listings.remove(node->listingId);
+        node->listingId = 0;
+    }
+    node->listed = false;
+    node->pending = Listing();
+    node->pendingPos = 0;
+    if (node->children.isEmpty())
+        return;
+    beginRemoveRows(indexFor(node), 0, node->children.size() - 1);
+    for (Node *child : node->children)
+        deleteSubtree(child);
+    node->children.clear();
+    node->children.squeeze();
+    endRemoveRows();
+}
+
+void FileTreeModel::deleteSubtree(Node *node)
+{
+    if (node->listingId)
+        m_listings.remove(node->listingId);
+    for (Node *child : node->children)
+        deleteSubtree(child);
+    delete node;
+}
+
+void FileTreeModel::badgesReady(quint64 generation, const QSharedPointer<VerdictBadges> &badges)
+{
+    if (generation != m_badgeRequest)
+        return;
+    m_badges = badges;
+    ++m_badgeGeneration;
+    badgesChanged(m_root);
+}
+
+void FileTreeModel::badgesChanged(Node *node)
+{
+    if (node->children.isEmpty())
+        return;
+    emit dataChanged(index(0, 0, indexFor(node)),
+                     index(node->children.size() - 1, ColumnCount - 1, indexFor(node)));
+    for (Node *child : node->children) {
+        if (child->isDir)
+            badgesChanged(child);
+    }
+}
@@ -0,0 +1,152 @@
+#ifndef FILETREEMODEL_H
+#define FILETREEMODEL_H
+
+#include <QAbstractItemModel>
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QHash>
+#include <QIcon>
+#include <QSharedPointer>
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+
+#include "scanreport.h"
+
+// Отметки проверки по последнему отчету. Вердикт файла ищется в
+// отображенном отчете (ScanReport::find), для каталогов заранее собран
+// худший уровень найденных файлов в поддереве.
+class VerdictBadges {
+public:
+    enum Badge : qint8 {
+        NoBadge = -1,   // файл или каталог вне отчета
+        Changed = -2    // файл изменился после проверки
+    };
+
+    bool load(const QString &reportFile);
+    const QString &reportFile() const { return m_reportFile; }
+
+    // Уровень ScanVerdict::Level или Badge. size и mtime - текущие (-1 - неизвестно)
+    int fileBadge(const QByteArray &path, qint64 size, qint64 mtime,
+                  ScanReport::Entry *entry = nullptr) const;
+    int directoryBadge(const QByteArray &path) const;
+
+    // Самый новый отчет, корень которого охватывает path или лежит под ним
+    static QString latestReport(const QString &path);
+
+private:
+    bool covers(const QByteArray &path) const;
+
+    QString m_reportFile;
+    ScanReport m_report;
+    QByteArray m_root;
+    QHash<QByteArray, quint8> m_flaggedDirs;  // каталог -> худший уровень в поддереве
+};
+
+// Дерево файлов для левой панели вместо QFileSystemModel.
+//
+// Каталог читается при раскрытии в фоновом потоке через readdir (без
+// stat каждого элемента и без наблюдателей), сортируется там же и
+// показывается порциями по FetchChunk строк: следующая порция
+// добавляется через fetchMore, когда вид докручен до конца. Размер и
+// время изменения запрашиваются только у строк, которые показываются.
+// Свернутый каталог освобождает потомков, поэтому память занимают
+// только раскрытые каталоги. Показывается все, включая исключенное из
+// сканирования; символические ссылки не раскрываются.
+//
+// Изменения на диске сами не отслеживаются: после операций с файлами
+// каталог перечитывается через refresh().
+class FileTreeModel : public QAbstractItemModel {
+    Q_OBJECT
+public:
+    enum Column {
+        NameColumn,
+        SizeColumn,
+        VerdictColumn,
+        ColumnCount
+    };
+
+    static const int FetchChunk = 1000;
+
+    explicit FileTreeModel(QObject *parent = nullptr);
+    ~FileTreeModel() override;
+
+    // Новый корень; модель сбрасывается, отметки берутся из последнего отчета
+    void setRootPath(const QString &path);
+    QString rootPath() const;
+
+    QString filePath(const QModelIndex &index) const;
+    bool isDir(const QModelIndex &index) const;
+    // Показанная строка по пути; каталоги не читаются
+    QModelIndex index(const QString &path) const;
+    // Перечитать каталог, если он раскрыт
+    void refresh(const QString &dirPath);
+    // Отметки из отчета; пустой путь - самый новый подходящий отчет
+    void loadReport(const QString &reportFile = QString());
+
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex &child) const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+
+public slots:
+    // Для сигнала QTreeView::collapsed
+    void release(const QModelIndex &index);
+
+private:
+    struct Item {
+        QByteArray name;
+        bool isDir;
+    };
+    typedef QVector<Item> Listing;
+
+    struct Node {
+        QByteArray name;       // у корня - полный путь
+        Node *parent = nullptr;
+        int row = 0;
+        bool isDir = false;
+        bool statDone = false;
+        qint64 size = -1;
+        qint64 mtime = -1;
+        int badge = VerdictBadges::NoBadge;
+        quint64 badgeGeneration = 0;
+        quint64 listingId = 0;  // ожидаемый результат чтения, 0 - не читается
+        bool listed = false;
+        QVector<Node *> children;  // показанные строки
+        Listing pending;           // прочитаны, еще не показаны
+        int pendingPos = 0;
+    };
+
+    Node *nodeFor(const QModelIndex &index) const;
+    QModelIndex indexFor(Node *node, int column = NameColumn) const;
+    QByteArray pathOf(const Node *node) const;
+    Node *findNode(const QByteArray &path) const;
+    void statNode(Node *node) const;
+    int badgeOf(Node *node) const;
+
+    void startListing(Node *node);
+    void listingReady(quint64 id, const QSharedPointer<Listing> &listing);
+    void showPending(Node *node, int count);
+    void clearChildren(Node *node);
+    void deleteSubtree(Node *node);
+    void badgesReady(quint64 generation, const QSharedPointer<VerdictBadges> &badges);
+    void badgesChanged(Node *node);
+
+    QThreadPool m_pool;
+    QAtomicInt m_stopping;
+    Node *m_root;
+    quint64 m_nextListing;
+    QHash<quint64, Node *> m_listings;  // номер чтения -> узел, который его ждет
+    QSharedPointer<const VerdictBadges> m_badges;
+    quint64 m_badgeGeneration;  // меняется с каждым набором отметок
+    quint64 m_badgeRequest;     // последний запрошенный loadReport
+    QIcon m_dirIcon;
+    QIcon m_fileIcon;
+};
+
+#endif // FILETREEMODEL_H
@@ -0,0 +1,275 @@
+#include "filewalker.h"
+
+#include <QDir>
+#include <QFileInfo>
+
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+namespace {
+
+// Элемент каталога: смещение имени в общем буфере и d_type
+struct DirItem {
+    int nameOffset;
+    unsigned char type;
+};
+
+const char IGNORE_FILE_NAME[] = ".fortiignore";
+
+inline bool isDotOrDotDot(const char *n)
+{
+    return n[0] == '.' && (n[1] == 0 || (n[1] == '.' && n[2] == 0));
+}
+
+} // namespace
+
+FileWalker::FileWalker(const ExclusionRules &rules)
+    : m_rules(rules)
+    , m_needSize(false)
+    , m_framesQueued(0)
+{
+}
+
+bool FileWalker::laterFrame(const Frame &a, const Frame &b)
+{
+    // Вершина кучи - старший приоритет, из равных - поставленный последним
+    if (a.priority != b.priority)
+        return a.priority < b.priority;
+    return a.order < b.order;
+}
+
+bool FileWalker::isExcluded(const QVector<Layer> &layers, const char *name, bool isDir) const
+{
+    // Более глубокие .fortiignore проверяются первыми
+    for (int i = layers.size() - 1; i >= 0; --i) {
+        const GlobRuleSet::Match m = layers[i].rules->match(layers[i].state, name, isDir);
+        if (m != GlobRuleSet::NoMatch)
+            return m == GlobRuleSet::Excluded;
+    }
+    return false;
+}
+
+bool FileWalker::excludedFsType(const QByteArray &path, quint64 dev)
+{
+    if (!m_rules.hasFsTypes())
+        return false;
+    auto it = m_fsTypeCache.constFind(dev);
+    if (it != m_fsTypeCache.constEnd())
+        return it.value();
+    struct statfs sfs;
+    if (::statfs(path.constData(), &sfs) != 0)
+        return false;
+    const bool excluded = m_rules.excludesFsType(qint64(sfs.f_type));
+    m_fsTypeCache.insert(dev, excluded);
+    return excluded;
+}
+
+bool FileWalker::walk(const QString &root, const FileCallback &onFile)
+{
+    m_stats = WalkStats();
+
+    Frame top;
+    top.path = QFile::encodeName(QDir::cleanPath(QFileInfo(root).absoluteFilePath()));
+    top.prefixNode = m_rules.hasPrefixes() ? m_rules.prefixRootFor(top.path)
+                                           : int(ExclusionRules::NoPrefixNode);
+    if (top.prefixNode == ExclusionRules::ExcludedPrefixNode) {
+        ++m_stats.prunedDirs;
+        return true;
+    }
+
+    struct stat st;
+    if (::stat(top.path.constData(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        ++m_stats.errors;
+        return true;
+    }
+    top.dev = st.st_dev;
+    top.priority = 0;
+    top.order = m_framesQueued++;
+    top.isRoot = true;
+    if (excludedFsType(top.path, top.dev)) {
+        ++m_stats.prunedDirs;
+        return true;
+    }
+    if (m_directoryFilter && !m_directoryFilter(top.path))
+        return true;
+
+    const QSharedPointer<GlobRuleSet> &globs = m_rules.globs();
+    if (!globs->isEmpty())
+        top.layers.append(Layer{ globs, globs->initialState() });
+
+    QVector<Frame> pending;
+    pending.append(top);
+    while (!pending.isEmpty()) {
+        if (m_directoryPriority)
+            std::pop_heap(pending.begin(), pending.end(), laterFrame);
+        Frame frame = pending.takeLast();
+        const int queued = pending.size();
+        if (!walkDirectory(frame, onFile, pending))
+            return false;
+        if (m_directoryPriority) {
+            for (int i = queued + 1; i <= pending.size(); ++i)
+                std::push_heap(pending.begin(), pending.begin() + i, laterFrame);
+        }
+    }
+    return true;
+}
+
+bool FileWalker::walkDirectory(Frame &frame, const FileCallback &onFile, QVector<Frame> &pending)
+{
+    // Ссылки внутри дерева не раскрываются, но корень может быть ссылкой
+    // (папка сканирования /home/user/data -> /mnt/data)
+    const int fd = ::open(frame.path.constData(),
+                          O_RDONLY | O_DIRECTORY | O_CLOEXEC | (frame.isRoot ? 0 : O_NOFOLLOW));
+    if (fd < 0) {
+        ++m_stats.errors;
+        if (m_directoryDone)
+            m_directoryDone(frame.path, 0);
+        return true;
+    }
+    DIR *dir = ::fdopendir(fd);
+    if (!dir) {
+        ::close(fd);
+        ++m_stats.errors;
+        if (m_directoryDone)
+            m_directoryDone(frame.path, 0);
+        return true;
+    }
+    ++m_stats.dirs;
+
+    // Каталог читается целиком до обработки: .fortiignore должен
+    // примениться ко всем его элементам. Имена лежат в одном буфере.
+    QByteArray names;
+    QVector<DirItem> items;
+    bool hasIgnoreFile = false;
+    while (struct dirent *e = ::readdir(dir)) {
+        const char *n = e->d_name;
+        if (isDotOrDotDot(n))
+            continue;
+        if (!hasIgnoreFile && strcmp(n, IGNORE_FILE_NAME) == 0)
+            hasIgnoreFile = true;
+        items.append(DirItem{ names.size(), e->d_type });
+        names.append(n, int(strlen(n)) + 1);
+    }
+    const int dfd = ::dirfd(dir);
+
+    m_pathBuffer = frame.path;
+    if (!m_pathBuffer.endsWith('/'))
+        m_pathBuffer.append('/');
+    const int base = m_pathBuffer.size();
+
+    if (hasIgnoreFile) {
+        m_pathBuffer.append(IGNORE_FILE_NAME);
+        QSharedPointer<GlobRuleSet> local = GlobRuleSet::fromFile(m_pathBuffer);
+        if (!local->isEmpty())
+            frame.layers.append(Layer{ local, local->initialState() });
+        m_pathBuffer.truncate(base);
+    }
+
+    const bool checkSize = m_needSize || m_rules.maxFileSize() > 0;
+    int subdirs = 0;
+    for (const DirItem &item : items) {
+        const char *name = names.constData() + item.nameOffset;
+        unsigned char type = item.type;
+        struct stat st;
+        bool haveStat = false;
+
+        if (type == DT_UNKNOWN || type == DT_LNK) {
+            if (::fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                ++m_stats.errors;
+                continue;
+            }
+            // Ссылки на каталоги не раскрываются, ссылки на файлы проверяются
+            if (S_ISLNK(st.st_mode)
+                && (::fstatat(dfd, name, &st, 0) != 0 || !S_ISREG(st.st_mode)))
+                continue;
+            haveStat = true;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+        }
+
+        if (type == DT_DIR) {
+            const int node = m_rules.prefixChild(frame.prefixNode, name);
+            if (node == ExclusionRules::ExcludedPrefixNode
+                || isExcluded(frame.layers, name, true)) {
+                ++m_stats.prunedDirs;
+                continue;
+            }
+
+            m_pathBuffer.truncate(base);
+            m_pathBuffer.append(name);
+
+            quint64 dev = frame.dev;
+            if (m_rules.hasFsTypes()) {
+                if (!haveStat && ::fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    ++m_stats.errors;
+                    continue;
+                }
+                dev = st.st_dev;
+                // Тип ФС проверяется только при переходе на другое устройство
+                if (dev != frame.dev && excludedFsType(m_pathBuffer, dev)) {
+                    ++m_stats.prunedDirs;
+                    continue;
+                }
+            }
+
+            if (m_directoryFilter && !m_directoryFilter(m_pathBuffer))
+                continue;
+
+            Frame child;
+            child.path = m_pathBuffer;
+            child.prefixNode = node;
+            child.dev = dev;
+            child.priority = m_directoryPriority ? m_directoryPriority(m_pathBuffer) : 0;
+            child.order = m_framesQueued++;
+            child.isRoot = false;
+            child.layers.reserve(frame.layers.size());
+            for (const Layer &layer : frame.layers)
+                child.layers.append(Layer{ layer.rules, layer.rules->childState(layer.state, name) });
+            pending.append(child);
+            ++subdirs;
+        } else if (type == DT_REG) {
+            // Правило path: может указывать и на отдельный файл
+            if (m_rules.prefixChild(frame.prefixNode, name) == ExclusionRules::ExcludedPrefixNode
+                || isExcluded(frame.layers, name, false)) {
+                ++m_stats.prunedFiles;
+                continue;
+            }
+            qint64 size = -1;
+            quint32 mode = 0;
+            qint64 mtime = 0;
+            qint64 ctime = 0;
+            if (checkSize) {
+                if (!haveStat && ::fstatat(dfd, name, &st, 0) != 0) {
+                    ++m_stats.errors;
+                    continue;
+                }
+                size = st.st_size;
+                mode = st.st_mode;
+                mtime = st.st_mtime;
+                ctime = st.st_ctime;
+                if (m_rules.maxFileSize() > 0 && size > m_rules.maxFileSize()) {
+                    ++m_stats.prunedFiles;
+                    continue;
+                }
+            }
+
+            ++m_stats.files;
+            m_pathBuffer.truncate(base);
+            m_pathBuffer.append(name);
+            const WalkEntry entry{ m_pathBuffer, base, size, mode, mtime, ctime };
+            if (!onFile(entry)) {
+                ::closedir(dir);
+                return false;
+            }
+        }
+    }
+
+    ::closedir(dir);
+    if (m_directoryDone)
+        m_directoryDone(frame.path, subdirs);
+    return true;
+}
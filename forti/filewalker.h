@@ -0,0 +1,103 @@
+#ifndef FILEWALKER_H
+#define FILEWALKER_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+#include <functional>
+
+#include "exclusionrules.h"
+
+// Файл, найденный при обходе
+struct WalkEntry {
+    const QByteArray &path;  // полный путь в кодировке ФС
+    int nameOffset;          // начало имени файла в path
+    qint64 size;             // -1, если размер не запрашивался
+    // Из того же stat, что и размер (при size < 0 - нули)
+    quint32 mode;
+    qint64 mtime;
+    qint64 ctime;
+
+    const char *name() const { return path.constData() + nameOffset; }
+    QString filePath() const { return QFile::decodeName(path); }
+};
+
+struct WalkStats {
+    qint64 files = 0;
+    qint64 dirs = 0;
+    qint64 prunedDirs = 0;   // каталоги, отсеченные правилами (не открывались)
+    qint64 prunedFiles = 0;  // файлы, отсеченные правилами
+    qint64 errors = 0;
+
+    qint64 pruned() const { return prunedDirs + prunedFiles; }
+};
+
+// Обход дерева каталогов через opendir/readdir с проверкой правил
+// исключения по ходу обхода: исключенные каталоги не открываются.
+// В каждом каталоге учитывается файл .fortiignore, его правила
+// действуют на всё поддерево.
+class FileWalker {
+public:
+    // Возврат false из обработчика прерывает обход
+    typedef std::function<bool(const WalkEntry &)> FileCallback;
+    // Возврат false - каталог не открывается (например, уже проверен)
+    typedef std::function<bool(const QByteArray &path)> DirectoryFilter;
+    // Все файлы каталога переданы обработчику, subdirs подкаталогов
+    // поставлены в очередь обхода (0, если каталог не открылся)
+    typedef std::function<void(const QByteArray &path, int subdirs)> DirectoryCallback;
+    // Больше - раньше. Без приоритета обход идет в глубину
+    typedef std::function<int(const QByteArray &path)> DirectoryPriority;
+
+    explicit FileWalker(const ExclusionRules &rules = ExclusionRules());
+
+    // Запрашивать размер, права и времена каждого файла (иначе размер
+    // только при правиле size:)
+    void setNeedSize(bool needSize) { m_needSize = needSize; }
+    void setDirectoryFilter(const DirectoryFilter &filter) { m_directoryFilter = filter; }
+    void setDirectoryCallback(const DirectoryCallback &callback) { m_directoryDone = callback; }
+    // Очередь каталогов упорядочивается по приоритету; при равном
+    // приоритете - в глубину, как без него. Обходятся все каталоги
+    void setDirectoryPriority(const DirectoryPriority &priority) { m_directoryPriority = priority; }
+
+    bool walk(const QString &root, const FileCallback &onFile);
+
+    const WalkStats &stats() const { return m_stats; }
+
+private:
+    struct Layer {
+        QSharedPointer<GlobRuleSet> rules;
+        GlobRuleSet::State state;
+    };
+
+    struct Frame {
+        QByteArray path;
+        int prefixNode;
+        quint64 dev;
+        QVector<Layer> layers;
+        int priority;
+        quint64 order;   // номер постановки в очередь
+        bool isRoot;     // корень обхода открывается и по ссылке
+    };
+
+    static bool laterFrame(const Frame &a, const Frame &b);
+
+    bool walkDirectory(Frame &frame, const FileCallback &onFile, QVector<Frame> &pending);
+    bool isExcluded(const QVector<Layer> &layers, const char *name, bool isDir) const;
+    bool excludedFsType(const QByteArray &path, quint64 dev);
+
+    ExclusionRules m_rules;
+    bool m_needSize;
+    DirectoryFilter m_directoryFilter;
+    DirectoryCallback m_directoryDone;
+    DirectoryPriority m_directoryPriority;
+    quint64 m_framesQueued;
+    WalkStats m_stats;
+    QByteArray m_pathBuffer;
+    QHash<quint64, bool> m_fsTypeCache;  // устройство -> исключено по типу ФС
+};
+
+#endif // FILEWALKER_H
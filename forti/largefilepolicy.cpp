@@ -0,0 +1,540 @@
+#include "largefilepolicy.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QStringList>
+#include <QTextStream>
+
+#include <algorithm>
+#include <limits>
+#include <string.h>
+#include <unistd.h>
+
+#include "exclusionrules.h"
+
+namespace {
+
+const qint64 DAY_SECONDS = 24 * 60 * 60;
+const qint64 NO_LIMIT = std::numeric_limits<qint64>::max();
+const qint64 DEFAULT_WINDOW = 8 * 1024 * 1024;
+// Меньше нельзя: условия uint32(N) правил смотрят в первые 4 КБ
+const qint64 MIN_WINDOW = 64 * 1024;
+// Исполняемые секции и центральный каталог ZIP читаются шире обычного окна
+const int CODE_WINDOWS = 4;
+const int DIRECTORY_WINDOWS = 16;
+const int MAX_PE_SECTIONS = 96;
+const int MAX_ELF_SEGMENTS = 256;
+const qint64 ZIP_TAIL = 22 + 0xffff;  // EOCD и комментарий
+
+const quint32 SCHEDULE_MAGIC = 0x31534346;  // "FCS1"
+const quint32 SCHEDULE_VERSION = 1;
+// Файл, который давно не встречался, из расписания убирается
+const qint64 FORGET_AFTER = 90 * DAY_SECONDS;
+
+template <typename T>
+T readLe(const uchar *p)
+{
+    T value;
+    memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+bool readAt(int fd, qint64 offset, QByteArray *buf, int size)
+{
+    buf->resize(size);
+    qint64 done = 0;
+    while (done < size) {
+        const ssize_t got = ::pread(fd, buf->data() + done, size_t(size - done), off_t(offset + done));
+        if (got <= 0)
+            return false;
+        done += got;
+    }
+    return true;
+}
+
+const uchar *bytes(const QByteArray &buf)
+{
+    return reinterpret_cast<const uchar *>(buf.constData());
+}
+
+} // namespace
+
+LargeFilePolicy::LargeFilePolicy()
+    : m_default(-1)
+    , m_minimumSize(NO_LIMIT)
+    , m_fullEvery(7 * DAY_SECONDS)
+{
+}
+
+bool LargeFilePolicy::isEmpty() const
+{
+    return m_minimumSize == NO_LIMIT;
+}
+
+bool LargeFilePolicy::addRule(const QString &line)
+{
+    const QString t = line.trimmed();
+    if (t.isEmpty() || t.startsWith('#'))
+        return false;
+
+    if (t.startsWith("full-every:")) {
+        bool ok = false;
+        const int days = t.mid(11).trimmed().toInt(&ok);
+        if (!ok || days < 0)
+            return false;
+        m_fullEvery = qint64(days) * DAY_SECONDS;
+        return true;
+    }
+
+    const QStringList parts = t.simplified().split(' ');
+    if (parts.size() != 3)
+        return false;
+    bool ok = false;
+    Rule rule{ ExclusionRules::parseSize(parts[1], &ok), Full, DEFAULT_WINDOW, 0 };
+    if (!ok || rule.threshold < 0)
+        return false;
+
+    const QStringList mode = parts[2].toLower().split(':');
+    if (mode[0] == "full" && mode.size() == 1) {
+        rule.mode = Full;
+    } else if (mode[0] == "headtail" && mode.size() <= 2) {
+        rule.mode = HeadTail;
+        if (mode.size() == 2)
+            rule.window = ExclusionRules::parseSize(mode[1], &ok);
+    } else if (mode[0] == "stride" && mode.size() == 3) {
+        rule.mode = Strided;
+        rule.stride = ExclusionRules::parseSize(mode[1], &ok);
+        if (ok)
+            rule.window = ExclusionRules::parseSize(mode[2], &ok);
+        ok = ok && rule.stride > rule.window;
+    } else if (mode[0] == "structure" && mode.size() <= 2) {
+        rule.mode = Structure;
+        if (mode.size() == 2)
+            rule.window = ExclusionRules::parseSize(mode[1], &ok);
+    } else {
+        return false;
+    }
+    if (!ok)
+        return false;
+    rule.window = qMax(rule.window, MIN_WINDOW);
+
+    const int index = m_rules.size();
+    m_rules.append(rule);
+    for (QString suffix : parts[0].toLower().split(',', Qt::SkipEmptyParts)) {
+        if (suffix == "*") {
+            m_default = index;
+            continue;
+        }
+        if (suffix.startsWith("*."))
+            suffix.remove(0, 2);
+        else if (suffix.startsWith('.'))
+            suffix.remove(0, 1);
+        m_bySuffix.insert(suffix.toUtf8(), index);
+    }
+    if (rule.mode != Full)
+        m_minimumSize = qMin(m_minimumSize, rule.threshold);
+    return true;
+}
+
+void LargeFilePolicy::parse(const QString &text)
+{
+    for (const QString &line : text.split('\n'))
+        addRule(line);
+}
+
+const LargeFilePolicy::Rule *LargeFilePolicy::ruleFor(const QByteArray &suffix, qint64 size) const
+{
+    const int index = m_bySuffix.value(suffix, m_default);
+    if (index < 0 || size < m_rules[index].threshold)
+        return nullptr;
+    return &m_rules[index];
+}
+
+LargeFilePolicy::Mode LargeFilePolicy::plan(const QByteArray &suffix, int fd, qint64 size,
+                                            const uchar *header, int headerSize,
+                                            QVector<Region> *regions) const
+{
+    regions->clear();
+    const Rule *rule = ruleFor(suffix, size);
+    if (!rule || rule->mode == Full)
+        return Full;
+
+    Mode mode = rule->mode;
+    if (mode == HeadTail) {
+        headTail(*rule, size, regions);
+    } else if (mode == Strided) {
+        strided(*rule, size, regions);
+    } else if (peRegions(fd, size, header, headerSize, rule->window, regions)
+               || elfRegions(fd, size, header, headerSize, rule->window, regions)
+               || zipRegions(fd, size, rule->window, regions)) {
+        // Начало и конец файла читаются при любой структуре
+        headTail(*rule, size, regions);
+    } else {
+        regions->clear();
+        mode = HeadTail;
+        headTail(*rule, size, regions);
+    }
+
+    normalize(size, regions);
+    if (regions->size() == 1 && regions->first().length >= size) {
+        regions->clear();
+        return Full;
+    }
+    return mode;
+}
+
+void LargeFilePolicy::headTail(const Rule &rule, qint64 size, QVector<Region> *regions)
+{
+    regions->append(Region{ 0, rule.window });
+    regions->append(Region{ size - rule.window, rule.window });
+}
+
+void LargeFilePolicy::strided(const Rule &rule, qint64 size, QVector<Region> *regions)
+{
+    headTail(rule, size, regions);
+    for (qint64 offset = rule.stride; offset < size - rule.window; offset += rule.stride)
+        regions->append(Region{ offset, rule.window });
+}
+
+// Заголовки и таблица секций, начало каждой секции (исполняемых - шире)
+// и данные после последней секции: туда дописывают полезную нагрузку
+bool LargeFilePolicy::peRegions(int fd, qint64 size, const uchar *header, int headerSize,
+                                qint64 window, QVector<Region> *regions)
+{
+    if (headerSize < 0x40 || header[0] != 'M' || header[1] != 'Z')
+        return false;
+    const quint32 peOffset = readLe<quint32>(header + 0x3c);
+    QByteArray coff;
+    if (qint64(peOffset) + 24 > size || !readAt(fd, peOffset, &coff, 24)
+        || memcmp(coff.constData(), "PE\0\0", 4) != 0)
+        return false;
+    const int sections = readLe<quint16>(bytes(coff) + 6);
+    const quint16 optionalSize = readLe<quint16>(bytes(coff) + 20);
+    const qint64 tableOffset = qint64(peOffset) + 24 + optionalSize;
+    QByteArray table;
+    if (sections <= 0 || sections > MAX_PE_SECTIONS
+        || !readAt(fd, tableOffset, &table, sections * 40))
+        return false;
+
+    regions->append(Region{ 0, tableOffset + sections * 40 });
+    qint64 lastEnd = 0;
+    for (int i = 0; i < sections; ++i) {
+        const uchar *section = bytes(table) + i * 40;
+        const quint32 rawSize = readLe<quint32>(section + 16);
+        const quint32 rawOffset = readLe<quint32>(section + 20);
+        const quint32 flags = readLe<quint32>(section + 36);
+        if (rawSize == 0)
+            continue;
+        // IMAGE_SCN_CNT_CODE или IMAGE_SCN_MEM_EXECUTE
+        const bool code = flags & 0x20000020u;
+        regions->append(Region{ rawOffset, qMin<qint64>(rawSize, code ? CODE_WINDOWS * window : window) });
+        lastEnd = qMax(lastEnd, qint64(rawOffset) + rawSize);
+    }
+    if (lastEnd > 0 && lastEnd < size)
+        regions->append(Region{ lastEnd, window });
+    return true;
+}
+
+// Заголовки программы и загружаемые сегменты (исполняемые - шире),
+// данные после последнего сегмента. Только little-endian
+bool LargeFilePolicy::elfRegions(int fd, qint64 size, const uchar *header, int headerSize,
+                                 qint64 window, QVector<Region> *regions)
+{
+    if (headerSize < 0x40 || memcmp(header, "\x7f" "ELF", 4) != 0 || header[5] != 1)
+        return false;
+    const bool is64 = header[4] == 2;
+    const qint64 phOffset = is64 ? qint64(readLe<quint64>(header + 0x20)) : readLe<quint32>(header + 0x1c);
+    const int phSize = readLe<quint16>(header + (is64 ? 0x36 : 0x2a));
+    const int phCount = readLe<quint16>(header + (is64 ? 0x38 : 0x2c));
+    QByteArray table;
+    if (phOffset <= 0 || phOffset >= size || phSize < (is64 ? 56 : 32) || phCount <= 0
+        || phCount > MAX_ELF_SEGMENTS || !readAt(fd, phOffset, &table, phSize * phCount))
+        return false;
+
+    regions->append(Region{ phOffset, qint64(phSize) * phCount });
+    qint64 lastEnd = 0;
+    for (int i = 0; i < phCount; ++i) {
+        const uchar *ph = bytes(table) + i * phSize;
+        if (readLe<quint32>(ph) != 1)  // PT_LOAD
+            continue;
+        const quint32 flags = readLe<quint32>(ph + (is64 ? 4 : 0x18));
+        const qint64 offset = is64 ? qint64(readLe<quint64>(ph + 8)) : readLe<quint32>(ph + 4);
+        const qint64 fileSize = is64 ? qint64(readLe<quint64>(ph + 0x20)) : readLe<quint32>(ph + 0x10);
+        if (offset < 0 || fileSize <= 0)
+            continue;
+        const bool code = flags & 1;  // PF_X
+        regions->append(Region{ offset, qMin<qint64>(fileSize, code ? CODE_WINDOWS * window : window) });
+        lastEnd = qMax(lastEnd, offset + fileSize);
+    }
+    if (lastEnd > 0 && lastEnd < size)
+        regions->append(Region{ lastEnd, window });
+    return true;
+}
+
+// Центральный каталог: имена и размеры всех вложенных файлов
+bool LargeFilePolicy::zipRegions(int fd, qint64 size, qint64 window, QVector<Region> *regions)
+{
+    const qint64 tailOffset = qMax<qint64>(0, size - ZIP_TAIL);
+    QByteArray tail;
+    if (!readAt(fd, tailOffset, &tail, int(size - tailOffset)))
+        return false;
+    int eocd = -1;
+    for (int i = tail.size() - 22; i >= 0; --i) {
+        if (memcmp(tail.constData() + i, "PK\5\6", 4) == 0) {
+            eocd = i;
+            break;
+        }
+    }
+    if (eocd < 0)
+        return false;
+
+    qint64 dirSize = readLe<quint32>(bytes(tail) + eocd + 12);
+    qint64 dirOffset = readLe<quint32>(bytes(tail) + eocd + 16);
+    if (dirOffset == 0xffffffffLL && eocd >= 20
+        && memcmp(tail.constData() + eocd - 20, "PK\6\7", 4) == 0) {
+        // ZIP64: размеры каталога - в отдельной записи
+        QByteArray record;
+        const qint64 recordOffset = qint64(readLe<quint64>(bytes(tail) + eocd - 20 + 8));
+        if (recordOffset < 0 || recordOffset + 56 > size || !readAt(fd, recordOffset, &record, 56)
+            || memcmp(record.constData(), "PK\6\6", 4) != 0)
+            return false;
+        dirSize = qint64(readLe<quint64>(bytes(record) + 40));
+        dirOffset = qint64(readLe<quint64>(bytes(record) + 48));
+    }
+    if (dirOffset < 0 || dirSize <= 0 || dirOffset >= size)
+        return false;
+    regions->append(Region{ dirOffset, qMin(dirSize, DIRECTORY_WINDOWS * window) });
+    return true;
+}
+
+// По возрастанию смещения, в пределах файла, перекрывающиеся и смежные
+// области склеены
+void LargeFilePolicy::normalize(qint64 size, QVector<Region> *regions)
+{
+    QVector<Region> clipped;
+    for (Region region : *regions) {
+        if (region.offset < 0) {
+            region.length += region.offset;
+            region.offset = 0;
+        }
+        region.length = qMin(region.length, size - region.offset);
+        if (region.length > 0)
+            clipped.append(region);
+    }
+    std::sort(clipped.begin(), clipped.end(), [](const Region &a, const Region &b) {
+        return a.offset < b.offset;
+    });
+    regions->clear();
+    for (const Region &region : clipped) {
+        if (!regions->isEmpty() && region.offset <= regions->last().offset + regions->last().length) {
+            Region &last = regions->last();
+            last.length = qMax(last.length, region.offset + region.length - last.offset);
+        } else {
+            regions->append(region);
+        }
+    }
+}
+
+QString LargeFilePolicy::modeText(quint8 mode)
+{
+    switch (mode) {
+    case Full:      return QString("целиком");
+    case HeadTail:  return QString("начало и конец");
+    case Strided:   return QString("выборка блоков");
+    case Structure: return QString("по структуре формата");
+    default:        return QString();
+    }
+}
+
+const char *LargeFilePolicy::modeName(quint8 mode)
+{
+    switch (mode) {
+    case HeadTail:  return "headtail";
+    case Strided:   return "stride";
+    case Structure: return "structure";
+    default:        return "full";
+    }
+}
+
+QString LargeFilePolicy::configPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppConfigLocation)
+           + "/largefiles.conf";
+}
+
+QString LargeFilePolicy::defaultText()
+{
+    return QStringLiteral(
+        "# Политика проверки крупных файлов FortiScan\n"
+        "# расширения (или *), порог, режим: full, headtail:окно, stride:шаг:блок, structure:окно\n"
+        "# full-every:дней - как часто проверять такие файлы целиком (0 - никогда)\n"
+        "iso,img,raw,vmdk,vdi,vhd,vhdx,qcow2  1G  stride:64M:1M\n"
+        "mp4,mkv,avi,mov,webm,m4v,mp3,flac,wav,ogg  256M  headtail:4M\n"
+        "tar,gz,tgz,bz2,xz,zst,7z,rar,bak,backup  1G  stride:32M:1M\n"
+        "zip,jar,apk,docx,xlsx,pptx,odt  256M  structure:8M\n"
+        "exe,dll,sys,so,elf,bin  256M  structure:8M\n"
+        "*  2G  headtail:16M\n"
+        "full-every:7\n");
+}
+
+QString LargeFilePolicy::loadText()
+{
+    QFile file(configPath());
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return defaultText();
+    QTextStream in(&file);
+    in.setCodec("UTF-8");
+    return in.readAll();
+}
+
+bool LargeFilePolicy::save(const QString &text)
+{
+    QDir().mkpath(QFileInfo(configPath()).absolutePath());
+    QFile file(configPath());
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+        return false;
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
+    out << text;
+    return true;
+}
+
+bool LargeFilePolicy::isDisabled()
+{
+    return qEnvironmentVariableIsSet("FORTI_FULL_SCAN");
+}
+
+QSharedPointer<const LargeFilePolicy> LargeFilePolicy::installed()
+{
+    if (isDisabled())
+        return QSharedPointer<const LargeFilePolicy>();
+    QSharedPointer<LargeFilePolicy> policy(new LargeFilePolicy);
+    policy->parse(loadText());
+    if (policy->isEmpty())
+        return QSharedPointer<const LargeFilePolicy>();
+    return policy;
+}
+
+// ---------------------------------------------------------------------
+// CoverageSchedule
+
+CoverageSchedule::CoverageSchedule()
+    : m_now(QDateTime::currentSecsSinceEpoch())
+    , m_dirty(false)
+{
+}
+
+quint64 CoverageSchedule::pathHash(const QByteArray &path)
+{
+    quint64 h = Q_UINT64_C(14695981039346656037);
+    for (char c : path) {
+        h ^= uchar(c);
+        h *= Q_UINT64_C(1099511628211);
+    }
+    return h;
+}
+
+bool CoverageSchedule::due(quint64 hash, const Stamp &stamp, qint64 fullEvery) const
+{
+    if (fullEvery <= 0)
+        return false;
+    if (stamp.lastFull > 0)
+        return m_now - stamp.lastFull >= fullEvery;
+    return m_now - stamp.firstSeen >= qint64(hash % quint64(fullEvery));
+}
+
+bool CoverageSchedule::fullScanDue(const QByteArray &path, qint64 fullEvery) const
+{
+    const quint64 hash = pathHash(path);
+    const auto it = m_files.constFind(hash);
+    return it != m_files.constEnd() && due(hash, it.value(), fullEvery);
+}
+
+bool CoverageSchedule::fileScanned(const QByteArray &path, quint8 coverage)
+{
+    const quint64 hash = pathHash(path);
+    auto it = m_files.find(hash);
+    if (coverage != LargeFilePolicy::Full) {
+        if (it == m_files.end())
+            m_files.insert(hash, Stamp{ m_now, 0, m_now });
+        else
+            it.value().lastSeen = m_now;
+        m_dirty = true;
+        return false;
+    }
+    if (it == m_files.end())
+        return false;
+    it.value().lastFull = m_now;
+    it.value().lastSeen = m_now;
+    m_dirty = true;
+    return true;
+}
+
+QString CoverageSchedule::cachePath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/coverage.fcs";
+}
+
+bool CoverageSchedule::load()
+{
+    QFile file(cachePath());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_12);
+    quint32 magic = 0;
+    quint32 version = 0;
+    quint32 count = 0;
+    in >> magic >> version >> count;
+    if (magic != SCHEDULE_MAGIC || version != SCHEDULE_VERSION)
+        return false;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        quint64 hash;
+        Stamp stamp;
+        in >> hash >> stamp.firstSeen >> stamp.lastFull >> stamp.lastSeen;
+        m_files.insert(hash, stamp);
+    }
+    if (in.status() != QDataStream::Ok) {
+        m_files.clear();
+        return false;
+    }
+    return true;
+}
+
+bool CoverageSchedule::save()
+{
+    if (!m_dirty)
+        return true;
+    for (auto it = m_files.begin(); it != m_files.end();) {
+        if (m_now - it.value().lastSeen > FORGET_AFTER)
+            it = m_files.erase(it);
+        else
+            ++it;
+    }
+    QDir().mkpath(QFileInfo(cachePath()).absolutePath());
+    QSaveFile file(cachePath());
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_12);
+    out << SCHEDULE_MAGIC << SCHEDULE_VERSION << quint32(m_files.size());
+    for (auto it = m_files.constBegin(); it != m_files.constEnd(); ++it)
+        out << it.key() << it.value().firstSeen << it.value().lastFull << it.value().lastSeen;
+    if (out.status() != QDataStream::Ok || !file.commit())
+        return false;
+    m_dirty = false;
+    return true;
+}
+
+QSharedPointer<const CoverageSchedule> CoverageSchedule::cached()
+{
+    QSharedPointer<CoverageSchedule> schedule(new CoverageSchedule);
+    if (!schedule->load() || schedule->m_files.isEmpty())
+        return QSharedPointer<const CoverageSchedule>();
+    return schedule;
+}
@@ -0,0 +1,141 @@
+#ifndef LARGEFILEPOLICY_H
+#define LARGEFILEPOLICY_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+// Политика проверки крупных файлов: что читать у файла больше порога
+// его типа. Медиа, резервные копии и образы дисков в несколько гигабайт
+// дорого читать целиком при каждом сканировании, но и пропускать их
+// нельзя. Режим выбирается по расширению:
+//   full       целиком
+//   headtail   окна в начале и в конце файла
+//   stride     блоки через равный шаг, плюс начало и конец
+//   structure  области по формату: секции PE, сегменты ELF, центральный
+//              каталог ZIP, данные после последней секции; файл другого
+//              формата - как headtail
+// Примененный режим записывается в вердикт и отчет. Целиком такие файлы
+// проверяются реже, по CoverageSchedule.
+//
+// Формат largefiles.conf (по одному правилу в строке, '#' - комментарий):
+//   iso,img,vmdk  1G  stride:64M:1M   расширения (или *), порог, режим
+//   mp4,mkv       256M  headtail:4M
+//   exe,dll       256M  structure:8M  окно на каждую область
+//   full-every:7                      полная проверка раз в 7 дней (0 - никогда)
+// Для расширения действует последнее подходящее правило, '*' - для
+// остальных. Отключение переменной окружения FORTI_FULL_SCAN.
+class LargeFilePolicy {
+public:
+    // Какая часть файла проверена (ScanVerdict::coverage)
+    enum Mode : quint8 {
+        Full = 0,
+        HeadTail,
+        Strided,
+        Structure
+    };
+
+    struct Region {
+        qint64 offset;
+        qint64 length;
+    };
+
+    LargeFilePolicy();
+
+    void parse(const QString &text);
+    bool addRule(const QString &line);
+    // Нет правил, по которым файл проверяется не целиком
+    bool isEmpty() const;
+
+    // Файлы меньше этого размера всегда проверяются целиком
+    qint64 minimumSize() const { return m_minimumSize; }
+    // Срок полной проверки, секунды (0 - не проверять целиком)
+    qint64 fullEvery() const { return m_fullEvery; }
+
+    // Режим для файла. Для неполного - области по возрастанию смещения,
+    // без перекрытий, первая начинается с нуля. header - уже прочитанное
+    // начало файла, остальное для structure читается через pread
+    Mode plan(const QByteArray &suffix, int fd, qint64 size, const uchar *header, int headerSize,
+              QVector<Region> *regions) const;
+
+    static QString modeText(quint8 mode);
+    static const char *modeName(quint8 mode);
+
+    static QString configPath();
+    static QString defaultText();
+    static QString loadText();
+    static bool save(const QString &text);
+    // Политика из largefiles.conf; пусто, если проверять все целиком
+    static QSharedPointer<const LargeFilePolicy> installed();
+    static bool isDisabled();
+
+private:
+    struct Rule {
+        qint64 threshold;
+        Mode mode;
+        qint64 window;
+        qint64 stride;
+    };
+
+    const Rule *ruleFor(const QByteArray &suffix, qint64 size) const;
+    static void headTail(const Rule &rule, qint64 size, QVector<Region> *regions);
+    static void strided(const Rule &rule, qint64 size, QVector<Region> *regions);
+    static bool peRegions(int fd, qint64 size, const uchar *header, int headerSize, qint64 window,
+                          QVector<Region> *regions);
+    static bool elfRegions(int fd, qint64 size, const uchar *header, int headerSize, qint64 window,
+                           QVector<Region> *regions);
+    static bool zipRegions(int fd, qint64 size, qint64 window, QVector<Region> *regions);
+    static void normalize(qint64 size, QVector<Region> *regions);
+
+    QVector<Rule> m_rules;
+    QHash<QByteArray, int> m_bySuffix;  // расширение -> правило
+    int m_default;                      // правило '*', -1 - нет
+    qint64 m_minimumSize;
+    qint64 m_fullEvery;
+};
+
+// Когда крупный файл проверить целиком. Для каждого крупного файла
+// хранится, когда он впервые встретился и когда был проверен целиком
+// (по 64-битному хешу пути). Полная проверка положена через fullEvery
+// после предыдущей; файлу, который еще ни разу не проверялся целиком,
+// срок сдвигается на долю интервала по хешу пути, чтобы полные
+// проверки не сходились в одно сканирование.
+//
+// Основной процесс ведет расписание по результатам (fileScanned) и
+// сохраняет его после сканирования; сканеры и обработчики только читают
+// сохраненное через cached().
+class CoverageSchedule {
+public:
+    CoverageSchedule();
+
+    bool fullScanDue(const QByteArray &path, qint64 fullEvery) const;
+    // Результат проверки. Файл попадает в расписание, когда проверен не
+    // целиком; полная проверка отмечается у файлов, которые уже в нем
+    // (тогда возвращается true)
+    bool fileScanned(const QByteArray &path, quint8 coverage);
+
+    bool load();
+    bool save();
+    int size() const { return m_files.size(); }
+
+    static QSharedPointer<const CoverageSchedule> cached();
+    static QString cachePath();
+
+private:
+    struct Stamp {
+        qint64 firstSeen;  // секунды с начала эпохи
+        qint64 lastFull;   // 0 - целиком не проверялся
+        qint64 lastSeen;
+    };
+
+    static quint64 pathHash(const QByteArray &path);
+    bool due(quint64 hash, const Stamp &stamp, qint64 fullEvery) const;
+
+    QHash<quint64, Stamp> m_files;
+    qint64 m_now;
+    bool m_dirty;
+};
+
+#endif // LARGEFILEPOLICY_H
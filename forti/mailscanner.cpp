@@ -0,0 +1,540 @@
+#include "mailscanner.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "filescanner.h"
+#include "sparsereader.h"
+
+namespace {
+
+const int READ_CHUNK = 256 * 1024;
+
+// Значение символа base64, -1 - не символ алфавита (пробелы, '=')
+struct Base64Table {
+    signed char value[256];
+
+    Base64Table()
+    {
+        memset(value, -1, sizeof(value));
+        const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (int i = 0; i < 64; ++i)
+            value[uchar(alphabet[i])] = char(i);
+    }
+};
+
+int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// Начинается ли текст с поля заголовка письма ("Имя: значение")
+bool looksLikeHeader(const uchar *p, const uchar *end)
+{
+    const uchar *start = p;
+    while (p < end && (isalnum(*p) || *p == '-'))
+        ++p;
+    return p - start >= 2 && p < end && *p == ':';
+}
+
+// Закодированные слова RFC 2047 (=?charset?B?...?=, =?charset?Q?...?=).
+// Кодировка не перекодируется: для имени вложения важно расширение
+QByteArray decodeWords(const QByteArray &text)
+{
+    if (!text.contains("=?"))
+        return text;
+    QByteArray out;
+    int pos = 0;
+    bool afterWord = false;
+    while (pos < text.size()) {
+        const int start = text.indexOf("=?", pos);
+        const int q1 = start < 0 ? -1 : text.indexOf('?', start + 2);
+        const int q2 = q1 < 0 ? -1 : text.indexOf('?', q1 + 1);
+        const int end = q2 < 0 ? -1 : text.indexOf("?=", q2 + 1);
+        if (end < 0 || q2 != q1 + 2) {
+            out += text.mid(pos);
+            break;
+        }
+        // Пробелы между соседними словами не значимы
+        const QByteArray between = text.mid(pos, start - pos);
+        if (!afterWord || !between.trimmed().isEmpty())
+            out += between;
+        QByteArray data = text.mid(q2 + 1, end - q2 - 1);
+        if ((text.at(q1 + 1) | 0x20) == 'b') {
+            out += QByteArray::fromBase64(data);
+        } else {
+            data.replace('_', ' ');
+            out += QByteArray::fromPercentEncoding(data, '=');
+        }
+        afterWord = true;
+        pos = end + 2;
+    }
+    return out;
+}
+
+// Параметр заголовка: name=value, name="value", а также RFC 2231:
+// name*=charset''%XX и продолжения name*0, name*1*...
+QByteArray headerParameter(const QByteArray &value, const QByteArray &name)
+{
+    const int size = value.size();
+    QByteArray result;
+    bool found = false;
+    for (int i = value.indexOf(';'); i >= 0 && i < size;) {
+        ++i;
+        int eq = i;
+        while (eq < size && value.at(eq) != '=' && value.at(eq) != ';')
+            ++eq;
+        const QByteArray key = value.mid(i, eq - i).trimmed().toLower();
+        if (eq >= size || value.at(eq) == ';') {
+            i = eq;
+            continue;
+        }
+        int j = eq + 1;
+        while (j < size && (value.at(j) == ' ' || value.at(j) == '\t'))
+            ++j;
+        QByteArray v;
+        if (j < size && value.at(j) == '"') {
+            for (++j; j < size && value.at(j) != '"'; ++j) {
+                if (value.at(j) == '\\' && j + 1 < size)
+                    ++j;
+                v += value.at(j);
+            }
+            while (j < size && value.at(j) != ';')
+                ++j;
+        } else {
+            const int k = j;
+            while (j < size && value.at(j) != ';')
+                ++j;
+            v = value.mid(k, j - k).trimmed();
+        }
+        i = j;
+
+        if (key == name) {
+            if (!found)
+                return decodeWords(v);
+        } else if (key.startsWith(name + '*')) {
+            if (key.endsWith('*')) {
+                if (!found) {
+                    const int q1 = v.indexOf('\'');
+                    const int q2 = q1 < 0 ? -1 : v.indexOf('\'', q1 + 1);
+                    if (q2 >= 0)
+                        v = v.mid(q2 + 1);
+                }
+                v = QByteArray::fromPercentEncoding(v);
+            }
+            result += v;
+            found = true;
+        }
+    }
+    return result;
+}
+
+} // namespace
+
+MailScanner::MailScanner()
+    : m_scanner(nullptr)
+    , m_path(nullptr)
+    , m_verdict(nullptr)
+    , m_kind(NotMail)
+    , m_state(Skip)
+    , m_message(0)
+    , m_lineFirst(true)
+    , m_blank(true)
+    , m_keepHeader(false)
+    , m_inEntry(false)
+    , m_encoding(Identity)
+    , m_bits(0)
+    , m_bitCount(0)
+    , m_outSize(0)
+    , m_flagged(0)
+{
+}
+
+bool MailScanner::isDisabled()
+{
+    return qEnvironmentVariableIsSet("FORTI_NO_MAIL_SCAN");
+}
+
+MailScanner::Kind MailScanner::detect(const QByteArray &path, const QByteArray &ext,
+                                      const unsigned char *header, int size)
+{
+    const uchar *end = header + size;
+    if (size >= 5 && memcmp(header, "From ", 5) == 0) {
+        // mbox: за строкой "From " - заголовки первого письма
+        const uchar *nl = static_cast<const uchar *>(memchr(header, '\n', size_t(size)));
+        return nl && looksLikeHeader(nl + 1, end) ? Mailbox : NotMail;
+    }
+    if (!looksLikeHeader(header, end))
+        return NotMail;
+    if (ext == "eml")
+        return Message;
+    // Письмо Maildir: файл в подкаталоге cur или new
+    const int slash = path.lastIndexOf('/');
+    const int parent = slash > 0 ? path.lastIndexOf('/', slash - 1) : -1;
+    if (slash - parent == 4) {
+        const char *dir = path.constData() + parent + 1;
+        if (memcmp(dir, "cur", 3) == 0 || memcmp(dir, "new", 3) == 0)
+            return Message;
+    }
+    return NotMail;
+}
+
+bool MailScanner::scan(FileScanner &scanner, int fd, const QByteArray &path, Kind kind,
+                       const unsigned char *header, int headerSize, ScanVerdict &verdict)
+{
+    m_scanner = &scanner;
+    m_path = &path;
+    m_verdict = &verdict;
+    m_kind = kind;
+    m_state = Skip;
+    m_message = 0;
+    m_line.resize(0);
+    m_lineFirst = true;
+    m_blank = true;
+    m_headers.resize(0);
+    m_keepHeader = false;
+    m_boundaries.clear();
+    m_inEntry = false;
+    m_flagged = 0;
+    m_details.resize(0);
+    if (m_buffer.size() != READ_CHUNK) {
+        m_buffer.resize(READ_CHUNK);
+        m_out.resize(OutputSize);
+        m_line.reserve(MaxLine);
+        m_headers.reserve(MaxHeaderBytes);
+    }
+
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (kind == Message)
+        startMessage();
+    feed(reinterpret_cast<const char *>(header), headerSize);
+    for (;;) {
+        const ssize_t got = ::read(fd, m_buffer.data(), size_t(READ_CHUNK));
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0) {
+            // Детекторы вложения завершаются, вывод не нужен
+            if (m_inEntry)
+                m_scanner->finishEntry();
+            m_inEntry = false;
+            return false;
+        }
+        if (got == 0)
+            break;
+        SparseReader::addProgress(got);
+        feed(m_buffer.constData(), int(got));
+    }
+    if (!m_line.isEmpty() || !m_lineFirst)
+        line(m_line.constData(), m_line.size(), m_lineFirst, true);
+    closeEntry();
+
+    if (m_flagged > 0) {
+        verdict.reason = ScanVerdict::MailAttachment;
+        verdict.detail = m_details;
+        if (m_flagged > MaxReported)
+            verdict.detail += QString("; еще вложений: %1").arg(m_flagged - MaxReported).toUtf8();
+    }
+    return true;
+}
+
+// Блок ящика по строкам. Строка, целиком лежащая в блоке, не копируется
+void MailScanner::feed(const char *data, int size)
+{
+    while (size > 0) {
+        const char *nl = static_cast<const char *>(memchr(data, '\n', size_t(size)));
+        const int n = nl ? int(nl - data) : size;
+        if (m_line.isEmpty() && nl && n <= MaxLine) {
+            line(data, n, m_lineFirst, true);
+            m_lineFirst = true;
+        } else {
+            const int take = qMin(n, MaxLine - m_line.size());
+            m_line.append(data, take);
+            if (take < n || (!nl && m_line.size() == MaxLine)) {
+                // Длинная строка обрабатывается кусками по MaxLine
+                line(m_line.constData(), m_line.size(), m_lineFirst, false);
+                m_lineFirst = false;
+                m_line.resize(0);
+                data += take;
+                size -= take;
+                continue;
+            }
+            if (nl) {
+                line(m_line.constData(), m_line.size(), m_lineFirst, true);
+                m_line.resize(0);
+                m_lineFirst = true;
+            }
+        }
+        const int used = n + (nl ? 1 : 0);
+        data += used;
+        size -= used;
+    }
+}
+
+// Кусок строки: first - с ее начала, last - до ее конца
+void MailScanner::line(const char *p, int n, bool first, bool last)
+{
+    if (last && n > 0 && p[n - 1] == '\r')
+        --n;
+    if (first && m_kind == Mailbox) {
+        if (m_blank && n >= 5 && memcmp(p, "From ", 5) == 0) {
+            startMessage();
+            m_blank = false;
+            return;
+        }
+        // mboxrd: ">From " в тексте письма хранится с лишней '>'
+        if (n > 5 && p[0] == '>') {
+            int k = 1;
+            while (k < n && p[k] == '>')
+                ++k;
+            if (n - k >= 5 && memcmp(p + k, "From ", 5) == 0) {
+                ++p;
+                --n;
+            }
+        }
+    }
+    if (first)
+        m_blank = last && n == 0;
+
+    // Граница multipart завершает часть в любом состоянии
+    if (first && n >= 2 && p[0] == '-' && p[1] == '-' && !m_boundaries.isEmpty()) {
+        bool closing = false;
+        const int level = matchBoundary(p, n, &closing);
+        if (level >= 0) {
+            closeEntry();
+            if (closing) {
+                m_boundaries.resize(level);
+                m_state = Skip;
+            } else {
+                m_boundaries.resize(level + 1);
+                m_state = Headers;
+                m_headers.resize(0);
+                m_keepHeader = false;
+            }
+            return;
+        }
+    }
+
+    if (m_state == Headers) {
+        headerLine(p, n, first);
+    } else if (m_state == Body) {
+        if (m_encoding == Base64) {
+            decodeBase64(p, n);
+        } else if (m_encoding == QuotedPrintable) {
+            decodeQuotedPrintable(p, n, last);
+        } else {
+            char *out = reserve(n + 1);
+            memcpy(out, p, size_t(n));
+            m_outSize += n;
+            if (last)
+                m_out[m_outSize++] = '\n';
+        }
+    }
+}
+
+// Из заголовков части нужны только Content-*; продолжения строк
+// (начинаются с пробела) склеиваются с предыдущей
+void MailScanner::headerLine(const char *p, int n, bool first)
+{
+    if (first && n == 0) {
+        endHeaders();
+        return;
+    }
+    if (first && p[0] != ' ' && p[0] != '\t') {
+        m_keepHeader = n > 8 && strncasecmp(p, "content-", 8) == 0;
+        if (m_keepHeader && !m_headers.isEmpty() && m_headers.size() < MaxHeaderBytes)
+            m_headers.append('\n');
+    }
+    if (m_keepHeader)
+        m_headers.append(p, qMin(n, MaxHeaderBytes - m_headers.size()));
+}
+
+void MailScanner::endHeaders()
+{
+    QByteArray type = "text/plain";
+    QByteArray boundary;
+    QByteArray name;
+    QByteArray fileName;
+    Encoding encoding = Identity;
+    for (const QByteArray &header : m_headers.split('\n')) {
+        const int colon = header.indexOf(':');
+        if (colon < 0)
+            continue;
+        const QByteArray field = header.left(colon).trimmed().toLower();
+        const QByteArray value = header.mid(colon + 1);
+        const int semicolon = value.indexOf(';');
+        const QByteArray token = value.left(semicolon < 0 ? value.size() : semicolon).trimmed().toLower();
+        if (field == "content-type") {
+            if (!token.isEmpty())
+                type = token;
+            boundary = headerParameter(value, "boundary");
+            name = headerParameter(value, "name");
+        } else if (field == "content-disposition") {
+            fileName = headerParameter(value, "filename");
+        } else if (field == "content-transfer-encoding") {
+            if (token == "base64")
+                encoding = Base64;
+            else if (token == "quoted-printable")
+                encoding = QuotedPrintable;
+        }
+    }
+    m_headers.resize(0);
+    m_keepHeader = false;
+
+    if (type.startsWith("multipart/") && !boundary.isEmpty() && boundary.size() <= MaxBoundary
+        && m_boundaries.size() < MaxDepth) {
+        m_boundaries.append("--" + boundary);
+        m_state = Skip;
+    } else if (type == "message/rfc822" && encoding == Identity) {
+        // Вложенное письмо: следом его заголовки
+        m_state = Headers;
+    } else {
+        openEntry(fileName.isEmpty() ? name : fileName, type, encoding);
+        m_state = Body;
+    }
+}
+
+// Номер уровня границы или -1. После границы допустимы "--" (конец
+// multipart) и пробелы
+int MailScanner::matchBoundary(const char *p, int n, bool *closing) const
+{
+    for (int level = m_boundaries.size() - 1; level >= 0; --level) {
+        const QByteArray &boundary = m_boundaries[level];
+        if (n < boundary.size() || memcmp(p, boundary.constData(), size_t(boundary.size())) != 0)
+            continue;
+        int k = boundary.size();
+        *closing = n - k >= 2 && p[k] == '-' && p[k + 1] == '-';
+        if (*closing)
+            k += 2;
+        while (k < n && (p[k] == ' ' || p[k] == '\t'))
+            ++k;
+        if (k == n)
+            return level;
+    }
+    return -1;
+}
+
+void MailScanner::startMessage()
+{
+    closeEntry();
+    ++m_message;
+    m_boundaries.clear();
+    m_headers.resize(0);
+    m_keepHeader = false;
+    m_state = Headers;
+}
+
+void MailScanner::openEntry(const QByteArray &name, const QByteArray &type, Encoding encoding)
+{
+    m_scanner->beginEntry(*m_path, name, type);
+    m_inEntry = true;
+    m_entryName = name;
+    m_entryType = type;
+    m_encoding = encoding;
+    m_bits = 0;
+    m_bitCount = 0;
+    m_outSize = 0;
+}
+
+void MailScanner::closeEntry()
+{
+    if (!m_inEntry)
+        return;
+    flush();
+    m_inEntry = false;
+    const ScanVerdict entry = m_scanner->finishEntry();
+    if (!entry.isFlagged())
+        return;
+
+    m_verdict->level = qMax(m_verdict->level, entry.level);
+    if (++m_flagged > MaxReported)
+        return;
+    QString label = QString::fromUtf8(m_entryName);
+    if (label.isEmpty())
+        label = m_entryType.startsWith("text/") ? QString("текст письма")
+                                                : QString("часть %1").arg(QString::fromUtf8(m_entryType));
+    if (m_kind == Mailbox)
+        label = QString("письмо %1, %2").arg(m_message).arg(label);
+    if (!m_details.isEmpty())
+        m_details += "; ";
+    m_details += QString("%1: %2").arg(label, entry.describe()).toUtf8();
+}
+
+// Место под size байт в буфере вывода; полный буфер уходит в сканер
+char *MailScanner::reserve(int size)
+{
+    if (m_outSize + size > OutputSize)
+        flush();
+    return m_out.data() + m_outSize;
+}
+
+void MailScanner::flush()
+{
+    if (m_outSize > 0)
+        m_scanner->feedEntry(reinterpret_cast<const unsigned char *>(m_out.constData()), m_outSize);
+    m_outSize = 0;
+}
+
+// Символы вне алфавита (переводы строк, мусор) пропускаются, '='
+// завершает группу
+void MailScanner::decodeBase64(const char *p, int n)
+{
+    static const Base64Table table;
+    char *out = reserve(n);
+    char *o = out;
+    for (int i = 0; i < n; ++i) {
+        const int v = table.value[uchar(p[i])];
+        if (v < 0) {
+            if (p[i] == '=')
+                m_bitCount = 0;
+            continue;
+        }
+        m_bits = (m_bits << 6) | quint32(v);
+        m_bitCount += 6;
+        if (m_bitCount >= 8) {
+            m_bitCount -= 8;
+            *o++ = char(m_bits >> m_bitCount);
+            m_bits &= (1u << m_bitCount) - 1;
+        }
+    }
+    m_outSize += int(o - out);
+}
+
+// "=XX" - байт, '=' в конце строки - мягкий перенос. Кусок длинной
+// строки декодируется отдельно: "=XX" на стыке кусков остается как есть
+void MailScanner::decodeQuotedPrintable(const char *p, int n, bool last)
+{
+    if (last) {
+        while (n > 0 && (p[n - 1] == ' ' || p[n - 1] == '\t'))
+            --n;
+    }
+    const bool soft = last && n > 0 && p[n - 1] == '=';
+    if (soft)
+        --n;
+    char *out = reserve(n + 1);
+    char *o = out;
+    for (int i = 0; i < n; ++i) {
+        if (p[i] == '=' && i + 2 < n) {
+            const int hi = hexValue(p[i + 1]);
+            const int lo = hexValue(p[i + 2]);
+            if (hi >= 0 && lo >= 0) {
+                *o++ = char(hi << 4 | lo);
+                i += 2;
+                continue;
+            }
+        }
+        *o++ = p[i];
+    }
+    if (last && !soft)
+        *o++ = '\n';
+    m_outSize += int(o - out);
+}
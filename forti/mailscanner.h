@@ -0,0 +1,104 @@
+#ifndef MAILSCANNER_H
+#define MAILSCANNER_H
+
+#include <QByteArray>
+#include <QVector>
+
+class FileScanner;
+struct ScanVerdict;
+
+// Потоковая проверка почтовых ящиков: mbox (письма подряд, каждое
+// начинается строкой "From " после пустой) и отдельные письма (файлы
+// Maildir в cur/ и new/, *.eml). Ящик читается последовательно и
+// разбирается по строкам, письмо в память целиком не загружается:
+// из заголовков частей MIME берутся только Content-*, вложения base64
+// и quoted-printable декодируются на лету в буфер OutputSize и блоками
+// уходят в FileScanner как отдельные файлы с именем и MIME-типом.
+// Память на письмо постоянна: строка, заголовки части, стек границ
+// multipart и буфер декодирования ограничены.
+//
+// Вердикт ящика - худший из вердиктов вложений (причина MailAttachment),
+// в подробностях - первые найденные вложения с номером письма.
+// Отключение переменной окружения FORTI_NO_MAIL_SCAN.
+class MailScanner {
+public:
+    enum Kind {
+        NotMail,
+        Mailbox,  // mbox
+        Message   // одно письмо
+    };
+
+    static const int MaxLine = 8 * 1024;          // длиннее - обрабатывается кусками
+    static const int MaxHeaderBytes = 16 * 1024;  // заголовки Content-* одной части
+    static const int MaxDepth = 16;               // вложенность multipart
+    static const int MaxBoundary = 200;
+    static const int OutputSize = 64 * 1024;
+    static const int MaxReported = 5;             // вложений в подробностях вердикта
+
+    MailScanner();
+
+    // По началу файла (уже прочитанному для проверок) и пути
+    static Kind detect(const QByteArray &path, const QByteArray &ext, const unsigned char *header, int size);
+    static bool isDisabled();
+
+    // Остаток файла читается с текущей позиции fd; header - уже прочитанное
+    // начало. false - ошибка чтения
+    bool scan(FileScanner &scanner, int fd, const QByteArray &path, Kind kind,
+              const unsigned char *header, int headerSize, ScanVerdict &verdict);
+
+private:
+    enum State {
+        Headers,  // заголовки письма или части
+        Body,     // содержимое части, уходит в сканер
+        Skip      // преамбула и эпилог multipart
+    };
+    enum Encoding {
+        Identity,
+        Base64,
+        QuotedPrintable
+    };
+
+    void feed(const char *data, int size);
+    void line(const char *p, int n, bool first, bool last);
+    void headerLine(const char *p, int n, bool first);
+    void endHeaders();
+    int matchBoundary(const char *p, int n, bool *closing) const;
+    void startMessage();
+    void openEntry(const QByteArray &name, const QByteArray &type, Encoding encoding);
+    void closeEntry();
+    char *reserve(int size);
+    void flush();
+    void decodeBase64(const char *p, int n);
+    void decodeQuotedPrintable(const char *p, int n, bool last);
+
+    FileScanner *m_scanner;
+    const QByteArray *m_path;
+    ScanVerdict *m_verdict;
+    Kind m_kind;
+    State m_state;
+    int m_message;  // номер текущего письма, с 1
+
+    QByteArray m_buffer;  // блок чтения
+    QByteArray m_line;    // строка, не поместившаяся в блок
+    bool m_lineFirst;     // следующий кусок - начало строки
+    bool m_blank;         // предыдущая строка пустая
+
+    QByteArray m_headers;  // заголовки Content-* через '\n'
+    bool m_keepHeader;     // текущий заголовок - Content-*
+    QVector<QByteArray> m_boundaries;  // "--граница", внешняя первой
+
+    // Текущее вложение
+    bool m_inEntry;
+    QByteArray m_entryName;
+    QByteArray m_entryType;
+    Encoding m_encoding;
+    quint32 m_bits;  // base64: недособранный байт
+    int m_bitCount;
+    QByteArray m_out;
+    int m_outSize;
+
+    int m_flagged;
+    QByteArray m_details;
+};
+
+#endif // MAILSCANNER_H
@@ -12,7 +12,6 @@
 #include <QTextStream>
 #include <QInputDialog>
 #include <QLabel>
-#include <QFileSystemModel>
 #include <QTreeView>
 #include <QSplitter>
 #include <QNetworkAccessManager>
@@ -30,26 +29,114 @@
 #include <QDirIterator>
 #include <QFileInfo>
 #include <QDialog>
+#include <QDialogButtonBox>
+#include <QCheckBox>
+#include <QFormLayout>
+#include <QLineEdit>
+#include <QPlainTextEdit>
+#include <QSpinBox>
+#include <QTreeWidget>
 #include <QProgressDialog>
 #include <QDesktopServices>
 #include <QCoreApplication>
 #include <QRegularExpression>
 #include <QScrollArea>
+#include <QPaintEvent>
+#include <QEventLoop>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QScopedPointer>
+#include <QSignalBlocker>
+#include <QTime>
 #include <Qt>
 
+#include <algorithm>
+
+#include "batchcipher.h"
+#include "detectorregistry.h"
+#include "diskusage.h"
+#include "duplicatefinder.h"
+#include "exclusionrules.h"
+#include "filescanner.h"
+#include "filetreemodel.h"
+#include "filewalker.h"
+#include "largefilepolicy.h"
+#include "onaccessguard.h"
+#include "packageallowlist.h"
+#include "pieceeditor.h"
+#include "processscanner.h"
+#include "rulecompiler.h"
+#include "scanbenchmark.h"
+#include "scancheckpoint.h"
+#include "scanpriority.h"
+#include "scanqueue.h"
+#include "scanreport.h"
+#include "scanworker.h"
+#include "scanworkerpool.h"
+#include "scriptanalyzer.h"
+#include "similaritydigest.h"
+#include "similarityindex.h"
+#include "startuptrace.h"
+
 static const char *APP_VERSION = "v1.0.6";
 
+// Сколько наборов дубликатов выводить в окно
+static const int MAX_SHOWN_DUPLICATE_SETS = 500;
+// Сколько ошибок пакетного шифрования выводить в окно
+static const int MAX_SHOWN_CIPHER_ERRORS = 200;
+
+// Код возврата окна занятого места: пересчитать без кэша
+static const int RESCAN_RESULT = 2;
+
+// Период повторной проверки процессов
+static const int PROCESS_SCAN_INTERVAL_MS = 60 * 1000;
+
+// Строка дерева занятого места; числовые столбцы сортируются по числу
+class DiskUsageItem : public QTreeWidgetItem {
+public:
+    DiskUsageItem(const DiskUsageTree &tree, int index)
+        : m_index(index)
+    {
+        const DiskUsageNode &node = tree.node(index);
+        const double mb = 1024.0 * 1024.0;
+        setText(0, QFile::decodeName(node.name) + (node.error ? " (нет доступа)" : ""));
+        setText(1, QString::number(node.totalBytes / mb, 'f', 2));
+        setText(2, QString::number(node.totalAllocated / mb, 'f', 2));
+        setText(3, QString::number(node.totalFiles));
+        setText(4, QString::number(node.totalDirs));
+        setData(1, Qt::UserRole, node.totalBytes);
+        setData(2, Qt::UserRole, node.totalAllocated);
+        setData(3, Qt::UserRole, node.totalFiles);
+        setData(4, Qt::UserRole, node.totalDirs);
+        for (int column = 1; column <= 4; ++column)
+            setTextAlignment(column, Qt::AlignRight | Qt::AlignVCenter);
+        if (!node.children.isEmpty())
+            setChildIndicatorPolicy(QTreeWidgetItem::ShowIndicator);
+    }
+
+    int index() const { return m_index; }
+
+    bool operator<(const QTreeWidgetItem &other) const override {
+        const int column = treeWidget() ? treeWidget()->sortColumn() : 0;
+        if (column == 0)
+            return text(0) < other.text(0);
+        return data(column, Qt::UserRole).toLongLong() < other.data(column, Qt::UserRole).toLongLong();
+    }
+
+private:
+    int m_index;
+};
+
 // Класс для проверки обновлений
 class Updater : public QObject {
     Q_OBJECT
 public:
     explicit Updater(const QString &currentVersion, QObject *parent = nullptr)
         : QObject(parent)
-        , manager(new QNetworkAccessManager(this))
+        , manager(nullptr)
         , m_currentVersion(currentVersion)
     {
-        connect(manager, &QNetworkAccessManager::finished,
-                this, &Updater::onFinished);
     }
 
     void checkForUpdates() {
@@ -57,10 +144,21 @@ public:
         QNetworkRequest request{QUrl(url)};
         request.setHeader(QNetworkRequest::UserAgentHeader,
                           "FortiScan-Client");
-        manager->get(request);
+        networkManager()->get(request);
     }
 
 private:
+    // Сетевой стек создается при первом запросе, а не при запуске
+    QNetworkAccessManager *networkManager() {
+        if (!manager) {
+            LazyInitTimer trace("network");
+            manager = new QNetworkAccessManager(this);
+            connect(manager, &QNetworkAccessManager::finished,
+                    this, &Updater::onFinished);
+        }
+        return manager;
+    }
+
     static void parseVersionString(const QString &str,
                                    int &major, int &minor, int &patch)
     {
@@ -134,7 +232,7 @@ public:
     explicit FortiScan(QWidget *parent = nullptr)
         : QWidget(parent)
         , treeView(new QTreeView(this))
-        , fsModel(new QFileSystemModel(this))
+        , fsModel(nullptr)
         , fileViewer(new QTextEdit(this))
         , fileLabel(new QLabel("Файл не выбран", this))
         , updater(new Updater(QString::fromLatin1(APP_VERSION), this))
@@ -142,6 +240,7 @@ public:
         setWindowTitle(QString("FortiScan Antivirus %1")
                            .arg(QCoreApplication::applicationVersion()));
         resize(1000, 600);
+        StartupTrace::instance().mark("window");
 
         mainLayout = new QVBoxLayout(this);
 
@@ -151,11 +250,34 @@ public:
         actionAddFunction = new QAction("Добавить функцию", this);
         actionUpdate = new QAction("Обновить", this);
         actionCheckUpdates = new QAction("Проверить обновления", this);
+        actionExclusions = new QAction("Исключения...", this);
+        actionLargeFiles = new QAction("Крупные файлы...", this);
+        actionRules = new QAction("Правила обнаружения...", this);
+        actionSimilarity = new QAction("Индекс похожих образцов...", this);
+        actionDetectors = new QAction("Детекторы...", this);
+        actionWatchProcesses = new QAction("Проверять процессы каждую минуту", this);
+        actionWatchProcesses->setCheckable(true);
+        actionOnAccess = new QAction("Проверка при открытии файлов...", this);
+        actionOnAccess->setCheckable(true);
         menuSettings->addAction(actionAddFunction);
         menuSettings->addAction(actionUpdate);
         menuSettings->addAction(actionCheckUpdates);
+        menuSettings->addAction(actionExclusions);
+        menuSettings->addAction(actionLargeFiles);
+        menuSettings->addAction(actionRules);
+        menuSettings->addAction(actionSimilarity);
+        menuSettings->addAction(actionDetectors);
+        menuSettings->addAction(actionWatchProcesses);
+        menuSettings->addAction(actionOnAccess);
         menuBar->addMenu(menuSettings);
+        auto *menuReports = new QMenu("Отчеты", this);
+        actionCompareReports = new QAction("Сравнить отчеты...", this);
+        actionExportReport = new QAction("Экспорт отчета...", this);
+        menuReports->addAction(actionCompareReports);
+        menuReports->addAction(actionExportReport);
+        menuBar->addMenu(menuReports);
         mainLayout->setMenuBar(menuBar);
+        StartupTrace::instance().mark("menu");
 
         // Создаем контейнер для кнопок и layout
         buttonContainer = new QWidget;
@@ -165,6 +287,8 @@ public:
         // Создаем кнопки
         bChooseFolder = new QPushButton("Выбрать папку");
         bScan = new QPushButton("Сканировать");
+        bProcesses = new QPushButton("Процессы");
+        bJobs = new QPushButton("Задания");
         bRead = new QPushButton("Читать файл");
         bEdit = new QPushButton("Редактировать");
         bDelete = new QPushButton("Удалить");
@@ -173,11 +297,14 @@ public:
         bEncrypt = new QPushButton("Зашифровать");
         bDecrypt = new QPushButton("Расшифровать");
         bCheckFS = new QPushButton("Проверка ФС");
+        bDuplicates = new QPushButton("Дубликаты");
         bCheckUpdates = new QPushButton("Проверить обновления");
 
         // Добавляем кнопки
         buttonLayout->addWidget(bChooseFolder);
         buttonLayout->addWidget(bScan);
+        buttonLayout->addWidget(bProcesses);
+        buttonLayout->addWidget(bJobs);
         buttonLayout->addWidget(bRead);
         buttonLayout->addWidget(bEdit);
         buttonLayout->addWidget(bDelete);
@@ -186,6 +313,7 @@ public:
         buttonLayout->addWidget(bEncrypt);
         buttonLayout->addWidget(bDecrypt);
         buttonLayout->addWidget(bCheckFS);
+        buttonLayout->addWidget(bDuplicates);
         buttonLayout->addWidget(bCheckUpdates);
 
         // Создаем ScrollArea
@@ -196,14 +324,16 @@ public:
         scrollArea->setWidget(buttonContainer);
 
         mainLayout->addWidget(scrollArea);
+        StartupTrace::instance().mark("buttons");
 
-        // Создаем splitter для дерева и просмотрщика
+        // Создаем splitter для дерева и просмотрщика.
+        // Модель файловой системы подключается после первой отрисовки
+        // (см. initDeferred), чтобы окно не ждало обхода домашней папки.
         splitter = new QSplitter(Qt::Horizontal);
-        fsModel->setRootPath(QDir::homePath());
-        treeView->setModel(fsModel);
-        treeView->setRootIndex(fsModel->index(QDir::homePath()));
 
         fileViewer->setReadOnly(true);
+        // Несколько файлов можно выделить для пакетного шифрования
+        treeView->setSelectionMode(QAbstractItemView::ExtendedSelection);
         splitter->addWidget(treeView);
         splitter->addWidget(fileViewer);
         splitter->setStretchFactor(1, 1);
@@ -217,6 +347,10 @@ public:
                 this, &FortiScan::selectFolder);
         connect(bScan, &QPushButton::clicked,
                 this, &FortiScan::startScan);
+        connect(bProcesses, &QPushButton::clicked,
+                this, &FortiScan::scanProcesses);
+        connect(bJobs, &QPushButton::clicked,
+                this, &FortiScan::showScanJobs);
         connect(bRead, &QPushButton::clicked,
                 this, &FortiScan::readFile);
         connect(bEdit, &QPushButton::clicked,
@@ -233,6 +367,8 @@ public:
                 this, &FortiScan::decryptFile);
         connect(bCheckFS, &QPushButton::clicked,
                 this, &FortiScan::checkFileSystem);
+        connect(bDuplicates, &QPushButton::clicked,
+                this, &FortiScan::findDuplicates);
         connect(bCheckUpdates, &QPushButton::clicked,
                 updater, &Updater::checkForUpdates);
         connect(treeView, &QTreeView::clicked,
@@ -241,9 +377,36 @@ public:
                 updater, &Updater::checkForUpdates);
         connect(actionUpdate, &QAction::triggered,
                 this, &FortiScan::openDownloadPage);
+        connect(actionExclusions, &QAction::triggered,
+                this, &FortiScan::editExclusions);
+        connect(actionLargeFiles, &QAction::triggered,
+                this, &FortiScan::editLargeFilePolicy);
+        connect(actionRules, &QAction::triggered,
+                this, &FortiScan::openRulesDirectory);
+        connect(actionSimilarity, &QAction::triggered,
+                this, &FortiScan::buildSimilarityIndex);
+        connect(actionDetectors, &QAction::triggered,
+                this, &FortiScan::openDetectorsDirectory);
+        connect(actionWatchProcesses, &QAction::toggled,
+                this, &FortiScan::setProcessWatch);
+        connect(actionOnAccess, &QAction::toggled,
+                this, &FortiScan::setOnAccessGuard);
+        connect(actionCompareReports, &QAction::triggered,
+                this, &FortiScan::compareReports);
+        connect(actionExportReport, &QAction::triggered,
+                this, &FortiScan::exportReport);
+        StartupTrace::instance().mark("layout");
+    }
 
-        // Автоматическая проверка обновлений через 2 секунды
-        QTimer::singleShot(2000, updater, &Updater::checkForUpdates);
+protected:
+    void paintEvent(QPaintEvent *event) override {
+        QWidget::paintEvent(event);
+        if (deferredInitScheduled)
+            return;
+        deferredInitScheduled = true;
+        StartupTrace::instance().mark("first-paint");
+        StartupTrace::instance().finish();
+        QTimer::singleShot(0, this, &FortiScan::initDeferred);
     }
 
 private:
@@ -253,12 +416,23 @@ private:
     QAction *actionAddFunction;
     QAction *actionUpdate;
     QAction *actionCheckUpdates;
+    QAction *actionExclusions;
+    QAction *actionLargeFiles;
+    QAction *actionRules;
+    QAction *actionSimilarity;
+    QAction *actionDetectors;
+    QAction *actionWatchProcesses;
+    QAction *actionOnAccess;
+    QAction *actionCompareReports;
+    QAction *actionExportReport;
 
     QWidget *buttonContainer;
     QHBoxLayout *buttonLayout;
 
     QPushButton *bChooseFolder;
     QPushButton *bScan;
+    QPushButton *bProcesses;
+    QPushButton *bJobs;
     QPushButton *bRead;
     QPushButton *bEdit;
     QPushButton *bDelete;
@@ -267,17 +441,67 @@ private:
     QPushButton *bEncrypt;
     QPushButton *bDecrypt;
     QPushButton *bCheckFS;
+    QPushButton *bDuplicates;
     QPushButton *bCheckUpdates;
 
     QSplitter *splitter;
 
     QTreeView *treeView;
-    QFileSystemModel *fsModel;
+    FileTreeModel *fsModel;
     QTextEdit *fileViewer;
     QLabel *fileLabel;
     QString folderPath;
     QString currentFilePath;
     Updater *updater;
+    bool deferredInitScheduled = false;
+    // Кэш вердиктов процессов живет между проверками
+    ProcessScanner processScanner;
+    QTimer *processTimer = nullptr;
+    bool processScanRunning = false;
+    QStringList lastProcessFindings;
+    // Очередь заданий работает в фоне, окно заданий не модальное
+    ScanQueue *scanQueue = nullptr;
+    QDialog *jobsDialog = nullptr;
+    QTreeWidget *jobsView = nullptr;
+    // Проверка при открытии; выбор точек монтирования помнится до выхода
+    OnAccessGuard *onAccessGuard = nullptr;
+    QStringList onAccessMounts;
+    bool onAccessAllOpens = false;
+    // Время детекторов последнего сканирования папки
+    QVector<DetectorTiming> lastDetectorTimings;
+
+    // Отложенная инициализация после первой отрисовки окна
+    void initDeferred() {
+        ensureFsModel();
+        // Задания по расписанию запускаются и без открытого окна заданий
+        ensureScanQueue();
+
+        // Автоматическая проверка обновлений через 2 секунды
+        QTimer::singleShot(2000, updater, &Updater::checkForUpdates);
+    }
+
+    FileTreeModel *ensureFsModel() {
+        if (!fsModel) {
+            LazyInitTimer trace("fs-model");
+            fsModel = new FileTreeModel(this);
+            fsModel->setRootPath(folderPath.isEmpty() ? QDir::homePath() : folderPath);
+            treeView->setModel(fsModel);
+            treeView->setUniformRowHeights(true);
+            // Свернутый каталог отдает память, при раскрытии читается заново
+            connect(treeView, &QTreeView::collapsed, fsModel, &FileTreeModel::release);
+        }
+        return fsModel;
+    }
+
+    ScanQueue *ensureScanQueue() {
+        if (!scanQueue) {
+            scanQueue = new ScanQueue(this);
+            connect(scanQueue, &ScanQueue::jobsChanged, this, &FortiScan::refreshScanJobs);
+            // Отметки в дереве - по отчету завершенного задания
+            connect(scanQueue, &ScanQueue::jobFinished, this, [this] { ensureFsModel()->loadReport(); });
+        }
+        return scanQueue;
+    }
 
     // Методы
 public slots:
@@ -285,9 +509,7 @@ public slots:
         QString dir = QFileDialog::getExistingDirectory(this, "Выбрать папку", folderPath.isEmpty() ? QDir::homePath() : folderPath);
         if (!dir.isEmpty()) {
             folderPath = dir;
-            fsModel->setRootPath(folderPath);
-            QModelIndex rootIndex = fsModel->index(folderPath);
-            treeView->setRootIndex(rootIndex);
+            ensureFsModel()->setRootPath(folderPath);
             fileViewer->clear();
             fileLabel->setText("Файл не выбран");
             currentFilePath.clear();
@@ -300,49 +522,264 @@ public slots:
             return;
         }
 
-        QStringList suspiciousExtensions = { "exe", "dll", "scr", "bat", "cmd", "js", "vbs" };
-        QStringList suspiciousFiles;
-
         int totalFiles = 0;
+        int failedFiles = 0;
+        quint64 nextId = 0;
+        bool canceled = false;
+        // Результаты копятся только в сборщике отчета: пути в нем сжаты,
+        // список найденного собирается из него же при показе
+        ScanReportWriter report;
+
+        auto addResult = [&](const QByteArray &path, const ScanVerdict &verdict) {
+            report.add(path, verdict);
+            if (verdict.level == ScanVerdict::Failed)
+                ++failedFiles;
+        };
+
+        // Правила компилируются здесь (или берутся из кэша), обработчики
+        // загружают уже готовый кэш
+        QStringList ruleErrors;
+        const QSharedPointer<const CompiledRules> rules = CompiledRules::installed(&ruleErrors);
+
+        // Прерванное сканирование того же каталога с теми же настройками
+        // можно продолжить: результаты берутся из журнала, проверенные
+        // поддеревья не обходятся заново
+        ScanCheckpoint checkpoint(folderPath, scanConfigKey(folderPath, *rules));
+        int restoredFiles = 0;
+        if (checkpoint.exists()) {
+            const auto answer = QMessageBox::question(
+                this, "Сканирование",
+                "Предыдущее сканирование этой папки было прервано.\n"
+                "Продолжить с места остановки?");
+            if (answer == QMessageBox::Yes) {
+                const qint64 restored = checkpoint.restore(addResult);
+                if (restored < 0) {
+                    // Частично загруженный журнал не смешивается с новым
+                    report.clear();
+                    failedFiles = 0;
+                } else {
+                    restoredFiles = int(restored);
+                }
+            }
+        }
+        if (restoredFiles == 0)
+            checkpoint.start();
+        totalFiles = restoredFiles;
 
         QProgressDialog progress("Сканирование...", "Отмена", 0, 0, this);
         progress.setWindowModality(Qt::ApplicationModal);
         progress.show();
 
-        QDirIterator it(folderPath,
-                        QDir::Files,
-                        QDirIterator::Subdirectories);
-        while (it.hasNext()) {
-            QString filePath = it.next();
+        // База пакетов читается до запуска обработчиков: они берут ее из
+        // кэша. Файлы пакетов, сверенные раньше и не менявшиеся, не читаются
+        progress.setLabelText("Чтение базы пакетов...");
+        qApp->processEvents();
+        TrustedFileCache trusted(PackageAllowlist::installed());
+        // Крупные файлы проверяются по политике; расписание полных проверок
+        // ведется здесь, обработчики читают его сохраненным
+        const QSharedPointer<const LargeFilePolicy> largeFiles = LargeFilePolicy::installed();
+        CoverageSchedule coverage;
+        if (largeFiles)
+            coverage.load();
+        int sampledFiles = 0;
+        int scheduledFullFiles = 0;
+
+        // Время до первой находки - от начала обхода
+        QElapsedTimer scanTimer;
+        scanTimer.start();
+        int scannedFiles = 0;
+        qint64 firstDetectionMs = -1;
+        int firstDetectionRank = 0;
+        QByteArray firstDetectionPath;
+
+        auto onResult = [&](quint64 id, const QByteArray &path, const ScanVerdict &verdict) {
+            trusted.fileScanned(id, verdict);
+            addResult(path, verdict);
+            checkpoint.fileScanned(path, verdict);
+            ++scannedFiles;
+            if (verdict.coverage != LargeFilePolicy::Full)
+                ++sampledFiles;
+            if (largeFiles && coverage.fileScanned(path, verdict.coverage))
+                ++scheduledFullFiles;
+            if (firstDetectionMs < 0
+                && (verdict.level == ScanVerdict::Suspicious || verdict.level == ScanVerdict::Malicious)) {
+                firstDetectionMs = scanTimer.elapsed();
+                firstDetectionRank = scannedFiles;
+                firstDetectionPath = path;
+            }
+        };
+
+        // Содержимое файлов разбирается в отдельных процессах, чтобы
+        // испорченный файл не мог уронить окно программы
+        ScanWorkerPool pool;
+        const bool isolated = pool.start();
+        connect(&pool, &ScanWorkerPool::fileScanned, this, onResult);
+        // Детекторы нужны окну только без обработчиков: те загружают их сами
+        FileScanner scanner(rules, SimilarityIndex::installed(), trusted.packages(),
+                            isolated ? QVector<DetectorFactory *>() : DetectorRegistry::installed());
+        scanner.setLargeFilePolicy(largeFiles, CoverageSchedule::cached());
+
+        // Сначала проверяется то, что вероятнее окажется угрозой: обход
+        // идет в опасные каталоги раньше, а среди найденных, но не
+        // проверенных файлов опасные обгоняют остальные. Без приоритета
+        // очередь работает по порядку обхода
+        const bool prioritized = !ScanPriority::isDisabled();
+        ScanPriority priority;
+        ScanScheduler scheduler(isolated ? &pool : nullptr, &scanner, prioritized, onResult);
+
+        // Исключенные каталоги отсекаются при обходе и не открываются
+        FileWalker walker(ExclusionRules::load());
+        walker.setDirectoryFilter([&](const QByteArray &dir) { return checkpoint.shouldWalk(dir); });
+        walker.setDirectoryCallback([&](const QByteArray &dir, int subdirs) {
+            checkpoint.directoryListed(dir, subdirs);
+        });
+        if (prioritized) {
+            walker.setNeedSize(true);
+            walker.setDirectoryPriority([&](const QByteArray &dir) { return priority.directoryScore(dir); });
+        }
+        walker.walk(folderPath, [&](const WalkEntry &entry) {
+            if (checkpoint.isScanned(entry.path))
+                return true;
             ++totalFiles;
+            checkpoint.fileQueued(entry.path);
 
-            QFileInfo info(filePath);
-            QString ext = info.suffix().toLower();
-            if (suspiciousExtensions.contains(ext)) {
-                suspiciousFiles << filePath;
-            }
+            const quint64 id = nextId++;
+            ScanVerdict known;
+            if (trusted.check(id, entry.path, &known))
+                onResult(id, entry.path, known);
+            else
+                scheduler.push(id, entry.path, prioritized ? priority.fileScore(entry) : 0);
+            scheduler.feed();
 
             if (totalFiles % 200 == 0) {
                 progress.setLabelText(QString("Проверено файлов: %1").arg(totalFiles));
                 qApp->processEvents();
-                if (progress.wasCanceled())
-                    break;
+                if (progress.wasCanceled()) {
+                    canceled = true;
+                    return false;
+                }
+            }
+            while (scheduler.isFull()) {
+                qApp->processEvents(QEventLoop::WaitForMoreEvents);
+                scheduler.feed();
+            }
+            return true;
+        });
+
+        if (canceled)
+            scheduler.clear();
+        if (isolated) {
+            scheduler.feed();
+            pool.flush();
+            while (!scheduler.isEmpty() || !pool.isIdle()) {
+                if (progress.wasCanceled()) {
+                    canceled = true;
+                    scheduler.clear();
+                    pool.cancel();
+                }
+                qApp->processEvents(QEventLoop::WaitForMoreEvents);
+                scheduler.feed();
+                pool.flush();
+            }
+        } else {
+            while (!scheduler.isEmpty()) {
+                scheduler.scanNext();
+                if (scheduler.size() % 200 == 0) {
+                    progress.setLabelText(QString("Осталось проверить: %1").arg(scheduler.size()));
+                    qApp->processEvents();
+                    if (progress.wasCanceled()) {
+                        canceled = true;
+                        scheduler.clear();
+                    }
+                }
             }
         }
 
         progress.close();
+        trusted.save();
+        if (largeFiles)
+            coverage.save();
+        scanner.endBatch();
+        lastDetectorTimings = pool.detectorTimings();
+        DetectorRegistry::mergeTimings(lastDetectorTimings, scanner.takeDetectorTimings());
+
+        // Прерванное сканирование не сохраняется: неполный отчет
+        // дал бы ложные "исчезнувшие" находки при сравнении. Вместо
+        // него на диске остается журнал для продолжения
+        QString reportPath;
+        QString reportError;
+        if (canceled) {
+            checkpoint.sync();
+        } else {
+            reportPath = ScanReport::newReportPath();
+            if (report.write(reportPath, folderPath, &reportError)) {
+                checkpoint.finish();
+                ensureFsModel()->loadReport(reportPath);
+            } else {
+                reportPath.clear();
+            }
+        }
 
+        const WalkStats &stats = walker.stats();
         fileViewer->clear();
         fileViewer->append(QString("Сканирование папки: %1\n").arg(folderPath));
         fileViewer->append(QString("Всего файлов: %1").arg(totalFiles));
-        fileViewer->append(QString("Подозрительных: %1").arg(suspiciousFiles.size()));
+        fileViewer->append(QString("Подозрительных: %1").arg(report.flaggedCount()));
+        if (firstDetectionMs >= 0)
+            fileViewer->append(QString("Первая находка: через %1 с, %2-й проверенный файл (%3)")
+                                   .arg(firstDetectionMs / 1000.0, 0, 'f', 2)
+                                   .arg(firstDetectionRank)
+                                   .arg(QFile::decodeName(firstDetectionPath)));
+        if (!prioritized)
+            fileViewer->append("Порядок проверки: по обходу (FORTI_NO_SCAN_PRIORITY)");
+        fileViewer->append(QString("Исключено правилами: %1 (каталогов: %2, файлов: %3)")
+                               .arg(stats.pruned())
+                               .arg(stats.prunedDirs)
+                               .arg(stats.prunedFiles));
+        if (failedFiles > 0)
+            fileViewer->append(QString("Не удалось проверить: %1").arg(failedFiles));
+        if (trusted.hits() + trusted.verified() > 0)
+            fileViewer->append(QString("Файлов пакетов без разбора: %1 (сверено: %2, из кэша: %3)")
+                                   .arg(trusted.hits() + trusted.verified())
+                                   .arg(trusted.verified())
+                                   .arg(trusted.hits()));
+        if (sampledFiles > 0)
+            fileViewer->append(QString("Крупных файлов проверено не целиком: %1 (политика: %2)")
+                                   .arg(sampledFiles)
+                                   .arg(LargeFilePolicy::configPath()));
+        if (scheduledFullFiles > 0)
+            fileViewer->append(QString("Крупных файлов проверено целиком по расписанию: %1")
+                                   .arg(scheduledFullFiles));
+        if (!isolated && !ScanWorkerPool::isDisabled())
+            fileViewer->append("Внимание: обработчики не запустились, файлы разобраны в процессе окна");
+        if (pool.restarts() > 0)
+            fileViewer->append(QString("Перезапусков обработчиков: %1").arg(pool.restarts()));
+        if (!lastDetectorTimings.isEmpty()) {
+            fileViewer->append("Время детекторов:");
+            for (const QString &line : describeDetectorTimings(lastDetectorTimings))
+                fileViewer->append("   " + line);
+        }
+        if (!ruleErrors.isEmpty()) {
+            fileViewer->append(QString("Правила с ошибками пропущены (%1):").arg(ruleErrors.size()));
+            for (const QString &e : ruleErrors)
+                fileViewer->append("   " + e);
+        }
+        if (restoredFiles > 0)
+            fileViewer->append(QString("Продолжено прерванное сканирование, из журнала: %1")
+                                   .arg(restoredFiles));
+        if (canceled)
+            fileViewer->append("Сканирование прервано, отчет не сохранен; его можно продолжить");
+        else if (!reportPath.isEmpty())
+            fileViewer->append(QString("Отчет: %1").arg(reportPath));
+        else
+            fileViewer->append(QString("Не удалось сохранить отчет: %1").arg(reportError));
         fileViewer->append("\n");
 
-        if (!suspiciousFiles.isEmpty()) {
+        if (report.flaggedCount() > 0) {
             fileViewer->append("Подозрительные файлы:");
-            for (const QString &f : suspiciousFiles) {
-                fileViewer->append(" - " + f);
-            }
+            report.forEachFlagged([this](const QByteArray &path, const ScanVerdict &verdict) {
+                fileViewer->append(QString(" - %1 (%2)").arg(QFile::decodeName(path), verdict.describe()));
+            });
         } else {
             fileViewer->append("Подозрительных файлов не найдено.");
         }
@@ -352,6 +789,379 @@ public slots:
                                  "Проверка папки завершена. Результат в правом окне.");
     }
 
+    // Окно заданий не блокирует главное: задания идут в фоне, их можно
+    // добавлять и отменять по одному
+    void showScanJobs() {
+        ensureScanQueue();
+        if (!jobsDialog) {
+            jobsDialog = new QDialog(this);
+            jobsDialog->setWindowTitle("Задания сканирования");
+            jobsDialog->resize(900, 400);
+            auto *layout = new QVBoxLayout(jobsDialog);
+            jobsView = new QTreeWidget(jobsDialog);
+            jobsView->setHeaderLabels(QStringList() << "Папка" << "Приоритет" << "Расписание"
+                                                    << "Состояние" << "Файлов" << "Найдено"
+                                                    << "Последний запуск");
+            jobsView->setRootIsDecorated(false);
+            layout->addWidget(jobsView);
+
+            auto *buttons = new QDialogButtonBox(QDialogButtonBox::Close, jobsDialog);
+            QPushButton *add = buttons->addButton("Добавить...", QDialogButtonBox::ActionRole);
+            QPushButton *run = buttons->addButton("Запустить", QDialogButtonBox::ActionRole);
+            QPushButton *cancel = buttons->addButton("Отменить", QDialogButtonBox::ActionRole);
+            QPushButton *remove = buttons->addButton("Удалить", QDialogButtonBox::ActionRole);
+            layout->addWidget(buttons);
+            connect(buttons, &QDialogButtonBox::rejected, jobsDialog, &QDialog::hide);
+            connect(add, &QPushButton::clicked, this, &FortiScan::addScanJob);
+            auto selectedJob = [this] {
+                QTreeWidgetItem *item = jobsView->currentItem();
+                return item ? item->data(0, Qt::UserRole).toInt() : 0;
+            };
+            connect(run, &QPushButton::clicked, this, [=] { scanQueue->runNow(selectedJob()); });
+            connect(cancel, &QPushButton::clicked, this, [=] { scanQueue->cancelJob(selectedJob()); });
+            connect(remove, &QPushButton::clicked, this, [=] { scanQueue->removeJob(selectedJob()); });
+            connect(jobsView, &QTreeWidget::itemDoubleClicked, this, [=] {
+                showScanJobReport(selectedJob());
+            });
+        }
+        refreshScanJobs();
+        jobsDialog->show();
+        jobsDialog->raise();
+    }
+
+    void addScanJob() {
+        QDialog dialog(jobsDialog);
+        dialog.setWindowTitle("Новое задание");
+        auto *form = new QFormLayout(&dialog);
+        auto *root = new QLineEdit(folderPath, &dialog);
+        auto *browse = new QPushButton("Обзор...", &dialog);
+        auto *rootRow = new QHBoxLayout;
+        rootRow->addWidget(root);
+        rootRow->addWidget(browse);
+        form->addRow("Папка:", rootRow);
+        auto *priority = new QSpinBox(&dialog);
+        priority->setRange(-100, 100);
+        form->addRow("Приоритет:", priority);
+        auto *interval = new QSpinBox(&dialog);
+        interval->setRange(0, 7 * 24 * 60);
+        interval->setSuffix(" мин");
+        interval->setSpecialValueText("однократно");
+        form->addRow("Повторять каждые:", interval);
+        auto *exclusions = new QPlainTextEdit(&dialog);
+        exclusions->setPlaceholderText("Свои исключения задания, в дополнение к общим:\n"
+                                       "glob, path:/префикс, size:>размер");
+        form->addRow("Исключения:", exclusions);
+        auto *buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, &dialog);
+        form->addRow(buttons);
+        connect(buttons, &QDialogButtonBox::accepted, &dialog, &QDialog::accept);
+        connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+        connect(browse, &QPushButton::clicked, &dialog, [&] {
+            const QString dir = QFileDialog::getExistingDirectory(&dialog, "Выбрать папку", root->text());
+            if (!dir.isEmpty())
+                root->setText(dir);
+        });
+
+        if (dialog.exec() != QDialog::Accepted)
+            return;
+        if (!QFileInfo(root->text()).isDir()) {
+            QMessageBox::warning(jobsDialog, "Ошибка", "Папка не найдена");
+            return;
+        }
+        scanQueue->addJob(root->text(), priority->value(), exclusions->toPlainText(),
+                          interval->value());
+    }
+
+    void refreshScanJobs() {
+        if (!jobsView || !jobsDialog->isVisible())
+            return;
+        const int current = jobsView->currentItem()
+                                ? jobsView->currentItem()->data(0, Qt::UserRole).toInt() : 0;
+        jobsView->clear();
+        for (const ScanJob &job : scanQueue->jobs()) {
+            auto *item = new QTreeWidgetItem(jobsView);
+            item->setData(0, Qt::UserRole, job.id);
+            item->setText(0, job.root);
+            item->setText(1, QString::number(job.priority));
+            item->setText(2, job.scheduleText());
+            item->setText(3, job.stateText());
+            item->setText(4, QString::number(job.files));
+            item->setText(5, QString::number(job.flagged));
+            item->setText(6, job.lastRun.isValid() ? job.lastRun.toString("dd.MM.yyyy HH:mm") : QString());
+            if (job.id == current)
+                jobsView->setCurrentItem(item);
+        }
+        jobsView->resizeColumnToContents(0);
+    }
+
+    void showScanJobReport(int id) {
+        for (const ScanJob &job : scanQueue->jobs()) {
+            if (job.id != id)
+                continue;
+            QStringList lines;
+            lines << QString("Задание: %1 (%2)").arg(job.root, job.scheduleText());
+            lines << QString("Состояние: %1").arg(job.stateText());
+            ScanReport report;
+            QString error;
+            if (job.reportPath.isEmpty()) {
+                lines << "Отчета еще нет";
+            } else if (!report.open(job.reportPath, &error)) {
+                lines << QString("Не удалось открыть отчет %1: %2").arg(job.reportPath, error);
+            } else {
+                lines << QString("Отчет: %1").arg(job.reportPath);
+                lines << QString("Всего файлов: %1").arg(report.count());
+                lines << QString("Подозрительных: %1").arg(report.flaggedCount());
+                ScanReport::Cursor cursor = report.cursor();
+                while (cursor.next()) {
+                    const ScanReport::Entry &entry = cursor.entry();
+                    if (entry.isFlagged())
+                        lines << QString(" - %1 (%2)").arg(QFile::decodeName(entry.path), entry.describe());
+                }
+            }
+            fileViewer->setPlainText(lines.join("\n"));
+            return;
+        }
+    }
+
+    void scanProcesses() {
+        runProcessScan(false);
+    }
+
+    void setProcessWatch(bool enabled) {
+        if (!processTimer) {
+            processTimer = new QTimer(this);
+            processTimer->setInterval(PROCESS_SCAN_INTERVAL_MS);
+            connect(processTimer, &QTimer::timeout, this, [this] { runProcessScan(true); });
+        }
+        if (enabled) {
+            processTimer->start();
+            runProcessScan(true);
+        } else {
+            processTimer->stop();
+        }
+    }
+
+    // Отпечаток правил и индекса похожих образцов: с другими правилами
+    // прежние вердикты процессов недействительны
+    static QByteArray detectionConfigKey() {
+        QFileInfoList files = QDir(CompiledRules::rulesDirectory()).entryInfoList(QDir::Files, QDir::Name);
+        files << QFileInfo(SimilarityIndex::defaultPath());
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        for (const QFileInfo &info : files) {
+            hash.addData(QFile::encodeName(info.fileName()));
+            hash.addData(QByteArray::number(info.size()) + ':'
+                         + QByteArray::number(info.lastModified().toMSecsSinceEpoch()) + '\n');
+        }
+        return hash.result();
+    }
+
+    // Периодическая проверка идет без окна прогресса и обновляет правое
+    // окно, только когда находки изменились
+    void runProcessScan(bool periodic) {
+        if (processScanRunning || (periodic && QApplication::activeModalWidget()))
+            return;
+        processScanRunning = true;
+        if (!processScanner.refresh(detectionConfigKey())) {
+            processScanRunning = false;
+            if (!periodic)
+                QMessageBox::warning(this, "Ошибка", "Не удалось прочитать /proc");
+            return;
+        }
+
+        // Читаются только новые и измененные файлы; если таких нет,
+        // обработчики не запускаются
+        const QVector<int> pending = processScanner.pending();
+        int done = 0;
+        bool canceled = false;
+        bool processIsolated = true;
+        if (!pending.isEmpty()) {
+            QScopedPointer<QProgressDialog> progress;
+            if (!periodic) {
+                progress.reset(new QProgressDialog("Проверка процессов...", "Отмена", 0, pending.size(), this));
+                progress->setWindowModality(Qt::WindowModal);
+                progress->setMinimumDuration(500);
+            }
+            auto wasCanceled = [&]() {
+                if (progress) {
+                    progress->setValue(done);
+                    canceled = canceled || progress->wasCanceled();
+                }
+                return canceled;
+            };
+
+            const QSharedPointer<const CompiledRules> rules = CompiledRules::installed();
+            const QSharedPointer<const PackageAllowlist> packages = PackageAllowlist::installed();
+            ScanWorkerPool pool;
+            const bool isolated = pool.start();
+            processIsolated = isolated;
+            connect(&pool, &ScanWorkerPool::fileScanned, this,
+                    [&](quint64 id, const QByteArray &, const ScanVerdict &verdict) {
+                        processScanner.setVerdict(int(id), verdict);
+                        ++done;
+                    });
+            QScopedPointer<FileScanner> scanner;
+            if (!isolated)
+                scanner.reset(new FileScanner(rules, SimilarityIndex::installed(), packages,
+                                              DetectorRegistry::installed()));
+            for (int index : pending) {
+                const QByteArray &path = processScanner.objects()[index].scanPath;
+                if (isolated) {
+                    pool.submit(quint64(index), path);
+                } else {
+                    processScanner.setVerdict(index, scanner->scan(path));
+                    ++done;
+                    qApp->processEvents();
+                    if (wasCanceled())
+                        break;
+                }
+            }
+            if (isolated) {
+                pool.flush();
+                while (!pool.isIdle()) {
+                    if (!canceled && wasCanceled())
+                        pool.cancel();
+                    qApp->processEvents(QEventLoop::WaitForMoreEvents);
+                }
+            }
+        }
+
+        const ProcessScanStats &stats = processScanner.stats();
+        const QVector<ProcessObject> &objects = processScanner.objects();
+        int failed = 0;
+        for (const ProcessObject &object : objects) {
+            if (object.verdict.level == ScanVerdict::Failed)
+                ++failed;
+        }
+
+        QStringList findings;
+        for (const ProcessInfo &process : processScanner.processes()) {
+            const QString name = QString("%1 %2").arg(process.pid).arg(QString::fromLocal8Bit(process.name));
+            for (int index : process.objects) {
+                const ProcessObject &object = objects[index];
+                if (object.verdict.isFlagged())
+                    findings << QString(" - %1: %2 (%3)").arg(name, QFile::decodeName(object.path),
+                                                             object.verdict.describe());
+            }
+            for (const QByteArray &note : process.notes)
+                findings << QString(" - %1: %2").arg(name, QString::fromUtf8(note));
+        }
+        processScanRunning = false;
+        if (periodic && findings == lastProcessFindings)
+            return;
+        lastProcessFindings = findings;
+
+        QStringList lines;
+        lines << QString("Проверка процессов: %1").arg(QTime::currentTime().toString("hh:mm:ss"))
+              << QString("Процессов: %1, нет доступа: %2").arg(stats.processes).arg(stats.inaccessible)
+              << QString("Исполняемых файлов: %1 (из кэша %2, прочитано %3)")
+                     .arg(stats.objects).arg(stats.cached).arg(done);
+        if (failed > 0)
+            lines << QString("Не удалось проверить: %1").arg(failed);
+        if (!processIsolated && !ScanWorkerPool::isDisabled())
+            lines << "Внимание: обработчики не запустились, файлы разобраны в процессе окна";
+        if (canceled)
+            lines << QString("Проверка прервана, не проверено: %1").arg(stats.pending - done);
+        lines << QString();
+        if (findings.isEmpty()) {
+            lines << "Подозрительных процессов не найдено.";
+        } else {
+            lines << "Подозрительные процессы (PID, имя):";
+            lines << findings;
+        }
+        fileViewer->setPlainText(lines.join("\n"));
+    }
+
+    // Точки монтирования и режим выбираются при каждом включении;
+    // находки дописываются в правое окно
+    void setOnAccessGuard(bool enabled) {
+        if (!enabled) {
+            if (!onAccessGuard || !onAccessGuard->isRunning())
+                return;
+            const OnAccessStats stats = onAccessGuard->stats();
+            onAccessGuard->stop();
+            fileViewer->append(QString("%1 Проверка при открытии выключена. Запросов: %2, из кэша: %3, "
+                                       "проверено: %4, запрещено: %5, разрешено по тайм-ауту: %6")
+                                   .arg(QTime::currentTime().toString("hh:mm:ss"))
+                                   .arg(stats.events).arg(stats.cached).arg(stats.scanned)
+                                   .arg(stats.denied).arg(stats.timedOut));
+            if (stats.cachedP99Us >= 0)
+                fileViewer->append(QString("Задержка из кэша: медиана %1 мкс, 99-й процентиль %2 мкс")
+                                       .arg(stats.cachedP50Us).arg(stats.cachedP99Us));
+            if (stats.scannedP99Us >= 0)
+                fileViewer->append(QString("Задержка с проверкой: медиана %1 мкс, 99-й процентиль %2 мкс")
+                                       .arg(stats.scannedP50Us).arg(stats.scannedP99Us));
+            return;
+        }
+
+        const QStringList mounts = OnAccessGuard::mountPoints();
+        QStringList checked = onAccessMounts;
+        if (checked.isEmpty())
+            checked << "/" << "/home" << "/tmp" << "/var/tmp" << "/dev/shm";
+        QDialog dialog(this);
+        dialog.setWindowTitle("Проверка при открытии файлов");
+        auto *layout = new QVBoxLayout(&dialog);
+        layout->addWidget(new QLabel("Точки монтирования:", &dialog));
+        auto *mountsView = new QTreeWidget(&dialog);
+        mountsView->setHeaderHidden(true);
+        for (const QString &mount : mounts) {
+            auto *item = new QTreeWidgetItem(mountsView, QStringList(mount));
+            item->setCheckState(0, checked.contains(mount) ? Qt::Checked : Qt::Unchecked);
+        }
+        layout->addWidget(mountsView);
+        auto *allOpens = new QCheckBox("Проверять любое открытие файла, а не только запуск программ", &dialog);
+        allOpens->setChecked(onAccessAllOpens);
+        layout->addWidget(allOpens);
+        auto *buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, &dialog);
+        layout->addWidget(buttons);
+        connect(buttons, &QDialogButtonBox::accepted, &dialog, &QDialog::accept);
+        connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+
+        QStringList selected;
+        if (dialog.exec() == QDialog::Accepted) {
+            for (int i = 0; i < mountsView->topLevelItemCount(); ++i) {
+                QTreeWidgetItem *item = mountsView->topLevelItem(i);
+                if (item->checkState(0) == Qt::Checked)
+                    selected << item->text(0);
+            }
+        }
+        QSignalBlocker blocker(actionOnAccess);
+        if (selected.isEmpty()) {
+            actionOnAccess->setChecked(false);
+            return;
+        }
+        onAccessMounts = selected;
+        onAccessAllOpens = allOpens->isChecked();
+
+        if (!onAccessGuard) {
+            onAccessGuard = new OnAccessGuard(this);
+            connect(onAccessGuard, &OnAccessGuard::fileFlagged, this,
+                    [this](const QString &path, int pid, const QString &description, bool blocked) {
+                        fileViewer->append(QString("%1 %2: %3 (PID %4): %5")
+                                               .arg(QTime::currentTime().toString("hh:mm:ss"),
+                                                    blocked ? "Открытие запрещено" : "Открыт до окончания проверки",
+                                                    path)
+                                               .arg(pid).arg(description));
+                    });
+            connect(onAccessGuard, &OnAccessGuard::failed, this, [this](const QString &error) {
+                onAccessGuard->stop();
+                QSignalBlocker blocker(actionOnAccess);
+                actionOnAccess->setChecked(false);
+                fileViewer->append(QString("%1 Проверка при открытии остановлена из-за ошибки: %2")
+                                       .arg(QTime::currentTime().toString("hh:mm:ss"), error));
+            });
+        }
+        QString error;
+        if (!onAccessGuard->start(selected, onAccessAllOpens ? OnAccessGuard::AllOpens : OnAccessGuard::ExecOnly,
+                                  &error)) {
+            actionOnAccess->setChecked(false);
+            QMessageBox::warning(this, "Ошибка", "Не удалось включить проверку при открытии:\n" + error);
+            return;
+        }
+        fileViewer->append(QString("%1 Проверка при открытии включена (%2): %3")
+                               .arg(QTime::currentTime().toString("hh:mm:ss"),
+                                    onAccessAllOpens ? "любое открытие" : "запуск программ",
+                                    selected.join(", ")));
+    }
+
     void readFile() {
         QString path = getSelectedFilePath();
         if (path.isEmpty()) {
@@ -373,35 +1183,29 @@ public slots:
             return;
         }
 
-        QFile file(path);
-        if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-            QMessageBox::warning(this, "Ошибка", "Не удалось открыть файл");
-            return;
-        }
-        QTextStream in(&file);
-        QString content = in.readAll();
-        file.close();
-
-        // Диалог с редактором
+        // Файл не читается целиком: редактор работает поверх отображения
+        // файла в память, несохраненные правки живут в таблице кусков
         QDialog dialog(this);
         dialog.setWindowTitle("Редактировать: " + path);
         auto *layout = new QVBoxLayout(&dialog);
-        auto *editor = new QTextEdit;
-        editor->setPlainText(content);
+        auto *editor = new PieceEditor;
+        QString error;
+        if (!editor->open(path, &error)) {
+            delete editor;
+            QMessageBox::warning(this, "Ошибка", "Не удалось открыть файл: " + error);
+            return;
+        }
         editor->setMinimumSize(800, 600);
         layout->addWidget(editor);
         auto *saveBtn = new QPushButton("Сохранить");
         layout->addWidget(saveBtn);
 
-        connect(saveBtn, &QPushButton::clicked, [&dialog, editor, path]() {
-            QFile saveFile(path);
-            if (!saveFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
-                QMessageBox::warning(&dialog, "Ошибка", "Не удалось сохранить");
+        connect(saveBtn, &QPushButton::clicked, [&dialog, editor]() {
+            QString saveError;
+            if (!editor->save(&saveError)) {
+                QMessageBox::warning(&dialog, "Ошибка", "Не удалось сохранить: " + saveError);
                 return;
             }
-            QTextStream out(&saveFile);
-            out << editor->toPlainText();
-            saveFile.close();
             QMessageBox::information(&dialog, "Готово", "Файл сохранен");
             dialog.accept();
         });
@@ -432,6 +1236,7 @@ public slots:
             return;
 
         if (QFile::remove(path)) {
+            ensureFsModel()->refresh(info.absolutePath());
             QMessageBox::information(this, "Удалено", "Файл удален");
             currentFilePath.clear();
             fileLabel->setText("Файл не выбран");
@@ -463,9 +1268,7 @@ public slots:
             QMessageBox::information(this, "Переименование", "Файл переименован");
             currentFilePath = newPath;
             fileLabel->setText("Выбран файл: " + newPath);
-            fsModel->setRootPath(QFileInfo(newPath).absolutePath());
-            QModelIndex idx = fsModel->index(newPath);
-            treeView->setCurrentIndex(idx);
+            ensureFsModel()->refresh(info.absolutePath());
             loadFileToViewer(newPath);
         } else {
             QMessageBox::warning(this, "Ошибка", "Не удалось переименовать");
@@ -488,6 +1291,7 @@ public slots:
         if (dest.isEmpty()) return;
 
         if (QFile::copy(path, dest)) {
+            ensureFsModel()->refresh(QFileInfo(dest).absolutePath());
             QMessageBox::information(this, "Копия", "Файл скопирован");
         } else {
             QMessageBox::warning(this, "Ошибка", "Не удалось скопировать");
@@ -495,131 +1299,243 @@ public slots:
     }
 
     void encryptFile() {
-        QString path = getSelectedFilePath();
-        if (path.isEmpty()) return;
+        runCipher(BatchCipher::Encrypt);
+    }
 
-        QFileInfo info(path);
-        if (!info.isFile()) {
-            QMessageBox::warning(this, "Ошибка", "Выберите файл для шифрования");
-            return;
-        }
+    void decryptFile() {
+        runCipher(BatchCipher::Decrypt);
+    }
 
-        QFile file(path);
-        if (!file.open(QIODevice::ReadOnly)) {
-            QMessageBox::warning(this, "Ошибка", "Не удалось открыть файл");
+    // Выделенные файлы и папки (или текущий файл) обрабатываются пулом
+    // потоков; ошибки по файлам собираются в правом окне, а не окнами
+    // сообщений на каждый файл
+    void runCipher(BatchCipher::Mode mode) {
+        const QStringList inputs = selectedPaths();
+        const bool encrypt = mode == BatchCipher::Encrypt;
+        if (inputs.isEmpty()) {
+            QMessageBox::warning(this, "Ошибка", encrypt ? "Выберите файлы или папку для шифрования"
+                                                         : "Выберите файлы или папку для расшифровки");
             return;
         }
 
-        QByteArray data = file.readAll();
-        file.close();
-
-        QByteArray key = "simplekey"; // простой XOR-ключ
-        QByteArray encrypted;
-        encrypted.reserve(data.size());
-        for (int i = 0; i < data.size(); ++i)
-            encrypted.append(data[i] ^ key[i % key.size()]);
+        QProgressDialog progress(encrypt ? "Шифрование..." : "Расшифровка...", "Отмена", 0, 0, this);
+        progress.setWindowModality(Qt::WindowModal);
+        progress.setMinimumDuration(500);
+
+        const double mb = 1024.0 * 1024.0;
+        BatchCipher cipher(mode);
+        const bool finished = cipher.run(inputs, [&](BatchCipher::Stage stage, qint64 done, qint64 total) {
+            if (stage == BatchCipher::Collecting) {
+                progress.setLabelText(QString("Поиск файлов: %1").arg(done));
+            } else {
+                progress.setLabelText(QString("Обработано %1 из %2 МБ")
+                                          .arg(done / mb, 0, 'f', 1)
+                                          .arg(total / mb, 0, 'f', 1));
+                progress.setMaximum(1000);
+                progress.setValue(total > 0 ? int(done * 1000 / total) : 0);
+            }
+            qApp->processEvents();
+            return !progress.wasCanceled();
+        });
+        progress.close();
+        // Результаты лежат рядом с исходными файлами
+        for (const QString &input : inputs) {
+            const QFileInfo info(input);
+            ensureFsModel()->refresh(info.absolutePath());
+            if (info.isDir())
+                fsModel->refresh(info.absoluteFilePath());
+        }
 
-        QString outPath = path + ".enc";
-        QFile outFile(outPath);
-        if (!outFile.open(QIODevice::WriteOnly)) {
-            QMessageBox::warning(this, "Ошибка", "Не удалось создать зашифрованный файл");
+        const CipherStats &stats = cipher.stats();
+        const QVector<CipherError> &errors = cipher.errors();
+        // Один выбранный файл - как раньше, сообщением с путем результата
+        if (finished && inputs.size() == 1 && stats.files == 1 && errors.isEmpty()
+            && QFileInfo(inputs.first()).isFile()) {
+            const QString outPath = QFile::decodeName(
+                cipher.outputPath(QFile::encodeName(QFileInfo(inputs.first()).absoluteFilePath())));
+            QMessageBox::information(this, encrypt ? "Зашифровано" : "Расшифровано",
+                                     QString(encrypt ? "Файл зашифрован в:\n%1" : "Файл расшифрован в:\n%1")
+                                         .arg(outPath));
             return;
         }
-        outFile.write(encrypted);
-        outFile.close();
 
-        QMessageBox::information(this,
-                                 "Зашифровано",
-                                 QString("Файл зашифрован в:\n%1").arg(outPath));
+        QStringList lines;
+        lines << (encrypt ? QString("Шифрование") : QString("Расшифровка"))
+                     + (finished ? QString() : QString(" прервано"))
+              << QString("Файлов: %1 (%2 МБ), обработано: %3")
+                     .arg(stats.files)
+                     .arg(stats.bytes / mb, 0, 'f', 2)
+                     .arg(stats.doneFiles - stats.failed)
+              << QString("Заданий пула: %1").arg(stats.tasks);
+        if (!errors.isEmpty()) {
+            lines << QString() << QString("Ошибки (%1):").arg(errors.size());
+            const int shown = qMin(errors.size(), MAX_SHOWN_CIPHER_ERRORS);
+            for (int i = 0; i < shown; ++i)
+                lines << QString("  %1: %2").arg(QFile::decodeName(errors[i].path), errors[i].message);
+            if (shown < errors.size())
+                lines << QString("  ... и еще: %1").arg(errors.size() - shown);
+        }
+        fileViewer->setPlainText(lines.join("\n"));
     }
 
-    void decryptFile() {
-        QString path = getSelectedFilePath();
-        if (path.isEmpty()) return;
-
-        QFileInfo info(path);
-        if (!info.isFile()) {
-            QMessageBox::warning(this, "Ошибка", "Выберите файл для расшифровки");
+    void checkFileSystem() {
+        if (folderPath.isEmpty()) {
+            QMessageBox::warning(this, "Ошибка", "Пожалуйста, выберите папку");
             return;
         }
+        showDiskUsage(false);
+    }
 
-        QFile file(path);
-        if (!file.open(QIODevice::ReadOnly)) {
-            QMessageBox::warning(this, "Ошибка", "Не удалось открыть файл");
+    // Дерево занятого места по каталогам. Прошлое дерево хранится в кэше,
+    // при повторной проверке перечитываются только измененные каталоги
+    void showDiskUsage(bool fullRescan) {
+        const QString cache = DiskUsageTree::cachePath(folderPath);
+        DiskUsageTree previous;
+        const bool incremental = !fullRescan && previous.load(cache);
+
+        QProgressDialog progress("Подсчет занятого места...", "Отмена", 0, 0, this);
+        progress.setWindowModality(Qt::WindowModal);
+        progress.setMinimumDuration(500);
+
+        DiskUsageTree tree;
+        const bool finished = tree.build(folderPath, incremental ? &previous : nullptr, [&](qint64 dirs) {
+            progress.setLabelText(QString("Проверено каталогов: %1").arg(dirs));
+            qApp->processEvents();
+            return !progress.wasCanceled();
+        });
+        progress.close();
+        if (!finished) {
+            if (!progress.wasCanceled())
+                QMessageBox::warning(this, "Ошибка", "Не удалось открыть папку");
             return;
         }
+        if (!tree.save(cache))
+            qWarning() << "Не удалось сохранить кэш дерева каталогов:" << cache;
 
-        QByteArray data = file.readAll();
-        file.close();
-
-        QByteArray key = "simplekey";
-        QByteArray decrypted;
-        decrypted.reserve(data.size());
-        for (int i = 0; i < data.size(); ++i)
-            decrypted.append(data[i] ^ key[i % key.size()]);
-
-        QString outPath = path;
-        if (outPath.endsWith(".enc"))
-            outPath.chop(4);
-        else
-            outPath += ".dec";
+        const DiskUsageNode &root = tree.node(0);
+        const double mb = 1024.0 * 1024.0;
+        QString infoText = QString(
+            "Папка: %1\n"
+            "Каталогов: %2\n"
+            "Файлов: %3\n"
+            "Общий размер файлов: %4 МБ\n"
+            "Занято на диске: %5 МБ\n"
+            "Каталогов прочитано: %6, взято из кэша: %7\n")
+                .arg(folderPath)
+                .arg(root.totalDirs)
+                .arg(root.totalFiles)
+                .arg(root.totalBytes / mb, 0, 'f', 2)
+                .arg(root.totalAllocated / mb, 0, 'f', 2)
+                .arg(tree.stats().dirsRead)
+                .arg(tree.stats().dirsReused);
+        if (tree.stats().errors > 0)
+            infoText += QString("Ошибок чтения: %1\n").arg(tree.stats().errors);
+        fileViewer->setPlainText(infoText);
 
-        QFile outFile(outPath);
-        if (!outFile.open(QIODevice::WriteOnly)) {
-            QMessageBox::warning(this, "Ошибка", "Не удалось создать расшифрованный файл");
-            return;
-        }
-        outFile.write(decrypted);
-        outFile.close();
+        QDialog dialog(this);
+        dialog.setWindowTitle("Занятое место: " + folderPath);
+        dialog.resize(800, 600);
+        auto *layout = new QVBoxLayout(&dialog);
+        auto *view = new QTreeWidget(&dialog);
+        view->setHeaderLabels(QStringList() << "Каталог" << "Размер, МБ" << "На диске, МБ"
+                                            << "Файлов" << "Каталогов");
+        view->setSortingEnabled(true);
+        layout->addWidget(view);
+        auto *buttons = new QDialogButtonBox(QDialogButtonBox::Close, &dialog);
+        QPushButton *rescan = buttons->addButton("Пересчитать полностью", QDialogButtonBox::ActionRole);
+        layout->addWidget(buttons);
+        connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+        connect(rescan, &QPushButton::clicked, &dialog, [&dialog] { dialog.done(RESCAN_RESULT); });
+
+        // Дочерние элементы создаются при раскрытии: в дереве могут быть
+        // сотни тысяч каталогов
+        auto addChildren = [&tree](QTreeWidgetItem *parent, int index) {
+            for (int child : tree.node(index).children)
+                parent->addChild(new DiskUsageItem(tree, child));
+        };
+        auto *rootItem = new DiskUsageItem(tree, 0);
+        view->addTopLevelItem(rootItem);
+        addChildren(rootItem, 0);
+        connect(view, &QTreeWidget::itemExpanded, &dialog, [&](QTreeWidgetItem *item) {
+            auto *duItem = static_cast<DiskUsageItem *>(item);
+            if (item->childCount() == 0 && !tree.node(duItem->index()).children.isEmpty())
+                addChildren(item, duItem->index());
+        });
+        view->sortByColumn(1, Qt::DescendingOrder);
+        rootItem->setExpanded(true);
+        view->resizeColumnToContents(0);
 
-        QMessageBox::information(this,
-                                 "Расшифровано",
-                                 QString("Файл расшифрован в:\n%1").arg(outPath));
+        if (dialog.exec() == RESCAN_RESULT)
+            showDiskUsage(true);
     }
 
-    void checkFileSystem() {
+    void findDuplicates() {
         if (folderPath.isEmpty()) {
             QMessageBox::warning(this, "Ошибка", "Пожалуйста, выберите папку");
             return;
         }
 
-        qint64 totalSize = 0;
-        int dirCount = 0;
-        int fileCount = 0;
-
-        QDirIterator it(folderPath,
-                        QDir::AllEntries | QDir::NoDotAndDotDot,
-                        QDirIterator::Subdirectories);
-        while (it.hasNext()) {
-            it.next();
-            QFileInfo info = it.fileInfo();
-            if (info.isDir())
-                ++dirCount;
-            else if (info.isFile()) {
-                ++fileCount;
-                totalSize += info.size();
+        QProgressDialog progress("Поиск дубликатов...", "Отмена", 0, 0, this);
+        progress.setWindowModality(Qt::WindowModal);
+        progress.setMinimumDuration(500);
+
+        DuplicateFinder finder(ExclusionRules::load());
+        const bool finished = finder.run(folderPath, [&](DuplicateFinder::Stage stage, qint64 done, qint64 total) {
+            switch (stage) {
+            case DuplicateFinder::Walking:
+                progress.setLabelText(QString("Обход: найдено файлов %1").arg(done));
+                break;
+            case DuplicateFinder::PartialHash:
+                progress.setLabelText(QString("Сравнение начала и конца: %1 из %2").arg(done).arg(total));
+                break;
+            case DuplicateFinder::FullHash:
+                progress.setLabelText(QString("Сравнение содержимого: %1 из %2").arg(done).arg(total));
+                break;
             }
+            qApp->processEvents();
+            return !progress.wasCanceled();
+        });
+        progress.close();
+        if (!finished) {
+            fileViewer->setPlainText("Поиск дубликатов прерван");
+            return;
         }
 
-        double sizeMb = totalSize / 1024.0 / 1024.0;
-
-        QString infoText = QString(
-            "Папка: %1\n"
-            "Каталогов: %2\n"
-            "Файлов: %3\n"
-            "Общий размер файлов: %4 МБ\n")
-                .arg(folderPath)
-                .arg(dirCount)
-                .arg(fileCount)
-                .arg(sizeMb, 0, 'f', 2);
-
-        fileViewer->setPlainText(infoText);
-        QMessageBox::information(this,
-                                 "Проверка ФС",
-                                 "Информация по файловой системе выведена в правое окно.");
+        const DuplicateStats &stats = finder.stats();
+        const double mb = 1024.0 * 1024.0;
+        QStringList lines;
+        lines << QString("Папка: %1").arg(folderPath)
+              << QString("Файлов: %1, общий размер %2 МБ").arg(stats.files).arg(stats.totalBytes / mb, 0, 'f', 2)
+              << QString("Наборов дубликатов: %1").arg(finder.sets().size())
+              << QString("Можно освободить: %1 МБ").arg(finder.reclaimable() / mb, 0, 'f', 2)
+              << QString("Прочитано: %1 МБ (кандидатов по размеру %2, прочитано целиком %3)")
+                     .arg(stats.bytesRead / mb, 0, 'f', 2)
+                     .arg(stats.sizeCandidates)
+                     .arg(stats.fullyHashed);
+        if (stats.hardLinks > 0)
+            lines << QString("Жестких ссылок на один файл (не учитываются): %1").arg(stats.hardLinks);
+        if (stats.errors > 0)
+            lines << QString("Ошибок чтения: %1").arg(stats.errors);
+
+        // Окно не рассчитано на миллионы строк: показываем крупнейшие наборы
+        const int shown = qMin(finder.sets().size(), MAX_SHOWN_DUPLICATE_SETS);
+        for (int i = 0; i < shown; ++i) {
+            const DuplicateSet &set = finder.sets()[i];
+            lines << QString() << QString("%1 копии по %2 байт, освободится %3 МБ:")
+                                      .arg(set.paths.size())
+                                      .arg(set.size)
+                                      .arg(set.reclaimable() / mb, 0, 'f', 2);
+            for (const QByteArray &path : set.paths)
+                lines << "  " + QFile::decodeName(path);
+        }
+        if (shown < finder.sets().size())
+            lines << QString() << QString("... и еще наборов: %1").arg(finder.sets().size() - shown);
+        fileViewer->setPlainText(lines.join("\n"));
     }
 
     void treeItemClicked(const QModelIndex &index) {
+        if (!fsModel)
+            return;
         QString path = fsModel->filePath(index);
         currentFilePath = path;
 
@@ -635,18 +1551,260 @@ public slots:
             fileViewer->clear();
     }
 
+    void editExclusions() {
+        bool ok = false;
+        QString text = QInputDialog::getMultiLineText(
+            this,
+            "Исключения",
+            "Правила исключения (glob, path:/префикс, size:>размер, fstype:тип).\n"
+            "В любом каталоге можно положить файл .fortiignore.",
+            ExclusionRules::loadText(),
+            &ok);
+        if (!ok)
+            return;
+        if (!ExclusionRules::save(text))
+            QMessageBox::warning(this, "Ошибка", "Не удалось сохранить правила исключения");
+    }
+
+    void editLargeFilePolicy() {
+        bool ok = false;
+        QString text = QInputDialog::getMultiLineText(
+            this,
+            "Крупные файлы",
+            "Что читать у крупных файлов: расширения, порог, режим\n"
+            "(full, headtail:окно, stride:шаг:блок, structure:окно), full-every:дней.",
+            LargeFilePolicy::loadText(),
+            &ok);
+        if (!ok)
+            return;
+        if (!LargeFilePolicy::save(text))
+            QMessageBox::warning(this, "Ошибка", "Не удалось сохранить политику крупных файлов");
+    }
+
+    void openRulesDirectory() {
+        const QString dir = CompiledRules::rulesDirectory();
+        QDir().mkpath(dir);
+        QStringList errors;
+        const QSharedPointer<const CompiledRules> rules = CompiledRules::installed(&errors);
+        QString text = QString("Каталог правил: %1\nФайлы *.rule, *.yar. Загружено правил: %2")
+                           .arg(dir)
+                           .arg(rules->rules.size());
+        if (!errors.isEmpty())
+            text += "\n\nОшибки:\n" + errors.join("\n");
+        fileViewer->setPlainText(text);
+        QDesktopServices::openUrl(QUrl::fromLocalFile(dir));
+    }
+
+    // Все, от чего зависят вердикты сканирования папки: исключения,
+    // правила, индекс образцов, политика крупных файлов, детекторы и
+    // .fortiignore корня. Журнал прерванного сканирования продолжается,
+    // только если ничего из этого не менялось
+    static QByteArray scanConfigKey(const QString &root, const CompiledRules &rules) {
+        QByteArray key = ExclusionRules::loadText().toUtf8();
+        auto add = [&key](const QByteArray &part) {
+            key += '\0';
+            key += part;
+        };
+        add(rules.sourceKey);
+        const QFileInfo index(SimilarityIndex::defaultPath());
+        add(index.exists() ? QByteArray::number(index.size()) + ' '
+                                 + QByteArray::number(index.lastModified().toMSecsSinceEpoch())
+                           : QByteArray());
+        add(LargeFilePolicy::isDisabled() ? QByteArray() : LargeFilePolicy::loadText().toUtf8());
+        for (DetectorFactory *factory : DetectorRegistry::installed())
+            add(factory->name().toUtf8());
+        QFile ignore(QDir(root).filePath(".fortiignore"));
+        add(ignore.open(QIODevice::ReadOnly) ? ignore.readAll() : QByteArray());
+        return key;
+    }
+
+    // Самые медленные детекторы - первыми
+    static QStringList describeDetectorTimings(QVector<DetectorTiming> timings) {
+        std::sort(timings.begin(), timings.end(), [](const DetectorTiming &a, const DetectorTiming &b) {
+            return a.nanoseconds > b.nanoseconds;
+        });
+        QStringList lines;
+        for (const DetectorTiming &timing : timings) {
+            const double ms = timing.nanoseconds / 1e6;
+            lines << QString("%1: файлов %2, %3 мс (%4 мкс на файл)")
+                         .arg(timing.name)
+                         .arg(timing.files)
+                         .arg(ms, 0, 'f', 1)
+                         .arg(timing.files > 0 ? timing.nanoseconds / 1e3 / timing.files : 0.0, 0, 'f', 1);
+        }
+        return lines;
+    }
+
+    void openDetectorsDirectory() {
+        const QString dir = DetectorRegistry::pluginsDirectory();
+        QDir().mkpath(dir);
+        QStringList errors;
+        const QVector<DetectorFactory *> &detectors = DetectorRegistry::installed(&errors);
+        QStringList lines;
+        lines << QString("Каталог детекторов: %1").arg(dir)
+              << QString("Плагины Qt с интерфейсом %1 (detectorplugin.h). Загружено: %2")
+                     .arg(DetectorFactory_iid).arg(detectors.size());
+        for (DetectorFactory *factory : detectors)
+            lines << "   " + factory->name();
+        if (!errors.isEmpty())
+            lines << QString() << "Ошибки:" << errors;
+        if (!lastDetectorTimings.isEmpty())
+            lines << QString() << "Время последнего сканирования:" << describeDetectorTimings(lastDetectorTimings);
+        lines << QString() << "Новые детекторы подключаются после перезапуска программы.";
+        fileViewer->setPlainText(lines.join("\n"));
+        QDesktopServices::openUrl(QUrl::fromLocalFile(dir));
+    }
+
+    // Индекс строится по каталогу с образцами: семейство - имя подкаталога
+    // первого уровня, для файлов в корне - имя файла
+    void buildSimilarityIndex() {
+        const QString dir = QFileDialog::getExistingDirectory(this, "Каталог с образцами");
+        if (dir.isEmpty())
+            return;
+
+        QProgressDialog progress("Построение индекса...", "Отмена", 0, 0, this);
+        progress.setWindowModality(Qt::WindowModal);
+        progress.setMinimumDuration(500);
+
+        const QByteArray root = QFile::encodeName(QDir(dir).absolutePath()) + '/';
+        SimilarityIndexWriter writer;
+        int files = 0;
+        bool canceled = false;
+        FileWalker walker;
+        walker.walk(dir, [&](const WalkEntry &entry) {
+            const SimilarityDigest digest = SimilarityDigestBuilder::digestFile(entry.path);
+            const QByteArray relative = entry.path.mid(root.size());
+            const int slash = relative.indexOf('/');
+            writer.add(digest, QFile::decodeName(slash > 0 ? relative.left(slash) : relative));
+
+            if (++files % 50 == 0) {
+                progress.setLabelText(QString("Обработано образцов: %1").arg(files));
+                qApp->processEvents();
+                if (progress.wasCanceled()) {
+                    canceled = true;
+                    return false;
+                }
+            }
+            return true;
+        });
+        progress.close();
+        if (canceled)
+            return;
+
+        QString error;
+        if (!writer.write(SimilarityIndex::defaultPath(), &error)) {
+            QMessageBox::warning(this, "Ошибка", "Не удалось сохранить индекс: " + error);
+            return;
+        }
+        fileViewer->setPlainText(QString("Индекс похожих образцов: %1\nОбразцов: %2 (пропущено коротких или однородных: %3)")
+                                     .arg(SimilarityIndex::defaultPath())
+                                     .arg(writer.size())
+                                     .arg(files - writer.size()));
+    }
+
+    void compareReports() {
+        const QString filter = "Отчеты сканирования (*.fsr)";
+        const QString beforePath = QFileDialog::getOpenFileName(
+            this, "Предыдущий отчет", ScanReport::defaultDirectory(), filter);
+        if (beforePath.isEmpty())
+            return;
+        const QString afterPath = QFileDialog::getOpenFileName(
+            this, "Новый отчет", QFileInfo(beforePath).absolutePath(), filter);
+        if (afterPath.isEmpty())
+            return;
+
+        ScanReport before;
+        ScanReport after;
+        QString error;
+        if (!before.open(beforePath, &error) || !after.open(afterPath, &error)) {
+            QMessageBox::warning(this, "Ошибка", "Не удалось открыть отчет: " + error);
+            return;
+        }
+
+        QStringList added;
+        QStringList removed;
+        QStringList changed;
+        ReportDiff::compare(before, after, [&](ReportDiff::Kind kind,
+                                               const ScanReport::Entry *was,
+                                               const ScanReport::Entry *now) {
+            const QString path = QFile::decodeName(now ? now->path : was->path);
+            switch (kind) {
+            case ReportDiff::NewDetection:
+                added << QString("%1 (%2)").arg(path, now->describe());
+                break;
+            case ReportDiff::RemovedDetection:
+                removed << path;
+                break;
+            case ReportDiff::ChangedDetection:
+                changed << QString("%1 (%2 -> %3)").arg(path, was->describe(), now->describe());
+                break;
+            }
+        });
+
+        fileViewer->clear();
+        fileViewer->append(QString("Сравнение отчетов:\n  %1\n  %2\n").arg(beforePath, afterPath));
+        fileViewer->append(QString("Файлов: %1 -> %2").arg(before.count()).arg(after.count()));
+        fileViewer->append(QString("Новых находок: %1, исчезло: %2, изменилось: %3\n")
+                               .arg(added.size())
+                               .arg(removed.size())
+                               .arg(changed.size()));
+        for (const QString &f : added)
+            fileViewer->append(" + " + f);
+        for (const QString &f : removed)
+            fileViewer->append(" - " + f);
+        for (const QString &f : changed)
+            fileViewer->append(" * " + f);
+    }
+
+    void exportReport() {
+        const QString reportPath = QFileDialog::getOpenFileName(
+            this, "Отчет для экспорта", ScanReport::defaultDirectory(),
+            "Отчеты сканирования (*.fsr)");
+        if (reportPath.isEmpty())
+            return;
+        const QString outPath = QFileDialog::getSaveFileName(
+            this, "Экспорт отчета", QFileInfo(reportPath).completeBaseName() + ".json",
+            "JSON (*.json);;CSV (*.csv)");
+        if (outPath.isEmpty())
+            return;
+
+        ScanReport source;
+        QString error;
+        if (!source.open(reportPath, &error)
+            || !ReportExporter::exportTo(source, outPath, ReportExporter::formatForFile(outPath), &error)) {
+            QMessageBox::warning(this, "Ошибка", "Не удалось экспортировать отчет: " + error);
+            return;
+        }
+        QMessageBox::information(this, "Экспорт", "Отчет сохранен в " + outPath);
+    }
+
     void openDownloadPage() {
         QDesktopServices::openUrl(
             QUrl("https://github.com/kion85/Forti/releases/latest"));
     }
 
     // Вспомогательные функции
+    // Выделенные в дереве пути; без выделения - текущий файл
+    QStringList selectedPaths() const {
+        QStringList paths;
+        if (fsModel && treeView->selectionModel()) {
+            for (const QModelIndex &index : treeView->selectionModel()->selectedRows())
+                paths << fsModel->filePath(index);
+        }
+        if (paths.isEmpty()) {
+            const QString path = getSelectedFilePath();
+            if (!path.isEmpty())
+                paths << path;
+        }
+        return paths;
+    }
+
     QString getSelectedFilePath() const {
         if (!currentFilePath.isEmpty())
             return currentFilePath;
 
         QModelIndex index = treeView->currentIndex();
-        if (index.isValid())
+        if (fsModel && index.isValid())
             return fsModel->filePath(index);
 
         return QString();
@@ -684,9 +1842,9 @@ public slots:
             QMessageBox::warning(this, "Ошибка", "Не удалось открыть файл для анализа");
             return;
         }
-        QTextStream in(&file);
-        QString content = in.readAll();
+        const QByteArray raw = file.readAll();
         file.close();
+        QString content = QString::fromLocal8Bit(raw);
 
         int letterCount = content.count(QRegularExpression("[A-Za-zА-Яа-яЁё]"));
         int wordCount = content.split(QRegularExpression("\\W+"), Qt::SkipEmptyParts).count();
@@ -709,22 +1867,24 @@ public slots:
             language = "Не определен";
         }
 
-        QStringList commonWords = {"if", "for", "while", "return", "class", "def", "import", "public", "private", "void", "function"};
-        int strangeWordsCount = 0;
-        QStringList words = content.split(QRegularExpression("\\W+"), Qt::SkipEmptyParts);
-        for (const QString &w : words) {
-            if (!commonWords.contains(w) && w.length() > 3 && !w.contains(QRegularExpression("[0-9]"))) {
-                strangeWordsCount++;
-            }
+        // Те же эвристики сценариев, что при сканировании
+        QString obfuscation = "не сценарий";
+        ScriptAnalyzer::Syntax syntax;
+        const uchar *data = reinterpret_cast<const uchar *>(raw.constData());
+        if (ScriptAnalyzer::syntaxFor(ext.toUtf8(), data, raw.size(), &syntax)) {
+            ScriptAnalyzer analyzer;
+            analyzer.reset(syntax);
+            analyzer.feed(data, raw.size());
+            obfuscation = QString::fromUtf8(analyzer.finish().describe());
         }
 
         QMessageBox msgBox(this);
         msgBox.setWindowTitle("Анализ файла");
-        QString text = QString("Количество букв: %1\nКоличество слов: %2\nЯзык: %3\nСтранных слов: %4")
+        QString text = QString("Количество букв: %1\nКоличество слов: %2\nЯзык: %3\nСценарий: %4")
                         .arg(letterCount)
                         .arg(wordCount)
                         .arg(language)
-                        .arg(strangeWordsCount);
+                        .arg(obfuscation);
         msgBox.setText(text);
         msgBox.exec();
     }
@@ -734,10 +1894,25 @@ public slots:
 
 int main(int argc, char *argv[])
 {
+    // Процесс-обработчик сканирования работает без GUI
+    if (argc == 3 && qstrcmp(argv[1], SCAN_WORKER_ARG) == 0) {
+        // Имя приложения задает пути к кэшу правил
+        QCoreApplication::setApplicationName("FortiScan");
+        return runScanWorker(QString::fromLocal8Bit(argv[2]));
+    }
+    if (argc == 3 && qstrcmp(argv[1], SCAN_BENCHMARK_ARG) == 0) {
+        QCoreApplication app(argc, argv);
+        app.setApplicationName("FortiScan");
+        return runScanBenchmark(QString::fromLocal8Bit(argv[2]));
+    }
+
+    StartupTrace::instance().start();
     QApplication app(argc, argv);
     app.setApplicationName("FortiScan");
     app.setApplicationVersion("v1.0.6");
+    StartupTrace::instance().mark("application");
     FortiScan window;
     window.show();
+    StartupTrace::instance().mark("show");
     return app.exec();
 }
@@ -5,4 +5,68 @@ CONFIG += c++14
 TARGET = myproject
 TEMPLATE = app
 
-SOURCES += main.cpp
+SOURCES += main.cpp \
+           batchcipher.cpp \
+           detectorregistry.cpp \
+           diskusage.cpp \
+           duplicatefinder.cpp \
+           exclusionrules.cpp \
+           filescanner.cpp \
+           filetreemodel.cpp \
+           filewalker.cpp \
+           largefilepolicy.cpp \
+           mailscanner.cpp \
+           onaccessguard.cpp \
+           packageallowlist.cpp \
+           pathpool.cpp \
+           pieceeditor.cpp \
+           piecetable.cpp \
+           processscanner.cpp \
+           resultring.cpp \
+           rulecompiler.cpp \
+           rulematcher.cpp \
+           scanbenchmark.cpp \
+           scancheckpoint.cpp \
+           scanpriority.cpp \
+           scanqueue.cpp \
+           scanreport.cpp \
+           scanworker.cpp \
+           scanworkerpool.cpp \
+           scriptanalyzer.cpp \
+           similaritydigest.cpp \
+           similarityindex.cpp \
+           sparsereader.cpp \
+           startuptrace.cpp
+
+HEADERS += batchcipher.h \
+           detectorplugin.h \
+           detectorregistry.h \
+           diskusage.h \
+           duplicatefinder.h \
+           exclusionrules.h \
+           filescanner.h \
+           filetreemodel.h \
+           filewalker.h \
+           largefilepolicy.h \
+           mailscanner.h \
+           onaccessguard.h \
+           packageallowlist.h \
+           pathpool.h \
+           pieceeditor.h \
+           piecetable.h \
+           processscanner.h \
+           resultring.h \
+           rulecompiler.h \
+           rulematcher.h \
+           scanbenchmark.h \
+           scancheckpoint.h \
+           scanpriority.h \
+           scanqueue.h \
+           scanreport.h \
+           scanworker.h \
+           scanworkerpool.h \
+           scriptanalyzer.h \
+           similaritydigest.h \
+           similarityindex.h \
+           sparsereader.h \
+           startuptrace.h
@@ -0,0 +1,674 @@
+#include "onaccessguard.h"
+
+#include <QAtomicInteger>
+#include <QDebug>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QQueue>
+#include <QReadWriteLock>
+#include <QSharedPointer>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include <algorithm>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "filescanner.h"
+#include "packageallowlist.h"
+#include "rulecompiler.h"
+#include "similarityindex.h"
+
+namespace {
+
+const int DEFAULT_TIMEOUT_MS = 250;
+// Очередь на проверку длиннее этого - открытие разрешается сразу
+const int MAX_QUEUED_SCANS = 4096;
+// Кэш больше этого очищается целиком
+const int MAX_CACHED_VERDICTS = 256 * 1024;
+const int EVENT_BUFFER = 64 * 1024;
+
+// Файловые системы без обычных файлов
+const char *const PSEUDO_FILESYSTEMS[] = {
+    "proc", "sysfs", "devtmpfs", "devpts", "cgroup", "cgroup2", "mqueue", "debugfs",
+    "tracefs", "securityfs", "pstore", "bpf", "autofs", "configfs", "fusectl",
+    "hugetlbfs", "binfmt_misc", "efivarfs", "nsfs", "rpc_pipefs", "selinuxfs"
+};
+
+qint64 nanoseconds(const struct timespec &ts)
+{
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+qint64 nowUs()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Программа процесса по /proc/PID/exe: (dev, inode), (0, 0) - недоступна
+QPair<quint64, quint64> executableOf(const char *pid)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/proc/%s/exe", pid);
+    struct stat st;
+    if (::stat(name, &st) != 0)
+        return qMakePair(quint64(0), quint64(0));
+    return qMakePair(quint64(st.st_dev), quint64(st.st_ino));
+}
+
+// Путь в /proc/self/mounts: пробелы и спецсимволы записаны как \ooo
+QByteArray unescapeMountPath(const QByteArray &path)
+{
+    QByteArray out;
+    out.reserve(path.size());
+    for (int i = 0; i < path.size(); ++i) {
+        if (path.at(i) == '\\' && i + 3 < path.size()) {
+            out.append(char((path.at(i + 1) - '0') * 64 + (path.at(i + 2) - '0') * 8
+                            + (path.at(i + 3) - '0')));
+            i += 3;
+        } else {
+            out.append(path.at(i));
+        }
+    }
+    return out;
+}
+
+// Гистограмма задержек: по 1 мкс до 256 мкс, дальше по степеням двойки.
+// Пишут несколько потоков без блокировок
+class LatencyHistogram {
+public:
+    void add(qint64 us)
+    {
+        int index;
+        if (us < Linear) {
+            index = int(qMax<qint64>(us, 0));
+        } else {
+            index = Linear;
+            for (qint64 bound = Linear * 2; us >= bound && index < Buckets - 1; bound *= 2)
+                ++index;
+        }
+        m_counts[index].fetchAndAddRelaxed(1);
+    }
+
+    // Верхняя граница корзины, в которую попал процентиль
+    qint64 percentile(int percent) const
+    {
+        quint64 total = 0;
+        for (int i = 0; i < Buckets; ++i)
+            total += m_counts[i].loadRelaxed();
+        if (total == 0)
+            return -1;
+        const quint64 rank = (total * quint64(percent) + 99) / 100;
+        quint64 seen = 0;
+        for (int i = 0; i < Buckets; ++i) {
+            seen += m_counts[i].loadRelaxed();
+            if (seen >= rank)
+                return i < Linear ? i + 1 : qint64(Linear) << (i - Linear + 1);
+        }
+        return qint64(Linear) << (Buckets - Linear);
+    }
+
+private:
+    static const int Linear = 256;
+    static const int Buckets = Linear + 24;
+    QAtomicInteger<quint32> m_counts[Buckets];
+};
+
+} // namespace
+
+struct OnAccessGuard::Engine {
+    typedef QPair<quint64, quint64> Key;  // dev, inode
+
+    struct CacheEntry {
+        qint64 size;
+        qint64 mtimeNs;
+        bool deny;
+    };
+
+    // Файл, который сейчас проверяют; modified - пришло событие изменения
+    struct ScanState {
+        int count;
+        bool modified;
+    };
+
+    struct Request {
+        int fd;
+        int pid;
+        quint64 seq;
+        qint64 startUs;
+        Key key;
+        qint64 size;
+        qint64 mtimeNs;
+    };
+
+    // Событие без ответа; номер отличает повторно выданный ядром дескриптор
+    struct Pending {
+        quint64 seq;
+        bool answered;
+    };
+
+    struct Deadline {
+        qint64 us;
+        int fd;
+        quint64 seq;
+    };
+
+    OnAccessGuard *owner = nullptr;
+    int fan = -1;
+    int wake = -1;
+    quint64 permissionMask = 0;
+    int timeoutMs = DEFAULT_TIMEOUT_MS;
+    int self = 0;
+    Key selfExecutable;
+
+    QSharedPointer<const CompiledRules> rules;
+    QSharedPointer<const SimilarityIndex> similarity;
+    QSharedPointer<const PackageAllowlist> packages;
+    QSharedPointer<const LargeFilePolicy> largeFiles;
+
+    // Кэш читает поток событий на каждом открытии, пишут редко
+    QReadWriteLock cacheLock;
+    QHash<Key, CacheEntry> cache;
+    QHash<Key, ScanState> scanning;
+
+    QMutex mutex;
+    QWaitCondition work;
+    QQueue<Request> queue;
+    QHash<int, Pending> pending;
+    QQueue<Deadline> deadlines;  // сроки идут по возрастанию: тайм-аут один
+    quint64 nextSeq = 0;
+    bool stopping = false;
+    QAtomicInt failed;  // поток событий остановился из-за ошибки
+
+    QAtomicInteger<quint64> events;
+    QAtomicInteger<quint64> cached;
+    QAtomicInteger<quint64> scanned;
+    QAtomicInteger<quint64> skipped;
+    QAtomicInteger<quint64> denied;
+    QAtomicInteger<quint64> timedOut;
+    QAtomicInteger<quint64> invalidated;
+    LatencyHistogram cachedLatency;
+    LatencyHistogram scannedLatency;
+
+    QThreadPool threads;
+
+    ~Engine()
+    {
+        if (fan >= 0)
+            ::close(fan);
+        if (wake >= 0)
+            ::close(wake);
+    }
+
+    // После fail() дескриптора fanotify нет: отвечать некому
+    void respond(int fd, quint32 response)
+    {
+        if (fan < 0)
+            return;
+        struct fanotify_response r;
+        r.fd = fd;
+        r.response = response;
+        if (::write(fan, &r, sizeof(r)) != ssize_t(sizeof(r)))
+            qWarning() << "fanotify: не удалось ответить ядру:" << strerror(errno);
+    }
+
+    void readEvents();
+    void fail(const QString &reason, const struct fanotify_event_metadata *event, ssize_t left);
+    void handle(const struct fanotify_event_metadata *event, qint64 startUs);
+    void invalidate(int fd);
+    int expire();
+    void scanLoop();
+    void finish(const Request &request, const QByteArray &path, const ScanVerdict &verdict,
+                bool cacheable);
+};
+
+void OnAccessGuard::Engine::readEvents()
+{
+    alignas(struct fanotify_event_metadata) char buffer[EVENT_BUFFER];
+    struct pollfd fds[2];
+    fds[0].fd = fan;
+    fds[0].events = POLLIN;
+    fds[1].fd = wake;
+    fds[1].events = POLLIN;
+    for (;;) {
+        const int wait = expire();
+        if (::poll(fds, 2, wait) < 0 && errno != EINTR) {
+            fail(QString("poll: %1").arg(strerror(errno)), nullptr, 0);
+            return;
+        }
+        if (fds[1].revents & POLLIN)
+            return;
+        if (!(fds[0].revents & POLLIN))
+            continue;
+        for (;;) {
+            ssize_t got = ::read(fan, buffer, sizeof(buffer));
+            if (got <= 0)
+                break;
+            const qint64 startUs = nowUs();
+            const struct fanotify_event_metadata *event =
+                reinterpret_cast<const struct fanotify_event_metadata *>(buffer);
+            for (; FAN_EVENT_OK(event, got); event = FAN_EVENT_NEXT(event, got)) {
+                if (event->vers != FANOTIFY_METADATA_VERSION) {
+                    fail(QString("неизвестная версия событий %1").arg(event->vers), event, got);
+                    return;
+                }
+                handle(event, startUs);
+            }
+        }
+    }
+}
+
+// Поток событий больше не может отвечать: все, что ждет ответа, и
+// оставшиеся в буфере события разрешаются, дескриптор fanotify
+// закрывается, и ядро само разрешает то, что еще не прочитано. Иначе
+// открытия на отмеченных точках монтирования ждали бы вечно
+void OnAccessGuard::Engine::fail(const QString &reason,
+                                 const struct fanotify_event_metadata *event, ssize_t left)
+{
+    qWarning() << "fanotify:" << reason;
+    for (; FAN_EVENT_OK(event, left); event = FAN_EVENT_NEXT(event, left)) {
+        if (event->fd < 0)
+            continue;
+        if (event->mask & permissionMask)
+            respond(event->fd, FAN_ALLOW);
+        ::close(event->fd);
+    }
+    {
+        QMutexLocker lock(&mutex);
+        for (auto it = pending.begin(); it != pending.end(); ++it) {
+            if (!it.value().answered) {
+                respond(it.key(), FAN_ALLOW);
+                it.value().answered = true;
+            }
+        }
+        deadlines.clear();
+        ::close(fan);
+        fan = -1;
+        stopping = true;
+        work.wakeAll();
+    }
+    failed.storeRelaxed(1);
+
+    OnAccessGuard *guard = owner;
+    QMetaObject::invokeMethod(guard, [guard, reason] {
+        emit guard->failed(reason);
+    }, Qt::QueuedConnection);
+}
+
+void OnAccessGuard::Engine::handle(const struct fanotify_event_metadata *event, qint64 startUs)
+{
+    // Потерянные события изменения - кэшу больше нельзя верить
+    if (event->mask & FAN_Q_OVERFLOW) {
+        QWriteLocker lock(&cacheLock);
+        invalidated.fetchAndAddRelaxed(quint64(cache.size()));
+        cache.clear();
+        for (auto it = scanning.begin(); it != scanning.end(); ++it)
+            it.value().modified = true;
+    }
+    const int fd = event->fd;
+    if (fd < 0)
+        return;
+    if (event->mask & FAN_MODIFY)
+        invalidate(fd);
+    if (!(event->mask & permissionMask)) {
+        ::close(fd);
+        return;
+    }
+
+    events.fetchAndAddRelaxed(1);
+    struct stat st;
+    if (event->pid == self || ::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        respond(fd, FAN_ALLOW);
+        ::close(fd);
+        skipped.fetchAndAddRelaxed(1);
+        return;
+    }
+
+    const Key key(quint64(st.st_dev), quint64(st.st_ino));
+    const qint64 mtimeNs = nanoseconds(st.st_mtim);
+    {
+        QReadLocker lock(&cacheLock);
+        auto it = cache.constFind(key);
+        if (it != cache.constEnd() && it.value().size == qint64(st.st_size)
+            && it.value().mtimeNs == mtimeNs) {
+            const bool deny = it.value().deny;
+            lock.unlock();
+            respond(fd, deny ? FAN_DENY : FAN_ALLOW);
+            ::close(fd);
+            cached.fetchAndAddRelaxed(1);
+            if (deny)
+                denied.fetchAndAddRelaxed(1);
+            cachedLatency.add(nowUs() - startUs);
+            return;
+        }
+    }
+
+    QMutexLocker lock(&mutex);
+    if (queue.size() >= MAX_QUEUED_SCANS) {
+        lock.unlock();
+        respond(fd, FAN_ALLOW);
+        ::close(fd);
+        skipped.fetchAndAddRelaxed(1);
+        return;
+    }
+    const Request request{ fd, int(event->pid), ++nextSeq, startUs, key, qint64(st.st_size), mtimeNs };
+    pending.insert(fd, Pending{ request.seq, false });
+    deadlines.enqueue(Deadline{ startUs + qint64(timeoutMs) * 1000, fd, request.seq });
+    queue.enqueue(request);
+    work.wakeOne();
+}
+
+void OnAccessGuard::Engine::invalidate(int fd)
+{
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+        return;
+    const Key key(quint64(st.st_dev), quint64(st.st_ino));
+    {
+        // Изменения обычно касаются файлов, которых нет в кэше
+        QReadLocker lock(&cacheLock);
+        if (!cache.contains(key) && !scanning.contains(key))
+            return;
+    }
+    QWriteLocker lock(&cacheLock);
+    if (cache.remove(key) > 0)
+        invalidated.fetchAndAddRelaxed(1);
+    auto it = scanning.find(key);
+    if (it != scanning.end())
+        it.value().modified = true;
+}
+
+// Разрешает просроченные события; возвращает, сколько мс ждать до
+// следующего срока (-1 - сроков нет)
+int OnAccessGuard::Engine::expire()
+{
+    QMutexLocker lock(&mutex);
+    const qint64 now = nowUs();
+    while (!deadlines.isEmpty() && deadlines.head().us <= now) {
+        const Deadline deadline = deadlines.dequeue();
+        auto it = pending.find(deadline.fd);
+        if (it == pending.end() || it.value().seq != deadline.seq || it.value().answered)
+            continue;
+        respond(deadline.fd, FAN_ALLOW);
+        it.value().answered = true;
+        timedOut.fetchAndAddRelaxed(1);
+    }
+    if (deadlines.isEmpty())
+        return -1;
+    return int((deadlines.head().us - now + 999) / 1000);
+}
+
+void OnAccessGuard::Engine::scanLoop()
+{
+    FileScanner scanner(rules, similarity, packages, DetectorRegistry::installed());
+    // Открытие ждет вердикта: крупные файлы только по политике, без
+    // полных проверок по расписанию
+    scanner.setLargeFilePolicy(largeFiles);
+    for (;;) {
+        Request request;
+        {
+            QMutexLocker lock(&mutex);
+            while (queue.isEmpty() && !stopping)
+                work.wait(&mutex);
+            if (stopping)
+                return;
+            request = queue.dequeue();
+        }
+
+        // Файлы читают процессы-обработчики ручного сканирования: проверять
+        // их второй раз незачем
+        char pid[16];
+        snprintf(pid, sizeof(pid), "%d", request.pid);
+        if (executableOf(pid) == selfExecutable) {
+            skipped.fetchAndAddRelaxed(1);
+            finish(request, QByteArray(), ScanVerdict(), false);
+            continue;
+        }
+
+        char link[64];
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", request.fd);
+        char target[4096];
+        const ssize_t length = ::readlink(link, target, sizeof(target));
+        const QByteArray path = length > 0 ? QByteArray(target, int(length)) : QByteArray();
+
+        {
+            QWriteLocker lock(&cacheLock);
+            auto it = scanning.find(request.key);
+            if (it == scanning.end())
+                scanning.insert(request.key, ScanState{ 1, false });
+            else
+                ++it.value().count;
+        }
+        const ScanVerdict verdict = scanner.scan(path, request.fd);
+        bool modified;
+        {
+            QWriteLocker lock(&cacheLock);
+            auto it = scanning.find(request.key);
+            modified = it.value().modified;
+            if (--it.value().count == 0)
+                scanning.erase(it);
+        }
+        scanned.fetchAndAddRelaxed(1);
+        finish(request, path, verdict, !modified && verdict.level != ScanVerdict::Failed);
+    }
+}
+
+void OnAccessGuard::Engine::finish(const Request &request, const QByteArray &path,
+                                   const ScanVerdict &verdict, bool cacheable)
+{
+    const bool deny = verdict.isFlagged();
+    if (cacheable) {
+        QWriteLocker lock(&cacheLock);
+        if (cache.size() >= MAX_CACHED_VERDICTS)
+            cache.clear();
+        cache.insert(request.key, CacheEntry{ request.size, request.mtimeNs, deny });
+    }
+
+    bool answered;
+    {
+        QMutexLocker lock(&mutex);
+        auto it = pending.find(request.fd);
+        answered = it.value().answered;
+        if (!answered)
+            respond(request.fd, deny ? FAN_DENY : FAN_ALLOW);
+        pending.erase(it);
+    }
+    ::close(request.fd);
+    if (!answered)
+        scannedLatency.add(nowUs() - request.startUs);
+    if (!deny)
+        return;
+
+    if (!answered)
+        denied.fetchAndAddRelaxed(1);
+    const QString name = QFile::decodeName(path);
+    const QString description = verdict.describe();
+    const int pid = request.pid;
+    const bool blocked = !answered;
+    OnAccessGuard *guard = owner;
+    QMetaObject::invokeMethod(guard, [guard, name, pid, description, blocked] {
+        emit guard->fileFlagged(name, pid, description, blocked);
+    }, Qt::QueuedConnection);
+}
+
+OnAccessGuard::OnAccessGuard(QObject *parent)
+    : QObject(parent)
+    , m_timeoutMs(DEFAULT_TIMEOUT_MS)
+{
+    bool ok = false;
+    const int timeout = qEnvironmentVariableIntValue("FORTI_ONACCESS_TIMEOUT_MS", &ok);
+    if (ok && timeout > 0)
+        m_timeoutMs = timeout;
+}
+
+OnAccessGuard::~OnAccessGuard()
+{
+    stop();
+}
+
+bool OnAccessGuard::isRunning() const
+{
+    return d && !d->failed.loadRelaxed();
+}
+
+bool OnAccessGuard::start(const QStringList &mounts, Mode mode, QString *error)
+{
+    stop();
+    QScopedPointer<Engine> engine(new Engine);
+    engine->owner = this;
+    engine->timeoutMs = m_timeoutMs;
+    engine->self = int(::getpid());
+    engine->selfExecutable = executableOf("self");
+
+    engine->fan = ::fanotify_init(FAN_CLASS_CONTENT | FAN_CLOEXEC | FAN_NONBLOCK,
+                                  O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+    if (engine->fan < 0) {
+        if (error) {
+            *error = errno == EPERM ? QString("нужны права администратора (CAP_SYS_ADMIN)")
+                                    : QString("fanotify недоступен: %1").arg(strerror(errno));
+        }
+        return false;
+    }
+    engine->wake = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (engine->wake < 0) {
+        if (error)
+            *error = QString("eventfd: %1").arg(strerror(errno));
+        return false;
+    }
+
+#ifdef FAN_OPEN_EXEC_PERM
+    engine->permissionMask = mode == ExecOnly ? FAN_OPEN_EXEC_PERM : FAN_OPEN_PERM;
+#else
+    if (mode == ExecOnly) {
+        if (error)
+            *error = QString("система собрана без FAN_OPEN_EXEC_PERM, выберите проверку любого открытия");
+        return false;
+    }
+    engine->permissionMask = FAN_OPEN_PERM;
+#endif
+
+    // Вердикты готовятся до отметок: после них каждое открытие ждет ответа
+    engine->rules = CompiledRules::installed();
+    engine->similarity = SimilarityIndex::installed();
+    engine->packages = PackageAllowlist::installed();
+    engine->largeFiles = LargeFilePolicy::installed();
+
+    QStringList failed;
+    int marked = 0;
+    for (const QString &mount : mounts) {
+        if (::fanotify_mark(engine->fan, FAN_MARK_ADD | FAN_MARK_MOUNT,
+                            engine->permissionMask | FAN_MODIFY, AT_FDCWD,
+                            QFile::encodeName(mount).constData()) == 0) {
+            ++marked;
+        } else {
+            if (errno == EINVAL && mode == ExecOnly) {
+                if (error)
+                    *error = QString("ядро не поддерживает проверку запуска (нужно 5.0+), "
+                                     "выберите проверку любого открытия");
+                return false;
+            }
+            failed << QString("%1: %2").arg(mount, QString::fromLocal8Bit(strerror(errno)));
+        }
+    }
+    if (marked == 0) {
+        if (error) {
+            *error = failed.isEmpty() ? QString("не выбрано ни одной точки монтирования")
+                                      : failed.join("\n");
+        }
+        return false;
+    }
+    for (const QString &line : failed)
+        qWarning() << "fanotify: точка монтирования пропущена:" << line;
+
+    Engine *e = engine.data();
+    const int scanners = qMax(2, QThread::idealThreadCount());
+    e->threads.setMaxThreadCount(scanners + 1);
+    e->threads.start([e] { e->readEvents(); });
+    for (int i = 0; i < scanners; ++i)
+        e->threads.start([e] { e->scanLoop(); });
+    d.reset(engine.take());
+    return true;
+}
+
+void OnAccessGuard::stop()
+{
+    if (!d)
+        return;
+    {
+        QMutexLocker lock(&d->mutex);
+        d->stopping = true;
+        d->work.wakeAll();
+    }
+    const quint64 one = 1;
+    if (::write(d->wake, &one, sizeof(one)) != ssize_t(sizeof(one)))
+        qWarning() << "fanotify: не удалось остановить поток событий";
+    d->threads.waitForDone();
+
+    // Непроверенные файлы разрешаются; остальное ядро разрешит само при
+    // закрытии дескриптора fanotify
+    while (!d->queue.isEmpty()) {
+        const Engine::Request request = d->queue.dequeue();
+        if (!d->pending.value(request.fd).answered)
+            d->respond(request.fd, FAN_ALLOW);
+        ::close(request.fd);
+    }
+    d.reset();
+}
+
+OnAccessStats OnAccessGuard::stats() const
+{
+    OnAccessStats s;
+    if (!d)
+        return s;
+    s.events = d->events.loadRelaxed();
+    s.cached = d->cached.loadRelaxed();
+    s.scanned = d->scanned.loadRelaxed();
+    s.skipped = d->skipped.loadRelaxed();
+    s.denied = d->denied.loadRelaxed();
+    s.timedOut = d->timedOut.loadRelaxed();
+    s.invalidated = d->invalidated.loadRelaxed();
+    s.cachedP50Us = d->cachedLatency.percentile(50);
+    s.cachedP99Us = d->cachedLatency.percentile(99);
+    s.scannedP50Us = d->scannedLatency.percentile(50);
+    s.scannedP99Us = d->scannedLatency.percentile(99);
+    return s;
+}
+
+QStringList OnAccessGuard::mountPoints()
+{
+    QStringList result;
+    QFile file("/proc/self/mounts");
+    if (!file.open(QIODevice::ReadOnly))
+        return result;
+    const QList<QByteArray> lines = file.readAll().split('\n');
+    for (const QByteArray &line : lines) {
+        const QList<QByteArray> fields = line.split(' ');
+        if (fields.size() < 3)
+            continue;
+        const QByteArray &type = fields.at(2);
+        bool pseudo = false;
+        for (const char *name : PSEUDO_FILESYSTEMS)
+            pseudo = pseudo || type == name;
+        if (pseudo)
+            continue;
+        const QString mount = QFile::decodeName(unescapeMountPath(fields.at(1)));
+        if (!result.contains(mount))
+            result << mount;
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
@@ -0,0 +1,81 @@
+#ifndef ONACCESSGUARD_H
+#define ONACCESSGUARD_H
+
+#include <QObject>
+#include <QScopedPointer>
+#include <QString>
+#include <QStringList>
+
+struct OnAccessStats {
+    quint64 events = 0;       // запросов разрешения
+    quint64 cached = 0;       // ответ из кэша вердиктов, без чтения файла
+    quint64 scanned = 0;      // файл прочитан
+    quint64 skipped = 0;      // свои процессы, не обычные файлы, переполнение очереди
+    quint64 denied = 0;
+    quint64 timedOut = 0;     // разрешено по тайм-ауту, проверка не успела
+    quint64 invalidated = 0;  // вердиктов сброшено изменением файла
+    // Задержка ответа от чтения события до ответа ядру, мкс; -1 - нет данных
+    qint64 cachedP50Us = -1;
+    qint64 cachedP99Us = -1;
+    qint64 scannedP50Us = -1;
+    qint64 scannedP99Us = -1;
+};
+
+// Проверка файлов при открытии через fanotify.
+//
+// На выбранных точках монтирования ядро перед запуском программы
+// (FAN_OPEN_EXEC_PERM) или перед любым открытием файла (FAN_OPEN_PERM)
+// ждет ответа: разрешить или запретить. Запрещается открытие файлов,
+// которые сканер отмечает как подозрительные или вредоносные.
+//
+// События читает один поток. Вердикт файла ищется в кэше по
+// (dev, inode) вместе с mtime и размером; при попадании поток отвечает
+// сразу, без передачи события и без чтения файла. Промахи проверяют
+// несколько потоков сканирования через дескриптор из события. Кэш
+// сбрасывается событиями изменения (FAN_MODIFY) и переполнением очереди
+// событий, когда изменения могли потеряться; файл, измененный во время
+// проверки, в кэш не попадает.
+//
+// Ответ не задерживается дольше тайм-аута (FORTI_ONACCESS_TIMEOUT_MS):
+// если проверка не успела, открытие разрешается, а вердикт все равно
+// кэшируется для следующих открытий. При ошибке потока событий все
+// открытия разрешаются и проверка выключается (сигнал failed). Открытия самой программы и ее
+// процессов-обработчиков разрешаются без проверки.
+//
+// Нужны права CAP_SYS_ADMIN. Правила и индексы загружаются при запуске.
+class OnAccessGuard : public QObject {
+    Q_OBJECT
+public:
+    enum Mode {
+        ExecOnly,  // только запуск программ (ядро 5.0+)
+        AllOpens   // любое открытие файла, в том числе библиотек и сценариев
+    };
+
+    explicit OnAccessGuard(QObject *parent = nullptr);
+    ~OnAccessGuard() override;
+
+    bool start(const QStringList &mounts, Mode mode, QString *error);
+    void stop();
+    bool isRunning() const;
+    OnAccessStats stats() const;
+    int timeoutMs() const { return m_timeoutMs; }
+
+    // Точки монтирования обычных файловых систем (без proc, sysfs и т.п.)
+    static QStringList mountPoints();
+
+signals:
+    // Найденный при открытии файл; blocked = false - открытие уже
+    // разрешено по тайм-ауту
+    void fileFlagged(const QString &path, int pid, const QString &description, bool blocked);
+    // Поток событий остановился из-за ошибки; ждавшие ответа открытия
+    // разрешены, отметки сняты. Остается вызвать stop()
+    void failed(const QString &error);
+
+private:
+    struct Engine;
+
+    QScopedPointer<Engine> d;
+    int m_timeoutMs;
+};
+
+#endif // ONACCESSGUARD_H
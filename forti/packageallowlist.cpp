@@ -0,0 +1,486 @@
+#include "packageallowlist.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QProcess>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <algorithm>
+
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sparsereader.h"
+
+namespace {
+
+const quint32 TABLE_MAGIC = 0x31415046;  // "FPA1"
+const quint32 TABLE_VERSION = 1;
+const quint32 TRUST_MAGIC = 0x31435446;  // "FTC1"
+const quint32 TRUST_VERSION = 1;
+
+const char DPKG_INFO_DIR[] = "/var/lib/dpkg/info";
+const char *const DPKG_DATABASE[] = { "/var/lib/dpkg/info", "/var/lib/dpkg/status" };
+const char *const RPM_DATABASE[] = {
+    "/var/lib/rpm", "/var/lib/rpm/rpmdb.sqlite", "/var/lib/rpm/Packages",
+    "/usr/lib/sysimage/rpm", "/usr/lib/sysimage/rpm/rpmdb.sqlite"
+};
+// Каталоги, которые при объединенном /usr - ссылки на /usr/...
+const char *const MERGED_DIRS[] = { "/bin/", "/sbin/", "/lib/", "/lib32/", "/lib64/", "/libx32/" };
+
+const int RPM_TIMEOUT_MS = 120 * 1000;
+const int READ_CHUNK = 64 * 1024;
+
+inline qint64 nanoseconds(const struct timespec &ts)
+{
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Строка hex-цифр в байты; пусто, если это не сумма или сумма нулевая
+QByteArray decodeDigest(const char *hex, int length)
+{
+    QByteArray out(length / 2, Qt::Uninitialized);
+    bool zero = true;
+    for (int i = 0; i < out.size(); ++i) {
+        const int hi = hexValue(hex[2 * i]);
+        const int lo = hexValue(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            return QByteArray();
+        out[i] = char(hi << 4 | lo);
+        zero = zero && out[i] == 0;
+    }
+    return zero ? QByteArray() : out;
+}
+
+int digestSize(quint8 algorithm)
+{
+    return algorithm == PackageAllowlist::Sha256 ? 32 : 16;
+}
+
+} // namespace
+
+// FNV-1a: хеш должен совпадать между запусками (qHash - со случайной солью)
+quint64 PackageAllowlist::pathHash(const char *path, int length)
+{
+    quint64 h = Q_UINT64_C(14695981039346656037);
+    for (int i = 0; i < length; ++i) {
+        h ^= uchar(path[i]);
+        h *= Q_UINT64_C(1099511628211);
+    }
+    return h;
+}
+
+QPair<const PackageAllowlist::Entry *, const PackageAllowlist::Entry *>
+PackageAllowlist::range(const QByteArray &path) const
+{
+    const quint64 hash = pathHash(path.constData(), path.size());
+    const Entry *begin = m_entries.constData();
+    const Entry *end = begin + m_entries.size();
+    const Entry *first = std::lower_bound(begin, end, hash, [](const Entry &e, quint64 h) {
+        return e.pathHash < h;
+    });
+    const Entry *last = first;
+    while (last != end && last->pathHash == hash)
+        ++last;
+    return qMakePair(first, last);
+}
+
+bool PackageAllowlist::contains(const QByteArray &path) const
+{
+    const auto r = range(path);
+    return r.first != r.second;
+}
+
+bool PackageAllowlist::verify(const QByteArray &path, int fd, qint64 size) const
+{
+    // Один путь может быть в нескольких пакетах (multiarch), суммы
+    // каждого алгоритма считаются за одно чтение
+    const auto r = range(path);
+    bool md5 = false;
+    bool sha256 = false;
+    for (const Entry *e = r.first; e != r.second; ++e) {
+        if (e->size >= 0 && e->size != size)
+            continue;
+        md5 = md5 || e->algorithm == Md5;
+        sha256 = sha256 || e->algorithm == Sha256;
+    }
+    if (!md5 && !sha256)
+        return false;
+
+    QCryptographicHash md5Hash(QCryptographicHash::Md5);
+    QCryptographicHash sha256Hash(QCryptographicHash::Sha256);
+    char buf[READ_CHUNK];
+    SparseReader reader(fd);
+    const bool read = reader.readAll(buf, sizeof(buf), [&](const uchar *data, int size) {
+        if (md5)
+            md5Hash.addData(reinterpret_cast<const char *>(data), size);
+        if (sha256)
+            sha256Hash.addData(reinterpret_cast<const char *>(data), size);
+    });
+    if (!read)
+        return false;
+    const QByteArray md5Result = md5 ? md5Hash.result() : QByteArray();
+    const QByteArray sha256Result = sha256 ? sha256Hash.result() : QByteArray();
+    for (const Entry *e = r.first; e != r.second; ++e) {
+        if (e->size >= 0 && e->size != size)
+            continue;
+        const QByteArray &actual = e->algorithm == Md5 ? md5Result : sha256Result;
+        if (memcmp(m_digests.constData() + e->digest, actual.constData(), size_t(actual.size())) == 0)
+            return true;
+    }
+    return false;
+}
+
+void PackageAllowlist::add(const QByteArray &path, qint64 size, Algorithm algorithm,
+                           const QByteArray &digest)
+{
+    if (digest.size() != digestSize(algorithm))
+        return;
+    Entry entry;
+    entry.pathHash = pathHash(path.constData(), path.size());
+    entry.size = size;
+    entry.digest = quint32(m_digests.size());
+    entry.algorithm = algorithm;
+    m_entries.append(entry);
+    m_digests.append(digest);
+
+    // Сканер видит файл по настоящему пути в /usr
+    if (m_mergedUsr) {
+        for (const char *dir : MERGED_DIRS) {
+            if (path.startsWith(dir)) {
+                const QByteArray usrPath = "/usr" + path;
+                entry.pathHash = pathHash(usrPath.constData(), usrPath.size());
+                m_entries.append(entry);
+                break;
+            }
+        }
+    }
+}
+
+// Строки "сумма  путь" без ведущего '/'
+void PackageAllowlist::loadDpkg(const QString &infoDir)
+{
+    const QStringList files = QDir(infoDir).entryList(QStringList() << "*.md5sums", QDir::Files);
+    QByteArray path;
+    for (const QString &name : files) {
+        QFile file(infoDir + '/' + name);
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+        const QByteArray data = file.readAll();
+        const char *p = data.constData();
+        const char *end = p + data.size();
+        while (p < end) {
+            const char *eol = static_cast<const char *>(memchr(p, '\n', size_t(end - p)));
+            if (!eol)
+                eol = end;
+            if (eol - p > 34 && p[32] == ' ' && p[33] == ' ') {
+                const QByteArray digest = decodeDigest(p, 32);
+                path.resize(0);
+                path.append('/');
+                path.append(p + 34, int(eol - p - 34));
+                if (!digest.isEmpty())
+                    add(path, -1, Md5, digest);
+            }
+            p = eol + 1;
+        }
+    }
+}
+
+// "путь размер mtime сумма режим владелец группа конфиг док rdev ссылка":
+// путь может содержать пробелы, поэтому поля разбираются с конца
+void PackageAllowlist::loadRpm()
+{
+    if (QStandardPaths::findExecutable("rpm").isEmpty())
+        return;
+    QProcess rpm;
+    rpm.start("rpm", QStringList() << "-qa" << "--dump");
+    if (!rpm.waitForStarted() || !rpm.waitForFinished(RPM_TIMEOUT_MS)
+        || rpm.exitStatus() != QProcess::NormalExit) {
+        qWarning() << "База rpm не прочитана:" << rpm.errorString();
+        rpm.kill();
+        return;
+    }
+    const QByteArray output = rpm.readAllStandardOutput();
+    for (const QByteArray &line : output.split('\n')) {
+        QByteArrayList fields = line.split(' ');
+        if (fields.size() < 11)
+            continue;
+        const int n = fields.size();
+        const QByteArray &digestHex = fields[n - 8];
+        const bool regular = (fields[n - 7].toUInt(nullptr, 8) & S_IFMT) == S_IFREG;
+        const bool config = fields[n - 4] == "1";
+        if (!regular || config)
+            continue;
+        Algorithm algorithm;
+        if (digestHex.size() == 32)
+            algorithm = Md5;
+        else if (digestHex.size() == 64)
+            algorithm = Sha256;
+        else
+            continue;
+        const QByteArray digest = decodeDigest(digestHex.constData(), digestHex.size());
+        bool ok = false;
+        const qint64 size = fields[n - 10].toLongLong(&ok);
+        if (digest.isEmpty() || !ok)
+            continue;
+        fields.erase(fields.end() - 10, fields.end());
+        add(fields.join(' '), size, algorithm, digest);
+    }
+}
+
+void PackageAllowlist::finish()
+{
+    std::sort(m_entries.begin(), m_entries.end(), [](const Entry &a, const Entry &b) {
+        return a.pathHash < b.pathHash;
+    });
+    m_entries.squeeze();
+    m_digests.squeeze();
+}
+
+// Ключ кэша - время изменения файлов базы; пусто, если базы нет
+QByteArray PackageAllowlist::databaseKey()
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    bool found = false;
+    auto addPath = [&](const char *path) {
+        struct stat st;
+        if (::stat(path, &st) != 0)
+            return;
+        found = true;
+        const qint64 stamp[] = { nanoseconds(st.st_mtim), qint64(st.st_size), qint64(st.st_ino) };
+        hash.addData(path);
+        hash.addData(reinterpret_cast<const char *>(stamp), sizeof(stamp));
+    };
+    for (const char *path : DPKG_DATABASE)
+        addPath(path);
+    for (const char *path : RPM_DATABASE)
+        addPath(path);
+    if (!found)
+        return QByteArray();
+    hash.addData(reinterpret_cast<const char *>(&TABLE_VERSION), sizeof(TABLE_VERSION));
+    return hash.result();
+}
+
+bool PackageAllowlist::save(const QString &fileName) const
+{
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_12);
+    out << TABLE_MAGIC << TABLE_VERSION << m_key << quint32(m_entries.size()) << m_digests;
+    // Записи - как есть в памяти: кэш локальный
+    out.writeRawData(reinterpret_cast<const char *>(m_entries.constData()),
+                     int(m_entries.size() * sizeof(Entry)));
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+QSharedPointer<PackageAllowlist> PackageAllowlist::load(const QString &fileName, const QByteArray &key)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return QSharedPointer<PackageAllowlist>();
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_12);
+    quint32 magic = 0;
+    quint32 version = 0;
+    QByteArray storedKey;
+    quint32 count = 0;
+    QSharedPointer<PackageAllowlist> list(new PackageAllowlist);
+    in >> magic >> version >> storedKey >> count >> list->m_digests;
+    if (in.status() != QDataStream::Ok || magic != TABLE_MAGIC || version != TABLE_VERSION
+        || storedKey != key || qint64(count) * qint64(sizeof(Entry)) > file.size())
+        return QSharedPointer<PackageAllowlist>();
+    list->m_entries.resize(int(count));
+    const int bytes = int(count * sizeof(Entry));
+    if (in.readRawData(reinterpret_cast<char *>(list->m_entries.data()), bytes) != bytes)
+        return QSharedPointer<PackageAllowlist>();
+
+    // Испорченный кэш не должен увести чтение суммы за пределы массива
+    for (const Entry &e : list->m_entries) {
+        if ((e.algorithm != Md5 && e.algorithm != Sha256)
+            || qint64(e.digest) + digestSize(e.algorithm) > list->m_digests.size()) {
+            qWarning() << "Кэш базы пакетов поврежден:" << fileName;
+            return QSharedPointer<PackageAllowlist>();
+        }
+    }
+    list->m_key = storedKey;
+    return list;
+}
+
+QString PackageAllowlist::cachePath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/packages.fpa";
+}
+
+bool PackageAllowlist::isDisabled()
+{
+    return qEnvironmentVariableIsSet("FORTI_NO_PACKAGE_ALLOWLIST");
+}
+
+QSharedPointer<const PackageAllowlist> PackageAllowlist::installed()
+{
+    if (isDisabled())
+        return QSharedPointer<const PackageAllowlist>();
+    const QByteArray key = databaseKey();
+    if (key.isEmpty())
+        return QSharedPointer<const PackageAllowlist>();
+    QSharedPointer<PackageAllowlist> list = load(cachePath(), key);
+    if (!list) {
+        list.reset(new PackageAllowlist);
+        list->m_key = key;
+        list->m_mergedUsr = QFileInfo("/bin").isSymLink();
+        list->loadDpkg(QString::fromLatin1(DPKG_INFO_DIR));
+        list->loadRpm();
+        list->finish();
+        if (!list->save(cachePath()))
+            qWarning() << "Не удалось сохранить кэш базы пакетов:" << cachePath();
+    }
+    if (list->isEmpty())
+        return QSharedPointer<const PackageAllowlist>();
+    return list;
+}
+
+QSharedPointer<const PackageAllowlist> PackageAllowlist::cached()
+{
+    if (isDisabled())
+        return QSharedPointer<const PackageAllowlist>();
+    const QByteArray key = databaseKey();
+    QSharedPointer<PackageAllowlist> list;
+    if (!key.isEmpty())
+        list = load(cachePath(), key);
+    if (!list || list->isEmpty())
+        return QSharedPointer<const PackageAllowlist>();
+    return list;
+}
+
+// ---------------------------------------------------------------------
+// TrustedFileCache
+
+TrustedFileCache::TrustedFileCache(const QSharedPointer<const PackageAllowlist> &packages)
+    : m_packages(packages)
+    , m_dirty(false)
+    , m_hits(0)
+    , m_verified(0)
+{
+    if (m_packages)
+        load();
+}
+
+bool TrustedFileCache::check(quint64 id, const QByteArray &path, ScanVerdict *verdict)
+{
+    if (!m_packages || !m_packages->contains(path))
+        return false;
+    struct stat st;
+    if (::stat(path.constData(), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+    const Key key(quint64(st.st_dev), quint64(st.st_ino));
+    const Stamp stamp{ qint64(st.st_size), nanoseconds(st.st_mtim), nanoseconds(st.st_ctim) };
+
+    QMutexLocker lock(&m_mutex);
+    auto it = m_files.constFind(key);
+    if (it != m_files.constEnd() && it.value().size == stamp.size
+        && it.value().mtimeNs == stamp.mtimeNs && it.value().ctimeNs == stamp.ctimeNs) {
+        ++m_hits;
+        *verdict = ScanVerdict();
+        verdict->reason = ScanVerdict::PackageFile;
+        verdict->size = stamp.size;
+        verdict->mtime = st.st_mtime;
+        return true;
+    }
+    m_pending.insert(id, qMakePair(key, stamp));
+    return false;
+}
+
+// Файл сверен, если сканер вернул PackageFile и файл не менялся с
+// момента check(): размер и mtime в вердикте - из его fstat
+void TrustedFileCache::fileScanned(quint64 id, const ScanVerdict &verdict)
+{
+    QMutexLocker lock(&m_mutex);
+    if (m_pending.isEmpty())
+        return;
+    auto it = m_pending.find(id);
+    if (it == m_pending.end())
+        return;
+    const Key key = it.value().first;
+    const Stamp stamp = it.value().second;
+    m_pending.erase(it);
+    if (verdict.reason == ScanVerdict::PackageFile && verdict.size == stamp.size
+        && verdict.mtime == stamp.mtimeNs / 1000000000) {
+        m_files.insert(key, stamp);
+        ++m_verified;
+        m_dirty = true;
+    } else if (m_files.remove(key) > 0) {
+        m_dirty = true;
+    }
+}
+
+QString TrustedFileCache::cachePath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/trusted.ftc";
+}
+
+void TrustedFileCache::load()
+{
+    QFile file(cachePath());
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_12);
+    quint32 magic = 0;
+    quint32 version = 0;
+    QByteArray key;
+    quint32 count = 0;
+    in >> magic >> version >> key >> count;
+    // Сверки со старой базой пакетов недействительны
+    if (magic != TRUST_MAGIC || version != TRUST_VERSION || key != m_packages->key())
+        return;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        quint64 dev, ino;
+        Stamp stamp;
+        in >> dev >> ino >> stamp.size >> stamp.mtimeNs >> stamp.ctimeNs;
+        m_files.insert(Key(dev, ino), stamp);
+    }
+    if (in.status() != QDataStream::Ok)
+        m_files.clear();
+}
+
+bool TrustedFileCache::save()
+{
+    QMutexLocker lock(&m_mutex);
+    if (!m_packages || !m_dirty)
+        return true;
+    QDir().mkpath(QFileInfo(cachePath()).absolutePath());
+    QSaveFile file(cachePath());
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_12);
+    out << TRUST_MAGIC << TRUST_VERSION << m_packages->key() << quint32(m_files.size());
+    for (auto it = m_files.constBegin(); it != m_files.constEnd(); ++it) {
+        out << it.key().first << it.key().second << it.value().size << it.value().mtimeNs
+            << it.value().ctimeNs;
+    }
+    if (out.status() != QDataStream::Ok || !file.commit())
+        return false;
+    m_dirty = false;
+    return true;
+}
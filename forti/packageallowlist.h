@@ -0,0 +1,113 @@
+#ifndef PACKAGEALLOWLIST_H
+#define PACKAGEALLOWLIST_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+#include "filescanner.h"
+
+// Контрольные суммы файлов из базы пакетного менеджера: *.md5sums dpkg
+// и вывод "rpm -qa --dump". Файл пакета, у которого совпали размер
+// (если база его хранит) и сумма, не разбирается: это неизмененный
+// файл системы. Конфигурационные файлы в таблицу не попадают, их
+// меняет администратор.
+//
+// Таблица компактная: записи по 24 байта (64-битный хеш пути, размер,
+// смещение суммы) отсортированы по хешу пути и ищутся двоичным поиском,
+// суммы лежат подряд в одном массиве, сами пути не хранятся. Разбор базы
+// занимает секунды (rpm - отдельный процесс), поэтому таблица сохраняется
+// в кэш с ключом по времени изменения базы; основной процесс обновляет
+// кэш через installed(), обработчики только читают его через cached().
+class PackageAllowlist {
+public:
+    enum Algorithm : quint8 { Md5 = 1, Sha256 = 2 };
+
+    int size() const { return m_entries.size(); }
+    bool isEmpty() const { return m_entries.isEmpty(); }
+    const QByteArray &key() const { return m_key; }
+
+    // Есть ли путь в базе; файл не читается
+    bool contains(const QByteArray &path) const;
+    // Сверка открытого файла с записями пути. Файл читается целиком,
+    // только если совпал размер
+    bool verify(const QByteArray &path, int fd, qint64 size) const;
+
+    static QSharedPointer<const PackageAllowlist> installed();
+    static QSharedPointer<const PackageAllowlist> cached();
+    static QString cachePath();
+    // Отключение переменной окружения FORTI_NO_PACKAGE_ALLOWLIST
+    static bool isDisabled();
+
+private:
+    struct Entry {
+        quint64 pathHash;
+        qint64 size;        // -1 - база размер не хранит (dpkg)
+        quint32 digest;     // смещение суммы в m_digests
+        quint8 algorithm;
+    };
+
+    static quint64 pathHash(const char *path, int length);
+    static QByteArray databaseKey();
+
+    void add(const QByteArray &path, qint64 size, Algorithm algorithm, const QByteArray &digest);
+    void loadDpkg(const QString &infoDir);
+    void loadRpm();
+    void finish();
+    bool save(const QString &fileName) const;
+    static QSharedPointer<PackageAllowlist> load(const QString &fileName, const QByteArray &key);
+    QPair<const Entry *, const Entry *> range(const QByteArray &path) const;
+
+    QVector<Entry> m_entries;
+    QByteArray m_digests;
+    QByteArray m_key;
+    bool m_mergedUsr = false;  // /bin и др. - ссылки в /usr
+};
+
+// Файлы пакетов, уже сверенные с базой: (dev, inode) -> размер, mtime и
+// ctime на момент сверки. Живет в основном процессе и сохраняется между
+// сканированиями, поэтому неизмененный файл сверяется один раз. Запись
+// сбрасывается, если файл изменился или обновилась база пакетов.
+//
+// check() и fileScanned() можно вызывать из разных потоков.
+class TrustedFileCache {
+public:
+    explicit TrustedFileCache(const QSharedPointer<const PackageAllowlist> &packages);
+
+    // true - файл сверен раньше и не менялся, verdict готов без чтения.
+    // Иначе файл пакета запоминается до fileScanned() с тем же номером
+    bool check(quint64 id, const QByteArray &path, ScanVerdict *verdict);
+    void fileScanned(quint64 id, const ScanVerdict &verdict);
+
+    bool save();
+    const QSharedPointer<const PackageAllowlist> &packages() const { return m_packages; }
+    int hits() const { return m_hits; }          // взято из кэша
+    int verified() const { return m_verified; }  // сверено в этом сканировании
+
+    static QString cachePath();
+
+private:
+    typedef QPair<quint64, quint64> Key;  // dev, inode
+
+    struct Stamp {
+        qint64 size;
+        qint64 mtimeNs;
+        qint64 ctimeNs;
+    };
+
+    void load();
+
+    QSharedPointer<const PackageAllowlist> m_packages;
+    QMutex m_mutex;
+    QHash<Key, Stamp> m_files;
+    QHash<quint64, QPair<Key, Stamp>> m_pending;  // номер файла -> его stat
+    bool m_dirty;
+    int m_hits;
+    int m_verified;
+};
+
+#endif // PACKAGEALLOWLIST_H
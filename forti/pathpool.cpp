@@ -0,0 +1,239 @@
+#include "pathpool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+StringArena::StringArena()
+    : m_used(ChunkSize)
+{
+}
+
+StringArena::~StringArena()
+{
+    for (char *chunk : m_chunks)
+        ::free(chunk);
+}
+
+quint32 StringArena::add(const char *data, int length)
+{
+    length = qBound(0, length, int(MaxLength));
+    const int needed = (length + 2 + Align - 1) & ~(Align - 1);
+    if (m_used + needed > ChunkSize) {
+        // Номер блока дальше не помещается в ссылку: продолжать нельзя,
+        // иначе новые ссылки указывали бы на старые строки
+        if (m_chunks.size() >= MaxChunks)
+            qFatal("StringArena: превышен объем арены (%d блоков)", MaxChunks);
+        char *chunk = static_cast<char *>(::malloc(ChunkSize));
+        Q_CHECK_PTR(chunk);
+        m_chunks.append(chunk);
+        m_used = 0;
+    }
+    char *p = m_chunks.last() + m_used;
+    const quint16 len = quint16(length);
+    memcpy(p, &len, sizeof(len));
+    memcpy(p + 2, data, size_t(length));
+    const quint32 ref = (quint32(m_chunks.size() - 1) << OffsetBits) | quint32(m_used >> AlignBits);
+    m_used += needed;
+    return ref;
+}
+
+const char *StringArena::data(quint32 ref) const
+{
+    return m_chunks[int(ref >> OffsetBits)] + ((ref & ((1u << OffsetBits) - 1)) << AlignBits) + 2;
+}
+
+int StringArena::length(quint32 ref) const
+{
+    quint16 len;
+    memcpy(&len, data(ref) - 2, sizeof(len));
+    return len;
+}
+
+void StringArena::reset()
+{
+    for (int i = 1; i < m_chunks.size(); ++i)
+        ::free(m_chunks[i]);
+    m_chunks.resize(qMin(m_chunks.size(), 1));
+    m_used = m_chunks.isEmpty() ? ChunkSize : 0;
+}
+
+PathPool::PathPool()
+    : m_lastDirId(RootDir)
+{
+    clear();
+}
+
+void PathPool::clear()
+{
+    m_names.reset();
+    m_dirs.clear();
+    m_dirs.append(Dir{ RootDir, m_names.add("", 0), 0 });
+    m_table.fill(0, 1024);
+    m_lastDir.resize(0);
+    m_lastDirId = RootDir;
+}
+
+quint32 PathPool::hashName(DirId parent, const char *name, int length)
+{
+    quint32 h = 2166136261u ^ parent;
+    for (int i = 0; i < length; ++i) {
+        h ^= uchar(name[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void PathPool::rehash(int buckets)
+{
+    m_table.fill(0, buckets);
+    const quint32 mask = quint32(buckets - 1);
+    for (int id = 1; id < m_dirs.size(); ++id) {
+        quint32 slot = m_dirs[id].hash & mask;
+        while (m_table[int(slot)])
+            slot = (slot + 1) & mask;
+        m_table[int(slot)] = DirId(id) + 1;
+    }
+}
+
+PathPool::DirId PathPool::findOrAdd(DirId parent, const char *name, int length)
+{
+    const quint32 hash = hashName(parent, name, length);
+    const quint32 mask = quint32(m_table.size() - 1);
+    quint32 slot = hash & mask;
+    while (const DirId stored = m_table[int(slot)]) {
+        const Dir &dir = m_dirs[int(stored - 1)];
+        if (dir.hash == hash && dir.parent == parent && m_names.length(dir.name) == length
+            && memcmp(m_names.data(dir.name), name, size_t(length)) == 0)
+            return stored - 1;
+        slot = (slot + 1) & mask;
+    }
+
+    const DirId id = DirId(m_dirs.size());
+    m_dirs.append(Dir{ parent, m_names.add(name, length), hash });
+    m_table[int(slot)] = id + 1;
+    // Заполнение таблицы не больше половины
+    if (m_dirs.size() * 2 > m_table.size())
+        rehash(m_table.size() * 2);
+    return id;
+}
+
+PathPool::DirId PathPool::directory(const char *path, int length)
+{
+    // "/a/b" -> родитель "/a", имя "b"; "" и "/" - корень
+    while (length > 0 && path[length - 1] == '/')
+        --length;
+    if (length == 0)
+        return RootDir;
+    int slash = length - 1;
+    while (slash >= 0 && path[slash] != '/')
+        --slash;
+    const DirId parent = slash > 0 ? directory(path, slash) : RootDir;
+    return findOrAdd(parent, path + slash + 1, length - slash - 1);
+}
+
+PathPool::DirId PathPool::directoryOf(const QByteArray &path, int *nameOffset)
+{
+    const int slash = path.lastIndexOf('/');
+    const int dirLength = qMax(slash, 0);
+    // Файлы приходят пачками из одного каталога
+    if (dirLength != m_lastDir.size()
+        || memcmp(m_lastDir.constData(), path.constData(), size_t(dirLength)) != 0) {
+        m_lastDirId = directory(path.constData(), dirLength);
+        m_lastDir.resize(dirLength);
+        memcpy(m_lastDir.data(), path.constData(), size_t(dirLength));
+    }
+    *nameOffset = slash + 1;
+    return m_lastDirId;
+}
+
+void PathPool::appendDirectory(QByteArray &out, DirId dir) const
+{
+    // Цепочка до корня собирается в обратном порядке
+    DirId chain[256];
+    int depth = 0;
+    for (DirId id = dir; id != RootDir; id = m_dirs[int(id)].parent) {
+        if (depth == int(sizeof(chain) / sizeof(chain[0]))) {
+            appendDirectory(out, id);
+            break;
+        }
+        chain[depth++] = id;
+    }
+    while (depth > 0) {
+        const Dir &d = m_dirs[int(chain[--depth])];
+        out.append('/');
+        out.append(m_names.data(d.name), m_names.length(d.name));
+    }
+}
+
+qint64 PathPool::memoryUsed() const
+{
+    return m_names.memoryUsed() + qint64(m_dirs.capacity()) * qint64(sizeof(Dir))
+           + qint64(m_table.size()) * qint64(sizeof(DirId));
+}
+
+QueuedPaths::QueuedPaths()
+    : m_current(0)
+    , m_count(0)
+    , m_liveBytes(0)
+{
+}
+
+QueuedPaths::Ref QueuedPaths::add(const QByteArray &path)
+{
+    int nameOffset = 0;
+    Ref ref;
+    ref.dir = m_dirs.directoryOf(path, &nameOffset);
+    ref.name = m_names[m_current].add(path.constData() + nameOffset, path.size() - nameOffset);
+    ++m_count;
+    m_liveBytes += names().length(ref.name) + 2;
+    return ref;
+}
+
+void QueuedPaths::remove(const Ref &ref)
+{
+    if (--m_count <= 0) {
+        clear();
+        return;
+    }
+    m_liveBytes -= names().length(ref.name) + 2;
+}
+
+void QueuedPaths::appendPath(QByteArray &out, const Ref &ref) const
+{
+    m_dirs.appendDirectory(out, ref.dir);
+    out.append('/');
+    out.append(names().data(ref.name), names().length(ref.name));
+}
+
+bool QueuedPaths::needsCompact() const
+{
+    // Переупаковка копирует только живые имена, поэтому при таком
+    // пороге обходится в среднем не дороже одного add() на файл
+    const qint64 used = names().memoryUsed();
+    return used > 4 * StringArena::ChunkSize && used > 4 * m_liveBytes;
+}
+
+void QueuedPaths::beginCompact()
+{
+    m_current ^= 1;
+    m_names[m_current].reset();
+}
+
+void QueuedPaths::keep(Ref &ref)
+{
+    const StringArena &old = m_names[m_current ^ 1];
+    ref.name = m_names[m_current].add(old.data(ref.name), old.length(ref.name));
+}
+
+void QueuedPaths::endCompact()
+{
+    m_names[m_current ^ 1].reset();
+}
+
+void QueuedPaths::clear()
+{
+    m_dirs.clear();
+    m_names[m_current].reset();
+    m_count = 0;
+    m_liveBytes = 0;
+}
@@ -0,0 +1,128 @@
+#ifndef PATHPOOL_H
+#define PATHPOOL_H
+
+#include <QByteArray>
+#include <QVector>
+
+// Арена строк: байты дописываются в блоки по ChunkSize без отдельного
+// выделения памяти на строку. Строка не пересекает границу блока и
+// хранится с двухбайтовой длиной впереди, начало выровнено на Align.
+// Ссылка - 32-битное смещение: номер блока и позиция в нем в единицах
+// Align, так что арена вмещает MaxChunks блоков (16 ГиБ). reset()
+// освобождает все сразу, первый блок остается для следующего заполнения.
+class StringArena {
+public:
+    static const int ChunkBits = 20;
+    static const int ChunkSize = 1 << ChunkBits;
+    static const int AlignBits = 2;
+    static const int Align = 1 << AlignBits;
+    static const int OffsetBits = ChunkBits - AlignBits;
+    static const int MaxChunks = 1 << (32 - OffsetBits);
+    static const int MaxLength = 0xffff;
+
+    StringArena();
+    ~StringArena();
+
+    quint32 add(const char *data, int length);
+    const char *data(quint32 ref) const;
+    int length(quint32 ref) const;
+
+    void reset();
+    qint64 memoryUsed() const { return qint64(m_chunks.size()) * ChunkSize; }
+
+private:
+    Q_DISABLE_COPY(StringArena)
+
+    QVector<char *> m_chunks;
+    int m_used;  // занято в последнем блоке
+};
+
+// Пул каталогов для больших наборов путей.
+//
+// Каталог хранится один раз как номер родителя и имя в арене, поэтому
+// пользователю пула достаточно держать для файла номер каталога и имя.
+// Полный путь собирается только для показа и выгрузки. Каталоги ищутся
+// в открытой хеш-таблице по (родитель, имя); файлы подряд из одного
+// каталога находят его без поиска. Пути абсолютные, каталог 0 - корень.
+class PathPool {
+public:
+    typedef quint32 DirId;
+    static const DirId RootDir = 0;
+
+    PathPool();
+
+    DirId directory(const char *path, int length);
+    // Каталог файла; *nameOffset - начало имени в path
+    DirId directoryOf(const QByteArray &path, int *nameOffset);
+
+    void appendDirectory(QByteArray &out, DirId dir) const;
+
+    int directoryCount() const { return m_dirs.size(); }
+    qint64 memoryUsed() const;
+    void clear();
+
+private:
+    Q_DISABLE_COPY(PathPool)
+
+    struct Dir {
+        DirId parent;
+        quint32 name;
+        quint32 hash;
+    };
+
+    static quint32 hashName(DirId parent, const char *name, int length);
+    DirId findOrAdd(DirId parent, const char *name, int length);
+    void rehash(int buckets);
+
+    StringArena m_names;
+    QVector<Dir> m_dirs;
+    QVector<DirId> m_table;  // номер каталога + 1, 0 - пусто
+    QByteArray m_lastDir;    // каталог последнего directoryOf()
+    DirId m_lastDirId;
+};
+
+// Пути файлов в очереди на проверку: каталог в PathPool и имя в арене,
+// без выделения памяти на файл. Пока идет обход, очередь не пустеет
+// и арену целиком не сбросить, поэтому когда выбывшие имена занимают
+// больше живых, владелец очереди переносит живые в свежую арену:
+//     if (paths.needsCompact()) {
+//         paths.beginCompact();
+//         for (Ref &ref : ...) paths.keep(ref);
+//         paths.endCompact();
+//     }
+// Опустевшая очередь сбрасывает все сразу.
+class QueuedPaths {
+public:
+    struct Ref {
+        PathPool::DirId dir;
+        quint32 name;
+    };
+
+    QueuedPaths();
+
+    Ref add(const QByteArray &path);
+    // Путь покинул очередь
+    void remove(const Ref &ref);
+    void appendPath(QByteArray &out, const Ref &ref) const;
+
+    bool needsCompact() const;
+    void beginCompact();
+    void keep(Ref &ref);
+    void endCompact();
+
+    int count() const { return m_count; }
+    void clear();
+
+private:
+    Q_DISABLE_COPY(QueuedPaths)
+
+    const StringArena &names() const { return m_names[m_current]; }
+
+    PathPool m_dirs;
+    StringArena m_names[2];  // при переупаковке - новая и старая
+    int m_current;
+    int m_count;
+    qint64 m_liveBytes;
+};
+
+#endif // PATHPOOL_H
@@ -0,0 +1,461 @@
+#include "pieceeditor.h"
+
+#include <QApplication>
+#include <QClipboard>
+#include <QFontDatabase>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QScrollBar>
+#include <QWheelEvent>
+
+#include <limits.h>
+
+namespace {
+
+const int TAB_WIDTH = 4;
+// Строки длиннее показываются обрезанными: минифицированные файлы
+// и логи не должны раскладываться целиком при каждой отрисовке
+const int MAX_LINE_BYTES = 16 * 1024;
+const int WHEEL_LINES = 3;
+const int CARET_MARGIN = 20;
+
+// Длина символа UTF-8 в начале p; некорректная последовательность - 1 байт
+int utf8Length(const char *p, int available)
+{
+    const uchar c = uchar(p[0]);
+    int n = 1;
+    if (c >= 0xc2 && c <= 0xdf)
+        n = 2;
+    else if (c >= 0xe0 && c <= 0xef)
+        n = 3;
+    else if (c >= 0xf0 && c <= 0xf4)
+        n = 4;
+    if (n > available)
+        return 1;
+    for (int i = 1; i < n; ++i) {
+        if ((uchar(p[i]) & 0xc0) != 0x80)
+            return 1;
+    }
+    return n;
+}
+
+} // namespace
+
+PieceEditor::PieceEditor(QWidget *parent)
+    : QAbstractScrollArea(parent)
+    , m_lineEnding("\n")
+    , m_top(0)
+    , m_caret(0)
+    , m_anchor(0)
+    , m_desiredX(0)
+    , m_scrollShift(0)
+    , m_settingScroll(false)
+{
+    setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    setFocusPolicy(Qt::StrongFocus);
+    viewport()->setCursor(Qt::IBeamCursor);
+}
+
+bool PieceEditor::open(const QString &fileName, QString *error)
+{
+    if (!m_text.open(fileName, error))
+        return false;
+    m_lineEnding = m_text.lineEnding();
+    m_top = m_caret = m_anchor = 0;
+    m_desiredX = 0;
+    horizontalScrollBar()->setValue(0);
+    updateScrollBars();
+    viewport()->update();
+    return true;
+}
+
+bool PieceEditor::save(QString *error)
+{
+    // Содержимое после сохранения то же, позиции остаются верными
+    const bool ok = m_text.save(error);
+    viewport()->update();
+    return ok;
+}
+
+qint64 PieceEditor::lineStart(qint64 pos) const
+{
+    return m_text.lastIndexOf('\n', pos) + 1;
+}
+
+qint64 PieceEditor::contentEnd(qint64 start) const
+{
+    const qint64 newline = m_text.indexOf('\n', start);
+    if (newline < 0)
+        return m_text.size();
+    return newline > start && m_text.at(newline - 1) == '\r' ? newline - 1 : newline;
+}
+
+qint64 PieceEditor::nextLine(qint64 start) const
+{
+    const qint64 newline = m_text.indexOf('\n', start);
+    return newline < 0 ? -1 : newline + 1;
+}
+
+qint64 PieceEditor::previousLine(qint64 start) const
+{
+    return start > 0 ? lineStart(start - 1) : -1;
+}
+
+qint64 PieceEditor::previousChar(qint64 pos) const
+{
+    if (pos <= 0)
+        return 0;
+    if (m_text.at(pos - 1) == '\n')
+        return pos >= 2 && m_text.at(pos - 2) == '\r' ? pos - 2 : pos - 1;
+    qint64 p = pos - 1;
+    while (p > 0 && pos - p < 4 && (uchar(m_text.at(p)) & 0xc0) == 0x80)
+        --p;
+    const QByteArray bytes = m_text.read(p, pos - p);
+    return utf8Length(bytes.constData(), bytes.size()) == pos - p ? p : pos - 1;
+}
+
+qint64 PieceEditor::nextChar(qint64 pos) const
+{
+    if (pos >= m_text.size())
+        return m_text.size();
+    const QByteArray bytes = m_text.read(pos, 4);
+    if (bytes.startsWith("\r\n"))
+        return pos + 2;
+    return pos + utf8Length(bytes.constData(), bytes.size());
+}
+
+PieceEditor::LineLayout PieceEditor::layoutLine(qint64 start) const
+{
+    LineLayout line;
+    line.start = start;
+    line.end = contentEnd(start);
+    const QByteArray bytes = m_text.read(start, qMin<qint64>(line.end - start, MAX_LINE_BYTES));
+    const QFontMetrics fm(font());
+    const int spaceWidth = fm.horizontalAdvance(QLatin1Char(' '));
+    int x = 0;
+    int column = 0;
+    for (int i = 0; i < bytes.size();) {
+        const int n = utf8Length(bytes.constData() + i, bytes.size() - i);
+        line.bytes.append(i);
+        line.xs.append(x);
+        const uchar c = uchar(bytes[i]);
+        if (c == '\t') {
+            const int spaces = TAB_WIDTH - column % TAB_WIDTH;
+            line.text += QString(spaces, QLatin1Char(' '));
+            x += spaces * spaceWidth;
+            column += spaces;
+        } else {
+            // Управляющие символы и байты не из UTF-8 показываются заменой
+            const QString s = (c < 0x20 || (n == 1 && c >= 0x80)) ? QString(QChar(0xfffd))
+                                                                  : QString::fromUtf8(bytes.constData() + i, n);
+            line.text += s;
+            x += fm.horizontalAdvance(s);
+            ++column;
+        }
+        i += n;
+    }
+    line.bytes.append(bytes.size());
+    line.xs.append(x);
+    return line;
+}
+
+int PieceEditor::xForPos(const LineLayout &line, qint64 pos) const
+{
+    const qint64 offset = pos - line.start;
+    for (int k = 0; k < line.bytes.size(); ++k) {
+        if (line.bytes[k] >= offset)
+            return line.xs[k];
+    }
+    return line.xs.last();
+}
+
+qint64 PieceEditor::posForX(const LineLayout &line, int x) const
+{
+    for (int k = 0; k + 1 < line.xs.size(); ++k) {
+        if (x < (line.xs[k] + line.xs[k + 1]) / 2)
+            return line.start + line.bytes[k];
+    }
+    return line.start + line.bytes.last();
+}
+
+int PieceEditor::visibleLines() const
+{
+    return qMax(1, viewport()->height() / QFontMetrics(font()).height());
+}
+
+qint64 PieceEditor::posAt(const QPoint &point) const
+{
+    const int row = qMax(0, point.y() / QFontMetrics(font()).height());
+    qint64 line = m_top;
+    for (int i = 0; i < row; ++i) {
+        const qint64 next = nextLine(line);
+        if (next < 0)
+            break;
+        line = next;
+    }
+    return posForX(layoutLine(line), point.x() + horizontalScrollBar()->value());
+}
+
+void PieceEditor::paintEvent(QPaintEvent *)
+{
+    QPainter painter(viewport());
+    painter.fillRect(viewport()->rect(), palette().base());
+    const QFontMetrics fm(font());
+    const int lineHeight = fm.height();
+    const int xOffset = horizontalScrollBar()->value();
+    const qint64 selStart = selectionStart();
+    const qint64 selEnd = selectionEnd();
+    int widest = 0;
+
+    qint64 start = m_top;
+    for (int y = 0; start >= 0 && y < viewport()->height(); y += lineHeight) {
+        const LineLayout line = layoutLine(start);
+        widest = qMax(widest, line.xs.last());
+        const qint64 next = nextLine(start);
+
+        if (hasSelection() && selStart <= line.end && selEnd > line.start) {
+            const int sx = xForPos(line, qMax(selStart, line.start));
+            // Выделенный перевод строки показывается полоской до ширины пробела
+            const int ex = selEnd > line.end ? line.xs.last() + fm.horizontalAdvance(QLatin1Char(' '))
+                                             : xForPos(line, selEnd);
+            painter.fillRect(sx - xOffset, y, ex - sx, lineHeight, palette().highlight());
+        }
+        painter.setPen(palette().text().color());
+        painter.drawText(-xOffset, y + fm.ascent(), line.text);
+
+        if (hasFocus() && m_caret >= line.start && m_caret <= line.end) {
+            const int cx = xForPos(line, m_caret) - xOffset;
+            painter.drawLine(cx, y, cx, y + lineHeight - 1);
+        }
+        start = next;
+    }
+
+    QScrollBar *hbar = horizontalScrollBar();
+    if (widest - viewport()->width() > hbar->maximum()) {
+        hbar->setRange(0, widest - viewport()->width() + CARET_MARGIN);
+        hbar->setPageStep(viewport()->width());
+    }
+}
+
+void PieceEditor::updateScrollBars()
+{
+    m_settingScroll = true;
+    m_scrollShift = 0;
+    while ((m_text.size() >> m_scrollShift) > INT_MAX / 2)
+        ++m_scrollShift;
+    QScrollBar *vbar = verticalScrollBar();
+    vbar->setRange(0, int(m_text.size() >> m_scrollShift));
+    // Шаг в байтах приблизительный: строки разной длины
+    vbar->setPageStep(qMax(1, int((qint64(visibleLines()) * 80) >> m_scrollShift)));
+    vbar->setValue(int(m_top >> m_scrollShift));
+    m_settingScroll = false;
+}
+
+void PieceEditor::scrollContentsBy(int, int dy)
+{
+    if (m_settingScroll)
+        return;
+    if (dy != 0)
+        m_top = lineStart(qMin(m_text.size(), qint64(verticalScrollBar()->value()) << m_scrollShift));
+    viewport()->update();
+}
+
+void PieceEditor::resizeEvent(QResizeEvent *event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    updateScrollBars();
+}
+
+void PieceEditor::wheelEvent(QWheelEvent *event)
+{
+    const int steps = event->angleDelta().y() / 120;
+    if (steps == 0) {
+        QAbstractScrollArea::wheelEvent(event);
+        return;
+    }
+    for (int i = 0; i < qAbs(steps) * WHEEL_LINES; ++i) {
+        const qint64 line = steps > 0 ? previousLine(m_top) : nextLine(m_top);
+        if (line < 0)
+            break;
+        m_top = line;
+    }
+    updateScrollBars();
+    viewport()->update();
+    event->accept();
+}
+
+void PieceEditor::ensureCaretVisible()
+{
+    const qint64 caretLine = lineStart(m_caret);
+    if (caretLine < m_top) {
+        m_top = caretLine;
+    } else {
+        const int lines = visibleLines();
+        int row = 0;
+        for (qint64 line = m_top; line >= 0 && line < caretLine && row < lines; ++row)
+            line = nextLine(line);
+        if (row >= lines) {
+            m_top = caretLine;
+            for (int i = 0; i < lines - 1; ++i) {
+                const qint64 previous = previousLine(m_top);
+                if (previous < 0)
+                    break;
+                m_top = previous;
+            }
+        }
+    }
+
+    QScrollBar *hbar = horizontalScrollBar();
+    const int x = xForPos(layoutLine(caretLine), m_caret);
+    if (x > hbar->maximum() + viewport()->width() - CARET_MARGIN)
+        hbar->setRange(0, x - viewport()->width() + CARET_MARGIN);
+    if (x < hbar->value())
+        hbar->setValue(qMax(0, x - CARET_MARGIN));
+    else if (x > hbar->value() + viewport()->width() - CARET_MARGIN)
+        hbar->setValue(x - viewport()->width() + CARET_MARGIN);
+
+    updateScrollBars();
+    viewport()->update();
+}
+
+void PieceEditor::moveCaret(qint64 pos, bool select, bool keepX)
+{
+    m_caret = qBound<qint64>(0, pos, m_text.size());
+    if (!select)
+        m_anchor = m_caret;
+    if (!keepX)
+        m_desiredX = xForPos(layoutLine(lineStart(m_caret)), m_caret);
+    ensureCaretVisible();
+}
+
+void PieceEditor::removeRange(qint64 pos, qint64 length)
+{
+    m_text.remove(pos, length);
+    if (m_top > pos)
+        m_top = lineStart(qMax(pos, m_top - length));
+    m_caret = m_anchor = pos;
+}
+
+void PieceEditor::replaceSelection(const QByteArray &text)
+{
+    qint64 pos = m_caret;
+    if (hasSelection()) {
+        pos = selectionStart();
+        removeRange(pos, selectionEnd() - pos);
+    }
+    m_text.insert(pos, text);
+    if (m_top > pos)
+        m_top += text.size();
+    moveCaret(pos + text.size(), false);
+}
+
+void PieceEditor::keyPressEvent(QKeyEvent *event)
+{
+    const bool shift = event->modifiers() & Qt::ShiftModifier;
+    const bool ctrl = event->modifiers() & Qt::ControlModifier;
+
+    if (event->matches(QKeySequence::SelectAll)) {
+        m_anchor = 0;
+        moveCaret(m_text.size(), true);
+        return;
+    }
+    if (event->matches(QKeySequence::Copy) || event->matches(QKeySequence::Cut)) {
+        if (hasSelection()) {
+            const QByteArray bytes = m_text.read(selectionStart(), selectionEnd() - selectionStart());
+            QApplication::clipboard()->setText(QString::fromUtf8(bytes));
+            if (event->matches(QKeySequence::Cut)) {
+                removeRange(selectionStart(), selectionEnd() - selectionStart());
+                moveCaret(m_caret, false);
+            }
+        }
+        return;
+    }
+    if (event->matches(QKeySequence::Paste)) {
+        // Вставленный текст получает переводы строк самого файла
+        QByteArray text = QApplication::clipboard()->text().toUtf8();
+        text.replace("\r\n", "\n");
+        if (m_lineEnding != "\n")
+            text.replace("\n", m_lineEnding);
+        if (!text.isEmpty())
+            replaceSelection(text);
+        return;
+    }
+
+    switch (event->key()) {
+    case Qt::Key_Left:
+        moveCaret(hasSelection() && !shift ? selectionStart() : previousChar(m_caret), shift);
+        return;
+    case Qt::Key_Right:
+        moveCaret(hasSelection() && !shift ? selectionEnd() : nextChar(m_caret), shift);
+        return;
+    case Qt::Key_Up:
+    case Qt::Key_Down:
+    case Qt::Key_PageUp:
+    case Qt::Key_PageDown: {
+        const bool up = event->key() == Qt::Key_Up || event->key() == Qt::Key_PageUp;
+        const bool page = event->key() == Qt::Key_PageUp || event->key() == Qt::Key_PageDown;
+        qint64 line = lineStart(m_caret);
+        for (int i = 0; i < (page ? visibleLines() : 1); ++i) {
+            const qint64 target = up ? previousLine(line) : nextLine(line);
+            if (target < 0)
+                break;
+            line = target;
+        }
+        moveCaret(posForX(layoutLine(line), m_desiredX), shift, true);
+        return;
+    }
+    case Qt::Key_Home:
+        moveCaret(ctrl ? 0 : lineStart(m_caret), shift);
+        return;
+    case Qt::Key_End:
+        moveCaret(ctrl ? m_text.size() : contentEnd(lineStart(m_caret)), shift);
+        return;
+    case Qt::Key_Backspace:
+        if (hasSelection())
+            replaceSelection(QByteArray());
+        else if (m_caret > 0) {
+            const qint64 from = previousChar(m_caret);
+            removeRange(from, m_caret - from);
+            moveCaret(from, false);
+        }
+        return;
+    case Qt::Key_Delete:
+        if (hasSelection())
+            replaceSelection(QByteArray());
+        else if (m_caret < m_text.size()) {
+            removeRange(m_caret, nextChar(m_caret) - m_caret);
+            moveCaret(m_caret, false);
+        }
+        return;
+    case Qt::Key_Return:
+    case Qt::Key_Enter:
+        replaceSelection(m_lineEnding);
+        return;
+    case Qt::Key_Tab:
+        replaceSelection("\t");
+        return;
+    default:
+        break;
+    }
+
+    const QString text = event->text();
+    if (!ctrl && !text.isEmpty() && text.at(0).isPrint()) {
+        replaceSelection(text.toUtf8());
+        return;
+    }
+    QAbstractScrollArea::keyPressEvent(event);
+}
+
+void PieceEditor::mousePressEvent(QMouseEvent *event)
+{
+    if (event->button() != Qt::LeftButton)
+        return;
+    moveCaret(posAt(event->pos()), event->modifiers() & Qt::ShiftModifier);
+}
+
+void PieceEditor::mouseMoveEvent(QMouseEvent *event)
+{
+    if (event->buttons() & Qt::LeftButton)
+        moveCaret(posAt(event->pos()), true);
+}
@@ -0,0 +1,75 @@
+#ifndef PIECEEDITOR_H
+#define PIECEEDITOR_H
+
+#include <QAbstractScrollArea>
+#include <QByteArray>
+#include <QVector>
+
+#include "piecetable.h"
+
+// Редактор текста поверх PieceTable. Рисует только видимые строки и не
+// строит индекс строк: вертикальная прокрутка идет по байтовому смещению,
+// строка находится поиском ближайшего перевода строки. Текст показывается
+// как UTF-8; байты, не являющиеся UTF-8, видны как замены, но остаются
+// в файле нетронутыми, пока их не удалить.
+class PieceEditor : public QAbstractScrollArea {
+public:
+    explicit PieceEditor(QWidget *parent = nullptr);
+
+    bool open(const QString &fileName, QString *error = nullptr);
+    bool save(QString *error = nullptr);
+    bool isModified() const { return m_text.isModified(); }
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void scrollContentsBy(int dx, int dy) override;
+    // Tab вставляет табуляцию, а не переводит фокус
+    bool focusNextPrevChild(bool) override { return false; }
+
+private:
+    // Раскладка одной строки: границы символов в байтах и пикселях
+    struct LineLayout {
+        qint64 start = 0;
+        qint64 end = 0;  // до "\r\n" или "\n"
+        QString text;
+        QVector<int> bytes;  // смещение символа от start
+        QVector<int> xs;     // левый край символа; последний - конец строки
+    };
+
+    qint64 lineStart(qint64 pos) const;
+    qint64 contentEnd(qint64 start) const;
+    qint64 nextLine(qint64 start) const;
+    qint64 previousLine(qint64 start) const;
+    qint64 previousChar(qint64 pos) const;
+    qint64 nextChar(qint64 pos) const;
+    LineLayout layoutLine(qint64 start) const;
+    int xForPos(const LineLayout &line, qint64 pos) const;
+    qint64 posForX(const LineLayout &line, int x) const;
+    qint64 posAt(const QPoint &point) const;
+    int visibleLines() const;
+
+    bool hasSelection() const { return m_anchor != m_caret; }
+    qint64 selectionStart() const { return qMin(m_anchor, m_caret); }
+    qint64 selectionEnd() const { return qMax(m_anchor, m_caret); }
+    void moveCaret(qint64 pos, bool select, bool keepX = false);
+    void replaceSelection(const QByteArray &text);
+    void removeRange(qint64 pos, qint64 length);
+    void ensureCaretVisible();
+    void updateScrollBars();
+
+    PieceTable m_text;
+    QByteArray m_lineEnding;
+    qint64 m_top;     // начало первой видимой строки
+    qint64 m_caret;
+    qint64 m_anchor;  // второй конец выделения
+    int m_desiredX;   // столбец для перемещения вверх-вниз
+    int m_scrollShift;  // байтовое смещение >> shift помещается в int
+    bool m_settingScroll;
+};
+
+#endif // PIECEEDITOR_H
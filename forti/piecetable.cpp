@@ -0,0 +1,230 @@
+#include "piecetable.h"
+
+#include <QSaveFile>
+
+#include <algorithm>
+#include <string.h>
+
+PieceTable::PieceTable()
+    : m_original(nullptr)
+    , m_originalSize(0)
+    , m_size(0)
+    , m_modified(false)
+{
+}
+
+PieceTable::~PieceTable()
+{
+    close();
+}
+
+void PieceTable::close()
+{
+    if (m_original)
+        m_file.unmap(reinterpret_cast<uchar *>(const_cast<char *>(m_original)));
+    m_original = nullptr;
+    m_originalSize = 0;
+    m_file.close();
+    m_add.clear();
+    m_pieces.clear();
+    m_offsets.clear();
+    m_size = 0;
+    m_modified = false;
+}
+
+bool PieceTable::open(const QString &fileName, QString *error)
+{
+    close();
+    m_fileName = fileName;
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        if (error)
+            *error = m_file.errorString();
+        return false;
+    }
+    m_originalSize = m_file.size();
+    if (m_originalSize > 0) {
+        m_original = reinterpret_cast<const char *>(m_file.map(0, m_originalSize));
+        if (!m_original) {
+            if (error)
+                *error = m_file.errorString();
+            m_file.close();
+            m_originalSize = 0;
+            return false;
+        }
+        m_pieces.append(Piece{ false, 0, m_originalSize });
+    }
+    updateOffsets();
+    return true;
+}
+
+const char *PieceTable::pieceData(const Piece &piece) const
+{
+    return (piece.added ? m_add.constData() : m_original) + piece.start;
+}
+
+void PieceTable::updateOffsets()
+{
+    m_offsets.resize(m_pieces.size());
+    qint64 offset = 0;
+    for (int i = 0; i < m_pieces.size(); ++i) {
+        m_offsets[i] = offset;
+        offset += m_pieces[i].length;
+    }
+    m_size = offset;
+}
+
+// Кусок, содержащий позицию pos (0 <= pos < size)
+int PieceTable::findPiece(qint64 pos) const
+{
+    return int(std::upper_bound(m_offsets.constBegin(), m_offsets.constEnd(), pos)
+               - m_offsets.constBegin()) - 1;
+}
+
+// Граница кусков ровно в pos
+void PieceTable::splitAt(qint64 pos)
+{
+    if (pos <= 0 || pos >= m_size)
+        return;
+    const int i = findPiece(pos);
+    const qint64 head = pos - m_offsets[i];
+    if (head == 0)
+        return;
+    Piece tail = m_pieces[i];
+    tail.start += head;
+    tail.length -= head;
+    m_pieces[i].length = head;
+    m_pieces.insert(i + 1, tail);
+    m_offsets.insert(i + 1, pos);
+}
+
+char PieceTable::at(qint64 pos) const
+{
+    const int i = findPiece(pos);
+    return pieceData(m_pieces[i])[pos - m_offsets[i]];
+}
+
+QByteArray PieceTable::read(qint64 pos, qint64 length) const
+{
+    QByteArray out;
+    if (pos < 0 || pos >= m_size || length <= 0)
+        return out;
+    length = qMin(length, m_size - pos);
+    out.reserve(int(length));
+    for (int i = findPiece(pos); i < m_pieces.size() && length > 0; ++i) {
+        const qint64 skip = pos - m_offsets[i];
+        const qint64 n = qMin(length, m_pieces[i].length - skip);
+        out.append(pieceData(m_pieces[i]) + skip, int(n));
+        pos += n;
+        length -= n;
+    }
+    return out;
+}
+
+qint64 PieceTable::indexOf(char c, qint64 from) const
+{
+    if (from < 0)
+        from = 0;
+    if (from >= m_size)
+        return -1;
+    for (int i = findPiece(from); i < m_pieces.size(); ++i) {
+        const qint64 skip = qMax<qint64>(0, from - m_offsets[i]);
+        const char *data = pieceData(m_pieces[i]);
+        const void *hit = memchr(data + skip, c, size_t(m_pieces[i].length - skip));
+        if (hit)
+            return m_offsets[i] + (static_cast<const char *>(hit) - data);
+    }
+    return -1;
+}
+
+qint64 PieceTable::lastIndexOf(char c, qint64 before) const
+{
+    before = qMin(before, m_size);
+    if (before <= 0)
+        return -1;
+    for (int i = findPiece(before - 1); i >= 0; --i) {
+        const qint64 end = qMin(m_pieces[i].length, before - m_offsets[i]);
+        const char *data = pieceData(m_pieces[i]);
+        const void *hit = memrchr(data, c, size_t(end));
+        if (hit)
+            return m_offsets[i] + (static_cast<const char *>(hit) - data);
+    }
+    return -1;
+}
+
+void PieceTable::insert(qint64 pos, const QByteArray &text)
+{
+    if (text.isEmpty() || pos < 0 || pos > m_size)
+        return;
+    m_modified = true;
+
+    // Набор подряд продолжает последний кусок буфера добавлений
+    if (pos > 0) {
+        const int i = findPiece(pos - 1);
+        Piece &p = m_pieces[i];
+        if (p.added && m_offsets[i] + p.length == pos && p.start + p.length == m_add.size()) {
+            m_add.append(text);
+            p.length += text.size();
+            for (int j = i + 1; j < m_offsets.size(); ++j)
+                m_offsets[j] += text.size();
+            m_size += text.size();
+            return;
+        }
+    }
+
+    const Piece piece{ true, m_add.size(), text.size() };
+    m_add.append(text);
+    if (pos == m_size) {
+        m_pieces.append(piece);
+    } else {
+        splitAt(pos);
+        m_pieces.insert(findPiece(pos), piece);
+    }
+    updateOffsets();
+}
+
+void PieceTable::remove(qint64 pos, qint64 length)
+{
+    if (pos < 0 || pos >= m_size || length <= 0)
+        return;
+    length = qMin(length, m_size - pos);
+    m_modified = true;
+    splitAt(pos);
+    splitAt(pos + length);
+    const int first = findPiece(pos);
+    int last = first;
+    for (qint64 removed = 0; removed < length; ++last)
+        removed += m_pieces[last].length;
+    m_pieces.remove(first, last - first);
+    updateOffsets();
+}
+
+QByteArray PieceTable::lineEnding() const
+{
+    const qint64 newline = indexOf('\n', 0);
+    if (newline > 0 && at(newline - 1) == '\r')
+        return QByteArray("\r\n");
+    return QByteArray("\n");
+}
+
+bool PieceTable::save(QString *error)
+{
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+    for (const Piece &piece : m_pieces) {
+        if (file.write(pieceData(piece), piece.length) != piece.length)
+            break;
+    }
+    // commit() сбрасывает данные на диск и заменяет файл переименованием;
+    // старое отображение остается действительным до повторного открытия
+    if (!file.commit()) {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+    return open(m_fileName, error);
+}
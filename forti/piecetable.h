@@ -0,0 +1,73 @@
+#ifndef PIECETABLE_H
+#define PIECETABLE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QVector>
+
+// Текст как таблица кусков поверх отображенного в память исходного файла.
+//
+// Исходный файл не читается целиком и не копируется: открытие - это mmap.
+// Вставленный текст дописывается в буфер добавлений, документ - список
+// кусков (исходный файл или буфер, начало, длина). Правка меняет только
+// список кусков, поэтому байты вне правок сохраняются как есть: кодировка
+// и переводы строк файла не меняются.
+//
+// Позиции и длины - в байтах. Файл не должен меняться снаружи, пока
+// открыт: отображение смотрит на его страницы.
+class PieceTable {
+public:
+    PieceTable();
+    ~PieceTable();
+
+    bool open(const QString &fileName, QString *error = nullptr);
+    const QString &fileName() const { return m_fileName; }
+
+    qint64 size() const { return m_size; }
+    bool isModified() const { return m_modified; }
+
+    char at(qint64 pos) const;
+    QByteArray read(qint64 pos, qint64 length) const;
+    // Первое вхождение c не раньше from, иначе -1
+    qint64 indexOf(char c, qint64 from) const;
+    // Последнее вхождение c раньше before, иначе -1
+    qint64 lastIndexOf(char c, qint64 before) const;
+
+    void insert(qint64 pos, const QByteArray &text);
+    void remove(qint64 pos, qint64 length);
+
+    // Перевод строки, встреченный в файле первым ("\r\n" или "\n")
+    QByteArray lineEnding() const;
+
+    // Запись во временный файл рядом, fsync и переименование поверх
+    // исходного (QSaveFile); затем файл открывается заново
+    bool save(QString *error = nullptr);
+
+private:
+    Q_DISABLE_COPY(PieceTable)
+
+    struct Piece {
+        bool added;    // кусок из буфера добавлений
+        qint64 start;
+        qint64 length;
+    };
+
+    const char *pieceData(const Piece &piece) const;
+    int findPiece(qint64 pos) const;
+    void splitAt(qint64 pos);
+    void updateOffsets();
+    void close();
+
+    QString m_fileName;
+    QFile m_file;
+    const char *m_original;
+    qint64 m_originalSize;
+    QByteArray m_add;
+    QVector<Piece> m_pieces;
+    QVector<qint64> m_offsets;  // начало каждого куска в документе
+    qint64 m_size;
+    bool m_modified;
+};
+
+#endif // PIECETABLE_H
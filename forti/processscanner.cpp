@@ -0,0 +1,283 @@
+#include "processscanner.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+namespace {
+
+const char DELETED_SUFFIX[] = " (deleted)";
+
+// Каталоги, из которых обычные программы код не загружают
+const char *const TEMP_PREFIXES[] = { "/tmp/", "/var/tmp/", "/dev/shm/" };
+
+qint64 nanoseconds(const struct timespec &ts)
+{
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+bool isPid(const char *name)
+{
+    if (!*name)
+        return false;
+    for (; *name; ++name) {
+        if (*name < '0' || *name > '9')
+            return false;
+    }
+    return true;
+}
+
+// Следующее поле строки maps, разделенное пробелами
+QByteArray field(const char *&p, const char *end)
+{
+    while (p < end && *p == ' ')
+        ++p;
+    const char *start = p;
+    while (p < end && *p != ' ')
+        ++p;
+    return QByteArray::fromRawData(start, int(p - start));
+}
+
+void addNote(ProcessInfo &process, const QByteArray &note)
+{
+    if (!process.notes.contains(note))
+        process.notes.append(note);
+}
+
+} // namespace
+
+ProcessScanner::ProcessScanner()
+    : m_generation(0)
+{
+}
+
+bool ProcessScanner::readFile(const QByteArray &path, QByteArray &out)
+{
+    // Размер файлов /proc заранее неизвестен (stat сообщает 0)
+    out.resize(0);
+    const int fd = ::open(path.constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    int used = 0;
+    for (;;) {
+        if (out.size() - used < 4096)
+            out.resize(qMax(8192, out.size() * 2));
+        const ssize_t got = ::read(fd, out.data() + used, size_t(out.size() - used));
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0) {
+            ::close(fd);
+            out.resize(used);
+            return got == 0;
+        }
+        used += int(got);
+    }
+}
+
+bool ProcessScanner::refresh(const QByteArray &configKey)
+{
+    // Вердикты, полученные с другими правилами, недействительны
+    if (configKey != m_configKey) {
+        m_cache.clear();
+        m_configKey = configKey;
+    }
+    ++m_generation;
+    m_objects.clear();
+    m_processes.clear();
+    m_pending.clear();
+    m_index.clear();
+    m_pathObjects.clear();
+    m_stats = ProcessScanStats();
+
+    DIR *dir = ::opendir("/proc");
+    if (!dir)
+        return false;
+    while (struct dirent *e = ::readdir(dir)) {
+        if (isPid(e->d_name))
+            scanProcess(QByteArray(e->d_name));
+    }
+    ::closedir(dir);
+
+    // Файлы, на которых больше не работает ни один процесс, забываются
+    for (auto it = m_cache.begin(); it != m_cache.end();) {
+        if (it.value().seen != m_generation)
+            it = m_cache.erase(it);
+        else
+            ++it;
+    }
+    m_stats.objects = m_objects.size();
+    m_stats.pending = m_pending.size();
+    return true;
+}
+
+void ProcessScanner::scanProcess(const QByteArray &pid)
+{
+    const QByteArray base = "/proc/" + pid;
+    const QByteArray exeLink = base + "/exe";
+    char target[PATH_MAX];
+    const ssize_t length = ::readlink(exeLink.constData(), target, sizeof(target) - 1);
+    if (length < 0) {
+        // У потоков ядра программы нет; процесс мог и завершиться
+        if (errno == EACCES || errno == EPERM) {
+            ++m_stats.processes;
+            ++m_stats.inaccessible;
+        }
+        return;
+    }
+    ++m_stats.processes;
+
+    ProcessInfo process;
+    process.pid = pid.toInt();
+    if (readFile(base + "/comm", m_buffer))
+        process.name = m_buffer.trimmed();
+
+    const QByteArray path(target, int(length));
+    struct stat st;
+    if (::stat(exeLink.constData(), &st) == 0) {
+        const bool deleted = path.endsWith(DELETED_SUFFIX);
+        // Удаленная программа доступна только через ссылку процесса
+        process.exe = addObject(Key(quint64(st.st_dev), quint64(st.st_ino)), &st, path,
+                                deleted ? exeLink : path, deleted);
+        process.objects.append(process.exe);
+        if (deleted)
+            addNote(process, "программа удалена с диска");
+    }
+    scanMaps(pid, process);
+    m_processes.append(process);
+}
+
+void ProcessScanner::scanMaps(const QByteArray &pid, ProcessInfo &process)
+{
+    if (!readFile("/proc/" + pid + "/maps", m_buffer)) {
+        ++m_stats.inaccessible;
+        return;
+    }
+
+    // адрес права смещение устройство inode путь
+    const char *p = m_buffer.constData();
+    const char *const bufferEnd = p + m_buffer.size();
+    while (p < bufferEnd) {
+        const char *eol = static_cast<const char *>(memchr(p, '\n', size_t(bufferEnd - p)));
+        const char *end = eol ? eol : bufferEnd;
+        const char *cursor = p;
+        p = end + 1;
+
+        const QByteArray range = field(cursor, end);
+        const QByteArray perms = field(cursor, end);
+        field(cursor, end);
+        const QByteArray device = field(cursor, end);
+        const QByteArray inode = field(cursor, end);
+        while (cursor < end && *cursor == ' ')
+            ++cursor;
+        const QByteArray path(cursor, int(end - cursor));
+
+        // Анонимная память (в том числе JIT) и [vdso] не проверяются
+        if (perms.size() < 4 || perms.at(2) != 'x' || path.isEmpty() || path.at(0) == '[')
+            continue;
+        const quint64 ino = inode.toULongLong();
+        if (ino == 0)
+            continue;
+
+        const bool memfd = path.startsWith("/memfd:");
+        const bool deleted = path.endsWith(DELETED_SUFFIX);
+        if (memfd)
+            addNote(process, "исполняемый код из memfd: " + path);
+        else if (deleted)
+            addNote(process, "исполняемое отображение удаленного файла: " + path);
+        for (const char *prefix : TEMP_PREFIXES) {
+            if (path.startsWith(prefix))
+                addNote(process, "исполняемый код из временного каталога: " + path);
+        }
+        if (perms.at(1) == 'w')
+            addNote(process, "файл отображен с правами записи и исполнения: " + path);
+
+        int object = -1;
+        if (!memfd && !deleted) {
+            auto it = m_pathObjects.constFind(path);
+            if (it != m_pathObjects.constEnd()) {
+                object = it.value();
+            } else {
+                struct stat st;
+                // Файл по этому пути мог быть заменен после загрузки
+                if (::stat(path.constData(), &st) == 0 && quint64(st.st_ino) == ino)
+                    object = addObject(Key(quint64(st.st_dev), quint64(st.st_ino)), &st, path, path, false);
+                m_pathObjects.insert(path, object);
+            }
+        }
+        if (object < 0 && process.exe >= 0 && m_objects[process.exe].ino == ino)
+            object = process.exe;
+        if (object < 0) {
+            // Удаленный или замененный файл читается через отображение процесса
+            const int colon = device.indexOf(':');
+            const quint64 dev = makedev(device.left(colon).toUInt(nullptr, 16),
+                                        device.mid(colon + 1).toUInt(nullptr, 16));
+            const QByteArray mapFile = "/proc/" + pid + "/map_files/" + range;
+            struct stat st;
+            const bool statOk = ::stat(mapFile.constData(), &st) == 0 && quint64(st.st_ino) == ino;
+            const Key key = statOk ? Key(quint64(st.st_dev), ino) : Key(dev, ino);
+            object = addObject(key, statOk ? &st : nullptr, path, mapFile, true);
+        }
+        if (!process.objects.contains(object))
+            process.objects.append(object);
+    }
+}
+
+int ProcessScanner::addObject(const Key &key, const struct stat *st, const QByteArray &path,
+                              const QByteArray &scanPath, bool deleted)
+{
+    auto found = m_index.constFind(key);
+    if (found != m_index.constEnd())
+        return found.value();
+
+    ProcessObject object;
+    object.dev = key.first;
+    object.ino = key.second;
+    object.path = path;
+    object.scanPath = scanPath;
+    object.deleted = deleted;
+    if (st) {
+        object.size = st->st_size;
+        object.mtimeNs = nanoseconds(st->st_mtim);
+        object.ctimeNs = nanoseconds(st->st_ctim);
+    }
+
+    const int index = m_objects.size();
+    auto it = m_cache.find(key);
+    if (st && it != m_cache.end() && it.value().size == object.size
+        && it.value().mtimeNs == object.mtimeNs && it.value().ctimeNs == object.ctimeNs) {
+        it.value().seen = m_generation;
+        object.verdict = it.value().verdict;
+        object.cached = true;
+        ++m_stats.cached;
+    } else {
+        m_pending.append(index);
+    }
+    m_objects.append(object);
+    m_index.insert(key, index);
+    return index;
+}
+
+void ProcessScanner::setVerdict(int object, const ScanVerdict &verdict)
+{
+    ProcessObject &o = m_objects[object];
+    o.verdict = verdict;
+    o.scanned = true;
+    // Непрочитанный файл проверяется снова при следующем обходе
+    if (verdict.level != ScanVerdict::Failed && o.size >= 0)
+        m_cache.insert(Key(o.dev, o.ino), CacheEntry{ o.size, o.mtimeNs, o.ctimeNs, verdict, m_generation });
+}
+
+bool ProcessScanner::isFlagged(const ProcessInfo &process) const
+{
+    for (int object : process.objects) {
+        if (m_objects[object].verdict.isFlagged())
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,107 @@
+#ifndef PROCESSSCANNER_H
+#define PROCESSSCANNER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QVector>
+
+#include "filescanner.h"
+
+struct stat;
+
+// Исполняемый файл, на котором работают процессы: программа или
+// отображенная с правом исполнения библиотека
+struct ProcessObject {
+    quint64 dev = 0;
+    quint64 ino = 0;
+    qint64 size = -1;      // -1 - файл недоступен для stat
+    qint64 mtimeNs = 0;
+    qint64 ctimeNs = 0;
+    QByteArray path;       // путь для показа (у удаленных - " (deleted)")
+    QByteArray scanPath;   // откуда читать содержимое
+    bool deleted = false;
+    bool cached = false;   // вердикт взят из кэша
+    bool scanned = false;
+    ScanVerdict verdict;
+};
+
+struct ProcessInfo {
+    int pid = 0;
+    QByteArray name;        // /proc/PID/comm
+    int exe = -1;           // объект программы
+    QVector<int> objects;   // программа и исполняемые отображения
+    QList<QByteArray> notes;  // подозрительные отображения (UTF-8)
+};
+
+struct ProcessScanStats {
+    int processes = 0;
+    int inaccessible = 0;   // нет прав на /proc/PID/exe или maps
+    int objects = 0;        // различных (dev, inode)
+    int cached = 0;
+    int pending = 0;
+};
+
+// Проверка запущенных процессов.
+//
+// refresh() обходит /proc: программу каждого процесса (/proc/PID/exe)
+// и исполняемые отображения из /proc/PID/maps. Каждый файл учитывается
+// один раз по (dev, inode), сколько бы процессов его ни использовали.
+// Удаленная программа, которая еще работает, читается через
+// /proc/PID/exe, удаленная библиотека - через /proc/PID/map_files.
+// Отображения из memfd, временных каталогов и с правами записи и
+// исполнения отмечаются у процесса без чтения файла.
+//
+// Вердикты хранятся в памяти по (dev, inode) вместе с размером, mtime
+// и ctime; повторный refresh() проверяет файл одним stat и читает
+// только новые и измененные. Записи о файлах, которых больше нет среди
+// процессов, удаляются; смена правил (configKey) сбрасывает кэш.
+class ProcessScanner {
+public:
+    ProcessScanner();
+
+    // false, если /proc не читается
+    bool refresh(const QByteArray &configKey);
+
+    const QVector<ProcessObject> &objects() const { return m_objects; }
+    const QVector<ProcessInfo> &processes() const { return m_processes; }
+    // Объекты без вердикта в кэше, их нужно проверить и вернуть в setVerdict()
+    const QVector<int> &pending() const { return m_pending; }
+    void setVerdict(int object, const ScanVerdict &verdict);
+
+    bool isFlagged(const ProcessInfo &process) const;
+    const ProcessScanStats &stats() const { return m_stats; }
+
+private:
+    typedef QPair<quint64, quint64> Key;  // dev, inode
+
+    struct CacheEntry {
+        qint64 size;
+        qint64 mtimeNs;
+        qint64 ctimeNs;
+        ScanVerdict verdict;
+        quint32 seen;  // номер последнего refresh(), в котором встретился файл
+    };
+
+    void scanProcess(const QByteArray &pid);
+    int addObject(const Key &key, const struct stat *st, const QByteArray &path,
+                  const QByteArray &scanPath, bool deleted);
+    void scanMaps(const QByteArray &pid, ProcessInfo &process);
+    bool readFile(const QByteArray &path, QByteArray &out);
+
+    QHash<Key, CacheEntry> m_cache;
+    QByteArray m_configKey;
+    quint32 m_generation;
+
+    // Текущий проход
+    QVector<ProcessObject> m_objects;
+    QVector<ProcessInfo> m_processes;
+    QVector<int> m_pending;
+    QHash<Key, int> m_index;
+    QHash<QByteArray, int> m_pathObjects;  // путь отображения -> объект, stat один раз за проход
+    ProcessScanStats m_stats;
+    QByteArray m_buffer;
+};
+
+#endif // PROCESSSCANNER_H
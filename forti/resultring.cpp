@@ -0,0 +1,89 @@
+#include "resultring.h"
+
+#include <new>
+#include <string.h>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+              "позиции кольца должны быть lock-free для работы между процессами");
+
+int ResultRing::segmentSize(quint32 capacity)
+{
+    return int(sizeof(Header) + capacity);
+}
+
+ResultRing ResultRing::create(void *memory, int size)
+{
+    ResultRing ring;
+    if (!memory || size <= int(sizeof(Header)))
+        return ring;
+    // Емкость - наибольшая степень двойки, помещающаяся в сегмент
+    quint32 capacity = 1;
+    while (quint64(capacity) * 2 <= quint64(size) - sizeof(Header))
+        capacity *= 2;
+
+    Header *header = new (memory) Header;
+    header->magic = Magic;
+    header->capacity = capacity;
+    header->writePos.store(0, std::memory_order_relaxed);
+    header->progress.store(0, std::memory_order_relaxed);
+    header->readPos.store(0, std::memory_order_release);
+    ring.m_header = header;
+    ring.m_data = static_cast<char *>(memory) + sizeof(Header);
+    return ring;
+}
+
+ResultRing ResultRing::attach(void *memory, int size)
+{
+    ResultRing ring;
+    if (!memory || size <= int(sizeof(Header)))
+        return ring;
+    Header *header = static_cast<Header *>(memory);
+    if (header->magic != Magic || sizeof(Header) + header->capacity > quint64(size))
+        return ring;
+    ring.m_header = header;
+    ring.m_data = static_cast<char *>(memory) + sizeof(Header);
+    return ring;
+}
+
+bool ResultRing::write(quint64 id, const ScanVerdict &verdict)
+{
+    if (!m_header)
+        return false;
+    const quint16 detailLen = quint16(qMin(verdict.detail.size(), int(MaxDetail)));
+    const quint32 len = (RecordHeaderSize + detailLen + 7) & ~7u;
+    const quint32 capacity = m_header->capacity;
+    const quint64 mask = capacity - 1;
+
+    quint64 head = m_header->writePos.load(std::memory_order_relaxed);
+    const quint64 tail = m_header->readPos.load(std::memory_order_acquire);
+    const quint32 offset = quint32(head & mask);
+    const quint32 contiguous = capacity - offset;
+    const quint64 need = len + (contiguous < len ? contiguous : 0);
+    if (capacity - (head - tail) < need)
+        return false;
+
+    if (contiguous < len) {
+        // Запись не переходит через конец буфера: хвост заполняется пустышкой
+        const quint32 pad = contiguous | PadFlag;
+        memcpy(m_data + offset, &pad, sizeof(pad));
+        head += contiguous;
+    }
+
+    char *rec = m_data + (head & mask);
+    memset(rec, 0, RecordHeaderSize);
+    memcpy(rec, &len, sizeof(len));
+    memcpy(rec + 8, &id, sizeof(id));
+    rec[16] = char(verdict.level);
+    rec[17] = char(verdict.reason);
+    memcpy(rec + 18, &detailLen, sizeof(detailLen));
+    rec[20] = char(verdict.coverage);
+    memcpy(rec + 24, &verdict.size, sizeof(verdict.size));
+    memcpy(rec + 32, &verdict.mtime, sizeof(verdict.mtime));
+    if (verdict.hash.size() >= HashSize)
+        memcpy(rec + 40, verdict.hash.constData(), HashSize);
+    if (detailLen)
+        memcpy(rec + RecordHeaderSize, verdict.detail.constData(), detailLen);
+
+    m_header->writePos.store(head + len, std::memory_order_release);
+    return true;
+}
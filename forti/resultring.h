@@ -0,0 +1,109 @@
+#ifndef RESULTRING_H
+#define RESULTRING_H
+
+#include <QByteArray>
+
+#include <atomic>
+#include <string.h>
+
+#include "filescanner.h"
+
+// Кольцевой буфер результатов в разделяемой памяти.
+// Один писатель (процесс-обработчик) и один читатель (основной процесс),
+// синхронизация только через атомарные позиции, без блокировок и каналов.
+// Запись: [u32 длина|флаг][u32 резерв][u64 id][u8 уровень][u8 причина]
+//         [u16 длина подробностей][u8 полнота проверки][3 байта резерв]
+//         [i64 размер][i64 mtime]
+//         [16 байт хеша][подробности], выровнено на 8 байт.
+class ResultRing {
+public:
+    ResultRing() : m_header(nullptr), m_data(nullptr) {}
+
+    static const quint32 DefaultCapacity = 1u << 20;
+    // Подробности длиннее обрезаются при записи
+    static const int MaxDetail = 4096;
+
+    // Размер сегмента для заданной емкости данных
+    static int segmentSize(quint32 capacity = DefaultCapacity);
+
+    // Разметка нового сегмента (в основном процессе)
+    static ResultRing create(void *memory, int size);
+    // Подключение к размеченному сегменту (в обработчике)
+    static ResultRing attach(void *memory, int size);
+
+    bool isValid() const { return m_header != nullptr; }
+
+    bool write(quint64 id, const ScanVerdict &verdict);
+
+    // Прочитано обработчиком байт файлов с запуска: растет и во время
+    // чтения одного большого файла, пока результата еще нет
+    std::atomic<quint64> *progressCounter() { return m_header ? &m_header->progress : nullptr; }
+    quint64 progress() const { return m_header ? m_header->progress.load(std::memory_order_relaxed) : 0; }
+
+    // Чтение всех готовых записей; возвращает их количество
+    template <typename Handler>
+    int drain(Handler handler);
+
+private:
+    struct Header {
+        quint32 magic;
+        quint32 capacity;
+        char pad0[56];
+        std::atomic<quint64> writePos;
+        char pad1[56];
+        std::atomic<quint64> readPos;
+        char pad2[56];
+        std::atomic<quint64> progress;
+        char pad3[56];
+    };
+
+    static const quint32 Magic = 0x46525232;  // "FRR2"
+    static const quint32 PadFlag = 0x80000000u;
+    static const int RecordHeaderSize = 56;
+    static const int HashSize = 16;
+
+    Header *m_header;
+    char *m_data;
+};
+
+template <typename Handler>
+int ResultRing::drain(Handler handler)
+{
+    if (!m_header)
+        return 0;
+    const quint64 mask = m_header->capacity - 1;
+    quint64 tail = m_header->readPos.load(std::memory_order_relaxed);
+    const quint64 head = m_header->writePos.load(std::memory_order_acquire);
+    int count = 0;
+    while (tail < head) {
+        const char *rec = m_data + (tail & mask);
+        quint32 len;
+        memcpy(&len, rec, sizeof(len));
+        if (len & PadFlag) {
+            tail += len & ~PadFlag;
+            continue;
+        }
+        quint64 id;
+        memcpy(&id, rec + 8, sizeof(id));
+        ScanVerdict verdict;
+        verdict.level = quint8(rec[16]);
+        verdict.reason = quint8(rec[17]);
+        verdict.coverage = quint8(rec[20]);
+        quint16 detailLen;
+        memcpy(&detailLen, rec + 18, sizeof(detailLen));
+        memcpy(&verdict.size, rec + 24, sizeof(verdict.size));
+        memcpy(&verdict.mtime, rec + 32, sizeof(verdict.mtime));
+        static const char zeroHash[HashSize] = {};
+        if (memcmp(rec + 40, zeroHash, HashSize) != 0)
+            verdict.hash = QByteArray(rec + 40, HashSize);
+        if (detailLen)
+            verdict.detail = QByteArray(rec + RecordHeaderSize, detailLen);
+        handler(id, verdict);
+        tail += len;
+        ++count;
+    }
+    m_header->readPos.store(tail, std::memory_order_release);
+    return count;
+}
+
+#endif // RESULTRING_H
@@ -0,0 +1,1655 @@
+#include "rulecompiler.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+
+#include "filescanner.h"
+
+namespace {
+
+const quint32 CACHE_MAGIC = 0x31435246;  // "FRC1"
+const quint32 CACHE_VERSION = 2;
+const quint32 NO_STATE = 0xffffffffu;
+const qint64 MAX_PATTERN_STATES = 100000;
+const qint64 MAX_TOTAL_STATES = 4000000;
+const int MAX_STACK = 256;
+const int MAX_REPEAT = 1000;
+const int MAX_NESTING = 64;
+
+const char BUILTIN_RULES[] =
+    "rule EICAR_Test_File {\n"
+    "  meta:\n"
+    "    description = \"тестовый файл EICAR\"\n"
+    "    severity = \"malicious\"\n"
+    "  strings:\n"
+    "    $s = \"EICAR-STANDARD-ANTIVIRUS-TEST-FILE!\"\n"
+    "  condition:\n"
+    "    $s in (0..64) and filesize < 128\n"
+    "}\n";
+
+struct ByteSet {
+    quint64 bits[4] = { 0, 0, 0, 0 };
+
+    void add(int b) { bits[b >> 6] |= quint64(1) << (b & 63); }
+    bool has(int b) const { return bits[b >> 6] & (quint64(1) << (b & 63)); }
+    void addRange(int lo, int hi)
+    {
+        for (int b = lo; b <= hi; ++b)
+            add(b);
+    }
+    void addAll(const ByteSet &other)
+    {
+        for (int i = 0; i < 4; ++i)
+            bits[i] |= other.bits[i];
+    }
+    void invert()
+    {
+        for (int i = 0; i < 4; ++i)
+            bits[i] = ~bits[i];
+    }
+    void addCaseVariants()
+    {
+        for (int b = 'a'; b <= 'z'; ++b) {
+            if (has(b) || has(b - 32)) {
+                add(b);
+                add(b - 32);
+            }
+        }
+    }
+    QByteArray toBytes() const
+    {
+        QByteArray out(32, '\0');
+        for (int b = 0; b < 256; ++b) {
+            if (has(b))
+                out[b >> 3] = char(uchar(out[b >> 3]) | (1u << (b & 7)));
+        }
+        return out;
+    }
+    static ByteSet any()
+    {
+        ByteSet s;
+        s.invert();
+        return s;
+    }
+    static ByteSet single(int b)
+    {
+        ByteSet s;
+        s.add(b);
+        return s;
+    }
+};
+
+// Дерево разбора строки: одно представление для текста, hex и regex
+struct AstNode {
+    enum Kind { Set, Concat, Alt, Repeat };
+    Kind kind = Concat;
+    ByteSet set;
+    QVector<int> kids;
+    int min = 0;
+    int max = 0;  // -1 - без ограничения
+};
+
+class Ast {
+public:
+    int set(const ByteSet &s)
+    {
+        AstNode n;
+        n.kind = AstNode::Set;
+        n.set = s;
+        return add(n);
+    }
+    int sequence(AstNode::Kind kind, const QVector<int> &kids)
+    {
+        if (kids.size() == 1)
+            return kids.first();
+        AstNode n;
+        n.kind = kind;
+        n.kids = kids;
+        return add(n);
+    }
+    int repeat(int kid, int min, int max)
+    {
+        AstNode n;
+        n.kind = AstNode::Repeat;
+        n.kids.append(kid);
+        n.min = min;
+        n.max = max;
+        return add(n);
+    }
+    const AstNode &node(int i) const { return m_nodes[i]; }
+
+    void makeCaseless()
+    {
+        for (AstNode &n : m_nodes) {
+            if (n.kind == AstNode::Set)
+                n.set.addCaseVariants();
+        }
+    }
+
+    // Минимальная и максимальная длина совпадения (-1 - не ограничена)
+    void lengths(int i, qint64 &min, qint64 &max) const
+    {
+        const AstNode &n = m_nodes[i];
+        switch (n.kind) {
+        case AstNode::Set:
+            min = max = 1;
+            return;
+        case AstNode::Concat:
+            min = max = 0;
+            for (int kid : n.kids) {
+                qint64 kmin, kmax;
+                lengths(kid, kmin, kmax);
+                min += kmin;
+                max = (max < 0 || kmax < 0) ? -1 : max + kmax;
+            }
+            return;
+        case AstNode::Alt:
+            for (int k = 0; k < n.kids.size(); ++k) {
+                qint64 kmin, kmax;
+                lengths(n.kids[k], kmin, kmax);
+                if (k == 0) {
+                    min = kmin;
+                    max = kmax;
+                } else {
+                    min = qMin(min, kmin);
+                    max = (max < 0 || kmax < 0) ? -1 : qMax(max, kmax);
+                }
+            }
+            return;
+        case AstNode::Repeat: {
+            qint64 kmin, kmax;
+            lengths(n.kids.first(), kmin, kmax);
+            min = kmin * n.min;
+            if (n.max == 0 || kmax == 0)
+                max = 0;
+            else if (n.max < 0 || kmax < 0)
+                max = -1;
+            else
+                max = kmax * n.max;
+            return;
+        }
+        }
+    }
+
+    // Оценка числа состояний НКА до построения
+    qint64 cost(int i) const
+    {
+        const AstNode &n = m_nodes[i];
+        qint64 total = 1;
+        switch (n.kind) {
+        case AstNode::Set:
+            return 1;
+        case AstNode::Concat:
+        case AstNode::Alt:
+            for (int kid : n.kids)
+                total += cost(kid);
+            return total;
+        case AstNode::Repeat: {
+            const qint64 kid = cost(n.kids.first()) + 1;
+            return kid * (n.max < 0 ? n.min + 1 : n.max) + 1;
+        }
+        }
+        return total;
+    }
+
+private:
+    int add(const AstNode &n)
+    {
+        m_nodes.append(n);
+        return m_nodes.size() - 1;
+    }
+
+    QVector<AstNode> m_nodes;
+};
+
+int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+bool isIdentStart(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+bool isIdentChar(char c)
+{
+    return isIdentStart(c) || (c >= '0' && c <= '9');
+}
+
+// Регулярные выражения: конкатенация, |, группы, классы, . и
+// квантификаторы *, +, ?, {n,m}. Якорь ^ допускается только в начале.
+class RegexParser {
+public:
+    RegexParser(const QByteArray &re, Ast &ast, bool dotAll)
+        : m_re(re)
+        , m_pos(0)
+        , m_ast(ast)
+        , m_dotAll(dotAll)
+        , m_depth(0)
+    {
+    }
+
+    int parse(bool &anchored, QString &error)
+    {
+        anchored = m_re.startsWith('^');
+        if (anchored)
+            ++m_pos;
+        const int root = parseAlt();
+        if (root >= 0 && m_pos < m_re.size())
+            fail("лишняя )");
+        error = m_error;
+        return m_error.isEmpty() ? root : -1;
+    }
+
+private:
+    bool atEnd() const { return m_pos >= m_re.size(); }
+    char peek() const { return atEnd() ? '\0' : m_re.at(m_pos); }
+    int fail(const QString &message)
+    {
+        if (m_error.isEmpty())
+            m_error = message;
+        return -1;
+    }
+
+    bool failed(const QString &message)
+    {
+        fail(message);
+        return false;
+    }
+
+    int parseAlt()
+    {
+        QVector<int> kids;
+        for (;;) {
+            const int kid = parseConcat();
+            if (kid < 0)
+                return -1;
+            kids.append(kid);
+            if (peek() != '|')
+                break;
+            ++m_pos;
+        }
+        return m_ast.sequence(AstNode::Alt, kids);
+    }
+
+    int parseConcat()
+    {
+        QVector<int> kids;
+        while (!atEnd() && peek() != '|' && peek() != ')') {
+            int atom = parseAtom();
+            if (atom < 0)
+                return -1;
+            atom = parseQuantifiers(atom);
+            if (atom < 0)
+                return -1;
+            kids.append(atom);
+        }
+        return m_ast.sequence(AstNode::Concat, kids);
+    }
+
+    int parseAtom()
+    {
+        const char c = m_re.at(m_pos++);
+        switch (c) {
+        case '(': {
+            if (++m_depth > MAX_NESTING)
+                return fail("слишком глубокая вложенность групп");
+            if (m_re.mid(m_pos, 2) == "?:")
+                m_pos += 2;
+            const int inner = parseAlt();
+            if (inner < 0)
+                return -1;
+            if (peek() != ')')
+                return fail("не закрыта группа (");
+            ++m_pos;
+            --m_depth;
+            return inner;
+        }
+        case '[': {
+            ByteSet set;
+            if (!parseClass(set))
+                return -1;
+            return m_ast.set(set);
+        }
+        case '.': {
+            ByteSet set = ByteSet::any();
+            if (!m_dotAll)
+                set.bits[0] &= ~(quint64(1) << '\n');
+            return m_ast.set(set);
+        }
+        case '\\': {
+            ByteSet set;
+            int single;
+            if (!parseEscape(set, single))
+                return -1;
+            return m_ast.set(set);
+        }
+        case '^':
+        case '$':
+            return fail("якорь поддерживается только в начале выражения");
+        case '*':
+        case '+':
+        case '?':
+            return fail("квантификатор без выражения");
+        default:
+            return m_ast.set(ByteSet::single(uchar(c)));
+        }
+    }
+
+    bool readInt(int &value)
+    {
+        const int start = m_pos;
+        value = 0;
+        while (!atEnd() && peek() >= '0' && peek() <= '9') {
+            value = value * 10 + (peek() - '0');
+            if (value > MAX_REPEAT)
+                return false;
+            ++m_pos;
+        }
+        return m_pos > start;
+    }
+
+    int parseQuantifiers(int atom)
+    {
+        for (;;) {
+            int min;
+            int max;
+            const char c = peek();
+            if (c == '*') {
+                min = 0;
+                max = -1;
+                ++m_pos;
+            } else if (c == '+') {
+                min = 1;
+                max = -1;
+                ++m_pos;
+            } else if (c == '?') {
+                min = 0;
+                max = 1;
+                ++m_pos;
+            } else if (c == '{' && m_pos + 1 < m_re.size() && m_re.at(m_pos + 1) >= '0'
+                       && m_re.at(m_pos + 1) <= '9') {
+                ++m_pos;
+                if (!readInt(min))
+                    return fail(QString("повторение больше %1").arg(MAX_REPEAT));
+                max = min;
+                if (peek() == ',') {
+                    ++m_pos;
+                    max = -1;
+                    if (peek() != '}' && !readInt(max))
+                        return fail(QString("повторение больше %1").arg(MAX_REPEAT));
+                }
+                if (peek() != '}' || (max >= 0 && max < min))
+                    return fail("неверный квантификатор {n,m}");
+                ++m_pos;
+            } else {
+                return atom;
+            }
+            // Ленивые квантификаторы не меняют факта совпадения
+            if (peek() == '?')
+                ++m_pos;
+            atom = m_ast.repeat(atom, min, max);
+        }
+    }
+
+    // single - код байта, если экранирование задает один байт, иначе -1
+    bool parseEscape(ByteSet &set, int &single)
+    {
+        single = -1;
+        if (atEnd())
+            return failed("незавершенное экранирование");
+        const char c = m_re.at(m_pos++);
+        switch (c) {
+        case 'd': set.addRange('0', '9'); return true;
+        case 'D': set.addRange('0', '9'); set.invert(); return true;
+        case 'w':
+        case 'W':
+            set.addRange('a', 'z');
+            set.addRange('A', 'Z');
+            set.addRange('0', '9');
+            set.add('_');
+            if (c == 'W')
+                set.invert();
+            return true;
+        case 's':
+        case 'S':
+            for (char ws : { ' ', '\t', '\n', '\r', '\f', '\v' })
+                set.add(ws);
+            if (c == 'S')
+                set.invert();
+            return true;
+        case 'n': single = '\n'; break;
+        case 'r': single = '\r'; break;
+        case 't': single = '\t'; break;
+        case 'f': single = '\f'; break;
+        case 'v': single = '\v'; break;
+        case '0': single = 0; break;
+        case 'x': {
+            const int hi = m_pos < m_re.size() ? hexValue(m_re.at(m_pos)) : -1;
+            const int lo = m_pos + 1 < m_re.size() ? hexValue(m_re.at(m_pos + 1)) : -1;
+            if (hi < 0 || lo < 0)
+                return failed("ожидалось \\xHH");
+            m_pos += 2;
+            single = hi * 16 + lo;
+            break;
+        }
+        case 'b':
+        case 'B':
+            return failed("границы слов не поддерживаются");
+        default:
+            single = uchar(c);
+            break;
+        }
+        set.add(single);
+        return true;
+    }
+
+    bool parseClass(ByteSet &set)
+    {
+        const bool negated = peek() == '^';
+        if (negated)
+            ++m_pos;
+        bool first = true;
+        while (!atEnd() && (peek() != ']' || first)) {
+            first = false;
+            int lo;
+            if (peek() == '\\') {
+                ++m_pos;
+                ByteSet escaped;
+                if (!parseEscape(escaped, lo))
+                    return false;
+                if (lo < 0) {
+                    set.addAll(escaped);
+                    continue;
+                }
+            } else {
+                lo = uchar(m_re.at(m_pos++));
+            }
+            int hi = lo;
+            if (peek() == '-' && m_pos + 1 < m_re.size() && m_re.at(m_pos + 1) != ']') {
+                ++m_pos;
+                if (peek() == '\\') {
+                    ++m_pos;
+                    ByteSet escaped;
+                    if (!parseEscape(escaped, hi))
+                        return false;
+                    if (hi < 0)
+                        return failed("неверный диапазон в классе");
+                } else {
+                    hi = uchar(m_re.at(m_pos++));
+                }
+                if (hi < lo)
+                    return failed("неверный диапазон в классе");
+            }
+            set.addRange(lo, hi);
+        }
+        if (atEnd())
+            return failed("не закрыт класс [");
+        ++m_pos;
+        if (negated)
+            set.invert();
+        return true;
+    }
+
+    const QByteArray &m_re;
+    int m_pos;
+    Ast &m_ast;
+    bool m_dotAll;
+    int m_depth;
+    QString m_error;
+};
+
+// Hex-строки: байты с масками полубайтов (4?, ??), прыжки [n-m] и
+// альтернативы ( .. | .. )
+class HexParser {
+public:
+    HexParser(const QByteArray &text, Ast &ast)
+        : m_text(text)
+        , m_pos(0)
+        , m_ast(ast)
+        , m_depth(0)
+    {
+    }
+
+    int parse(QString &error)
+    {
+        const int root = parseSequence();
+        skipSpace();
+        if (root >= 0 && m_pos < m_text.size())
+            fail("неожиданный символ в hex-строке");
+        error = m_error;
+        return m_error.isEmpty() ? root : -1;
+    }
+
+private:
+    void skipSpace()
+    {
+        while (m_pos < m_text.size() && QChar::isSpace(uchar(m_text.at(m_pos))))
+            ++m_pos;
+    }
+    char peek()
+    {
+        skipSpace();
+        return m_pos < m_text.size() ? m_text.at(m_pos) : '\0';
+    }
+    int fail(const QString &message)
+    {
+        if (m_error.isEmpty())
+            m_error = message;
+        return -1;
+    }
+
+    bool readInt(int &value)
+    {
+        skipSpace();
+        const int start = m_pos;
+        value = 0;
+        while (m_pos < m_text.size() && m_text.at(m_pos) >= '0' && m_text.at(m_pos) <= '9') {
+            value = value * 10 + (m_text.at(m_pos++) - '0');
+            if (value > MAX_REPEAT)
+                return false;
+        }
+        return m_pos > start;
+    }
+
+    int parseSequence()
+    {
+        QVector<int> items;
+        for (;;) {
+            const char c = peek();
+            if (c == '\0' || c == '|' || c == ')')
+                break;
+            int item;
+            if (c == '[') {
+                ++m_pos;
+                int min;
+                int max;
+                if (!readInt(min))
+                    return fail("неверный прыжок [n-m]");
+                max = min;
+                if (peek() == '-') {
+                    ++m_pos;
+                    max = -1;
+                    if (peek() != ']' && !readInt(max))
+                        return fail("неверный прыжок [n-m]");
+                }
+                if (peek() != ']' || (max >= 0 && max < min))
+                    return fail("неверный прыжок [n-m]");
+                ++m_pos;
+                item = m_ast.repeat(m_ast.set(ByteSet::any()), min, max);
+            } else if (c == '(') {
+                ++m_pos;
+                if (++m_depth > MAX_NESTING)
+                    return fail("слишком глубокая вложенность");
+                QVector<int> alts;
+                for (;;) {
+                    const int alt = parseSequence();
+                    if (alt < 0)
+                        return -1;
+                    alts.append(alt);
+                    if (peek() != '|')
+                        break;
+                    ++m_pos;
+                }
+                if (peek() != ')')
+                    return fail("не закрыта группа (");
+                ++m_pos;
+                --m_depth;
+                item = m_ast.sequence(AstNode::Alt, alts);
+            } else {
+                if (m_pos + 1 >= m_text.size())
+                    return fail("неполный байт в hex-строке");
+                const char hiChar = m_text.at(m_pos);
+                const char loChar = m_text.at(m_pos + 1);
+                const int hi = hexValue(hiChar);
+                const int lo = hexValue(loChar);
+                if ((hi < 0 && hiChar != '?') || (lo < 0 && loChar != '?'))
+                    return fail("неверный байт в hex-строке");
+                m_pos += 2;
+                ByteSet set;
+                for (int b = 0; b < 256; ++b) {
+                    if ((hi < 0 || (b >> 4) == hi) && (lo < 0 || (b & 15) == lo))
+                        set.add(b);
+                }
+                item = m_ast.set(set);
+            }
+            items.append(item);
+        }
+        if (items.isEmpty())
+            return fail("пустая hex-строка");
+        return m_ast.sequence(AstNode::Concat, items);
+    }
+
+    const QByteArray &m_text;
+    int m_pos;
+    Ast &m_ast;
+    int m_depth;
+    QString m_error;
+};
+
+// Общее состояние компиляции всех исходников
+struct CompileContext {
+    CompiledRules &out;
+    QHash<QByteArray, quint32> setIndex;
+    QSet<QByteArray> ruleNames;
+};
+
+struct Fragment {
+    quint32 start;
+    QVector<quint32> holes;  // состояние * 2 + (1, если out2)
+};
+
+quint32 addState(CompiledRules &out, quint8 op, quint32 arg, quint32 next, quint32 next2)
+{
+    CompiledRules::NfaState st;
+    st.op = op;
+    st.arg = arg;
+    st.out = next;
+    st.out2 = next2;
+    out.nfa.append(st);
+    return quint32(out.nfa.size() - 1);
+}
+
+void patch(CompiledRules &out, const QVector<quint32> &holes, quint32 target)
+{
+    for (quint32 hole : holes) {
+        CompiledRules::NfaState &st = out.nfa[int(hole >> 1)];
+        if (hole & 1)
+            st.out2 = target;
+        else
+            st.out = target;
+    }
+}
+
+quint32 setIndex(CompileContext &ctx, const ByteSet &set)
+{
+    const QByteArray bytes = set.toBytes();
+    auto it = ctx.setIndex.constFind(bytes);
+    if (it != ctx.setIndex.constEnd())
+        return it.value();
+    const quint32 index = quint32(ctx.out.byteSets.size());
+    ctx.out.byteSets.append(bytes);
+    ctx.setIndex.insert(bytes, index);
+    return index;
+}
+
+void append(CompiledRules &out, Fragment &result, bool &have, const Fragment &next)
+{
+    if (!have) {
+        result = next;
+        have = true;
+    } else {
+        patch(out, result.holes, next.start);
+        result.holes = next.holes;
+    }
+}
+
+Fragment build(CompileContext &ctx, const Ast &ast, int index)
+{
+    CompiledRules &out = ctx.out;
+    const AstNode &n = ast.node(index);
+    Fragment result;
+    bool have = false;
+
+    switch (n.kind) {
+    case AstNode::Set: {
+        const quint32 s = addState(out, CompiledRules::OpByte, setIndex(ctx, n.set), NO_STATE, NO_STATE);
+        return Fragment{ s, { s * 2 } };
+    }
+    case AstNode::Concat:
+        for (int kid : n.kids)
+            append(out, result, have, build(ctx, ast, kid));
+        break;
+    case AstNode::Alt: {
+        QVector<Fragment> alts;
+        for (int kid : n.kids)
+            alts.append(build(ctx, ast, kid));
+        quint32 start = alts.last().start;
+        for (int i = alts.size() - 2; i >= 0; --i)
+            start = addState(out, CompiledRules::OpSplit, 0, alts[i].start, start);
+        result.start = start;
+        for (const Fragment &f : alts)
+            result.holes += f.holes;
+        return result;
+    }
+    case AstNode::Repeat: {
+        const int kid = n.kids.first();
+        for (int i = 0; i < n.min; ++i)
+            append(out, result, have, build(ctx, ast, kid));
+        if (n.max < 0) {
+            const Fragment body = build(ctx, ast, kid);
+            const quint32 s = addState(out, CompiledRules::OpSplit, 0, body.start, NO_STATE);
+            patch(out, body.holes, s);
+            append(out, result, have, Fragment{ s, { s * 2 + 1 } });
+        } else {
+            for (int i = n.min; i < n.max; ++i) {
+                Fragment body = build(ctx, ast, kid);
+                const quint32 s = addState(out, CompiledRules::OpSplit, 0, body.start, NO_STATE);
+                body.holes.append(s * 2 + 1);
+                body.start = s;
+                append(out, result, have, body);
+            }
+        }
+        break;
+    }
+    }
+
+    if (!have) {
+        const quint32 s = addState(out, CompiledRules::OpJump, 0, NO_STATE, NO_STATE);
+        return Fragment{ s, { s * 2 } };
+    }
+    return result;
+}
+
+class RuleParser {
+public:
+    RuleParser(const QByteArray &src, const QString &origin, CompileContext &ctx)
+        : m_src(src)
+        , m_pos(0)
+        , m_line(1)
+        , m_origin(origin)
+        , m_ctx(ctx)
+        , m_patternBase(0)
+        , m_depth(0)
+        , m_maxDepth(0)
+    {
+    }
+
+    void parse()
+    {
+        while (!atEnd()) {
+            m_error.clear();
+            if (!parseRule()) {
+                m_ctx.out.errors << QString("%1:%2: %3").arg(m_origin).arg(m_line).arg(m_error);
+                skipToNextRule();
+            }
+        }
+    }
+
+private:
+    struct PendingPattern {
+        QByteArray name;
+        Ast ast;
+        int root = -1;
+        bool anchored = false;
+        qint32 length = -1;
+    };
+
+    // --- лексика ---
+
+    void skipSpace()
+    {
+        while (m_pos < m_src.size()) {
+            const char c = m_src.at(m_pos);
+            if (c == '\n') {
+                ++m_line;
+                ++m_pos;
+            } else if (c == ' ' || c == '\t' || c == '\r') {
+                ++m_pos;
+            } else if (c == '/' && m_pos + 1 < m_src.size() && m_src.at(m_pos + 1) == '/') {
+                while (m_pos < m_src.size() && m_src.at(m_pos) != '\n')
+                    ++m_pos;
+            } else if (c == '/' && m_pos + 1 < m_src.size() && m_src.at(m_pos + 1) == '*') {
+                m_pos += 2;
+                while (m_pos + 1 < m_src.size()
+                       && !(m_src.at(m_pos) == '*' && m_src.at(m_pos + 1) == '/')) {
+                    if (m_src.at(m_pos) == '\n')
+                        ++m_line;
+                    ++m_pos;
+                }
+                m_pos = qMin(m_pos + 2, m_src.size());
+            } else {
+                break;
+            }
+        }
+    }
+
+    bool atEnd()
+    {
+        skipSpace();
+        return m_pos >= m_src.size();
+    }
+
+    char peek()
+    {
+        skipSpace();
+        return m_pos < m_src.size() ? m_src.at(m_pos) : '\0';
+    }
+
+    bool consume(const char *token)
+    {
+        skipSpace();
+        const int len = int(qstrlen(token));
+        if (m_src.mid(m_pos, len) != token)
+            return false;
+        m_pos += len;
+        return true;
+    }
+
+    bool peekWord(const char *word)
+    {
+        skipSpace();
+        const int len = int(qstrlen(word));
+        return m_src.mid(m_pos, len) == word
+               && (m_pos + len >= m_src.size() || !isIdentChar(m_src.at(m_pos + len)));
+    }
+
+    bool consumeWord(const char *word)
+    {
+        if (!peekWord(word))
+            return false;
+        m_pos += int(qstrlen(word));
+        return true;
+    }
+
+    // Идентификатор без пропуска пробелов (сразу за $, #, @)
+    QByteArray identHere()
+    {
+        const int start = m_pos;
+        if (m_pos < m_src.size() && isIdentStart(m_src.at(m_pos))) {
+            while (m_pos < m_src.size() && isIdentChar(m_src.at(m_pos)))
+                ++m_pos;
+        }
+        return m_src.mid(start, m_pos - start);
+    }
+
+    QByteArray readIdent()
+    {
+        skipSpace();
+        return identHere();
+    }
+
+    bool readNumber(qint64 &value)
+    {
+        skipSpace();
+        const int start = m_pos;
+        bool ok = false;
+        if (m_src.mid(m_pos, 2) == "0x") {
+            m_pos += 2;
+            while (m_pos < m_src.size() && hexValue(m_src.at(m_pos)) >= 0)
+                ++m_pos;
+            value = m_src.mid(start + 2, m_pos - start - 2).toLongLong(&ok, 16);
+        } else {
+            while (m_pos < m_src.size() && m_src.at(m_pos) >= '0' && m_src.at(m_pos) <= '9')
+                ++m_pos;
+            value = m_src.mid(start, m_pos - start).toLongLong(&ok);
+            if (m_src.mid(m_pos, 2) == "KB") {
+                value *= 1024;
+                m_pos += 2;
+            } else if (m_src.mid(m_pos, 2) == "MB") {
+                value *= 1024 * 1024;
+                m_pos += 2;
+            }
+        }
+        if (!ok || (m_pos < m_src.size() && isIdentChar(m_src.at(m_pos))))
+            return fail("неверное число");
+        return true;
+    }
+
+    bool fail(const QString &message)
+    {
+        if (m_error.isEmpty())
+            m_error = message;
+        return false;
+    }
+
+    void skipToNextRule()
+    {
+        while (m_pos < m_src.size()) {
+            const int nl = m_src.indexOf('\n', m_pos);
+            if (nl < 0) {
+                m_pos = m_src.size();
+                return;
+            }
+            m_pos = nl + 1;
+            ++m_line;
+            int i = m_pos;
+            while (i < m_src.size() && (m_src.at(i) == ' ' || m_src.at(i) == '\t'))
+                ++i;
+            const QByteArray rest = m_src.mid(i, 8);
+            if (rest.startsWith("rule ") || rest.startsWith("private ") || rest.startsWith("global "))
+                return;
+        }
+    }
+
+    // --- правило ---
+
+    bool parseRule()
+    {
+        while (consumeWord("private") || consumeWord("global")) {
+        }
+        if (!consumeWord("rule"))
+            return fail("ожидалось слово rule");
+
+        CompiledRules::Rule rule;
+        rule.name = readIdent();
+        if (rule.name.isEmpty())
+            return fail("ожидалось имя правила");
+        if (m_ctx.ruleNames.contains(rule.name))
+            return fail(QString("правило %1 уже определено").arg(QString::fromUtf8(rule.name)));
+        if (consume(":")) {
+            while (!readIdent().isEmpty()) {
+            }
+        }
+        if (!consume("{"))
+            return fail("ожидалась {");
+
+        rule.level = ScanVerdict::Suspicious;
+        m_pending.clear();
+        m_names.clear();
+        m_code.clear();
+        m_depth = m_maxDepth = 0;
+        m_patternBase = m_ctx.out.patterns.size();
+
+        if (consumeWord("meta") && (!consume(":") || !parseMeta(rule)))
+            return fail("ошибка в секции meta");
+        if (consumeWord("strings") && (!consume(":") || !parseStrings()))
+            return fail("ошибка в секции strings");
+        if (!consumeWord("condition") || !consume(":"))
+            return fail("ожидалась секция condition");
+        if (!parseOr())
+            return false;
+        if (!consume("}"))
+            return fail("ожидалась } в конце правила");
+        if (m_maxDepth > MAX_STACK)
+            return fail("слишком сложное условие");
+
+        qint64 cost = 0;
+        for (const PendingPattern &p : m_pending)
+            cost += p.ast.cost(p.root) + 1;
+        if (m_ctx.out.nfa.size() + cost > MAX_TOTAL_STATES)
+            return fail("превышен общий размер автомата правил");
+
+        const quint32 ruleIndex = quint32(m_ctx.out.rules.size());
+        for (const PendingPattern &p : m_pending) {
+            CompiledRules::Pattern pattern;
+            pattern.rule = ruleIndex;
+            pattern.length = p.length;
+            const quint32 patternIndex = quint32(m_ctx.out.patterns.size());
+            m_ctx.out.patterns.append(pattern);
+
+            const Fragment f = build(m_ctx, p.ast, p.root);
+            const quint32 match = addState(m_ctx.out, CompiledRules::OpMatch, patternIndex, NO_STATE, NO_STATE);
+            patch(m_ctx.out, f.holes, match);
+            if (p.anchored)
+                m_ctx.out.anchoredStarts.append(f.start);
+            else
+                m_ctx.out.floatingStarts.append(f.start);
+        }
+
+        rule.code = m_code;
+        m_ctx.out.rules.append(rule);
+        m_ctx.out.maxStack = qMax(m_ctx.out.maxStack, m_maxDepth);
+        m_ctx.ruleNames.insert(rule.name);
+        return true;
+    }
+
+    bool parseMeta(CompiledRules::Rule &rule)
+    {
+        while (!peekWord("strings") && !peekWord("condition")) {
+            const QByteArray key = readIdent();
+            if (key.isEmpty() || !consume("="))
+                return false;
+            QByteArray value;
+            qint64 number;
+            if (peek() == '"') {
+                if (!readQuoted(value))
+                    return false;
+            } else if (!consumeWord("true") && !consumeWord("false") && !readNumber(number)) {
+                return false;
+            }
+            if (key == "description") {
+                rule.description = value;
+            } else if (key == "severity") {
+                if (value == "malicious")
+                    rule.level = ScanVerdict::Malicious;
+                else if (value == "suspicious")
+                    rule.level = ScanVerdict::Suspicious;
+                else
+                    return fail("severity: ожидалось malicious или suspicious");
+            }
+        }
+        return true;
+    }
+
+    bool readQuoted(QByteArray &out)
+    {
+        skipSpace();
+        if (m_pos >= m_src.size() || m_src.at(m_pos) != '"')
+            return fail("ожидалась строка в кавычках");
+        ++m_pos;
+        out.clear();
+        while (m_pos < m_src.size()) {
+            const char c = m_src.at(m_pos++);
+            if (c == '"')
+                return true;
+            if (c == '\n')
+                break;
+            if (c != '\\') {
+                out.append(c);
+                continue;
+            }
+            if (m_pos >= m_src.size())
+                break;
+            const char e = m_src.at(m_pos++);
+            switch (e) {
+            case 'n': out.append('\n'); break;
+            case 'r': out.append('\r'); break;
+            case 't': out.append('\t'); break;
+            case 'x': {
+                const int hi = m_pos < m_src.size() ? hexValue(m_src.at(m_pos)) : -1;
+                const int lo = m_pos + 1 < m_src.size() ? hexValue(m_src.at(m_pos + 1)) : -1;
+                if (hi < 0 || lo < 0)
+                    return fail("ожидалось \\xHH");
+                out.append(char(hi * 16 + lo));
+                m_pos += 2;
+                break;
+            }
+            default:
+                out.append(e);
+            }
+        }
+        return fail("не закрыта строка");
+    }
+
+    bool parseStrings()
+    {
+        while (peek() == '$') {
+            ++m_pos;
+            PendingPattern p;
+            p.name = identHere();
+            if (p.name.isEmpty())
+                return fail("у строки должно быть имя");
+            if (m_names.contains(p.name))
+                return fail(QString("строка $%1 уже определена").arg(QString::fromUtf8(p.name)));
+            if (!consume("="))
+                return fail("ожидался =");
+            if (!parsePattern(p))
+                return false;
+
+            qint64 min;
+            qint64 max;
+            p.ast.lengths(p.root, min, max);
+            if (min == 0)
+                return fail(QString("строка $%1 может совпасть с пустой").arg(QString::fromUtf8(p.name)));
+            if (p.ast.cost(p.root) > MAX_PATTERN_STATES)
+                return fail(QString("строка $%1 слишком сложна").arg(QString::fromUtf8(p.name)));
+            p.length = (min == max && max <= 0x7fffffff) ? qint32(max) : -1;
+
+            m_names.insert(p.name, m_pending.size());
+            m_pending.append(p);
+        }
+        return true;
+    }
+
+    bool parsePattern(PendingPattern &p)
+    {
+        const char c = peek();
+        QString error;
+        if (c == '"') {
+            QByteArray text;
+            if (!readQuoted(text))
+                return false;
+            if (text.isEmpty())
+                return fail("пустая строка");
+            bool nocase = false;
+            bool wide = false;
+            bool ascii = false;
+            for (;;) {
+                if (consumeWord("nocase"))
+                    nocase = true;
+                else if (consumeWord("wide"))
+                    wide = true;
+                else if (consumeWord("ascii"))
+                    ascii = true;
+                else if (consumeWord("private"))
+                    continue;
+                else
+                    break;
+            }
+            QVector<int> narrow;
+            QVector<int> utf16;
+            for (char ch : text) {
+                const int b = uchar(ch);
+                narrow.append(p.ast.set(ByteSet::single(b)));
+                utf16.append(narrow.last());
+                utf16.append(p.ast.set(ByteSet::single(0)));
+            }
+            const int narrowRoot = p.ast.sequence(AstNode::Concat, narrow);
+            const int wideRoot = p.ast.sequence(AstNode::Concat, utf16);
+            if (wide && ascii)
+                p.root = p.ast.sequence(AstNode::Alt, { narrowRoot, wideRoot });
+            else
+                p.root = wide ? wideRoot : narrowRoot;
+            if (nocase)
+                p.ast.makeCaseless();
+            return true;
+        }
+        if (c == '{') {
+            const int end = m_src.indexOf('}', m_pos);
+            if (end < 0)
+                return fail("не закрыта hex-строка");
+            const QByteArray body = m_src.mid(m_pos + 1, end - m_pos - 1);
+            m_line += body.count('\n');
+            m_pos = end + 1;
+            p.root = HexParser(body, p.ast).parse(error);
+            return p.root >= 0 || fail(error);
+        }
+        if (c == '/') {
+            int i = m_pos + 1;
+            QByteArray body;
+            while (i < m_src.size() && m_src.at(i) != '/' && m_src.at(i) != '\n') {
+                if (m_src.at(i) == '\\' && i + 1 < m_src.size())
+                    body.append(m_src.at(i++));
+                body.append(m_src.at(i++));
+            }
+            if (i >= m_src.size() || m_src.at(i) != '/')
+                return fail("не закрыто регулярное выражение");
+            m_pos = i + 1;
+            bool nocase = false;
+            bool dotAll = false;
+            while (m_pos < m_src.size() && (m_src.at(m_pos) == 'i' || m_src.at(m_pos) == 's')) {
+                (m_src.at(m_pos) == 'i' ? nocase : dotAll) = true;
+                ++m_pos;
+            }
+            for (;;) {
+                if (consumeWord("nocase"))
+                    nocase = true;
+                else if (consumeWord("ascii") || consumeWord("private"))
+                    continue;
+                else if (peekWord("wide"))
+                    return fail("wide не поддерживается для регулярных выражений");
+                else
+                    break;
+            }
+            p.root = RegexParser(body, p.ast, dotAll).parse(p.anchored, error);
+            if (p.root < 0)
+                return fail(error);
+            if (nocase)
+                p.ast.makeCaseless();
+            return true;
+        }
+        return fail("ожидалась строка, hex-строка или регулярное выражение");
+    }
+
+    // --- условие ---
+
+    void op(qint64 code, int stackEffect)
+    {
+        m_code.append(code);
+        m_depth += stackEffect;
+        m_maxDepth = qMax(m_maxDepth, m_depth);
+    }
+
+    int patternIndex(const QByteArray &name)
+    {
+        auto it = m_names.constFind(name);
+        if (it == m_names.constEnd()) {
+            fail(QString("неизвестная строка $%1").arg(QString::fromUtf8(name)));
+            return -1;
+        }
+        return it.value();
+    }
+
+    // Для at, in и @ нужна позиция начала: только строки постоянной длины
+    bool requireFixed(int local)
+    {
+        if (m_pending[local].length < 0)
+            return fail(QString("у строки $%1 переменная длина, смещение недоступно")
+                            .arg(QString::fromUtf8(m_pending[local].name)));
+        return true;
+    }
+
+    bool parseOr()
+    {
+        if (!parseAnd())
+            return false;
+        while (consumeWord("or")) {
+            if (!parseAnd())
+                return false;
+            op(CompiledRules::CondOr, -1);
+        }
+        return true;
+    }
+
+    bool parseAnd()
+    {
+        if (!parseNot())
+            return false;
+        while (consumeWord("and")) {
+            if (!parseNot())
+                return false;
+            op(CompiledRules::CondAnd, -1);
+        }
+        return true;
+    }
+
+    bool parseNot()
+    {
+        if (consumeWord("not")) {
+            if (!parseNot())
+                return false;
+            op(CompiledRules::CondNot, 0);
+            return true;
+        }
+        return parseComparison();
+    }
+
+    bool parseComparison()
+    {
+        if (!parseSum())
+            return false;
+        static const struct {
+            const char *token;
+            CompiledRules::CondOp code;
+        } ops[] = {
+            { "==", CompiledRules::CondEq }, { "!=", CompiledRules::CondNe },
+            { "<=", CompiledRules::CondLe }, { ">=", CompiledRules::CondGe },
+            { "<", CompiledRules::CondLt },  { ">", CompiledRules::CondGt },
+        };
+        for (const auto &o : ops) {
+            if (consume(o.token)) {
+                if (!parseSum())
+                    return false;
+                op(o.code, -1);
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool parseSum()
+    {
+        if (!parseTerm())
+            return false;
+        for (;;) {
+            const char c = peek();
+            if (c != '+' && c != '-')
+                return true;
+            ++m_pos;
+            if (!parseTerm())
+                return false;
+            op(c == '+' ? CompiledRules::CondAdd : CompiledRules::CondSub, -1);
+        }
+    }
+
+    bool parseTerm()
+    {
+        if (!parsePrimary())
+            return false;
+        while (peek() == '*') {
+            ++m_pos;
+            if (!parsePrimary())
+                return false;
+            op(CompiledRules::CondMul, -1);
+        }
+        return true;
+    }
+
+    bool parseSet(QVector<int> &set)
+    {
+        if (consumeWord("them")) {
+            for (int i = 0; i < m_pending.size(); ++i)
+                set.append(i);
+        } else {
+            if (!consume("("))
+                return fail("ожидалось them или список строк");
+            do {
+                if (peek() != '$')
+                    return fail("ожидалась строка $имя");
+                ++m_pos;
+                const QByteArray name = identHere();
+                if (m_pos < m_src.size() && m_src.at(m_pos) == '*') {
+                    ++m_pos;
+                    const int before = set.size();
+                    for (int i = 0; i < m_pending.size(); ++i) {
+                        if (m_pending[i].name.startsWith(name))
+                            set.append(i);
+                    }
+                    if (set.size() == before)
+                        return fail(QString("нет строк $%1*").arg(QString::fromUtf8(name)));
+                } else {
+                    const int index = patternIndex(name);
+                    if (index < 0)
+                        return false;
+                    set.append(index);
+                }
+            } while (consume(","));
+            if (!consume(")"))
+                return fail("ожидалась )");
+        }
+        if (set.isEmpty())
+            return fail("у правила нет строк");
+        return true;
+    }
+
+    bool parseOf(qint64 threshold)
+    {
+        QVector<int> set;
+        if (!parseSet(set))
+            return false;
+        op(CompiledRules::CondOf, 1);
+        m_code.append(threshold < 0 ? set.size() : threshold);
+        m_code.append(set.size());
+        for (int local : set)
+            m_code.append(m_patternBase + local);
+        return true;
+    }
+
+    bool parsePrimary()
+    {
+        const char c = peek();
+        if (c == '(') {
+            ++m_pos;
+            if (!parseOr())
+                return false;
+            return consume(")") || fail("ожидалась )");
+        }
+        if (c >= '0' && c <= '9') {
+            qint64 value;
+            if (!readNumber(value))
+                return false;
+            if (consumeWord("of"))
+                return parseOf(value);
+            op(CompiledRules::CondPush, 1);
+            m_code.append(value);
+            return true;
+        }
+        if (c == '$' || c == '#' || c == '@') {
+            ++m_pos;
+            const int local = patternIndex(identHere());
+            if (local < 0)
+                return false;
+            const qint64 global = m_patternBase + local;
+            if (c == '#') {
+                op(CompiledRules::CondCount, 1);
+                m_code.append(global);
+                return true;
+            }
+            if (c == '@') {
+                if (!requireFixed(local))
+                    return false;
+                if (consume("[")) {
+                    if (!parseSum() || !consume("]"))
+                        return fail("ожидалось @строка[номер]");
+                } else {
+                    op(CompiledRules::CondPush, 1);
+                    m_code.append(1);
+                }
+                op(CompiledRules::CondOffset, 0);
+                m_code.append(global);
+                return true;
+            }
+            if (consumeWord("at")) {
+                if (!requireFixed(local) || !parseSum())
+                    return false;
+                op(CompiledRules::CondAt, 0);
+                m_code.append(global);
+                return true;
+            }
+            if (consumeWord("in")) {
+                if (!requireFixed(local))
+                    return false;
+                if (!consume("(") || !parseSum() || !consume("..") || !parseSum() || !consume(")"))
+                    return fail("ожидалось in (начало..конец)");
+                op(CompiledRules::CondIn, -1);
+                m_code.append(global);
+                return true;
+            }
+            op(CompiledRules::CondMatched, 1);
+            m_code.append(global);
+            return true;
+        }
+
+        const QByteArray word = readIdent();
+        if (word == "true" || word == "false") {
+            op(CompiledRules::CondPush, 1);
+            m_code.append(word == "true" ? 1 : 0);
+            return true;
+        }
+        if (word == "filesize") {
+            op(CompiledRules::CondFileSize, 1);
+            return true;
+        }
+        if (word == "script_score") {
+            op(CompiledRules::CondScriptScore, 1);
+            return true;
+        }
+        if (word == "any" || word == "all") {
+            if (!consumeWord("of"))
+                return fail("ожидалось of");
+            return parseOf(word == "any" ? 1 : -1);
+        }
+        static const struct {
+            const char *name;
+            CompiledRules::CondOp code;
+        } readers[] = {
+            { "uint8", CompiledRules::CondUint8 },       { "uint16", CompiledRules::CondUint16 },
+            { "uint32", CompiledRules::CondUint32 },     { "uint16be", CompiledRules::CondUint16Be },
+            { "uint32be", CompiledRules::CondUint32Be },
+        };
+        for (const auto &r : readers) {
+            if (word == r.name) {
+                if (!consume("(") || !parseSum() || !consume(")"))
+                    return fail(QString("ожидалось %1(смещение)").arg(r.name));
+                op(r.code, 0);
+                return true;
+            }
+        }
+        if (word.isEmpty())
+            return fail("ожидалось выражение");
+        return fail(QString("неизвестный идентификатор %1").arg(QString::fromUtf8(word)));
+    }
+
+    const QByteArray &m_src;
+    int m_pos;
+    int m_line;
+    QString m_origin;
+    CompileContext &m_ctx;
+    QString m_error;
+
+    QVector<PendingPattern> m_pending;
+    QHash<QByteArray, int> m_names;
+    int m_patternBase;
+    QVector<qint64> m_code;
+    int m_depth;
+    int m_maxDepth;
+};
+
+// Классы эквивалентности байтов: байты, одинаково входящие во все
+// множества, неразличимы для автомата, и таблица переходов ДКА
+// хранит по одной ячейке на класс, а не на каждый байт.
+void computeByteClasses(CompiledRules &rules)
+{
+    QHash<QByteArray, int> signatures;
+    rules.byteClass = QByteArray(256, '\0');
+    rules.classByte.clear();
+    const int sets = rules.byteSets.size();
+    for (int b = 0; b < 256; ++b) {
+        QByteArray signature((sets + 7) / 8, '\0');
+        for (int i = 0; i < sets; ++i) {
+            if (rules.inSet(quint32(i), uchar(b)))
+                signature[i >> 3] = char(uchar(signature[i >> 3]) | (1u << (i & 7)));
+        }
+        auto it = signatures.constFind(signature);
+        int cls;
+        if (it != signatures.constEnd()) {
+            cls = it.value();
+        } else {
+            cls = rules.classByte.size();
+            signatures.insert(signature, cls);
+            rules.classByte.append(char(b));
+        }
+        rules.byteClass[b] = char(cls);
+    }
+}
+
+} // namespace
+
+QDataStream &operator<<(QDataStream &s, const CompiledRules::NfaState &st)
+{
+    return s << st.op << st.arg << st.out << st.out2;
+}
+
+QDataStream &operator>>(QDataStream &s, CompiledRules::NfaState &st)
+{
+    return s >> st.op >> st.arg >> st.out >> st.out2;
+}
+
+QDataStream &operator<<(QDataStream &s, const CompiledRules::Pattern &p)
+{
+    return s << p.rule << p.length;
+}
+
+QDataStream &operator>>(QDataStream &s, CompiledRules::Pattern &p)
+{
+    return s >> p.rule >> p.length;
+}
+
+QDataStream &operator<<(QDataStream &s, const CompiledRules::Rule &r)
+{
+    return s << r.name << r.description << r.level << r.code;
+}
+
+QDataStream &operator>>(QDataStream &s, CompiledRules::Rule &r)
+{
+    return s >> r.name >> r.description >> r.level >> r.code;
+}
+
+QSharedPointer<CompiledRules> RuleCompiler::compile(const QVector<Source> &sources)
+{
+    QSharedPointer<CompiledRules> rules(new CompiledRules);
+    CompileContext ctx{ *rules, QHash<QByteArray, quint32>(), QSet<QByteArray>() };
+    for (const Source &source : sources)
+        RuleParser(source.second, source.first, ctx).parse();
+    computeByteClasses(*rules);
+    return rules;
+}
+
+bool CompiledRules::save(const QString &fileName, const QByteArray &key) const
+{
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_12);
+    out << CACHE_MAGIC << CACHE_VERSION << key
+        << nfa << byteSets << byteClass << classByte << anchoredStarts << floatingStarts
+        << patterns << rules << errors << qint32(maxStack);
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+QSharedPointer<CompiledRules> CompiledRules::load(const QString &fileName, const QByteArray &key)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return QSharedPointer<CompiledRules>();
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_12);
+    quint32 magic = 0;
+    quint32 version = 0;
+    QByteArray storedKey;
+    in >> magic >> version >> storedKey;
+    if (magic != CACHE_MAGIC || version != CACHE_VERSION || storedKey != key)
+        return QSharedPointer<CompiledRules>();
+
+    QSharedPointer<CompiledRules> rules(new CompiledRules);
+    qint32 maxStack = 0;
+    in >> rules->nfa >> rules->byteSets >> rules->byteClass >> rules->classByte
+       >> rules->anchoredStarts >> rules->floatingStarts >> rules->patterns >> rules->rules
+       >> rules->errors >> maxStack;
+    rules->maxStack = maxStack;
+    if (in.status() != QDataStream::Ok)
+        return QSharedPointer<CompiledRules>();
+
+    // Испорченный кэш не должен уронить обработчик: проверяем ссылки
+    const quint32 states = quint32(rules->nfa.size());
+    bool valid = rules->byteClass.size() == 256 && !rules->classByte.isEmpty()
+                 && rules->maxStack >= 0 && rules->maxStack <= MAX_STACK;
+    for (const QByteArray &set : rules->byteSets)
+        valid = valid && set.size() == 32;
+    for (int b = 0; valid && b < 256; ++b)
+        valid = uchar(rules->byteClass.at(b)) < uchar(rules->classByte.size());
+    for (const NfaState &st : rules->nfa) {
+        if (!valid)
+            break;
+        switch (st.op) {
+        case OpByte:  valid = st.arg < quint32(rules->byteSets.size()) && st.out < states; break;
+        case OpSplit: valid = st.out < states && st.out2 < states; break;
+        case OpJump:  valid = st.out < states; break;
+        case OpMatch: valid = st.arg < quint32(rules->patterns.size()); break;
+        default:      valid = false;
+        }
+    }
+    for (quint32 s : rules->anchoredStarts + rules->floatingStarts)
+        valid = valid && s < states;
+    for (const Pattern &p : rules->patterns)
+        valid = valid && p.rule < quint32(rules->rules.size());
+    if (!valid) {
+        qWarning() << "Кэш правил поврежден:" << fileName;
+        return QSharedPointer<CompiledRules>();
+    }
+    return rules;
+}
+
+QString CompiledRules::rulesDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppConfigLocation) + "/rules";
+}
+
+QString CompiledRules::cachePath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/rules.frc";
+}
+
+QSharedPointer<const CompiledRules> CompiledRules::installed(QStringList *errors)
+{
+    QVector<RuleCompiler::Source> sources;
+    sources.append(RuleCompiler::Source("встроенные правила", QByteArray(BUILTIN_RULES)));
+    const QFileInfoList files = QDir(rulesDirectory())
+                                    .entryInfoList(QStringList() << "*.rule" << "*.yar" << "*.yara",
+                                                   QDir::Files | QDir::Readable, QDir::Name);
+    for (const QFileInfo &info : files) {
+        QFile file(info.absoluteFilePath());
+        if (file.open(QIODevice::ReadOnly))
+            sources.append(RuleCompiler::Source(info.fileName(), file.readAll()));
+    }
+
+    // Ключ кэша - хеш всех исходников и версии формата
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(reinterpret_cast<const char *>(&CACHE_VERSION), sizeof(CACHE_VERSION));
+    for (const RuleCompiler::Source &source : sources) {
+        hash.addData(source.first.toUtf8());
+        hash.addData("\0", 1);
+        hash.addData(source.second);
+        hash.addData("\0", 1);
+    }
+    const QByteArray key = hash.result();
+
+    QSharedPointer<CompiledRules> rules = load(cachePath(), key);
+    if (!rules) {
+        rules = RuleCompiler::compile(sources);
+        if (!rules->save(cachePath(), key))
+            qWarning() << "Не удалось сохранить кэш правил:" << cachePath();
+    }
+    rules->sourceKey = key;
+    if (errors)
+        *errors = rules->errors;
+    return rules;
+}
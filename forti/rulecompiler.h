@@ -0,0 +1,129 @@
+#ifndef RULECOMPILER_H
+#define RULECOMPILER_H
+
+#include <QByteArray>
+#include <QPair>
+#include <QSharedPointer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// Скомпилированный набор правил обнаружения.
+//
+// Строки всех правил (текст, hex-строки с масками и прыжками,
+// регулярные выражения) собраны в один НКА по Томпсону; по нему
+// RuleMatcher лениво строит ДКА. Условия правил хранятся байт-кодом
+// стековой машины и вычисляются после прохода по файлу.
+struct CompiledRules {
+    enum NfaOp : quint8 {
+        OpByte,   // байт из множества arg, далее out
+        OpSplit,  // out и out2
+        OpJump,   // out
+        OpMatch   // найдена строка arg
+    };
+
+    struct NfaState {
+        quint8 op = OpJump;
+        quint32 arg = 0;
+        quint32 out = 0;
+        quint32 out2 = 0;
+    };
+
+    struct Pattern {
+        quint32 rule = 0;
+        qint32 length = -1;  // -1: длина переменная, смещение начала неизвестно
+    };
+
+    struct Rule {
+        QByteArray name;
+        QByteArray description;
+        quint8 level = 0;     // ScanVerdict::Level
+        QVector<qint64> code;
+    };
+
+    // Байт-код условий. Операнды идут следом за кодом операции.
+    enum CondOp : qint64 {
+        CondPush,      // значение
+        CondFileSize,
+        CondMatched,   // строка
+        CondCount,     // строка
+        CondOffset,    // строка; снимает номер вхождения (с 1)
+        CondAt,        // строка; снимает смещение
+        CondIn,        // строка; снимает верхнюю и нижнюю границы
+        CondUint8,
+        CondUint16,
+        CondUint32,
+        CondUint16Be,
+        CondUint32Be,
+        CondOf,        // порог, число строк, строки...
+        CondNot,
+        CondAnd,
+        CondOr,
+        CondEq,
+        CondNe,
+        CondLt,
+        CondLe,
+        CondGt,
+        CondGe,
+        CondAdd,
+        CondSub,
+        CondMul,
+        CondScriptScore
+    };
+
+    QVector<NfaState> nfa;
+    QVector<QByteArray> byteSets;     // битовые маски по 32 байта
+    QByteArray byteClass;             // байт -> класс эквивалентности
+    QByteArray classByte;             // класс -> байт-представитель
+    QVector<quint32> anchoredStarts;  // строки, привязанные к началу файла
+    QVector<quint32> floatingStarts;
+    QVector<Pattern> patterns;
+    QVector<Rule> rules;
+    QStringList errors;               // правила, пропущенные из-за ошибок
+    QByteArray sourceKey;             // хеш исходников и формата (installed), не сохраняется
+    int maxStack = 0;
+
+    bool isEmpty() const { return rules.isEmpty(); }
+    int classCount() const { return classByte.size(); }
+    bool inSet(quint32 set, uchar byte) const
+    {
+        return uchar(byteSets[int(set)].at(byte >> 3)) & (1u << (byte & 7));
+    }
+
+    bool save(const QString &fileName, const QByteArray &key) const;
+    static QSharedPointer<CompiledRules> load(const QString &fileName, const QByteArray &key);
+
+    // Правила из каталога правил (*.rule, *.yar) и встроенные.
+    // Результат компиляции кэшируется на диске по хешу исходников,
+    // поэтому процессы-обработчики не компилируют правила заново.
+    static QSharedPointer<const CompiledRules> installed(QStringList *errors = nullptr);
+    static QString rulesDirectory();
+    static QString cachePath();
+};
+
+// Компилятор языка правил в стиле YARA:
+//
+//   rule Name : tag {
+//     meta:
+//       description = "..."
+//       severity = "malicious"        // или "suspicious" (по умолчанию)
+//     strings:
+//       $a = "text" nocase wide ascii
+//       $b = { 4D 5A ?? ?? [2-8] ( 50 45 | 4E 45 ) }
+//       $c = /eval\s*\(\s*base64_decode/i
+//     condition:
+//       $a or (#b > 2 and $c in (0..1024)) or 2 of ($a, $c*) and filesize < 1MB
+//   }
+//
+// В условиях также доступны @a[n], $a at N, any/all/N of them,
+// uint8/16/32(N) и uint16be/uint32be(N) по первым 4 КБ файла, а также
+// script_score - оценка обфускации сценария 0..100 (см. ScriptAnalyzer).
+// Правило с ошибкой пропускается, остальные компилируются.
+class RuleCompiler {
+public:
+    typedef QPair<QString, QByteArray> Source;  // происхождение, текст
+
+    static QSharedPointer<CompiledRules> compile(const QVector<Source> &sources);
+};
+
+#endif // RULECOMPILER_H
@@ -0,0 +1,380 @@
+#include "rulematcher.h"
+
+#include <QVarLengthArray>
+
+#include <algorithm>
+
+#include "sparsereader.h"
+
+namespace {
+
+const int MAX_OFFSETS = 16;       // смещений на строку для at, in и @
+const int HEAD_SIZE = 4096;       // байты для uint8/16/32
+const int MAX_FILE_FLUSHES = 3;   // после стольких сбросов в файле - НКА
+const qint64 DEFAULT_BUDGET_MB = 8;
+
+qint64 dfaBudget()
+{
+    bool ok = false;
+    const qint64 mb = qEnvironmentVariable("FORTI_RULE_DFA_MB").toLongLong(&ok);
+    return (ok && mb > 0 ? mb : DEFAULT_BUDGET_MB) * 1024 * 1024;
+}
+
+} // namespace
+
+RuleMatcher::RuleMatcher(const QSharedPointer<const CompiledRules> &rules)
+    : m_rules(rules)
+    , m_memory(0)
+    , m_budget(dfaBudget())
+    , m_flushes(0)
+    , m_state(0)
+    , m_pos(0)
+    , m_fileFlushes(0)
+    , m_nfaMode(false)
+    , m_generation(0)
+{
+    m_mark.fill(0, m_rules->nfa.size());
+    m_counts.fill(0, m_rules->patterns.size());
+    m_offsets.fill(0, m_rules->patterns.size() * MAX_OFFSETS);
+
+    ++m_generation;
+    for (quint32 s : m_rules->floatingStarts)
+        addClosure(s, m_floating);
+    std::sort(m_floating.begin(), m_floating.end());
+
+    startState();
+}
+
+void RuleMatcher::addClosure(quint32 state, QVector<quint32> &set)
+{
+    m_stack.append(state);
+    while (!m_stack.isEmpty()) {
+        const quint32 s = m_stack.takeLast();
+        if (m_mark[int(s)] == m_generation)
+            continue;
+        m_mark[int(s)] = m_generation;
+        const CompiledRules::NfaState &st = m_rules->nfa[int(s)];
+        switch (st.op) {
+        case CompiledRules::OpSplit:
+            m_stack.append(st.out2);
+            m_stack.append(st.out);
+            break;
+        case CompiledRules::OpJump:
+            m_stack.append(st.out);
+            break;
+        default:
+            set.append(s);
+        }
+    }
+}
+
+void RuleMatcher::step(const QVector<quint32> &from, uchar byte, QVector<quint32> &to)
+{
+    to.clear();
+    ++m_generation;
+    for (quint32 s : from) {
+        const CompiledRules::NfaState &st = m_rules->nfa[int(s)];
+        if (st.op == CompiledRules::OpByte && m_rules->inSet(st.arg, byte))
+            addClosure(st.out, to);
+    }
+    // Незакрепленные строки могут начаться с любой позиции
+    for (quint32 s : m_floating) {
+        if (m_mark[int(s)] != m_generation) {
+            m_mark[int(s)] = m_generation;
+            to.append(s);
+        }
+    }
+    std::sort(to.begin(), to.end());
+}
+
+int RuleMatcher::addState(const QVector<quint32> &set)
+{
+    const QByteArray key(reinterpret_cast<const char *>(set.constData()),
+                         set.size() * int(sizeof(quint32)));
+    auto it = m_stateIndex.constFind(key);
+    if (it != m_stateIndex.constEnd())
+        return it.value();
+
+    DState state;
+    state.nfa = set;
+    for (quint32 s : set) {
+        const CompiledRules::NfaState &st = m_rules->nfa[int(s)];
+        if (st.op == CompiledRules::OpMatch)
+            state.matches.append(st.arg);
+    }
+    const int index = m_states.size();
+    m_accepting.append(state.matches.isEmpty() ? '\0' : '\1');
+    m_states.append(state);
+    m_stateIndex.insert(key, index);
+
+    const int classes = m_rules->classCount();
+    m_table.resize(m_table.size() + classes);
+    std::fill(m_table.end() - classes, m_table.end(), -1);
+    m_memory += qint64(classes) * 4 + qint64(set.size()) * 8 + key.size() + 128;
+    return index;
+}
+
+void RuleMatcher::startState()
+{
+    QVector<quint32> set;
+    ++m_generation;
+    for (quint32 s : m_rules->anchoredStarts)
+        addClosure(s, set);
+    for (quint32 s : m_floating) {
+        if (m_mark[int(s)] != m_generation) {
+            m_mark[int(s)] = m_generation;
+            set.append(s);
+        }
+    }
+    std::sort(set.begin(), set.end());
+    addState(set);
+}
+
+int RuleMatcher::transition(int state, int cls)
+{
+    QVector<quint32> next;
+    step(m_states[state].nfa, uchar(m_rules->classByte.at(cls)), next);
+
+    if (m_memory > m_budget) {
+        ++m_flushes;
+        if (++m_fileFlushes > MAX_FILE_FLUSHES) {
+            // Автомат не помещается в бюджет на этом файле: дальше - НКА
+            m_nfaMode = true;
+            m_nfaSet = next;
+            return -1;
+        }
+        m_states.clear();
+        m_stateIndex.clear();
+        m_table.clear();
+        m_accepting.clear();
+        m_memory = 0;
+        startState();
+        return addState(next);
+    }
+
+    const int index = addState(next);
+    m_table[state * m_rules->classCount() + cls] = index;
+    return index;
+}
+
+void RuleMatcher::reset()
+{
+    for (quint32 p : m_touched)
+        m_counts[int(p)] = 0;
+    m_touched.clear();
+    m_head.clear();
+    m_pos = 0;
+    m_fileFlushes = 0;
+    m_nfaMode = false;
+    m_state = 0;
+}
+
+void RuleMatcher::record(quint32 pattern, qint64 pos)
+{
+    const quint32 count = ++m_counts[int(pattern)];
+    if (count == 1)
+        m_touched.append(pattern);
+    if (count <= quint32(MAX_OFFSETS)) {
+        const qint32 length = m_rules->patterns[int(pattern)].length;
+        m_offsets[int(pattern) * MAX_OFFSETS + int(count) - 1] = length > 0 ? pos - length + 1 : pos;
+    }
+}
+
+void RuleMatcher::feed(const uchar *data, int size)
+{
+    if (m_head.size() < HEAD_SIZE && m_pos == m_head.size())
+        m_head.append(reinterpret_cast<const char *>(data), qMin(size, HEAD_SIZE - m_head.size()));
+
+    int i = 0;
+    if (!m_nfaMode) {
+        const uchar *byteClass = reinterpret_cast<const uchar *>(m_rules->byteClass.constData());
+        const int classes = m_rules->classCount();
+        const qint32 *table = m_table.constData();
+        int s = m_state;
+        for (; i < size; ++i) {
+            const int cls = byteClass[data[i]];
+            int next = table[s * classes + cls];
+            if (next < 0) {
+                next = transition(s, cls);
+                table = m_table.constData();
+                if (next < 0)
+                    break;
+            }
+            s = next;
+            if (m_accepting.at(s)) {
+                for (quint32 p : m_states[s].matches)
+                    record(p, m_pos + i);
+            }
+        }
+        m_state = s;
+        if (m_nfaMode) {
+            // Байт i уже обработан при переключении
+            for (quint32 st : m_nfaSet) {
+                if (m_rules->nfa[int(st)].op == CompiledRules::OpMatch)
+                    record(m_rules->nfa[int(st)].arg, m_pos + i);
+            }
+            ++i;
+        }
+    }
+
+    for (; i < size; ++i) {
+        step(m_nfaSet, data[i], m_nfaNext);
+        m_nfaSet.swap(m_nfaNext);
+        for (quint32 st : m_nfaSet) {
+            if (m_rules->nfa[int(st)].op == CompiledRules::OpMatch)
+                record(m_rules->nfa[int(st)].arg, m_pos + i);
+        }
+    }
+    m_pos += size;
+}
+
+// Нули подаются, пока очередной ноль не оставит ДКА в том же состоянии
+// без найденных строк: дальше каждый ноль ничего не меняет, и остаток
+// дыры только сдвигает позицию. Строки из одних нулей находятся как в
+// сплошном файле, потому что их состояние принимающее
+void RuleMatcher::feedZeros(qint64 length)
+{
+    static const uchar zero = 0;
+    while (length > 0) {
+        const int size = int(qMin<qint64>(length, SparseReader::ZeroBlockSize));
+        feed(SparseReader::zeros(), size);
+        length -= size;
+        if (length == 0 || m_nfaMode)
+            continue;
+        const int before = m_state;
+        feed(&zero, 1);
+        --length;
+        if (!m_nfaMode && m_state == before && !m_accepting.at(m_state)) {
+            m_pos += length;
+            return;
+        }
+    }
+}
+
+// Пропущенный участок не читается: совпадение, начатое до него, обрывается,
+// после него строки ищутся заново (закрепленные в начале файла - нет)
+void RuleMatcher::skip(qint64 length)
+{
+    if (length <= 0)
+        return;
+    m_pos += length;
+    if (m_nfaMode)
+        m_nfaSet = m_floating;
+    else
+        m_state = addState(m_floating);
+}
+
+qint64 RuleMatcher::readHead(qint64 offset, int size, bool bigEndian) const
+{
+    // За пределами первых HEAD_SIZE байт значение считается нулем
+    if (offset < 0 || offset + size > m_head.size())
+        return 0;
+    quint64 value = 0;
+    for (int k = 0; k < size; ++k) {
+        const int index = bigEndian ? k : size - 1 - k;
+        value = (value << 8) | uchar(m_head.at(int(offset) + index));
+    }
+    return qint64(value);
+}
+
+bool RuleMatcher::evaluate(const CompiledRules::Rule &rule, qint64 fileSize, int scriptScore) const
+{
+    QVarLengthArray<qint64, 32> stack;
+    const QVector<qint64> &code = rule.code;
+    auto pop = [&stack]() {
+        const qint64 v = stack.last();
+        stack.removeLast();
+        return v;
+    };
+    auto offsets = [this](qint64 p, qint64 &count) {
+        count = qMin<qint64>(m_counts[int(p)], MAX_OFFSETS);
+        return m_offsets.constData() + p * MAX_OFFSETS;
+    };
+
+    for (int pc = 0; pc < code.size();) {
+        const qint64 instr = code[pc++];
+        switch (instr) {
+        case CompiledRules::CondPush:
+            stack.append(code[pc++]);
+            break;
+        case CompiledRules::CondFileSize:
+            stack.append(fileSize);
+            break;
+        case CompiledRules::CondScriptScore:
+            stack.append(scriptScore);
+            break;
+        case CompiledRules::CondMatched:
+            stack.append(m_counts[int(code[pc++])] > 0);
+            break;
+        case CompiledRules::CondCount:
+            stack.append(m_counts[int(code[pc++])]);
+            break;
+        case CompiledRules::CondOffset: {
+            qint64 count;
+            const qint64 *offs = offsets(code[pc++], count);
+            const qint64 n = pop();
+            stack.append(n >= 1 && n <= count ? offs[n - 1] : -1);
+            break;
+        }
+        case CompiledRules::CondAt:
+        case CompiledRules::CondIn: {
+            qint64 count;
+            const qint64 *offs = offsets(code[pc++], count);
+            const qint64 hi = pop();
+            const qint64 lo = instr == CompiledRules::CondIn ? pop() : hi;
+            bool found = false;
+            for (qint64 k = 0; k < count && !found; ++k)
+                found = offs[k] >= lo && offs[k] <= hi;
+            stack.append(found);
+            break;
+        }
+        case CompiledRules::CondUint8:    stack.append(readHead(pop(), 1, false)); break;
+        case CompiledRules::CondUint16:   stack.append(readHead(pop(), 2, false)); break;
+        case CompiledRules::CondUint32:   stack.append(readHead(pop(), 4, false)); break;
+        case CompiledRules::CondUint16Be: stack.append(readHead(pop(), 2, true)); break;
+        case CompiledRules::CondUint32Be: stack.append(readHead(pop(), 4, true)); break;
+        case CompiledRules::CondOf: {
+            const qint64 threshold = code[pc++];
+            const qint64 n = code[pc++];
+            qint64 matched = 0;
+            for (qint64 k = 0; k < n; ++k)
+                matched += m_counts[int(code[pc++])] > 0;
+            stack.append(matched >= threshold);
+            break;
+        }
+        case CompiledRules::CondNot:
+            stack.append(!pop());
+            break;
+        default: {
+            const qint64 b = pop();
+            const qint64 a = pop();
+            qint64 r = 0;
+            switch (instr) {
+            case CompiledRules::CondAnd: r = a && b; break;
+            case CompiledRules::CondOr:  r = a || b; break;
+            case CompiledRules::CondEq:  r = a == b; break;
+            case CompiledRules::CondNe:  r = a != b; break;
+            case CompiledRules::CondLt:  r = a < b; break;
+            case CompiledRules::CondLe:  r = a <= b; break;
+            case CompiledRules::CondGt:  r = a > b; break;
+            case CompiledRules::CondGe:  r = a >= b; break;
+            case CompiledRules::CondAdd: r = a + b; break;
+            case CompiledRules::CondSub: r = a - b; break;
+            case CompiledRules::CondMul: r = a * b; break;
+            }
+            stack.append(r);
+        }
+        }
+    }
+    return !stack.isEmpty() && stack.last() != 0;
+}
+
+QVector<int> RuleMatcher::finish(qint64 fileSize, int scriptScore)
+{
+    QVector<int> matched;
+    for (int r = 0; r < m_rules->rules.size(); ++r) {
+        if (evaluate(m_rules->rules[r], fileSize, scriptScore))
+            matched.append(r);
+    }
+    return matched;
+}
@@ -0,0 +1,85 @@
+#ifndef RULEMATCHER_H
+#define RULEMATCHER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QSharedPointer>
+#include <QVector>
+
+#include "rulecompiler.h"
+
+// Поиск строк всех правил за один проход по содержимому файла.
+// ДКА строится лениво из общего НКА и сохраняется между файлами.
+// Память под состояния ограничена (FORTI_RULE_DFA_MB, по умолчанию 8):
+// при переполнении кэш сбрасывается, а если в одном файле сбросы
+// повторяются, остаток файла проходит симуляцией НКА.
+class RuleMatcher {
+public:
+    explicit RuleMatcher(const QSharedPointer<const CompiledRules> &rules);
+
+    // Нужно ли содержимое файла (есть ли у правил строки)
+    bool needsContent() const { return !m_rules->patterns.isEmpty(); }
+
+    void reset();
+    void feed(const uchar *data, int size);
+    // length нулевых байт (дыра разреженного файла)
+    void feedZeros(qint64 length);
+    // Сдвинуть позицию на length непрочитанных байт (выборочная проверка)
+    void skip(qint64 length);
+
+    // Условия вычисляются после прохода; индексы сработавших правил.
+    // scriptScore - оценка обфускации сценария (script_score)
+    QVector<int> finish(qint64 fileSize, int scriptScore = 0);
+
+    const QSharedPointer<const CompiledRules> &rules() const { return m_rules; }
+    int dfaStates() const { return m_states.size(); }
+    int cacheFlushes() const { return m_flushes; }
+
+private:
+    struct DState {
+        QVector<quint32> nfa;      // отсортированное множество состояний НКА
+        QVector<quint32> matches;  // строки, найденные в этом состоянии
+    };
+
+    void addClosure(quint32 state, QVector<quint32> &set);
+    void step(const QVector<quint32> &from, uchar byte, QVector<quint32> &to);
+    int addState(const QVector<quint32> &set);
+    int transition(int state, int cls);
+    void startState();
+    void record(quint32 pattern, qint64 pos);
+    bool evaluate(const CompiledRules::Rule &rule, qint64 fileSize, int scriptScore) const;
+    qint64 readHead(qint64 offset, int size, bool bigEndian) const;
+
+    QSharedPointer<const CompiledRules> m_rules;
+
+    // Кэш ДКА: состояние 0 - начальное
+    QVector<DState> m_states;
+    QHash<QByteArray, int> m_stateIndex;
+    QVector<qint32> m_table;     // состояние * классов + класс -> состояние, -1 - не вычислено
+    QByteArray m_accepting;      // состояние -> есть найденные строки
+    qint64 m_memory;
+    qint64 m_budget;
+    int m_flushes;
+
+    // Текущий файл
+    int m_state;
+    qint64 m_pos;
+    int m_fileFlushes;
+    bool m_nfaMode;
+    QVector<quint32> m_nfaSet;
+    QVector<quint32> m_nfaNext;
+    QByteArray m_head;
+
+    // Служебное для обхода НКА
+    QVector<quint32> m_mark;
+    quint32 m_generation;
+    QVector<quint32> m_stack;
+    QVector<quint32> m_floating;  // замыкание незакрепленных начал
+
+    // Найденные строки: число вхождений и первые смещения
+    QVector<quint32> m_counts;
+    QVector<qint64> m_offsets;
+    QVector<quint32> m_touched;
+};
+
+#endif // RULEMATCHER_H
@@ -0,0 +1,111 @@
+#include "scanbenchmark.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QVector>
+
+#include <stdio.h>
+
+#include "exclusionrules.h"
+#include "filescanner.h"
+#include "filewalker.h"
+#include "rulecompiler.h"
+#include "scanpriority.h"
+#include "scanworkerpool.h"
+#include "similarityindex.h"
+
+namespace {
+
+struct Detection {
+    qint64 ms;
+    int rank;  // номер среди проверенных файлов
+    QByteArray path;
+    QString description;
+};
+
+} // namespace
+
+int runScanBenchmark(const QString &root)
+{
+    QTextStream out(stdout);
+    if (!QFileInfo(root).isDir()) {
+        out << "Каталог не найден: " << root << "\n";
+        return 2;
+    }
+
+    ScanWorkerPool pool;
+    const bool isolated = pool.start();
+    const QSharedPointer<const CompiledRules> rules = CompiledRules::installed();
+    // База пакетов не подключается: замеряется порядок, а не пропуск
+    // сверенных файлов
+    FileScanner scanner(rules, SimilarityIndex::installed(), QSharedPointer<const PackageAllowlist>(),
+                        isolated ? QVector<DetectorFactory *>() : DetectorRegistry::installed());
+    scanner.setLargeFilePolicy(LargeFilePolicy::installed(), CoverageSchedule::cached());
+
+    const bool prioritized = !ScanPriority::isDisabled();
+    ScanPriority priority;
+
+    QElapsedTimer timer;
+    timer.start();
+    int scanned = 0;
+    QVector<Detection> detections;
+    auto onResult = [&](quint64, const QByteArray &path, const ScanVerdict &verdict) {
+        ++scanned;
+        if (verdict.level == ScanVerdict::Suspicious || verdict.level == ScanVerdict::Malicious)
+            detections.append(Detection{ timer.elapsed(), scanned, path, verdict.describe() });
+    };
+    QObject::connect(&pool, &ScanWorkerPool::fileScanned, onResult);
+    // Очередь та же, что при сканировании папки
+    ScanScheduler scheduler(isolated ? &pool : nullptr, &scanner, prioritized, onResult);
+
+    quint64 nextId = 0;
+    FileWalker walker(ExclusionRules::load());
+    if (prioritized) {
+        walker.setNeedSize(true);
+        walker.setDirectoryPriority([&](const QByteArray &dir) { return priority.directoryScore(dir); });
+    }
+    walker.walk(root, [&](const WalkEntry &entry) {
+        scheduler.push(nextId++, entry.path, prioritized ? priority.fileScore(entry) : 0);
+        scheduler.feed();
+        while (scheduler.isFull()) {
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+            scheduler.feed();
+        }
+        return true;
+    });
+    const qint64 walkMs = timer.elapsed();
+
+    if (isolated) {
+        scheduler.feed();
+        pool.flush();
+        while (!scheduler.isEmpty() || !pool.isIdle()) {
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+            scheduler.feed();
+            pool.flush();
+        }
+    } else {
+        while (!scheduler.isEmpty())
+            scheduler.scanNext();
+    }
+    const qint64 totalMs = timer.elapsed();
+
+    out << "Каталог: " << root << "\n"
+        << "Порядок: " << (prioritized ? "по риску" : "по обходу") << "\n"
+        << "Проверка: " << (isolated ? "в обработчиках" : "в основном процессе") << "\n"
+        << "Файлов: " << scanned << ", обход: " << walkMs << " мс, всего: " << totalMs << " мс\n"
+        << "Находок: " << detections.size() << "\n";
+    if (detections.isEmpty())
+        return 1;
+
+    const Detection &first = detections.first();
+    out << "Время до первой находки: " << first.ms << " мс (файл " << first.rank << " из "
+        << scanned << ")\n";
+    for (const Detection &detection : detections) {
+        out << "  " << detection.ms << " мс  #" << detection.rank << "  "
+            << QFile::decodeName(detection.path) << "  " << detection.description << "\n";
+    }
+    return 0;
+}
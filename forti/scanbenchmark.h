@@ -0,0 +1,15 @@
+#ifndef SCANBENCHMARK_H
+#define SCANBENCHMARK_H
+
+#include <QString>
+
+// Аргумент командной строки: forti --scan-benchmark <каталог>
+static const char SCAN_BENCHMARK_ARG[] = "--scan-benchmark";
+
+// Сканирование каталога без окна с замером времени до каждой находки.
+// Образцы подкладываются в дерево заранее; порядок - тот же, что у
+// сканирования из окна (FORTI_NO_SCAN_PRIORITY - в порядке обхода).
+// Отчет пишется в stdout, код возврата 0 - есть находки, 1 - нет, 2 - ошибка.
+int runScanBenchmark(const QString &root);
+
+#endif // SCANBENCHMARK_H
@@ -0,0 +1,413 @@
+#include "scancheckpoint.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace {
+
+const char MAGIC[4] = { 'F', 'S', 'J', '1' };
+const quint32 VERSION = 1;
+const int FLUSH_BYTES = 256 * 1024;
+const int DEFAULT_SYNC_SECONDS = 10;
+// Запись длиннее - признак порчи, а не настоящая запись
+const quint32 MAX_RECORD = 1 << 20;
+
+// Журнал читается той же машиной, что писала: порядок байт родной
+template <typename T>
+void put(QByteArray &out, T value)
+{
+    out.append(reinterpret_cast<const char *>(&value), int(sizeof(T)));
+}
+
+void putBytes(QByteArray &out, const QByteArray &bytes)
+{
+    put<quint32>(out, quint32(bytes.size()));
+    out.append(bytes);
+}
+
+// Последовательное чтение с проверкой границ
+struct Reader {
+    const uchar *p;
+    const uchar *end;
+
+    template <typename T>
+    bool get(T *value)
+    {
+        if (end - p < qint64(sizeof(T)))
+            return false;
+        memcpy(value, p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+
+    bool getBytes(QByteArray *bytes)
+    {
+        quint32 n = 0;
+        if (!get(&n) || quint64(end - p) < n)
+            return false;
+        *bytes = QByteArray(reinterpret_cast<const char *>(p), int(n));
+        p += n;
+        return true;
+    }
+};
+
+quint32 fnv1a(const uchar *data, qint64 size)
+{
+    quint32 h = 2166136261u;
+    for (qint64 i = 0; i < size; ++i) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+bool writeAll(int fd, const char *data, qint64 size)
+{
+    while (size > 0) {
+        const ssize_t n = ::write(fd, data, size_t(size));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+QByteArray encodeRoot(const QString &root)
+{
+    return QFile::encodeName(QDir::cleanPath(QFileInfo(root).absoluteFilePath()));
+}
+
+} // namespace
+
+ScanCheckpoint::ScanCheckpoint(const QString &root, const QByteArray &configText)
+    : m_fileName(defaultPath(root))
+    , m_rootPath(encodeRoot(root))
+    , m_fd(-1)
+    , m_syncIntervalMs(DEFAULT_SYNC_SECONDS * 1000)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(m_rootPath);
+    hash.addData("\0", 1);
+    hash.addData(configText);
+    m_fingerprint = hash.result();
+
+    bool ok = false;
+    const int seconds = qEnvironmentVariableIntValue("FORTI_CHECKPOINT_SECONDS", &ok);
+    if (ok && seconds >= 0)
+        m_syncIntervalMs = qint64(seconds) * 1000;
+}
+
+ScanCheckpoint::~ScanCheckpoint()
+{
+    if (m_fd >= 0) {
+        flush();
+        ::close(m_fd);
+    }
+}
+
+QString ScanCheckpoint::defaultPath(const QString &root)
+{
+    const QByteArray key = QCryptographicHash::hash(encodeRoot(root), QCryptographicHash::Sha1).toHex();
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)
+           + "/checkpoints/" + QString::fromLatin1(key) + ".fsj";
+}
+
+bool ScanCheckpoint::readHeader(const uchar *data, qint64 size, qint64 *headerSize) const
+{
+    Reader in{ data, data + size };
+    char magic[4];
+    quint32 version = 0;
+    QByteArray fingerprint;
+    if (!in.get(&magic) || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0
+        || !in.get(&version) || version != VERSION
+        || !in.getBytes(&fingerprint) || fingerprint != m_fingerprint)
+        return false;
+    *headerSize = in.p - data;
+    return true;
+}
+
+bool ScanCheckpoint::exists() const
+{
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const QByteArray head = file.read(64);
+    qint64 headerSize = 0;
+    return readHeader(reinterpret_cast<const uchar *>(head.constData()), head.size(), &headerSize);
+}
+
+qint64 ScanCheckpoint::restore(const ResultCallback &onResult)
+{
+    m_dirs.clear();
+    m_completed.clear();
+    m_restoredFiles.clear();
+
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return -1;
+    const qint64 size = file.size();
+    const uchar *data = size > 0 ? file.map(0, size) : nullptr;
+    qint64 offset = 0;
+    if (!data || !readHeader(data, size, &offset))
+        return -1;
+
+    // Первый проход: результаты в отчет, набор завершенных каталогов.
+    // Чтение останавливается на первой неполной или испорченной записи
+    qint64 results = 0;
+    QVector<QPair<qint64, qint64>> resultSpans;  // пути результатов в файле
+    while (offset < size) {
+        Reader in{ data + offset, data + size };
+        quint32 length = 0;
+        quint8 type = 0;
+        if (!in.get(&length) || length > MAX_RECORD || !in.get(&type)
+            || quint64(in.end - in.p) < quint64(length) + sizeof(quint32))
+            break;
+        quint32 checksum = 0;
+        memcpy(&checksum, in.p + length, sizeof(checksum));
+        if (checksum != fnv1a(in.p - 1, qint64(length) + 1))
+            break;
+
+        Reader payload{ in.p, in.p + length };
+        if (type == ResultRecord) {
+            QByteArray path;
+            ScanVerdict verdict;
+            if (!payload.getBytes(&path) || !payload.get(&verdict.level) || !payload.get(&verdict.reason)
+                || !payload.get(&verdict.size) || !payload.get(&verdict.mtime)
+                || !payload.getBytes(&verdict.hash) || !payload.getBytes(&verdict.detail))
+                break;
+            // Полнота проверки дописана в конец записи; без нее - целиком
+            payload.get(&verdict.coverage);
+            onResult(path, verdict);
+            resultSpans.append(qMakePair(qint64(in.p - data), qint64(in.p + length - data)));
+            ++results;
+        } else if (type == DirectoryRecord) {
+            m_completed.insert(QByteArray(reinterpret_cast<const char *>(in.p), int(length)));
+        } else {
+            break;
+        }
+        offset = (in.p - data) + length + sizeof(quint32);
+    }
+
+    // Вложенные завершенные каталоги не нужны: хватает вершины поддерева
+    QSet<QByteArray> tops;
+    for (const QByteArray &dir : m_completed) {
+        if (!hasCompletedAncestor(dir))
+            tops.insert(dir);
+    }
+    m_completed = tops;
+
+    // Второй проход: запоминаются только файлы вне завершенных поддеревьев,
+    // остальные обход и так не увидит
+    for (const QPair<qint64, qint64> &span : resultSpans) {
+        Reader payload{ data + span.first, data + span.second };
+        QByteArray path;
+        if (payload.getBytes(&path) && !hasCompletedAncestor(path))
+            m_restoredFiles.insert(path);
+    }
+    file.unmap(const_cast<uchar *>(data));
+    file.close();
+
+    // Испорченный хвост отрезается, запись продолжается за последней
+    // целой записью
+    m_fd = ::open(QFile::encodeName(m_fileName).constData(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (m_fd < 0 || ::ftruncate(m_fd, offset) != 0) {
+        qWarning() << "Не удалось продолжить журнал сканирования:" << m_fileName << strerror(errno);
+        if (m_fd >= 0)
+            ::close(m_fd);
+        m_fd = -1;
+        return -1;
+    }
+    m_sinceSync.start();
+    return results;
+}
+
+bool ScanCheckpoint::start()
+{
+    m_dirs.clear();
+    m_completed.clear();
+    m_restoredFiles.clear();
+    m_buffer.clear();
+    if (m_fd >= 0)
+        ::close(m_fd);
+
+    QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+    m_fd = ::open(QFile::encodeName(m_fileName).constData(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+    if (m_fd < 0) {
+        qWarning() << "Не удалось создать журнал сканирования:" << m_fileName << strerror(errno);
+        return false;
+    }
+    QByteArray header(MAGIC, sizeof(MAGIC));
+    put<quint32>(header, VERSION);
+    putBytes(header, m_fingerprint);
+    if (!writeAll(m_fd, header.constData(), header.size()) || ::fdatasync(m_fd) != 0) {
+        qWarning() << "Не удалось записать журнал сканирования:" << m_fileName << strerror(errno);
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    m_sinceSync.start();
+    return true;
+}
+
+void ScanCheckpoint::finish()
+{
+    m_buffer.clear();
+    discard();
+}
+
+void ScanCheckpoint::discard()
+{
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+    m_buffer.clear();
+    QFile::remove(m_fileName);
+}
+
+QByteArray ScanCheckpoint::parentOf(const QByteArray &path) const
+{
+    const int slash = path.lastIndexOf('/');
+    if (slash < 0)
+        return QByteArray();
+    return slash == 0 ? QByteArray("/") : path.left(slash);
+}
+
+// Каталог файла в m_parent: буфер переиспользуется, память выделяется
+// только при смене каталога, а не на каждый файл
+const QByteArray &ScanCheckpoint::fileParent(const QByteArray &file)
+{
+    const int slash = file.lastIndexOf('/');
+    const int length = slash > 0 ? slash : slash + 1;
+    m_parent.resize(length);
+    memcpy(m_parent.data(), file.constData(), size_t(length));
+    return m_parent;
+}
+
+bool ScanCheckpoint::hasCompletedAncestor(const QByteArray &path) const
+{
+    QByteArray dir = path;
+    while (dir != m_rootPath && dir.size() > m_rootPath.size()) {
+        dir = parentOf(dir);
+        if (m_completed.contains(dir))
+            return true;
+    }
+    return false;
+}
+
+bool ScanCheckpoint::shouldWalk(const QByteArray &dir)
+{
+    if (!m_completed.contains(dir))
+        return true;
+    // Уже завершенный подкаталог засчитывается родителю сразу
+    if (dir != m_rootPath)
+        m_dirs[parentOf(dir)].doneChildren.append(dir);
+    return false;
+}
+
+void ScanCheckpoint::fileQueued(const QByteArray &file)
+{
+    ++m_dirs[fileParent(file)].pendingFiles;
+}
+
+void ScanCheckpoint::directoryListed(const QByteArray &dir, int subdirs)
+{
+    DirState &state = m_dirs[dir];
+    state.listed = true;
+    state.pendingChildren += subdirs;
+    tryComplete(dir);
+}
+
+void ScanCheckpoint::fileScanned(const QByteArray &file, const ScanVerdict &verdict)
+{
+    m_record.resize(0);
+    putBytes(m_record, file);
+    put<quint8>(m_record, verdict.level);
+    put<quint8>(m_record, verdict.reason);
+    put<qint64>(m_record, verdict.size);
+    put<qint64>(m_record, verdict.mtime);
+    putBytes(m_record, verdict.hash);
+    putBytes(m_record, verdict.detail);
+    put<quint8>(m_record, verdict.coverage);
+    append(ResultRecord, m_record);
+
+    const QByteArray &dir = fileParent(file);
+    auto it = m_dirs.find(dir);
+    if (it != m_dirs.end()) {
+        --it.value().pendingFiles;
+        tryComplete(dir);
+    }
+}
+
+// Каталог завершен: отметка в журнал, родителю на один подкаталог
+// меньше; завершение может подняться на несколько уровней сразу
+void ScanCheckpoint::tryComplete(QByteArray dir)
+{
+    for (;;) {
+        auto it = m_dirs.find(dir);
+        if (it == m_dirs.end() || !it.value().listed || it.value().pendingFiles > 0
+            || it.value().pendingChildren > 0)
+            return;
+        for (const QByteArray &child : it.value().doneChildren)
+            m_completed.remove(child);
+        m_dirs.erase(it);
+        m_completed.insert(dir);
+        append(DirectoryRecord, dir);
+        if (dir == m_rootPath)
+            return;
+
+        const QByteArray child = dir;
+        dir = parentOf(child);
+        DirState &parent = m_dirs[dir];
+        --parent.pendingChildren;
+        parent.doneChildren.append(child);
+    }
+}
+
+void ScanCheckpoint::append(RecordType type, const QByteArray &payload)
+{
+    if (m_fd < 0)
+        return;
+    const int start = m_buffer.size();
+    put<quint32>(m_buffer, quint32(payload.size()));
+    put<quint8>(m_buffer, type);
+    m_buffer.append(payload);
+    const uchar *typed = reinterpret_cast<const uchar *>(m_buffer.constData()) + start + sizeof(quint32);
+    put<quint32>(m_buffer, fnv1a(typed, payload.size() + 1));
+
+    if (m_buffer.size() >= FLUSH_BYTES)
+        flush();
+    if (m_syncIntervalMs > 0 && m_sinceSync.elapsed() >= m_syncIntervalMs)
+        sync();
+}
+
+bool ScanCheckpoint::flush()
+{
+    if (m_fd < 0 || m_buffer.isEmpty())
+        return m_fd >= 0;
+    const bool ok = writeAll(m_fd, m_buffer.constData(), m_buffer.size());
+    if (!ok)
+        qWarning() << "Не удалось дописать журнал сканирования:" << m_fileName << strerror(errno);
+    m_buffer.clear();
+    return ok;
+}
+
+bool ScanCheckpoint::sync()
+{
+    const bool ok = flush() && ::fdatasync(m_fd) == 0;
+    m_sinceSync.start();
+    return ok;
+}
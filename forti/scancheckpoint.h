@@ -0,0 +1,105 @@
+#ifndef SCANCHECKPOINT_H
+#define SCANCHECKPOINT_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+#include <functional>
+
+#include "filescanner.h"
+
+// Контрольная точка сканирования: журнал, позволяющий продолжить
+// прерванное или аварийно завершенное сканирование с того же места.
+//
+// Журнал (*.fsj) только дописывается: результаты проверенных файлов
+// и отметки о завершенных каталогах. Каталог завершен, когда все его
+// файлы проверены (результаты приходят от обработчиков в любом порядке)
+// и все подкаталоги завершены. Запись буферизуется, fdatasync - раз
+// в FORTI_CHECKPOINT_SECONDS (по умолчанию 10) и при отмене. Каждая
+// запись несет контрольную сумму: оборванный хвост после сбоя
+// отбрасывается при загрузке.
+//
+// При продолжении завершенные поддеревья не открываются, остальные
+// каталоги читаются заново (это и есть восстановленный фронт обхода),
+// уже проверенные в них файлы пропускаются. Результаты из журнала
+// попадают в отчет вместе с новыми, поэтому отчет совпадает с отчетом
+// непрерывного сканирования.
+//
+// Разметка записи: u32 длина данных, u8 тип, данные, u32 FNV-1a типа
+// и данных. Заголовок: "FSJ1", версия, отпечаток корня и настроек
+// сканирования.
+class ScanCheckpoint {
+public:
+    typedef std::function<void(const QByteArray &path, const ScanVerdict &verdict)> ResultCallback;
+
+    // configText - все, что влияет на состав обхода и вердикты: исключения,
+    // правила, индекс образцов, политика крупных файлов, детекторы
+    ScanCheckpoint(const QString &root, const QByteArray &configText);
+    ~ScanCheckpoint();
+
+    const QString &fileName() const { return m_fileName; }
+    static QString defaultPath(const QString &root);
+
+    // Есть журнал для того же корня и тех же правил
+    bool exists() const;
+    // Загрузить журнал и продолжить запись в него; -1 при ошибке
+    qint64 restore(const ResultCallback &onResult);
+    // Начать новый журнал
+    bool start();
+    // Сканирование завершено, отчет сохранен: журнал больше не нужен
+    void finish();
+    void discard();
+
+    // Обработчики обхода (FileWalker) и результатов
+    bool shouldWalk(const QByteArray &dir);
+    bool isScanned(const QByteArray &file) const { return m_restoredFiles.contains(file); }
+    void fileQueued(const QByteArray &file);
+    void directoryListed(const QByteArray &dir, int subdirs);
+    void fileScanned(const QByteArray &file, const ScanVerdict &verdict);
+
+    // Дописать буфер и сбросить на диск
+    bool sync();
+
+private:
+    Q_DISABLE_COPY(ScanCheckpoint)
+
+    enum RecordType : quint8 {
+        ResultRecord = 1,
+        DirectoryRecord = 2
+    };
+
+    struct DirState {
+        int pendingFiles = 0;
+        int pendingChildren = 0;
+        bool listed = false;
+        QVector<QByteArray> doneChildren;  // для сжатия набора завершенных
+    };
+
+    QByteArray parentOf(const QByteArray &path) const;
+    const QByteArray &fileParent(const QByteArray &file);
+    bool hasCompletedAncestor(const QByteArray &path) const;
+    void tryComplete(QByteArray dir);
+    void append(RecordType type, const QByteArray &payload);
+    bool flush();
+    bool readHeader(const uchar *data, qint64 size, qint64 *headerSize) const;
+
+    QString m_fileName;
+    QByteArray m_rootPath;
+    QByteArray m_fingerprint;
+    int m_fd;
+    QByteArray m_buffer;
+    QByteArray m_record;  // запись результата перед добавлением в буфер
+    QByteArray m_parent;
+    QElapsedTimer m_sinceSync;
+    qint64 m_syncIntervalMs;
+
+    QHash<QByteArray, DirState> m_dirs;   // каталоги, начатые, но не завершенные
+    QSet<QByteArray> m_completed;         // вершины завершенных поддеревьев
+    QSet<QByteArray> m_restoredFiles;     // проверенные файлы в незавершенных каталогах
+};
+
+#endif // SCANCHECKPOINT_H
@@ -0,0 +1,235 @@
+#include "scanpriority.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include "filescanner.h"
+#include "scanworkerpool.h"
+
+namespace {
+
+const qint64 DAY_SECONDS = 24 * 60 * 60;
+const qint64 LARGE_FILE = 256LL * 1024 * 1024;
+
+// Расширения, которые обычно запускаются или открываются с макросами
+const char *const RISKY_SUFFIXES[] = {
+    "exe", "dll", "scr", "com", "pif", "bat", "cmd", "ps1", "vbs", "vbe", "js", "jse",
+    "wsf", "hta", "msi", "lnk", "jar", "apk", "sh", "run", "bin", "elf", "so", "py",
+    "docm", "xlsm", "pptm", "iso", "img", "appimage", "deb", "rpm"
+};
+
+// Медиа: большие, многочисленные и редко несут исполняемое
+const char *const MEDIA_SUFFIXES[] = {
+    "mp3", "flac", "ogg", "wav", "m4a", "mp4", "mkv", "avi", "mov", "webm",
+    "jpg", "jpeg", "png", "gif", "heic", "raw", "cr2", "nef"
+};
+
+template <size_t N>
+bool hasSuffix(const char *name, const char *const (&suffixes)[N])
+{
+    const char *dot = strrchr(name, '.');
+    if (!dot || dot == name)
+        return false;
+    for (const char *suffix : suffixes) {
+        if (strcasecmp(dot + 1, suffix) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool isUnder(const QByteArray &path, const QByteArray &dir)
+{
+    return path.startsWith(dir) && (path.size() == dir.size() || path.at(dir.size()) == '/');
+}
+
+} // namespace
+
+ScanPriority::ScanPriority()
+    : m_now(QDateTime::currentSecsSinceEpoch())
+    , m_lastDirScore(0)
+{
+    const QString home = QDir::homePath();
+    addLocation(QStandardPaths::writableLocation(QStandardPaths::DownloadLocation), 40);
+    addLocation(home + "/Downloads", 40);
+    addLocation(QStandardPaths::writableLocation(QStandardPaths::DesktopLocation), 30);
+    addLocation(home + "/.config/autostart", 40);
+    addLocation(home + "/.local/bin", 30);
+    addLocation(home + "/bin", 30);
+    addLocation(home + "/.local/share/applications", 20);
+    addLocation(QDir::tempPath(), 40);
+    addLocation("/tmp", 40);
+    addLocation("/var/tmp", 40);
+    addLocation("/dev/shm", 40);
+    addLocation("/etc/cron.d", 30);
+    addLocation(QStandardPaths::writableLocation(QStandardPaths::MusicLocation), -30);
+    addLocation(QStandardPaths::writableLocation(QStandardPaths::MoviesLocation), -30);
+    addLocation(QStandardPaths::writableLocation(QStandardPaths::PicturesLocation), -30);
+    // Вложенное место проверяется раньше охватывающего
+    std::sort(m_locations.begin(), m_locations.end(), [](const Location &a, const Location &b) {
+        return a.path.size() > b.path.size();
+    });
+}
+
+bool ScanPriority::isDisabled()
+{
+    return qEnvironmentVariableIsSet("FORTI_NO_SCAN_PRIORITY");
+}
+
+void ScanPriority::addLocation(const QString &path, int score)
+{
+    if (path.isEmpty())
+        return;
+    const QByteArray encoded = QFile::encodeName(QDir::cleanPath(path));
+    // Домашний каталог сам по себе не место риска (например, если
+    // загрузок нет и DownloadLocation вернул его)
+    if (encoded == QFile::encodeName(QDir::homePath()) || encoded == "/")
+        return;
+    for (const Location &location : m_locations) {
+        if (location.path == encoded)
+            return;
+    }
+    m_locations.append(Location{ encoded, score });
+}
+
+int ScanPriority::recencyScore(qint64 mtime, qint64 ctime) const
+{
+    const qint64 age = m_now - qMax(mtime, ctime);
+    if (age < DAY_SECONDS)
+        return 25;
+    if (age < 7 * DAY_SECONDS)
+        return 10;
+    return 0;
+}
+
+int ScanPriority::directoryScore(const QByteArray &dir) const
+{
+    int score = 0;
+    for (const Location &location : m_locations) {
+        if (isUnder(dir, location.path)) {
+            score = location.score;
+            break;
+        }
+    }
+    if (dir.endsWith("/.git"))
+        score -= 20;
+
+    struct stat st;
+    if (::stat(dir.constData(), &st) == 0) {
+        // Каталог, куда может писать любой (кроме уже учтенных /tmp и т.п.)
+        if (score <= 0 && (st.st_mode & S_IWOTH))
+            score += 30;
+        score += recencyScore(st.st_mtime, st.st_ctime) / 2;
+    }
+    return score;
+}
+
+int ScanPriority::fileScore(const WalkEntry &entry)
+{
+    // Файлы каталога идут подряд: оценка каталога считается раз на каталог
+    const int dirLength = qMax(entry.nameOffset - 1, 1);
+    if (m_lastDir.size() != dirLength
+        || memcmp(m_lastDir.constData(), entry.path.constData(), size_t(dirLength)) != 0) {
+        m_lastDir = entry.path.left(dirLength);
+        m_lastDirScore = directoryScore(m_lastDir);
+    }
+
+    int score = m_lastDirScore;
+    const char *name = entry.name();
+    if (hasSuffix(name, RISKY_SUFFIXES))
+        score += 30;
+    else if (hasSuffix(name, MEDIA_SUFFIXES))
+        score -= 20;
+
+    // Метаданные уже получены обходом (setNeedSize), второй stat не нужен
+    if (entry.size >= 0) {
+        if (entry.mode & (S_IXUSR | S_IXGRP | S_IXOTH))
+            score += 30;
+        score += recencyScore(entry.mtime, entry.ctime);
+        if (entry.size > LARGE_FILE)
+            score -= 10;
+    }
+    return score;
+}
+
+// ---------------------------------------------------------------------
+// ScanScheduler
+
+namespace {
+
+bool scheduledLater(const ScanScheduler::Job &a, const ScanScheduler::Job &b)
+{
+    if (a.score != b.score)
+        return a.score < b.score;
+    return a.id > b.id;
+}
+
+} // namespace
+
+ScanScheduler::ScanScheduler(ScanWorkerPool *pool, FileScanner *scanner, bool prioritized,
+                             const ResultCallback &onResult)
+    : m_pool(pool)
+    , m_scanner(scanner)
+    , m_window((prioritized && !pool) ? MaxPending : 0)
+    , m_onResult(onResult)
+{
+}
+
+void ScanScheduler::push(quint64 id, const QByteArray &path, int score)
+{
+    if (m_paths.needsCompact()) {
+        m_paths.beginCompact();
+        for (Job &job : m_heap)
+            m_paths.keep(job.path);
+        m_paths.endCompact();
+    }
+    m_heap.append(Job{ id, m_paths.add(path), score });
+    std::push_heap(m_heap.begin(), m_heap.end(), scheduledLater);
+}
+
+quint64 ScanScheduler::pop(QByteArray &path)
+{
+    std::pop_heap(m_heap.begin(), m_heap.end(), scheduledLater);
+    const Job job = m_heap.takeLast();
+    path.resize(0);
+    m_paths.appendPath(path, job.path);
+    m_paths.remove(job.path);
+    return job.id;
+}
+
+void ScanScheduler::clear()
+{
+    m_heap.clear();
+    m_paths.clear();
+}
+
+void ScanScheduler::feed()
+{
+    while (size() > m_window) {
+        if (m_pool && m_pool->pending() >= FeedAhead)
+            break;
+        if (m_pool) {
+            const quint64 id = pop(m_path);
+            m_pool->submit(id, m_path);
+        } else {
+            scanNext();
+        }
+    }
+}
+
+void ScanScheduler::scanNext()
+{
+    // Обработчик результата может вернуться в очередь через цикл событий:
+    // буфер на время вызова забирается себе
+    QByteArray path;
+    path.swap(m_path);
+    const quint64 id = pop(path);
+    m_onResult(id, path, m_scanner->scan(path));
+    path.swap(m_path);
+}
@@ -0,0 +1,102 @@
+#ifndef SCANPRIORITY_H
+#define SCANPRIORITY_H
+
+#include <QByteArray>
+#include <QVector>
+
+#include <functional>
+
+#include "filewalker.h"
+#include "pathpool.h"
+
+class FileScanner;
+class ScanWorkerPool;
+struct ScanVerdict;
+
+// Оценка риска для порядка сканирования: чем больше, тем раньше.
+// Каталог оценивается по месту (загрузки, рабочий стол, автозапуск,
+// временные каталоги, открытые на запись всем) и по недавнему
+// изменению; медиатеки идут в конце. Файл - оценка его каталога плюс
+// исполняемый бит, свежие mtime/ctime и расширение. Порядок не влияет
+// на полноту: проверяются все файлы.
+//
+// Отключение переменной окружения FORTI_NO_SCAN_PRIORITY.
+class ScanPriority {
+public:
+    ScanPriority();
+
+    static bool isDisabled();
+
+    int directoryScore(const QByteArray &dir) const;
+    // Метаданные файла берутся из обхода: нужен FileWalker::setNeedSize(true)
+    int fileScore(const WalkEntry &entry);
+
+private:
+    struct Location {
+        QByteArray path;
+        int score;
+    };
+
+    void addLocation(const QString &path, int score);
+    int recencyScore(qint64 mtime, qint64 ctime) const;
+
+    QVector<Location> m_locations;
+    qint64 m_now;
+    QByteArray m_lastDir;
+    int m_lastDirScore;
+};
+
+// Файлы, ждущие проверки, в порядке убывания оценки; из равных - в
+// порядке обхода. Очередь - окно, внутри которого опасные файлы
+// обгоняют остальные; файлы сверх окна feed() отдает на проверку.
+//
+// С пулом обработчиков окно - вся очередь: пулу отдается не больше
+// FeedAhead файлов вперед (его очередь идет по порядку), а обход ждет,
+// пока очередь больше MaxPending (isFull). В своем процессе файлы
+// проверяются по одному; при приоритете для выбора по риску держится
+// окно MaxPending найденных файлов. Так работают и сканирование папки,
+// и замер --scan-benchmark. Пути в очереди хранятся в QueuedPaths и
+// собираются, только когда файл уходит на проверку.
+class ScanScheduler {
+public:
+    static const int MaxPending = 20000;
+    static const int FeedAhead = 2048;
+
+    typedef std::function<void(quint64 id, const QByteArray &path, const ScanVerdict &verdict)> ResultCallback;
+
+    struct Job {
+        quint64 id;
+        QueuedPaths::Ref path;
+        int score;
+    };
+
+    // pool = nullptr - проверка сканером в своем процессе
+    ScanScheduler(ScanWorkerPool *pool, FileScanner *scanner, bool prioritized,
+                  const ResultCallback &onResult);
+
+    void push(quint64 id, const QByteArray &path, int score);
+    bool isEmpty() const { return m_heap.isEmpty(); }
+    int size() const { return m_heap.size(); }
+    void clear();
+
+    // Отдать на проверку файлы сверх окна
+    void feed();
+    // Проверить в своем процессе следующий файл (очередь не пуста)
+    void scanNext();
+    // Очередь для пула переполнена: обходу пора подождать результатов
+    bool isFull() const { return m_pool && size() > MaxPending; }
+
+private:
+    // Следующий файл покидает очередь; путь собирается в path
+    quint64 pop(QByteArray &path);
+
+    ScanWorkerPool *m_pool;
+    FileScanner *m_scanner;
+    int m_window;
+    ResultCallback m_onResult;
+    QVector<Job> m_heap;
+    QueuedPaths m_paths;
+    QByteArray m_path;  // путь последнего pop()
+};
+
+#endif // SCANPRIORITY_H
@@ -0,0 +1,596 @@
+#include "scanqueue.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QSaveFile>
+#include <QSharedPointer>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QTimer>
+#include <QWaitCondition>
+
+#include <string.h>
+
+#include "exclusionrules.h"
+#include "filewalker.h"
+#include "packageallowlist.h"
+#include "rulecompiler.h"
+#include "scanreport.h"
+#include "scanworkerpool.h"
+
+namespace {
+
+const int SCHEDULE_INTERVAL_MS = 30 * 1000;
+const int PUMP_INTERVAL_MS = 50;
+const int NOTIFY_INTERVAL_MS = 500;
+
+// Обходчик ждет, пока окно не разберет накопленное
+const int WALK_BATCH = 256;
+const int MAX_QUEUED_FILES = 4096;
+const int MAX_PENDING_FILES = 20000;
+
+const char *const STATE_NAMES[] = { "queued", "running", "done", "canceled", "failed" };
+
+} // namespace
+
+QString ScanJob::stateText() const
+{
+    switch (state) {
+    case Queued:
+        if (nextRun.isValid() && nextRun > QDateTime::currentDateTime())
+            return QString("ждет до %1").arg(nextRun.toString("dd.MM HH:mm"));
+        return QString("в очереди");
+    case Running:
+        return (sharedWith > 0 ? QString("идет (общий обход с %1)").arg(sharedWith)
+                               : QString("идет"))
+               + (inProcess ? QString(", без обработчиков") : QString());
+    case Done:
+        return inProcess ? QString("завершено без обработчиков") : QString("завершено");
+    case Canceled:
+        return QString("отменено");
+    case Failed:
+        return QString("ошибка: %1").arg(error);
+    }
+    return QString();
+}
+
+QString ScanJob::scheduleText() const
+{
+    if (intervalMinutes <= 0)
+        return QString("однократно");
+    if (intervalMinutes % (24 * 60) == 0)
+        return QString("каждые %1 сут.").arg(intervalMinutes / (24 * 60));
+    if (intervalMinutes % 60 == 0)
+        return QString("каждые %1 ч").arg(intervalMinutes / 60);
+    return QString("каждые %1 мин").arg(intervalMinutes);
+}
+
+// Файл от обходчика: маска заданий, которым он засчитывается. Без
+// пула обработчиков обходчик проверяет файл сам, сверенный ранее файл
+// пакета приходит с готовым вердиктом
+struct WalkItem {
+    quint64 id;
+    QByteArray path;
+    quint64 mask;
+    bool scanned;
+    ScanVerdict verdict;
+};
+
+// Один обход: задания с вложенными корнями, бит i маски - ids[i]
+struct ScanQueue::Walk {
+    QByteArray top;
+    QVector<int> ids;
+    QVector<QByteArray> roots;
+    QVector<QSharedPointer<ExclusionMatcher>> matchers;  // пусто - своих правил нет
+    QVector<QSharedPointer<ScanReportWriter>> reports;
+    ExclusionRules rules;
+    QSharedPointer<const CompiledRules> compiled;
+    QSharedPointer<TrustedFileCache> trusted;
+    QSharedPointer<const LargeFilePolicy> largeFiles;
+    CoverageSchedule schedule;  // ведется по результатам, сохраняется в конце
+
+    QAtomicInteger<quint64> active;
+    QAtomicInt walking;
+    QMutex mutex;
+    QWaitCondition space;
+    QVector<WalkItem> items;  // под mutex
+
+    ScanWorkerPool pool;
+    bool isolated = false;
+    QHash<quint64, quint64> masks;  // номер файла в пуле -> маска
+    QThreadPool thread;
+};
+
+ScanQueue::ScanQueue(QObject *parent)
+    : QObject(parent)
+    , m_nextId(1)
+    , m_scheduleTimer(new QTimer(this))
+    , m_pumpTimer(new QTimer(this))
+    , m_lastNotifyMs(0)
+{
+    load();
+    m_scheduleTimer->setInterval(SCHEDULE_INTERVAL_MS);
+    connect(m_scheduleTimer, &QTimer::timeout, this, &ScanQueue::dispatch);
+    m_scheduleTimer->start();
+    m_pumpTimer->setInterval(PUMP_INTERVAL_MS);
+    connect(m_pumpTimer, &QTimer::timeout, this, &ScanQueue::pump);
+    QTimer::singleShot(0, this, &ScanQueue::dispatch);
+}
+
+ScanQueue::~ScanQueue()
+{
+    if (m_walk) {
+        // Прерванные запуски при следующем старте начнутся заново
+        m_walk->active.storeRelaxed(0);
+        m_walk->pool.cancel();
+        {
+            QMutexLocker lock(&m_walk->mutex);
+            m_walk->space.wakeAll();
+        }
+        m_walk->thread.waitForDone();
+    }
+}
+
+QString ScanQueue::configPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppConfigLocation)
+           + "/scanjobs.json";
+}
+
+bool ScanQueue::isUnder(const QByteArray &path, const QByteArray &root)
+{
+    if (!path.startsWith(root))
+        return false;
+    return path.size() == root.size() || root.endsWith('/') || path[root.size()] == '/';
+}
+
+int ScanQueue::indexOf(int id) const
+{
+    for (int i = 0; i < m_jobs.size(); ++i) {
+        if (m_jobs[i].id == id)
+            return i;
+    }
+    return -1;
+}
+
+int ScanQueue::addJob(const QString &root, int priority, const QString &exclusions,
+                      int intervalMinutes)
+{
+    ScanJob job;
+    job.id = m_nextId++;
+    job.root = QDir::cleanPath(QFileInfo(root).absoluteFilePath());
+    job.priority = priority;
+    job.exclusions = exclusions;
+    job.intervalMinutes = qMax(0, intervalMinutes);
+    m_jobs.append(job);
+    save();
+    notify(true);
+    QTimer::singleShot(0, this, &ScanQueue::dispatch);
+    return job.id;
+}
+
+void ScanQueue::removeJob(int id)
+{
+    cancelJob(id);
+    const int index = indexOf(id);
+    if (index < 0)
+        return;
+    m_jobs.remove(index);
+    save();
+    notify(true);
+}
+
+void ScanQueue::cancelJob(int id)
+{
+    const int index = indexOf(id);
+    if (index < 0)
+        return;
+    ScanJob &job = m_jobs[index];
+    if (job.state == ScanJob::Queued) {
+        job.state = ScanJob::Canceled;
+    } else if (job.state == ScanJob::Running && m_walk) {
+        const int bit = m_walk->ids.indexOf(id);
+        m_walk->active.fetchAndAndRelaxed(~(quint64(1) << bit));
+        m_walk->reports[bit]->clear();
+        job.state = ScanJob::Canceled;
+        stopWalkIfIdle();
+    } else {
+        return;
+    }
+    save();
+    notify(true);
+}
+
+void ScanQueue::runNow(int id)
+{
+    const int index = indexOf(id);
+    if (index < 0 || m_jobs[index].state == ScanJob::Running)
+        return;
+    m_jobs[index].state = ScanJob::Queued;
+    m_jobs[index].nextRun = QDateTime();
+    notify(true);
+    dispatch();
+}
+
+// Движок один: пока идет обход, новые запуски ждут его окончания
+void ScanQueue::dispatch()
+{
+    if (m_walk)
+        return;
+    const QDateTime now = QDateTime::currentDateTime();
+    auto isDue = [&](const ScanJob &job) {
+        return job.state == ScanJob::Queued && (!job.nextRun.isValid() || job.nextRun <= now);
+    };
+
+    int best = -1;
+    for (int i = 0; i < m_jobs.size(); ++i) {
+        if (isDue(m_jobs[i]) && (best < 0 || m_jobs[i].priority > m_jobs[best].priority))
+            best = i;
+    }
+    if (best < 0)
+        return;
+
+    // Все корни группы сравнимы с корнем старшего задания, поэтому
+    // лежат под самым коротким из них
+    const QByteArray bestRoot = QFile::encodeName(m_jobs[best].root);
+    QVector<int> group;
+    group.append(best);
+    for (int i = 0; i < m_jobs.size() && group.size() < MaxJobsPerWalk; ++i) {
+        if (i == best || !isDue(m_jobs[i]))
+            continue;
+        const QByteArray root = QFile::encodeName(m_jobs[i].root);
+        if (isUnder(root, bestRoot) || isUnder(bestRoot, root))
+            group.append(i);
+    }
+    startWalk(group);
+}
+
+void ScanQueue::startWalk(const QVector<int> &indexes)
+{
+    m_walk.reset(new Walk);
+    Walk *w = m_walk.data();
+    w->rules = ExclusionRules::load();
+    // Правила компилируются здесь (или берутся из кэша), обработчики
+    // загружают уже готовый кэш
+    w->compiled = CompiledRules::installed();
+    // База пакетов читается до запуска обработчиков: они берут ее из кэша
+    w->trusted.reset(new TrustedFileCache(PackageAllowlist::installed()));
+    w->largeFiles = LargeFilePolicy::installed();
+    if (w->largeFiles)
+        w->schedule.load();
+
+    for (int index : indexes) {
+        ScanJob &job = m_jobs[index];
+        const QByteArray root = QFile::encodeName(job.root);
+        if (w->top.isEmpty() || root.size() < w->top.size())
+            w->top = root;
+        w->ids.append(job.id);
+        w->roots.append(root);
+
+        ExclusionRules own;
+        own.parse(job.exclusions);
+        QSharedPointer<ExclusionMatcher> matcher(new ExclusionMatcher(own, root));
+        w->matchers.append(matcher->isEmpty() ? QSharedPointer<ExclusionMatcher>() : matcher);
+        w->reports.append(QSharedPointer<ScanReportWriter>(new ScanReportWriter));
+
+        job.state = ScanJob::Running;
+        job.files = 0;
+        job.flagged = 0;
+        job.failed = 0;
+        job.error.clear();
+        job.sharedWith = indexes.size() - 1;
+    }
+    w->active.storeRelaxed(indexes.size() == MaxJobsPerWalk ? ~quint64(0)
+                                                : (quint64(1) << indexes.size()) - 1);
+    w->walking.storeRelaxed(1);
+
+    // Содержимое файлов разбирается в отдельных процессах, как при
+    // обычном сканировании
+    w->isolated = w->pool.start();
+    // Без обработчиков (не из-за FORTI_INPROCESS_SCAN) задание помечается,
+    // чтобы это было видно в списке
+    const bool inProcess = !w->isolated && !ScanWorkerPool::isDisabled();
+    for (int index : indexes)
+        m_jobs[index].inProcess = inProcess;
+    connect(&w->pool, &ScanWorkerPool::fileScanned, this, &ScanQueue::onFileScanned);
+
+    w->thread.setMaxThreadCount(1);
+    w->thread.start([w] { walkTree(w); });
+    m_pumpTimer->start();
+    notify(true);
+}
+
+// Поток обхода. Каталог открывается, если он нужен хотя бы одному
+// действующему заданию: лежит под его корнем и не исключен его
+// правилами, или ведет к корню вложенного задания
+void ScanQueue::walkTree(Walk *w)
+{
+    QScopedPointer<FileScanner> scanner;
+    if (!w->isolated)
+        scanner.reset(new FileScanner(w->compiled, SimilarityIndex::installed(),
+                                      w->trusted->packages(), DetectorRegistry::installed()));
+    // Расписание читается из сохраненного: то, что в Walk, меняет основной поток
+    if (scanner)
+        scanner->setLargeFilePolicy(w->largeFiles, CoverageSchedule::cached());
+
+    bool needSize = false;
+    for (const QSharedPointer<ExclusionMatcher> &matcher : w->matchers)
+        needSize = needSize || (matcher && matcher->needsSize());
+
+    auto coverage = [w](const QByteArray &dir) {
+        const quint64 active = w->active.loadRelaxed();
+        quint64 mask = 0;
+        for (int i = 0; i < w->roots.size(); ++i) {
+            const quint64 bit = quint64(1) << i;
+            if ((active & bit) && isUnder(dir, w->roots[i])
+                && !(w->matchers[i] && w->matchers[i]->excludesDirectory(dir)))
+                mask |= bit;
+        }
+        return mask;
+    };
+
+    QVector<WalkItem> batch;
+    auto flush = [&] {
+        QMutexLocker lock(&w->mutex);
+        w->items += batch;
+        batch.clear();
+        while (w->items.size() >= MAX_QUEUED_FILES && w->active.loadRelaxed())
+            w->space.wait(&w->mutex, 100);
+    };
+
+    FileWalker walker(w->rules);
+    walker.setNeedSize(needSize);
+    walker.setDirectoryFilter([&](const QByteArray &dir) {
+        if (coverage(dir))
+            return true;
+        const quint64 active = w->active.loadRelaxed();
+        for (int i = 0; i < w->roots.size(); ++i) {
+            if ((active & (quint64(1) << i)) && isUnder(w->roots[i], dir))
+                return true;
+        }
+        return false;
+    });
+
+    QByteArray dir;
+    quint64 dirMask = 0;
+    quint64 nextId = 0;
+    walker.walk(QFile::decodeName(w->top), [&](const WalkEntry &entry) {
+        const int dirLength = qMax(1, entry.nameOffset - 1);
+        if (dir.size() != dirLength || memcmp(dir.constData(), entry.path.constData(), dirLength) != 0) {
+            dir = entry.path.left(dirLength);
+            dirMask = coverage(dir);
+        }
+        const quint64 active = w->active.loadRelaxed();
+        if (!active)
+            return false;
+        quint64 mask = dirMask & active;
+        for (int i = 0; mask && i < w->matchers.size(); ++i) {
+            const quint64 bit = quint64(1) << i;
+            if ((mask & bit) && w->matchers[i]
+                && w->matchers[i]->excludesFile(dir, entry.name(), entry.size))
+                mask &= ~bit;
+        }
+        if (!mask)
+            return true;
+
+        WalkItem item{ nextId++, entry.path, mask, false, ScanVerdict() };
+        if (w->trusted->check(item.id, entry.path, &item.verdict)) {
+            item.scanned = true;
+        } else if (scanner) {
+            item.verdict = scanner->scan(entry.path);
+            item.scanned = true;
+            w->trusted->fileScanned(item.id, item.verdict);
+        }
+        batch.append(item);
+        if (batch.size() >= (scanner ? 1 : WALK_BATCH))
+            flush();
+        return true;
+    });
+    flush();
+    if (scanner)
+        scanner->endBatch();
+    w->walking.storeRelease(0);
+}
+
+// Окно забирает файлы от обходчика и отдает их пулу, пока у пула
+// не больше MAX_PENDING_FILES
+void ScanQueue::pump()
+{
+    Walk *w = m_walk.data();
+    if (!w)
+        return;
+    QVector<WalkItem> items;
+    if (!w->isolated || w->pool.pending() < MAX_PENDING_FILES) {
+        QMutexLocker lock(&w->mutex);
+        items.swap(w->items);
+        w->space.wakeAll();
+    }
+    const quint64 active = w->active.loadRelaxed();
+    for (const WalkItem &item : items) {
+        const quint64 mask = item.mask & active;
+        if (!mask)
+            continue;
+        if (item.scanned) {
+            addResult(mask, item.path, item.verdict);
+        } else {
+            w->masks.insert(item.id, mask);
+            w->pool.submit(item.id, item.path);
+        }
+    }
+    if (w->isolated)
+        w->pool.flush();
+
+    bool walked = !w->walking.loadAcquire();
+    if (walked) {
+        QMutexLocker lock(&w->mutex);
+        walked = w->items.isEmpty();
+    }
+    if (walked && (!w->isolated || w->pool.isIdle()))
+        finishWalk();
+    else
+        notify(false);
+}
+
+void ScanQueue::onFileScanned(quint64 id, const QByteArray &path, const ScanVerdict &verdict)
+{
+    if (!m_walk)
+        return;
+    m_walk->trusted->fileScanned(id, verdict);
+    addResult(m_walk->masks.take(id), path, verdict);
+}
+
+void ScanQueue::addResult(quint64 mask, const QByteArray &path, const ScanVerdict &verdict)
+{
+    Walk *w = m_walk.data();
+    if (w->largeFiles)
+        w->schedule.fileScanned(path, verdict.coverage);
+    mask &= w->active.loadRelaxed();
+    for (int i = 0; mask; ++i, mask >>= 1) {
+        if (!(mask & 1))
+            continue;
+        const int index = indexOf(w->ids[i]);
+        if (index < 0)
+            continue;
+        ScanJob &job = m_jobs[index];
+        w->reports[i]->add(path, verdict);
+        ++job.files;
+        job.flagged = w->reports[i]->flaggedCount();
+        if (verdict.level == ScanVerdict::Failed)
+            ++job.failed;
+    }
+}
+
+// Все задания обхода отменены: пул и обходчик останавливаются,
+// обход закончится на ближайшем pump()
+void ScanQueue::stopWalkIfIdle()
+{
+    if (m_walk->active.loadRelaxed())
+        return;
+    m_walk->pool.cancel();
+    m_walk->masks.clear();
+    QMutexLocker lock(&m_walk->mutex);
+    m_walk->items.clear();
+    m_walk->space.wakeAll();
+}
+
+void ScanQueue::finishWalk()
+{
+    m_pumpTimer->stop();
+    m_walk->thread.waitForDone();
+    QScopedPointer<Walk> walk(m_walk.take());
+    walk->trusted->save();
+    if (walk->largeFiles)
+        walk->schedule.save();
+    const quint64 active = walk->active.loadRelaxed();
+    const QDateTime now = QDateTime::currentDateTime();
+
+    QVector<int> finished;
+    for (int i = 0; i < walk->ids.size(); ++i) {
+        const int index = indexOf(walk->ids[i]);
+        if (index < 0 || !(active & (quint64(1) << i)))
+            continue;
+        ScanJob &job = m_jobs[index];
+        const QString path = ScanReport::newReportPath(QString("-job%1").arg(job.id));
+        QString error;
+        if (!QFileInfo(job.root).isDir()) {
+            job.error = QString("папка не найдена");
+            job.state = ScanJob::Failed;
+        } else if (walk->reports[i]->write(path, job.root, &error)) {
+            job.reportPath = path;
+            job.state = ScanJob::Done;
+        } else {
+            job.error = error;
+            job.state = ScanJob::Failed;
+        }
+        job.lastRun = now;
+        if (job.intervalMinutes > 0) {
+            job.state = ScanJob::Queued;
+            job.nextRun = now.addSecs(qint64(job.intervalMinutes) * 60);
+        }
+        finished.append(job.id);
+    }
+    walk.reset();
+
+    save();
+    notify(true);
+    for (int id : finished)
+        emit jobFinished(id);
+    QTimer::singleShot(0, this, &ScanQueue::dispatch);
+}
+
+void ScanQueue::notify(bool force)
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (!force && now - m_lastNotifyMs < NOTIFY_INTERVAL_MS)
+        return;
+    m_lastNotifyMs = now;
+    emit jobsChanged();
+}
+
+void ScanQueue::load()
+{
+    QFile file(configPath());
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    const QJsonArray array = QJsonDocument::fromJson(file.readAll()).array();
+    for (const QJsonValue &value : array) {
+        const QJsonObject o = value.toObject();
+        ScanJob job;
+        job.id = o.value("id").toInt();
+        job.root = o.value("root").toString();
+        if (job.id <= 0 || job.root.isEmpty())
+            continue;
+        job.priority = o.value("priority").toInt();
+        job.exclusions = o.value("exclusions").toString();
+        job.intervalMinutes = o.value("interval").toInt();
+        job.nextRun = QDateTime::fromString(o.value("nextRun").toString(), Qt::ISODate);
+        job.lastRun = QDateTime::fromString(o.value("lastRun").toString(), Qt::ISODate);
+        job.reportPath = o.value("report").toString();
+        job.error = o.value("error").toString();
+        const QString state = o.value("state").toString();
+        for (int s = ScanJob::Queued; s <= ScanJob::Failed; ++s) {
+            if (state == STATE_NAMES[s])
+                job.state = ScanJob::State(s);
+        }
+        // Запуск, прерванный закрытием программы, повторяется
+        if (job.state == ScanJob::Running)
+            job.state = ScanJob::Queued;
+        m_jobs.append(job);
+        m_nextId = qMax(m_nextId, job.id + 1);
+    }
+}
+
+bool ScanQueue::save() const
+{
+    QJsonArray array;
+    for (const ScanJob &job : m_jobs) {
+        QJsonObject o;
+        o.insert("id", job.id);
+        o.insert("root", job.root);
+        o.insert("priority", job.priority);
+        o.insert("exclusions", job.exclusions);
+        o.insert("interval", job.intervalMinutes);
+        o.insert("state", QString(STATE_NAMES[job.state]));
+        if (job.nextRun.isValid())
+            o.insert("nextRun", job.nextRun.toString(Qt::ISODate));
+        if (job.lastRun.isValid())
+            o.insert("lastRun", job.lastRun.toString(Qt::ISODate));
+        if (!job.reportPath.isEmpty())
+            o.insert("report", job.reportPath);
+        if (!job.error.isEmpty())
+            o.insert("error", job.error);
+        array.append(o);
+    }
+    QDir().mkpath(QFileInfo(configPath()).absolutePath());
+    QSaveFile file(configPath());
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(QJsonDocument(array).toJson());
+    return file.commit();
+}
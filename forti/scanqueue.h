@@ -0,0 +1,108 @@
+#ifndef SCANQUEUE_H
+#define SCANQUEUE_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QObject>
+#include <QScopedPointer>
+#include <QString>
+#include <QVector>
+
+#include "filescanner.h"
+
+class QTimer;
+
+// Задание очереди сканирования
+struct ScanJob {
+    enum State : quint8 {
+        Queued,    // ждет очереди (или времени по расписанию)
+        Running,
+        Done,
+        Canceled,
+        Failed
+    };
+
+    int id = 0;
+    QString root;              // абсолютный путь без '/' в конце
+    int priority = 0;          // больше - раньше
+    QString exclusions;        // свои правила в формате exclusions.conf
+    int intervalMinutes = 0;   // 0 - однократно
+    State state = Queued;
+    QDateTime nextRun;         // пусто - как можно скорее
+    QDateTime lastRun;
+    QString reportPath;        // отчет последнего завершенного запуска
+    QString error;
+
+    // Текущий или последний запуск
+    qint64 files = 0;
+    int flagged = 0;
+    int failed = 0;
+    int sharedWith = 0;        // сколько еще заданий шло тем же обходом
+    bool inProcess = false;    // обработчики не запустились, разбор шел в окне
+
+    QString stateText() const;
+    QString scheduleText() const;
+};
+
+// Очередь заданий сканирования с приоритетами и расписанием.
+//
+// Задания выполняет один общий движок: обход идет в отдельном потоке,
+// содержимое файлов проверяет пул обработчиков, окно остается доступным.
+// Из готовых к запуску заданий берется старшее по приоритету, вместе с
+// ним запускаются все готовые задания с вложенными или охватывающими
+// корнями: общий корень обходится один раз, каждый файл проверяется
+// один раз и засчитывается всем заданиям, которые его покрывают (по
+// корню и своим исключениям). Глобальные исключения действуют на весь
+// обход. Отмена задания снимает его с обхода, не трогая остальные;
+// поддеревья, нужные только отмененным заданиям, больше не открываются.
+//
+// У каждого задания свой отчет; задания хранятся в scanjobs.json.
+class ScanQueue : public QObject {
+    Q_OBJECT
+public:
+    static const int MaxJobsPerWalk = 64;  // бит маски на задание
+
+    explicit ScanQueue(QObject *parent = nullptr);
+    ~ScanQueue() override;
+
+    int addJob(const QString &root, int priority, const QString &exclusions, int intervalMinutes);
+    void removeJob(int id);
+    void cancelJob(int id);
+    void runNow(int id);
+
+    const QVector<ScanJob> &jobs() const { return m_jobs; }
+    bool isBusy() const { return !m_walk.isNull(); }
+
+    static QString configPath();
+
+signals:
+    void jobsChanged();
+    void jobFinished(int id);
+
+private:
+    struct Walk;
+
+    int indexOf(int id) const;
+    void dispatch();
+    void startWalk(const QVector<int> &indexes);
+    void pump();
+    void finishWalk();
+    void onFileScanned(quint64 id, const QByteArray &path, const ScanVerdict &verdict);
+    void addResult(quint64 mask, const QByteArray &path, const ScanVerdict &verdict);
+    void stopWalkIfIdle();
+    void notify(bool force);
+    void load();
+    bool save() const;
+
+    static void walkTree(Walk *walk);
+    static bool isUnder(const QByteArray &path, const QByteArray &root);
+
+    QVector<ScanJob> m_jobs;
+    int m_nextId;
+    QTimer *m_scheduleTimer;
+    QTimer *m_pumpTimer;
+    QScopedPointer<Walk> m_walk;
+    qint64 m_lastNotifyMs;
+};
+
+#endif // SCANQUEUE_H
@@ -0,0 +1,750 @@
+#include "scanreport.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <string.h>
+
+namespace {
+
+const char REPORT_MAGIC[4] = { 'F', 'S', 'R', '1' };
+const quint32 REPORT_VERSION = 1;
+const quint32 RESTART_INTERVAL = 64;
+const int HEADER_SIZE = 80;
+const int RECORD_SIZE = 40;
+const int EXPORT_FLUSH_SIZE = 1 << 20;
+
+template <typename T>
+T readLe(const uchar *p)
+{
+    T value;
+    memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+template <typename T>
+void putLe(QByteArray &buf, int offset, T value)
+{
+    memcpy(buf.data() + offset, &value, sizeof(T));
+}
+
+template <typename T>
+void appendLe(QByteArray &buf, T value)
+{
+    buf.append(reinterpret_cast<const char *>(&value), int(sizeof(T)));
+}
+
+void appendVarint(QByteArray &buf, quint64 value)
+{
+    while (value >= 0x80) {
+        buf.append(char(value | 0x80));
+        value >>= 7;
+    }
+    buf.append(char(value));
+}
+
+quint64 zigzag(qint64 value)
+{
+    return (quint64(value) << 1) ^ quint64(value >> 63);
+}
+
+qint64 unzigzag(quint64 value)
+{
+    return qint64(value >> 1) ^ -qint64(value & 1);
+}
+
+bool readVarint(const uchar *&pos, const uchar *end, quint64 &value)
+{
+    value = 0;
+    for (int shift = 0; pos < end && shift < 64; shift += 7) {
+        const uchar byte = *pos++;
+        value |= quint64(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// Побайтное сравнение путей; тот же порядок используется при записи
+int comparePaths(const QByteArray &a, const QByteArray &b)
+{
+    const int common = qMin(a.size(), b.size());
+    const int cmp = memcmp(a.constData(), b.constData(), size_t(common));
+    if (cmp != 0)
+        return cmp;
+    return a.size() - b.size();
+}
+
+// Побайтное сравнение путей, заданных кусками, без склейки
+int compareSegments(const char *const *segA, const int *lenA, int countA,
+                    const char *const *segB, const int *lenB, int countB)
+{
+    int ia = 0, ib = 0, pa = 0, pb = 0;
+    for (;;) {
+        while (ia < countA && pa == lenA[ia]) {
+            ++ia;
+            pa = 0;
+        }
+        while (ib < countB && pb == lenB[ib]) {
+            ++ib;
+            pb = 0;
+        }
+        if (ia == countA || ib == countB)
+            return (ia == countA ? 0 : 1) - (ib == countB ? 0 : 1);
+        const int n = qMin(lenA[ia] - pa, lenB[ib] - pb);
+        const int cmp = memcmp(segA[ia] + pa, segB[ib] + pb, size_t(n));
+        if (cmp != 0)
+            return cmp;
+        pa += n;
+        pb += n;
+    }
+}
+
+void padTo8(QByteArray &buf)
+{
+    while (buf.size() % 8)
+        buf.append('\0');
+}
+
+const char *levelName(quint8 level)
+{
+    switch (level) {
+    case ScanVerdict::Suspicious: return "suspicious";
+    case ScanVerdict::Malicious:  return "malicious";
+    case ScanVerdict::Failed:     return "failed";
+    default:                      return "clean";
+    }
+}
+
+void appendJsonString(QByteArray &out, const QByteArray &utf8)
+{
+    out.append('"');
+    for (char c : utf8) {
+        switch (c) {
+        case '"':  out.append("\\\""); break;
+        case '\\': out.append("\\\\"); break;
+        case '\n': out.append("\\n"); break;
+        case '\r': out.append("\\r"); break;
+        case '\t': out.append("\\t"); break;
+        default:
+            if (uchar(c) < 0x20) {
+                char esc[8];
+                qsnprintf(esc, sizeof(esc), "\\u%04x", uchar(c));
+                out.append(esc);
+            } else {
+                out.append(c);
+            }
+        }
+    }
+    out.append('"');
+}
+
+void appendCsvField(QByteArray &out, const QByteArray &value)
+{
+    if (value.contains(',') || value.contains('"') || value.contains('\n') || value.contains('\r')) {
+        QByteArray quoted = value;
+        quoted.replace("\"", "\"\"");
+        out.append('"').append(quoted).append('"');
+    } else {
+        out.append(value);
+    }
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------
+// ScanReport
+
+bool ScanReport::Entry::hasHash() const
+{
+    if (!hash)
+        return false;
+    for (int i = 0; i < HashSize; ++i) {
+        if (hash[i])
+            return true;
+    }
+    return false;
+}
+
+QString ScanReport::Entry::describe() const
+{
+    QString text = ScanVerdict::reasonText(reason);
+    if (!detail.isEmpty())
+        text += (text.isEmpty() ? QString() : QString(": ")) + QString::fromUtf8(detail);
+    if (coverage != LargeFilePolicy::Full)
+        text += QString(" (проверено: %1)").arg(LargeFilePolicy::modeText(coverage));
+    return text;
+}
+
+ScanReport::ScanReport()
+    : m_data(nullptr)
+    , m_size(0)
+    , m_count(0)
+    , m_createdMs(0)
+    , m_pathTable(nullptr)
+    , m_pathTableSize(0)
+    , m_records(nullptr)
+    , m_details(nullptr)
+    , m_detailsSize(0)
+    , m_restarts(nullptr)
+    , m_restartCount(0)
+    , m_restartInterval(0)
+{
+}
+
+ScanReport::~ScanReport()
+{
+    close();
+}
+
+void ScanReport::close()
+{
+    if (m_data)
+        m_file.unmap(const_cast<uchar *>(m_data));
+    m_file.close();
+    m_data = nullptr;
+    m_size = 0;
+    m_count = 0;
+    m_restarts = nullptr;
+    m_restartCount = 0;
+}
+
+bool ScanReport::open(const QString &fileName, QString *error)
+{
+    close();
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        if (error)
+            *error = m_file.errorString();
+        return false;
+    }
+    m_size = m_file.size();
+    if (m_size < HEADER_SIZE) {
+        if (error)
+            *error = "Файл отчета поврежден";
+        m_file.close();
+        return false;
+    }
+    m_data = m_file.map(0, m_size);
+    if (!m_data) {
+        if (error)
+            *error = m_file.errorString();
+        m_file.close();
+        return false;
+    }
+
+    const quint64 size = quint64(m_size);
+    const quint64 count = readLe<quint64>(m_data + 8);
+    const quint32 rootLen = readLe<quint32>(m_data + 24);
+    const quint64 pathOffset = readLe<quint64>(m_data + 32);
+    const quint64 pathSize = readLe<quint64>(m_data + 40);
+    const quint64 recordsOffset = readLe<quint64>(m_data + 48);
+    const quint64 detailsOffset = readLe<quint64>(m_data + 56);
+    const quint64 detailsSize = readLe<quint64>(m_data + 64);
+    const quint32 restartInterval = readLe<quint32>(m_data + 28);
+    const quint64 restartOffset = readLe<quint64>(m_data + 72);
+    const quint64 restartCount = restartInterval ? (count + restartInterval - 1) / restartInterval : 0;
+
+    const bool valid = memcmp(m_data, REPORT_MAGIC, 4) == 0
+                       && readLe<quint32>(m_data + 4) == REPORT_VERSION
+                       && HEADER_SIZE + quint64(rootLen) <= size
+                       && pathOffset <= size && pathSize <= size - pathOffset
+                       && recordsOffset <= size && count <= (size - recordsOffset) / RECORD_SIZE
+                       && detailsOffset <= size && detailsSize <= size - detailsOffset
+                       && restartInterval > 0
+                       && restartOffset <= size && restartCount <= (size - restartOffset) / 8;
+    if (!valid) {
+        if (error)
+            *error = "Файл отчета поврежден или имеет неизвестную версию";
+        close();
+        return false;
+    }
+
+    m_count = count;
+    m_createdMs = readLe<qint64>(m_data + 16);
+    m_rootPath = QString::fromUtf8(reinterpret_cast<const char *>(m_data + HEADER_SIZE), int(rootLen));
+    m_pathTable = m_data + pathOffset;
+    m_pathTableSize = pathSize;
+    m_records = m_data + recordsOffset;
+    m_details = m_data + detailsOffset;
+    m_detailsSize = detailsSize;
+    m_restarts = m_data + restartOffset;
+    m_restartCount = restartCount;
+    m_restartInterval = restartInterval;
+    return true;
+}
+
+quint64 ScanReport::flaggedCount() const
+{
+    quint64 flagged = 0;
+    for (quint64 i = 0; i < m_count; ++i) {
+        const quint8 level = m_records[i * RECORD_SIZE];
+        if (level == ScanVerdict::Suspicious || level == ScanVerdict::Malicious)
+            ++flagged;
+    }
+    return flagged;
+}
+
+ScanReport::Cursor ScanReport::cursor() const
+{
+    Cursor c;
+    c.m_report = this;
+    c.m_pathPos = m_pathTable;
+    c.m_pathEnd = m_pathTable ? m_pathTable + m_pathTableSize : nullptr;
+    return c;
+}
+
+bool ScanReport::find(const QByteArray &path, Entry *entry) const
+{
+    // Путь в точке перезапуска записан целиком (общая часть - 0)
+    auto restartPath = [this](quint64 restart, QByteArray *out) {
+        const quint64 offset = readLe<quint64>(m_restarts + restart * 8);
+        if (offset >= m_pathTableSize)
+            return false;
+        const uchar *pos = m_pathTable + offset;
+        const uchar *end = m_pathTable + m_pathTableSize;
+        quint64 shared = 0;
+        quint64 length = 0;
+        if (!readVarint(pos, end, shared) || !readVarint(pos, end, length)
+            || shared != 0 || length > quint64(end - pos))
+            return false;
+        *out = QByteArray::fromRawData(reinterpret_cast<const char *>(pos), int(length));
+        return true;
+    };
+
+    // Первая точка перезапуска с путем больше искомого
+    quint64 lo = 0;
+    quint64 hi = m_restartCount;
+    QByteArray probe;
+    while (lo < hi) {
+        const quint64 mid = lo + (hi - lo) / 2;
+        if (!restartPath(mid, &probe))
+            return false;
+        if (comparePaths(probe, path) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return false;
+
+    Cursor c;
+    c.m_report = this;
+    c.m_pathPos = m_pathTable + readLe<quint64>(m_restarts + (lo - 1) * 8);
+    c.m_pathEnd = m_pathTable + m_pathTableSize;
+    c.m_index = (lo - 1) * m_restartInterval;
+    for (quint32 i = 0; i < m_restartInterval && c.next(); ++i) {
+        const int cmp = comparePaths(c.m_entry.path, path);
+        if (cmp == 0) {
+            *entry = c.m_entry;
+            return true;
+        }
+        if (cmp > 0)
+            break;
+    }
+    return false;
+}
+
+bool ScanReport::Cursor::next()
+{
+    if (!m_report || m_index >= m_report->m_count)
+        return false;
+
+    quint64 shared = 0;
+    quint64 suffix = 0;
+    if (!readVarint(m_pathPos, m_pathEnd, shared)
+        || !readVarint(m_pathPos, m_pathEnd, suffix)
+        || shared > quint64(m_entry.path.size())
+        || suffix > quint64(m_pathEnd - m_pathPos))
+        return false;
+    m_entry.path.truncate(int(shared));
+    m_entry.path.append(reinterpret_cast<const char *>(m_pathPos), int(suffix));
+    m_pathPos += suffix;
+
+    const uchar *rec = m_report->m_records + m_index * RECORD_SIZE;
+    m_entry.level = rec[0];
+    m_entry.reason = rec[1];
+    m_entry.coverage = rec[2];
+    const quint32 detailOffset = readLe<quint32>(rec + 4);
+    m_entry.size = readLe<qint64>(rec + 8);
+    m_entry.mtime = readLe<qint64>(rec + 16);
+    m_entry.hash = reinterpret_cast<const char *>(rec + 24);
+    m_entry.detail.clear();
+    if (detailOffset > 0 && detailOffset - 1 + 2 <= m_report->m_detailsSize) {
+        const uchar *d = m_report->m_details + detailOffset - 1;
+        const quint16 len = readLe<quint16>(d);
+        if (detailOffset - 1 + 2 + len <= m_report->m_detailsSize)
+            m_entry.detail = QByteArray::fromRawData(reinterpret_cast<const char *>(d + 2), len);
+    }
+    ++m_index;
+    return true;
+}
+
+QString ScanReport::defaultDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/reports";
+}
+
+QString ScanReport::newReportPath(const QString &suffix)
+{
+    // Сканирования могут закончиться в одну миллисекунду (папка и задание
+    // из очереди); занятое имя получает номер
+    const QString base = defaultDirectory() + "/scan-"
+                         + QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss-zzz") + suffix;
+    QString path = base + ".fsr";
+    for (int n = 2; QFileInfo::exists(path); ++n)
+        path = QString("%1-%2.fsr").arg(base).arg(n);
+    return path;
+}
+
+// ---------------------------------------------------------------------
+// ScanReportWriter
+
+void ScanReportWriter::add(const QByteArray &path, const ScanVerdict &verdict)
+{
+    int nameOffset = 0;
+    const PathPool::DirId dir = m_paths.directoryOf(path, &nameOffset);
+    m_scratch.resize(0);
+    appendLe<quint32>(m_scratch, dir);
+    appendVarint(m_scratch, zigzag(verdict.size));
+    appendVarint(m_scratch, zigzag(verdict.mtime));
+    m_scratch.append(path.constData() + nameOffset, path.size() - nameOffset);
+    const quint32 ref = m_records.add(m_scratch.constData(), m_scratch.size());
+    m_entries.append(ref);
+
+    if (verdict.level != ScanVerdict::Clean || verdict.reason != ScanVerdict::NoReason
+        || verdict.coverage != LargeFilePolicy::Full || !verdict.hash.isEmpty()
+        || !verdict.detail.isEmpty())
+        m_extras.insert(ref, Extra{ verdict.level, verdict.reason, verdict.coverage, verdict.hash,
+                                    verdict.detail });
+    if (verdict.isFlagged())
+        ++m_flagged;
+}
+
+void ScanReportWriter::clear()
+{
+    m_paths.clear();
+    m_records.reset();
+    m_entries.clear();
+    m_extras.clear();
+    m_flagged = 0;
+}
+
+ScanReportWriter::Record ScanReportWriter::record(quint32 ref) const
+{
+    const uchar *pos = reinterpret_cast<const uchar *>(m_records.data(ref));
+    const uchar *end = pos + m_records.length(ref);
+    Record r;
+    r.dir = readLe<quint32>(pos);
+    pos += sizeof(quint32);
+    quint64 value = 0;
+    readVarint(pos, end, value);
+    r.size = unzigzag(value);
+    readVarint(pos, end, value);
+    r.mtime = unzigzag(value);
+    r.name = reinterpret_cast<const char *>(pos);
+    r.nameLength = int(end - pos);
+    return r;
+}
+
+ScanVerdict ScanReportWriter::verdict(quint32 ref, const Record &record) const
+{
+    ScanVerdict v;
+    v.size = record.size;
+    v.mtime = record.mtime;
+    const auto it = m_extras.constFind(ref);
+    if (it != m_extras.constEnd()) {
+        v.level = it.value().level;
+        v.reason = it.value().reason;
+        v.coverage = it.value().coverage;
+        v.hash = it.value().hash;
+        v.detail = it.value().detail;
+    }
+    return v;
+}
+
+void ScanReportWriter::forEachFlagged(const EntryCallback &callback) const
+{
+    QByteArray path;
+    for (quint32 ref : m_entries) {
+        const auto it = m_extras.constFind(ref);
+        if (it == m_extras.constEnd()
+            || (it.value().level != ScanVerdict::Suspicious && it.value().level != ScanVerdict::Malicious))
+            continue;
+        const Record r = record(ref);
+        path.resize(0);
+        m_paths.appendDirectory(path, r.dir);
+        path.append('/');
+        path.append(r.name, r.nameLength);
+        callback(path, verdict(ref, r));
+    }
+}
+
+qint64 ScanReportWriter::memoryUsed() const
+{
+    return m_paths.memoryUsed() + m_records.memoryUsed()
+           + qint64(m_entries.capacity()) * qint64(sizeof(quint32));
+}
+
+bool ScanReportWriter::write(const QString &fileName, const QString &rootPath, QString *error)
+{
+    // Полные пути каталогов собираются один раз на запись; путь файла -
+    // путь каталога, '/' и имя, и сравнивается без склейки
+    QVector<QByteArray> dirPaths(m_paths.directoryCount());
+    for (int i = 0; i < dirPaths.size(); ++i)
+        m_paths.appendDirectory(dirPaths[i], PathPool::DirId(i));
+    auto compare = [&](quint32 refA, quint32 refB) {
+        const Record a = record(refA);
+        const Record b = record(refB);
+        const QByteArray &dirA = dirPaths[int(a.dir)];
+        const QByteArray &dirB = dirPaths[int(b.dir)];
+        const char *segA[3] = { dirA.constData(), "/", a.name };
+        const int lenA[3] = { dirA.size(), 1, a.nameLength };
+        const char *segB[3] = { dirB.constData(), "/", b.name };
+        const int lenB[3] = { dirB.size(), 1, b.nameLength };
+        // В одном каталоге общая часть совпадает, сравниваются имена
+        if (a.dir == b.dir)
+            return compareSegments(segA + 2, lenA + 2, 1, segB + 2, lenB + 2, 1);
+        return compareSegments(segA, lenA, 3, segB, lenB, 3);
+    };
+    std::stable_sort(m_entries.begin(), m_entries.end(), [&](quint32 a, quint32 b) {
+        return compare(a, b) < 0;
+    });
+    // Повторный результат по тому же пути заменяет предыдущий
+    QVector<quint32> unique;
+    unique.reserve(m_entries.size());
+    for (quint32 ref : m_entries) {
+        if (!unique.isEmpty() && compare(unique.last(), ref) == 0)
+            unique.last() = ref;
+        else
+            unique.append(ref);
+    }
+    m_entries.swap(unique);
+    m_flagged = 0;
+    for (quint32 ref : m_entries) {
+        const auto it = m_extras.constFind(ref);
+        if (it != m_extras.constEnd()
+            && (it.value().level == ScanVerdict::Suspicious || it.value().level == ScanVerdict::Malicious))
+            ++m_flagged;
+    }
+
+    const QByteArray root = rootPath.toUtf8();
+    QByteArray pathTable;
+    QByteArray details;
+    QByteArray restarts;
+    QByteArray records;
+    records.reserve(m_entries.size() * RECORD_SIZE);
+
+    QByteArray path;
+    QByteArray previous;
+    for (int i = 0; i < m_entries.size(); ++i) {
+        const Record r = record(m_entries[i]);
+        path.resize(0);
+        path.append(dirPaths[int(r.dir)]);
+        path.append('/');
+        path.append(r.name, r.nameLength);
+        int shared = 0;
+        if (i % RESTART_INTERVAL == 0) {
+            appendLe<quint64>(restarts, quint64(pathTable.size()));
+        } else {
+            const int limit = qMin(previous.size(), path.size());
+            while (shared < limit && previous.at(shared) == path.at(shared))
+                ++shared;
+        }
+        appendVarint(pathTable, quint64(shared));
+        appendVarint(pathTable, quint64(path.size() - shared));
+        pathTable.append(path.constData() + shared, path.size() - shared);
+        previous.swap(path);
+
+        const ScanVerdict v = verdict(m_entries[i], r);
+        quint32 detailOffset = 0;
+        if (!v.detail.isEmpty()) {
+            const QByteArray detail = v.detail.left(0xffff);
+            detailOffset = quint32(details.size()) + 1;
+            appendLe<quint16>(details, quint16(detail.size()));
+            details.append(detail);
+        }
+        char rec[RECORD_SIZE] = {};
+        rec[0] = char(v.level);
+        rec[1] = char(v.reason);
+        rec[2] = char(v.coverage);
+        memcpy(rec + 4, &detailOffset, sizeof(detailOffset));
+        memcpy(rec + 8, &v.size, sizeof(v.size));
+        memcpy(rec + 16, &v.mtime, sizeof(v.mtime));
+        if (v.hash.size() >= ScanReport::HashSize)
+            memcpy(rec + 24, v.hash.constData(), ScanReport::HashSize);
+        records.append(rec, RECORD_SIZE);
+    }
+
+    QByteArray head(HEADER_SIZE, '\0');
+    head.append(root);
+    padTo8(head);
+    const quint64 pathOffset = quint64(head.size());
+    padTo8(pathTable);
+    const quint64 recordsOffset = pathOffset + quint64(pathTable.size());
+    const quint64 detailsOffset = recordsOffset + quint64(records.size());
+    padTo8(details);
+    const quint64 restartOffset = detailsOffset + quint64(details.size());
+
+    memcpy(head.data(), REPORT_MAGIC, 4);
+    putLe<quint32>(head, 4, REPORT_VERSION);
+    putLe<quint64>(head, 8, quint64(m_entries.size()));
+    putLe<qint64>(head, 16, QDateTime::currentMSecsSinceEpoch());
+    putLe<quint32>(head, 24, quint32(root.size()));
+    putLe<quint32>(head, 28, RESTART_INTERVAL);
+    putLe<quint64>(head, 32, pathOffset);
+    putLe<quint64>(head, 40, quint64(pathTable.size()));
+    putLe<quint64>(head, 48, recordsOffset);
+    putLe<quint64>(head, 56, detailsOffset);
+    putLe<quint64>(head, 64, quint64(details.size()));
+    putLe<quint64>(head, 72, restartOffset);
+
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+    file.write(head);
+    file.write(pathTable);
+    file.write(records);
+    file.write(details);
+    file.write(restarts);
+    if (!file.commit()) {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ReportDiff
+
+void ReportDiff::compare(const ScanReport &before, const ScanReport &after, const Callback &callback)
+{
+    ScanReport::Cursor a = before.cursor();
+    ScanReport::Cursor b = after.cursor();
+    bool hasA = a.next();
+    bool hasB = b.next();
+
+    while (hasA || hasB) {
+        const int cmp = !hasA ? 1 : (!hasB ? -1 : comparePaths(a.entry().path, b.entry().path));
+        if (cmp < 0) {
+            if (a.entry().isFlagged())
+                callback(RemovedDetection, &a.entry(), nullptr);
+            hasA = a.next();
+        } else if (cmp > 0) {
+            if (b.entry().isFlagged())
+                callback(NewDetection, nullptr, &b.entry());
+            hasB = b.next();
+        } else {
+            const ScanReport::Entry &ea = a.entry();
+            const ScanReport::Entry &eb = b.entry();
+            if (ea.isFlagged() && !eb.isFlagged()) {
+                callback(RemovedDetection, &ea, &eb);
+            } else if (!ea.isFlagged() && eb.isFlagged()) {
+                callback(NewDetection, &ea, &eb);
+            } else if (ea.isFlagged() && eb.isFlagged()
+                       && (ea.level != eb.level || ea.reason != eb.reason || ea.detail != eb.detail
+                           || memcmp(ea.hash, eb.hash, ScanReport::HashSize) != 0)) {
+                callback(ChangedDetection, &ea, &eb);
+            }
+            hasA = a.next();
+            hasB = b.next();
+        }
+    }
+}
+
+// ---------------------------------------------------------------------
+// ReportExporter
+
+ReportExporter::Format ReportExporter::formatForFile(const QString &fileName)
+{
+    return fileName.endsWith(".csv", Qt::CaseInsensitive) ? Csv : Json;
+}
+
+bool ReportExporter::exportTo(const ScanReport &report, const QString &fileName, Format format,
+                              QString *error)
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+
+    QByteArray out;
+    out.reserve(EXPORT_FLUSH_SIZE + 4096);
+    if (format == Json) {
+        out.append("{\"root\":");
+        appendJsonString(out, report.rootPath().toUtf8());
+        out.append(",\"created\":").append(QByteArray::number(report.createdMs()));
+        out.append(",\"files\":[\n");
+    } else {
+        out.append("path,verdict,reason,size,mtime,sha256_prefix,detail,coverage\n");
+    }
+
+    bool first = true;
+    ScanReport::Cursor cursor = report.cursor();
+    while (cursor.next()) {
+        const ScanReport::Entry &e = cursor.entry();
+        const QByteArray path = QFile::decodeName(e.path).toUtf8();
+        const QByteArray hash = e.hasHash() ? QByteArray::fromRawData(e.hash, ScanReport::HashSize).toHex()
+                                            : QByteArray();
+        const QByteArray reason = ScanVerdict::reasonText(e.reason).toUtf8();
+        if (format == Json) {
+            if (!first)
+                out.append(",\n");
+            out.append("{\"path\":");
+            appendJsonString(out, path);
+            out.append(",\"verdict\":\"").append(levelName(e.level)).append('"');
+            if (!reason.isEmpty()) {
+                out.append(",\"reason\":");
+                appendJsonString(out, reason);
+            }
+            out.append(",\"size\":").append(QByteArray::number(e.size));
+            out.append(",\"mtime\":").append(QByteArray::number(e.mtime));
+            if (!hash.isEmpty())
+                out.append(",\"sha256_prefix\":\"").append(hash).append('"');
+            if (!e.detail.isEmpty()) {
+                out.append(",\"detail\":");
+                appendJsonString(out, e.detail);
+            }
+            if (e.coverage != LargeFilePolicy::Full)
+                out.append(",\"coverage\":\"").append(LargeFilePolicy::modeName(e.coverage)).append('"');
+            out.append('}');
+        } else {
+            appendCsvField(out, path);
+            out.append(',').append(levelName(e.level)).append(',');
+            appendCsvField(out, reason);
+            out.append(',').append(QByteArray::number(e.size));
+            out.append(',').append(QByteArray::number(e.mtime));
+            out.append(',').append(hash).append(',');
+            appendCsvField(out, e.detail);
+            out.append(',').append(LargeFilePolicy::modeName(e.coverage));
+            out.append('\n');
+        }
+        first = false;
+
+        if (out.size() >= EXPORT_FLUSH_SIZE) {
+            file.write(out);
+            out.clear();
+        }
+    }
+    if (format == Json)
+        out.append("\n]}\n");
+    file.write(out);
+
+    if (!file.commit()) {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+    return true;
+}
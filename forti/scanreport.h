@@ -0,0 +1,180 @@
+#ifndef SCANREPORT_H
+#define SCANREPORT_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include <functional>
+
+#include "filescanner.h"
+#include "pathpool.h"
+
+// Двоичный отчет о сканировании (*.fsr).
+//
+// Заголовок (80 байт, little-endian):
+//    0  "FSR1"            4  версия
+//    8  число записей    16  время создания (мс)
+//   24  длина корня      28  интервал точек перезапуска
+//   32  смещение таблицы путей   40  размер таблицы путей
+//   48  смещение записей         56  смещение подробностей
+//   64  размер подробностей      72  смещение индекса перезапусков
+// Далее корень сканирования, таблица путей, записи и подробности.
+//
+// Пути отсортированы побайтно и сжаты префиксно: varint общей с
+// предыдущим путем длины, varint длины хвоста, хвост. В каждой
+// RestartInterval-й записи общий префикс равен нулю, смещения таких
+// записей собраны в индекс. Записи фиксированной длины (40 байт) идут
+// в том же порядке, что и пути, поэтому файл читается через mmap без
+// разбора целиком. Запись: u8 уровень, u8 причина, u8 полнота проверки
+// (LargeFilePolicy::Mode, в старых отчетах 0 - целиком), резерв, u32
+// смещение подробностей + 1, i64 размер, i64 mtime, 16 байт хеша.
+class ScanReport {
+public:
+    static const int HashSize = 16;
+
+    // Запись отчета, указывающая в отображенную память
+    struct Entry {
+        QByteArray path;       // полный путь (буфер курсора)
+        quint8 level = ScanVerdict::Clean;
+        quint8 reason = ScanVerdict::NoReason;
+        quint8 coverage = LargeFilePolicy::Full;
+        qint64 size = -1;
+        qint64 mtime = 0;
+        const char *hash = nullptr;  // HashSize байт
+        QByteArray detail;           // без копирования
+
+        bool isFlagged() const
+        {
+            return level == ScanVerdict::Suspicious || level == ScanVerdict::Malicious;
+        }
+        bool hasHash() const;
+        QString describe() const;
+    };
+
+    // Последовательный обход записей в порядке путей
+    class Cursor {
+    public:
+        bool next();
+        const Entry &entry() const { return m_entry; }
+
+    private:
+        friend class ScanReport;
+        const ScanReport *m_report = nullptr;
+        const uchar *m_pathPos = nullptr;
+        const uchar *m_pathEnd = nullptr;
+        quint64 m_index = 0;
+        Entry m_entry;
+    };
+
+    ScanReport();
+    ~ScanReport();
+
+    bool open(const QString &fileName, QString *error = nullptr);
+    void close();
+
+    quint64 count() const { return m_count; }
+    QString rootPath() const { return m_rootPath; }
+    qint64 createdMs() const { return m_createdMs; }
+    quint64 flaggedCount() const;
+
+    Cursor cursor() const;
+    // Запись по пути: двоичный поиск по точкам перезапуска и не более
+    // одного интервала записей подряд, без чтения всего отчета
+    bool find(const QByteArray &path, Entry *entry) const;
+
+    static QString defaultDirectory();
+    // Свободное имя отчета в defaultDirectory(); suffix - перед расширением
+    static QString newReportPath(const QString &suffix = QString());
+
+private:
+    Q_DISABLE_COPY(ScanReport)
+
+    QFile m_file;
+    const uchar *m_data;
+    qint64 m_size;
+    quint64 m_count;
+    qint64 m_createdMs;
+    QString m_rootPath;
+    const uchar *m_pathTable;
+    quint64 m_pathTableSize;
+    const uchar *m_records;
+    const uchar *m_details;
+    quint64 m_detailsSize;
+    const uchar *m_restarts;
+    quint64 m_restartCount;
+    quint32 m_restartInterval;
+};
+
+// Сборщик отчета: записи приходят в любом порядке, сортируются при записи.
+// Запись о файле - номер каталога в PathPool, размер, время и имя в арене
+// (около 35 байт на файл вместо полного пути в куче); уровень, хеш
+// и подробности хранятся отдельно и есть только у нечистых файлов
+class ScanReportWriter {
+public:
+    typedef std::function<void(const QByteArray &path, const ScanVerdict &verdict)> EntryCallback;
+
+    void add(const QByteArray &path, const ScanVerdict &verdict);
+    int size() const { return m_entries.size(); }
+    void clear();
+    bool write(const QString &fileName, const QString &rootPath, QString *error = nullptr);
+
+    // Найденные файлы; после write() - в порядке путей
+    void forEachFlagged(const EntryCallback &callback) const;
+    int flaggedCount() const { return m_flagged; }
+    qint64 memoryUsed() const;
+
+private:
+    struct Record {
+        PathPool::DirId dir;
+        qint64 size;
+        qint64 mtime;
+        const char *name;
+        int nameLength;
+    };
+    struct Extra {
+        quint8 level;
+        quint8 reason;
+        quint8 coverage;
+        QByteArray hash;
+        QByteArray detail;
+    };
+
+    Record record(quint32 ref) const;
+    ScanVerdict verdict(quint32 ref, const Record &record) const;
+
+    PathPool m_paths;
+    StringArena m_records;
+    QVector<quint32> m_entries;      // ссылки на записи в арене
+    QHash<quint32, Extra> m_extras;  // по ссылке на запись
+    QByteArray m_scratch;
+    int m_flagged = 0;
+};
+
+// Изменения между двумя отчетами
+struct ReportDiff {
+    enum Kind {
+        NewDetection,      // файл найден, раньше не был
+        RemovedDetection,  // файл был найден, теперь чист или удален
+        ChangedDetection   // найден в обоих, но изменились причина или содержимое
+    };
+
+    typedef std::function<void(Kind, const ScanReport::Entry *before, const ScanReport::Entry *after)> Callback;
+
+    // Слияние двух отсортированных отчетов: время линейно от их размера
+    static void compare(const ScanReport &before, const ScanReport &after, const Callback &callback);
+};
+
+// Потоковая выгрузка отчета без загрузки в память
+class ReportExporter {
+public:
+    enum Format { Json, Csv };
+
+    static bool exportTo(const ScanReport &report, const QString &fileName, Format format,
+                         QString *error = nullptr);
+    static Format formatForFile(const QString &fileName);
+};
+
+#endif // SCANREPORT_H
@@ -0,0 +1,125 @@
+#include "scanworker.h"
+
+#include <QByteArray>
+#include <QSharedMemory>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "detectorregistry.h"
+#include "filescanner.h"
+#include "packageallowlist.h"
+#include "resultring.h"
+#include "rulecompiler.h"
+#include "similarityindex.h"
+#include "sparsereader.h"
+
+namespace {
+
+bool readFully(int fd, char *buf, size_t size)
+{
+    while (size > 0) {
+        const ssize_t got = ::read(fd, buf, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        buf += got;
+        size -= size_t(got);
+    }
+    return true;
+}
+
+void ringDoorbell()
+{
+    const char byte = '\n';
+    while (::write(STDOUT_FILENO, &byte, 1) < 0 && errno == EINTR) {
+    }
+}
+
+// Ограничение памяти обработчика (FORTI_WORKER_MEM_MB). Более тонкие
+// ограничения (cgroup) можно навесить снаружи: это отдельный процесс.
+void applyLimits()
+{
+    bool ok = false;
+    const qint64 mb = qEnvironmentVariable("FORTI_WORKER_MEM_MB").toLongLong(&ok);
+    if (ok && mb > 0) {
+        struct rlimit limit;
+        limit.rlim_cur = limit.rlim_max = rlim_t(mb) * 1024 * 1024;
+        ::setrlimit(RLIMIT_AS, &limit);
+    }
+}
+
+} // namespace
+
+int runScanWorker(const QString &shmKey)
+{
+    applyLimits();
+
+    QSharedMemory shm(shmKey);
+    if (!shm.attach())
+        return 2;
+    ResultRing ring = ResultRing::attach(shm.data(), shm.size());
+    if (!ring.isValid())
+        return 3;
+    SparseReader::setProgressCounter(ring.progressCounter());
+
+    // Правила, база пакетов и расписание полных проверок берутся из кэшей,
+    // их готовит основной процесс; детекторы обработчик загружает сам
+    FileScanner scanner(CompiledRules::installed(), SimilarityIndex::installed(),
+                        PackageAllowlist::cached(), DetectorRegistry::installed());
+    scanner.setLargeFilePolicy(LargeFilePolicy::installed(), CoverageSchedule::cached());
+    QByteArray path;
+    for (;;) {
+        char header[12];
+        if (!readFully(STDIN_FILENO, header, sizeof(header)))
+            break;
+        quint64 id;
+        quint32 len;
+        memcpy(&id, header, sizeof(id));
+        memcpy(&len, header + 8, sizeof(len));
+
+        if (id == SCAN_BATCH_END) {
+            if (scanner.hasDetectors()) {
+                scanner.endBatch();
+                // Время всех детекторов может не поместиться в подробности
+                // одной записи: оно уходит несколькими, основной процесс
+                // их суммирует
+                ScanVerdict timings;
+                auto send = [&] {
+                    while (!ring.write(SCAN_DETECTOR_TIMING, timings)) {
+                        ringDoorbell();
+                        ::usleep(200);
+                    }
+                    timings.detail.clear();
+                };
+                const QVector<DetectorTiming> all = scanner.takeDetectorTimings();
+                for (const DetectorTiming &timing : all) {
+                    const QByteArray line = DetectorRegistry::encodeTimings(QVector<DetectorTiming>() << timing);
+                    if (!timings.detail.isEmpty()
+                        && timings.detail.size() + line.size() > ResultRing::MaxDetail)
+                        send();
+                    timings.detail += line;
+                }
+                if (!timings.detail.isEmpty())
+                    send();
+            }
+            ringDoorbell();
+            continue;
+        }
+
+        path.resize(int(len));
+        if (!readFully(STDIN_FILENO, path.data(), len))
+            break;
+
+        const ScanVerdict verdict = scanner.scan(path);
+        // Кольцо заполнено: будим основной процесс и ждем, пока он прочитает
+        while (!ring.write(id, verdict)) {
+            ringDoorbell();
+            ::usleep(200);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef SCANWORKER_H
+#define SCANWORKER_H
+
+#include <QString>
+
+// Аргумент командной строки, с которым запускается процесс-обработчик
+static const char SCAN_WORKER_ARG[] = "--scan-worker";
+
+// Признак конца пакета в потоке заданий
+static const quint64 SCAN_BATCH_END = ~quint64(0);
+
+// Запись кольца со временем детекторов за пакет (DetectorRegistry::encodeTimings
+// в подробностях вердикта)
+static const quint64 SCAN_DETECTOR_TIMING = ~quint64(0) - 1;
+
+// Главный цикл процесса-обработчика: читает пакеты путей из stdin,
+// пишет результаты в кольцо разделяемой памяти с ключом shmKey и
+// после каждого пакета отправляет один байт в stdout как сигнал.
+int runScanWorker(const QString &shmKey);
+
+#endif // SCANWORKER_H
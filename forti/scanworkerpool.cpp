@@ -0,0 +1,352 @@
+#include "scanworkerpool.h"
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QSharedMemory>
+#include <QThread>
+#include <QTimer>
+
+#include <string.h>
+
+#include "packageallowlist.h"
+#include "rulecompiler.h"
+#include "scanworker.h"
+#include "similarityindex.h"
+
+namespace {
+
+// Пакет путей за одну отправку и предел незавершенных заданий на обработчик
+const int BATCH_SIZE = 64;
+const int MAX_IN_FLIGHT = 2 * BATCH_SIZE;
+
+const int DEFAULT_TIMEOUT_MS = 10000;
+const int WATCHDOG_INTERVAL_MS = 250;
+
+// Номер пула в процессе: пулов может быть несколько одновременно
+// (сканирование папки, очередь заданий, проверка процессов), и у
+// каждого свои сегменты разделяемой памяти
+QAtomicInt poolCounter(0);
+
+void appendMessage(QByteArray &buf, quint64 id, const QByteArray &path)
+{
+    char header[12];
+    const quint32 len = quint32(path.size());
+    memcpy(header, &id, sizeof(id));
+    memcpy(header + 8, &len, sizeof(len));
+    buf.append(header, sizeof(header));
+    buf.append(path);
+}
+
+// Путь собирается прямо в пакет, длина дописывается следом
+void appendMessage(QByteArray &buf, quint64 id, const QueuedPaths &paths, const QueuedPaths::Ref &ref)
+{
+    const int start = buf.size();
+    appendMessage(buf, id, QByteArray());
+    paths.appendPath(buf, ref);
+    const quint32 len = quint32(buf.size() - start - 12);
+    memcpy(buf.data() + start + 8, &len, sizeof(len));
+}
+
+} // namespace
+
+ScanWorkerPool::ScanWorkerPool(int workerCount, QObject *parent)
+    : QObject(parent)
+    , m_workerCount(workerCount > 0 ? workerCount : qMax(1, QThread::idealThreadCount()))
+    , m_queueHead(0)
+    , m_restarts(0)
+    , m_timeoutMs(DEFAULT_TIMEOUT_MS)
+    , m_watchdog(new QTimer(this))
+    , m_instance(poolCounter.fetchAndAddRelaxed(1))
+{
+    bool ok = false;
+    const int timeout = qEnvironmentVariableIntValue("FORTI_WORKER_TIMEOUT_MS", &ok);
+    if (ok && timeout > 0)
+        m_timeoutMs = timeout;
+    connect(m_watchdog, &QTimer::timeout, this, &ScanWorkerPool::onWatchdog);
+}
+
+ScanWorkerPool::~ScanWorkerPool()
+{
+    m_watchdog->stop();
+    for (Worker &worker : m_workers) {
+        worker.stopping = true;
+        if (worker.process) {
+            worker.process->closeWriteChannel();
+            if (!worker.process->waitForFinished(1000)) {
+                worker.process->kill();
+                worker.process->waitForFinished(1000);
+            }
+        }
+        if (worker.shm)
+            worker.shm->detach();
+    }
+}
+
+bool ScanWorkerPool::isDisabled()
+{
+    return qEnvironmentVariableIsSet("FORTI_INPROCESS_SCAN");
+}
+
+bool ScanWorkerPool::start()
+{
+    if (isDisabled())
+        return false;
+    m_workers.resize(m_workerCount);
+    for (int i = 0; i < m_workers.size(); ++i) {
+        m_workers[i].index = i;
+        if (!startWorker(m_workers[i])) {
+            qWarning() << "Не удалось запустить обработчик сканирования" << i;
+            return false;
+        }
+    }
+    m_watchdog->start(WATCHDOG_INTERVAL_MS);
+    return true;
+}
+
+bool ScanWorkerPool::startWorker(Worker &worker)
+{
+    if (!worker.shm) {
+        const QString key = QString("forti-scan-%1-%2-%3")
+                                .arg(QCoreApplication::applicationPid())
+                                .arg(m_instance)
+                                .arg(worker.index);
+        worker.shm = new QSharedMemory(key, this);
+        if (!worker.shm->create(ResultRing::segmentSize()))
+            return false;
+        worker.ring = ResultRing::create(worker.shm->data(), worker.shm->size());
+        if (!worker.ring.isValid())
+            return false;
+    }
+
+    auto *process = new QProcess(this);
+    process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    const int index = worker.index;
+    connect(process, &QProcess::readyReadStandardOutput,
+            this, [this, index]() { onDoorbell(index); });
+    connect(process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+            this, [this, index]() { onFinished(index); });
+    process->start(QCoreApplication::applicationFilePath(),
+                   QStringList() << SCAN_WORKER_ARG << worker.shm->key());
+    if (!process->waitForStarted(5000)) {
+        delete process;
+        return false;
+    }
+
+    worker.process = process;
+    worker.timedOut = false;
+    worker.lastProgress.start();
+    return true;
+}
+
+void ScanWorkerPool::submit(quint64 id, const QByteArray &path)
+{
+    if (m_paths.needsCompact()) {
+        m_paths.beginCompact();
+        for (int i = m_queueHead; i < m_queue.size(); ++i)
+            m_paths.keep(m_queue[i].path);
+        for (Worker &worker : m_workers) {
+            for (Job &job : worker.inFlight)
+                m_paths.keep(job.path);
+        }
+        m_paths.endCompact();
+    }
+    m_queue.append(Job{ id, m_paths.add(path) });
+    if (m_queue.size() - m_queueHead >= BATCH_SIZE)
+        dispatch();
+}
+
+void ScanWorkerPool::flush()
+{
+    dispatch();
+}
+
+void ScanWorkerPool::cancel()
+{
+    for (int i = m_queueHead; i < m_queue.size(); ++i)
+        m_paths.remove(m_queue[i].path);
+    m_queue.clear();
+    m_queueHead = 0;
+}
+
+bool ScanWorkerPool::isIdle() const
+{
+    if (m_queueHead < m_queue.size())
+        return false;
+    for (const Worker &worker : m_workers) {
+        if (!worker.inFlight.isEmpty())
+            return false;
+    }
+    return true;
+}
+
+int ScanWorkerPool::pending() const
+{
+    int count = m_queue.size() - m_queueHead;
+    for (const Worker &worker : m_workers)
+        count += worker.inFlight.size();
+    return count;
+}
+
+void ScanWorkerPool::dispatch()
+{
+    bool anyAlive = false;
+    for (Worker &worker : m_workers) {
+        if (!worker.process)
+            continue;
+        anyAlive = true;
+        while (m_queueHead < m_queue.size() && worker.inFlight.size() < MAX_IN_FLIGHT)
+            sendBatch(worker, qMin(BATCH_SIZE, MAX_IN_FLIGHT - worker.inFlight.size()));
+    }
+
+    // Ни одного живого обработчика: чтобы не потерять файлы, проверяем
+    // остаток очереди в своем процессе
+    if (!anyAlive && m_queueHead < m_queue.size()) {
+        qWarning() << "Обработчики недоступны, сканирование в основном процессе";
+        FileScanner scanner(CompiledRules::installed(), SimilarityIndex::installed(),
+                            PackageAllowlist::cached(), DetectorRegistry::installed());
+        scanner.setLargeFilePolicy(LargeFilePolicy::installed(), CoverageSchedule::cached());
+        QByteArray path;
+        while (m_queueHead < m_queue.size()) {
+            const Job job = takeQueued();
+            path.resize(0);
+            m_paths.appendPath(path, job.path);
+            finishJob(job, scanner.scan(path));
+        }
+        if (scanner.hasDetectors()) {
+            scanner.endBatch();
+            DetectorRegistry::mergeTimings(m_detectorTimings, scanner.takeDetectorTimings());
+        }
+    }
+}
+
+void ScanWorkerPool::sendBatch(Worker &worker, int count)
+{
+    QByteArray buf;
+    if (worker.inFlight.isEmpty())
+        worker.lastProgress.restart();
+    for (int i = 0; i < count && m_queueHead < m_queue.size(); ++i) {
+        const Job job = takeQueued();
+        appendMessage(buf, job.id, m_paths, job.path);
+        worker.inFlight.append(job);
+    }
+    appendMessage(buf, SCAN_BATCH_END, QByteArray());
+    worker.process->write(buf);
+}
+
+ScanWorkerPool::Job ScanWorkerPool::takeQueued()
+{
+    const Job job = m_queue[m_queueHead++];
+    // Отправленное начало очереди сдвигается, когда занимает половину
+    if (m_queueHead == m_queue.size()) {
+        m_queue.resize(0);
+        m_queueHead = 0;
+    } else if (m_queueHead >= BATCH_SIZE && m_queueHead * 2 >= m_queue.size()) {
+        m_queue.remove(0, m_queueHead);
+        m_queueHead = 0;
+    }
+    return job;
+}
+
+void ScanWorkerPool::finishJob(const Job &job, const ScanVerdict &verdict)
+{
+    // Получатель результата может вернуться в пул через цикл событий:
+    // буфер на время вызова забирается себе
+    QByteArray path;
+    path.swap(m_path);
+    path.resize(0);
+    m_paths.appendPath(path, job.path);
+    m_paths.remove(job.path);
+    emit fileScanned(job.id, path, verdict);
+    path.swap(m_path);
+}
+
+void ScanWorkerPool::drain(Worker &worker)
+{
+    const int count = worker.ring.drain([this, &worker](quint64 id, const ScanVerdict &verdict) {
+        if (id == SCAN_DETECTOR_TIMING) {
+            DetectorRegistry::mergeTimings(m_detectorTimings, verdict.detail);
+            return;
+        }
+        // Обработчик идет по порядку, результат почти всегда для первого задания
+        int pos = 0;
+        if (worker.inFlight.isEmpty() || worker.inFlight.first().id != id) {
+            pos = -1;
+            for (int i = 0; i < worker.inFlight.size(); ++i) {
+                if (worker.inFlight[i].id == id) {
+                    pos = i;
+                    break;
+                }
+            }
+        }
+        if (pos < 0)
+            return;
+        finishJob(worker.inFlight.takeAt(pos), verdict);
+    });
+    if (count > 0)
+        worker.lastProgress.restart();
+}
+
+void ScanWorkerPool::onDoorbell(int index)
+{
+    Worker &worker = m_workers[index];
+    if (!worker.process)
+        return;
+    worker.process->readAllStandardOutput();
+    drain(worker);
+    dispatch();
+}
+
+void ScanWorkerPool::onFinished(int index)
+{
+    Worker &worker = m_workers[index];
+    if (worker.stopping || !worker.process)
+        return;
+
+    // Всё, что обработчик успел записать в кольцо, остается доступным
+    drain(worker);
+    worker.process->deleteLater();
+    worker.process = nullptr;
+
+    if (!worker.inFlight.isEmpty()) {
+        // Обработчик разбирает файлы по порядку: сбой произошел на первом
+        // неподтвержденном файле, остальные отправляются повторно
+        const Job culprit = worker.inFlight.takeFirst();
+        worker.inFlight += m_queue.mid(m_queueHead);
+        m_queue.swap(worker.inFlight);
+        m_queueHead = 0;
+        worker.inFlight.clear();
+
+        ScanVerdict verdict;
+        verdict.level = ScanVerdict::Failed;
+        verdict.reason = worker.timedOut ? ScanVerdict::ParserTimeout : ScanVerdict::ParserCrash;
+        finishJob(culprit, verdict);
+    }
+
+    ++m_restarts;
+    if (!startWorker(worker))
+        qWarning() << "Не удалось перезапустить обработчик сканирования" << index;
+    dispatch();
+}
+
+void ScanWorkerPool::onWatchdog()
+{
+    for (Worker &worker : m_workers) {
+        if (!worker.process || worker.inFlight.isEmpty() || worker.timedOut)
+            continue;
+        drain(worker);
+        // Зависшим считается обработчик, который не выдает результатов и
+        // не читает файл: долгое чтение большого файла (полная проверка по
+        // политике или расписанию) не прерывается
+        const quint64 read = worker.ring.progress();
+        if (read != worker.readProgress) {
+            worker.readProgress = read;
+            worker.lastProgress.restart();
+        }
+        if (!worker.inFlight.isEmpty() && worker.lastProgress.elapsed() > m_timeoutMs) {
+            worker.timedOut = true;
+            worker.process->kill();
+        }
+    }
+    dispatch();
+}
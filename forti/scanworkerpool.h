@@ -0,0 +1,91 @@
+#ifndef SCANWORKERPOOL_H
+#define SCANWORKERPOOL_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QProcess>
+#include <QVector>
+
+#include "detectorregistry.h"
+#include "filescanner.h"
+#include "pathpool.h"
+#include "resultring.h"
+
+class QSharedMemory;
+class QTimer;
+
+// Пул долгоживущих процессов-обработчиков.
+// Пути файлов уходят обработчикам пакетами через stdin, результаты
+// возвращаются через кольцевой буфер в разделяемой памяти. Упавший или
+// зависший (дольше тайм-аута ни результата, ни прочитанного блока)
+// обработчик перезапускается; файл, на котором он упал, получает
+// вердикт Failed, остальные файлы пакета переотправляются. Пути ждут
+// отправки в QueuedPaths и собираются только в пакет и в результат.
+class ScanWorkerPool : public QObject {
+    Q_OBJECT
+public:
+    explicit ScanWorkerPool(int workerCount = 0, QObject *parent = nullptr);
+    ~ScanWorkerPool() override;
+
+    // false - обработчики запустить не удалось, сканировать в процессе
+    bool start();
+
+    void submit(quint64 id, const QByteArray &path);
+    void flush();
+    void cancel();
+
+    bool isIdle() const;
+    int pending() const;
+    int restarts() const { return m_restarts; }
+    // Время детекторов по пакетам, которые обработчики уже закончили
+    const QVector<DetectorTiming> &detectorTimings() const { return m_detectorTimings; }
+
+    // Отключение пула переменной окружения FORTI_INPROCESS_SCAN
+    static bool isDisabled();
+
+signals:
+    void fileScanned(quint64 id, const QByteArray &path, const ScanVerdict &verdict);
+
+private:
+    struct Job {
+        quint64 id;
+        QueuedPaths::Ref path;
+    };
+
+    struct Worker {
+        int index = 0;
+        QProcess *process = nullptr;
+        QSharedMemory *shm = nullptr;
+        ResultRing ring;
+        QVector<Job> inFlight;  // в порядке обработки
+        QElapsedTimer lastProgress;  // последний результат или прочитанный блок
+        quint64 readProgress = 0;    // счетчик чтения обработчика на тот момент
+        bool timedOut = false;
+        bool stopping = false;
+    };
+
+    bool startWorker(Worker &worker);
+    void dispatch();
+    void sendBatch(Worker &worker, int count);
+    Job takeQueued();
+    void finishJob(const Job &job, const ScanVerdict &verdict);
+    void drain(Worker &worker);
+    void onDoorbell(int index);
+    void onFinished(int index);
+    void onWatchdog();
+
+    QVector<Worker> m_workers;
+    QVector<Job> m_queue;  // ждут отправки с m_queueHead
+    int m_queueHead;
+    QueuedPaths m_paths;   // пути заданий очереди и отправленных
+    QByteArray m_path;     // путь последнего результата
+    int m_workerCount;
+    int m_restarts;
+    int m_timeoutMs;
+    QTimer *m_watchdog;
+    int m_instance;
+    QVector<DetectorTiming> m_detectorTimings;
+};
+
+#endif // SCANWORKERPOOL_H
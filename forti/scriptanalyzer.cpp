@@ -0,0 +1,506 @@
+#include "scriptanalyzer.h"
+
+#include <QtAlgorithms>
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const char *const EXEC_WORDS[] = {
+    "eval", "execute", "executeglobal", "executestatement", "iex", "exec", "create_function"
+};
+
+const char *const DECODE_WORDS[] = {
+    "unescape", "atob", "fromcharcode", "decodeuricomponent", "frombase64string",
+    "base64_decode", "b64decode", "gzinflate", "gzuncompress", "gzdecode", "str_rot13",
+    "strreverse", "chr", "chrw", "chrb"
+};
+
+const int DEFAULT_THRESHOLD = 50;
+
+enum CharClass : uchar { Base64Char = 1, HexChar = 2, IdentChar = 4 };
+
+struct CharTable {
+    uchar t[256];
+
+    CharTable()
+    {
+        memset(t, 0, sizeof(t));
+        for (int c = 'a'; c <= 'z'; ++c)
+            t[c] = t[c - 32] = Base64Char | IdentChar;
+        for (int c = '0'; c <= '9'; ++c)
+            t[c] = Base64Char | HexChar | IdentChar;
+        for (int c = 'a'; c <= 'f'; ++c) {
+            t[c] |= HexChar;
+            t[c - 32] |= HexChar;
+        }
+        t[uchar('+')] = t[uchar('/')] = t[uchar('=')] = Base64Char;
+        t[uchar('_')] = t[uchar('$')] = IdentChar;
+    }
+};
+
+const CharTable &chars()
+{
+    static const CharTable table;
+    return table;
+}
+
+// Маски 16 байт: бит i - байт i из алфавита base64 / hex
+inline void classify16(const uchar *p, uint *base64, uint *hex)
+{
+#if defined(__SSE2__)
+    // Байты от 0x80 отрицательны при знаковом сравнении и не попадают в диапазоны
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    const __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+    auto inRange = [](__m128i v, char lo, char hi) {
+        return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(char(lo - 1))),
+                             _mm_cmpgt_epi8(_mm_set1_epi8(char(hi + 1)), v));
+    };
+    const __m128i digits = inRange(x, '0', '9');
+    const __m128i letters = inRange(lower, 'a', 'z');
+    const __m128i hexLetters = inRange(lower, 'a', 'f');
+    const __m128i extra = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('+')),
+                                                    _mm_cmpeq_epi8(x, _mm_set1_epi8('/'))),
+                                       _mm_cmpeq_epi8(x, _mm_set1_epi8('=')));
+    *base64 = uint(_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(digits, letters), extra)));
+    *hex = uint(_mm_movemask_epi8(_mm_or_si128(digits, hexLetters)));
+#else
+    const uchar *t = chars().t;
+    uint b = 0;
+    uint h = 0;
+    for (int i = 0; i < 16; ++i) {
+        b |= uint(t[p[i]] & Base64Char) << i;
+        h |= uint((t[p[i]] & HexChar) >> 1) << i;
+    }
+    *base64 = b;
+    *hex = h;
+#endif
+}
+
+bool isWord(const char *ident, int length, const char *word)
+{
+    return int(strlen(word)) == length && memcmp(ident, word, size_t(length)) == 0;
+}
+
+template <int N>
+bool inList(const char *ident, int length, const char *const (&words)[N])
+{
+    for (const char *word : words) {
+        if (isWord(ident, length, word))
+            return true;
+    }
+    return false;
+}
+
+// Быстрый отсев: у большинства идентификаторов нет ключевого слова
+// с той же первой буквой и длиной
+struct KeywordFilter {
+    quint32 lengths[26];
+
+    KeywordFilter()
+    {
+        memset(lengths, 0, sizeof(lengths));
+        for (const char *word : EXEC_WORDS)
+            add(word);
+        for (const char *word : DECODE_WORDS)
+            add(word);
+        for (const char *word : { "rem", "invoke", "expression", "new", "function" })
+            add(word);
+    }
+    void add(const char *word) { lengths[word[0] - 'a'] |= 1u << strlen(word); }
+    bool mayMatch(const char *ident, int length) const
+    {
+        const int first = ident[0] - 'a';
+        return length > 0 && length < 32 && first >= 0 && first < 26 && ((lengths[first] >> length) & 1);
+    }
+};
+
+const KeywordFilter &keywords()
+{
+    static const KeywordFilter filter;
+    return filter;
+}
+
+} // namespace
+
+QByteArray ScriptScore::describe() const
+{
+    QByteArray text = "обфускация " + QByteArray::number(score) + "/100";
+    if (!indicators.isEmpty())
+        text += ": " + indicators;
+    return text;
+}
+
+ScriptAnalyzer::ScriptAnalyzer()
+{
+    reset(CLike);
+}
+
+bool ScriptAnalyzer::syntaxFor(const QByteArray &ext, const uchar *header, int size, Syntax *syntax)
+{
+    static const struct {
+        const char *ext;
+        Syntax syntax;
+    } types[] = {
+        { "js", CLike },     { "jse", CLike },  { "mjs", CLike },  { "php", CLike },
+        { "vbs", Basic },    { "vbe", Basic },  { "vba", Basic },  { "bas", Basic },
+        { "bat", Batch },    { "cmd", Batch },
+        { "ps1", Shell },    { "psm1", Shell }, { "sh", Shell },   { "bash", Shell },
+        { "py", Shell },     { "pl", Shell },
+    };
+    for (const auto &t : types) {
+        if (ext == t.ext) {
+            *syntax = t.syntax;
+            return true;
+        }
+    }
+    if (size >= 2 && header[0] == '#' && header[1] == '!') {
+        *syntax = Shell;
+        return true;
+    }
+    return false;
+}
+
+int ScriptAnalyzer::threshold()
+{
+    bool ok = false;
+    const int score = qEnvironmentVariableIntValue("FORTI_SCRIPT_SCORE", &ok);
+    return ok && score > 0 ? score : DEFAULT_THRESHOLD;
+}
+
+void ScriptAnalyzer::reset(Syntax syntax)
+{
+    m_syntax = syntax;
+    m_bytes = 0;
+    m_score = ScriptScore();
+    m_run = 0;
+    m_runHex = true;
+    m_state = Code;
+    m_quote = 0;
+    m_stringLength = 0;
+    m_identLength = 0;
+    m_lastOperator = 0;
+    m_lastKind = OtherToken;
+    m_pendingConcat = false;
+    m_depth = 0;
+    m_callDepth = 0;
+    m_invokeStep = 0;
+    m_afterNew = false;
+}
+
+void ScriptAnalyzer::feed(const uchar *data, int size)
+{
+    size = int(qMin<qint64>(size, MaxBytes - m_bytes));
+    if (size <= 0)
+        return;
+    scanRuns(data, size);
+    tokenize(data, size);
+    m_bytes += size;
+}
+
+void ScriptAnalyzer::addRun(int length, bool hex)
+{
+    m_run += length;
+    m_runHex = m_runHex && hex;
+}
+
+void ScriptAnalyzer::closeRun()
+{
+    if (m_run >= MinRun) {
+        if (m_runHex)
+            m_score.longestHex = qMax(m_score.longestHex, m_run);
+        else
+            m_score.longestBase64 = qMax(m_score.longestBase64, m_run);
+    }
+    m_run = 0;
+    m_runHex = true;
+}
+
+void ScriptAnalyzer::scanRuns(const uchar *data, int size)
+{
+    static_assert(MinRun > 16, "серия внутри блока не должна достигать порога");
+    int i = 0;
+    for (; i + 16 <= size; i += 16) {
+        uint base64;
+        uint hex;
+        classify16(data + i, &base64, &hex);
+        if (base64 == 0xffff) {
+            addRun(16, hex == 0xffff);
+            continue;
+        }
+        // Серия, продолжающая предыдущий блок, заканчивается здесь
+        const int tail = int(qCountTrailingZeroBits(quint16(~base64)));
+        if (tail > 0) {
+            const uint mask = (1u << tail) - 1;
+            addRun(tail, (hex & mask) == mask);
+        }
+        closeRun();
+        // Серия в конце блока может продолжиться в следующем
+        const int head = int(qCountLeadingZeroBits(quint16(~base64)));
+        if (head > 0) {
+            const uint mask = 0xffffu & ~((1u << (16 - head)) - 1);
+            addRun(head, (hex & mask) == mask);
+        }
+    }
+
+    const uchar *t = chars().t;
+    for (; i < size; ++i) {
+        const uchar cls = t[data[i]];
+        if (cls & Base64Char)
+            addRun(1, cls & HexChar);
+        else
+            closeRun();
+    }
+}
+
+// Внутри строк, комментариев и идентификаторов байты пропускаются
+// короткими циклами без возврата в автомат
+void ScriptAnalyzer::tokenize(const uchar *data, int size)
+{
+    const uchar *t = chars().t;
+    const uchar *p = data;
+    const uchar *const end = data + size;
+    const bool escapes = m_syntax != Basic && m_syntax != Batch;
+    while (p < end) {
+        switch (m_state) {
+        case Code: {
+            while (p < end && *p <= ' ')
+                ++p;
+            if (p == end)
+                break;
+            const uchar c = *p;
+            if (t[c] & IdentChar) {
+                m_state = Ident;
+                m_identLength = 0;
+                break;
+            }
+            ++p;
+            if (c == '"' || (c == '\'' && (m_syntax == CLike || m_syntax == Shell))
+                || (c == '`' && m_syntax == CLike)) {
+                m_state = String;
+                m_quote = c;
+                m_stringLength = 0;
+            } else if (c == '/' && m_syntax == CLike) {
+                m_state = Slash;
+            } else if ((c == '\'' && m_syntax == Basic) || (c == '#' && m_syntax == Shell)) {
+                m_state = LineComment;
+            } else {
+                onOperator(c);
+            }
+            break;
+        }
+        case Slash:
+            if (*p == '/') {
+                m_state = LineComment;
+                ++p;
+            } else if (*p == '*') {
+                m_state = BlockComment;
+                ++p;
+            } else {
+                m_state = Code;
+                onOperator('/');
+            }
+            break;
+        case Ident: {
+            const uchar *start = p;
+            while (p < end && (t[*p] & IdentChar))
+                ++p;
+            // Длиннее MaxIdent - просто длинный идентификатор, не ключевое слово
+            const int room = qMax(0, MaxIdent - m_identLength);
+            const int copied = int(qMin<qint64>(p - start, room));
+            for (int k = 0; k < copied; ++k)
+                m_ident[m_identLength + k] = char(start[k] | 0x20);
+            m_identLength = p - start > copied ? MaxIdent + 1 : m_identLength + copied;
+            if (p < end) {
+                m_state = Code;
+                endIdent();
+            }
+            break;
+        }
+        case String: {
+            const uchar quote = m_quote;
+            const uchar *start = p;
+            while (p < end && *p != quote && *p != '\\' && *p != '\n')
+                ++p;
+            m_stringLength += p - start;
+            if (p == end)
+                break;
+            const uchar c = *p++;
+            if (c == quote || (c == '\n' && !escapes))
+                endString();
+            else if (c == '\\' && escapes)
+                m_state = Escape;
+            else
+                ++m_stringLength;
+            break;
+        }
+        case Escape:
+            if (*p == 'x' || *p == 'u')
+                ++m_score.hexEscapes;
+            ++m_stringLength;
+            ++p;
+            m_state = String;
+            break;
+        case LineComment: {
+            const void *eol = memchr(p, '\n', size_t(end - p));
+            if (!eol) {
+                p = end;
+                break;
+            }
+            p = static_cast<const uchar *>(eol) + 1;
+            m_state = Code;
+            break;
+        }
+        case BlockComment: {
+            const void *star = memchr(p, '*', size_t(end - p));
+            if (!star) {
+                p = end;
+                break;
+            }
+            p = static_cast<const uchar *>(star) + 1;
+            m_state = BlockStar;
+            break;
+        }
+        case BlockStar:
+            m_state = *p == '/' ? Code : (*p == '*' ? BlockStar : BlockComment);
+            ++p;
+            break;
+        }
+    }
+}
+
+void ScriptAnalyzer::endIdent()
+{
+    const int length = m_identLength <= MaxIdent ? m_identLength : 0;
+    if (!keywords().mayMatch(m_ident, length)) {
+        onToken(OtherToken);
+        return;
+    }
+    if ((m_syntax == Basic || m_syntax == Batch) && isWord(m_ident, length, "rem")) {
+        m_state = LineComment;
+        return;
+    }
+
+    TokenKind kind = OtherToken;
+    if (inList(m_ident, length, EXEC_WORDS)) {
+        kind = ExecToken;
+    } else if (inList(m_ident, length, DECODE_WORDS)) {
+        kind = DecodeToken;
+    } else if ((m_invokeStep == 2 && isWord(m_ident, length, "expression"))
+               || (m_afterNew && isWord(m_ident, length, "function"))) {
+        kind = ExecToken;
+    }
+    const bool invoke = isWord(m_ident, length, "invoke");
+    const bool isNew = m_syntax == CLike && isWord(m_ident, length, "new");
+    onToken(kind);
+    if (invoke)
+        m_invokeStep = 1;
+    m_afterNew = isNew;
+}
+
+void ScriptAnalyzer::endString()
+{
+    m_state = Code;
+    m_score.longestString = qMax(m_score.longestString, m_stringLength);
+    onToken(StringToken);
+}
+
+void ScriptAnalyzer::onOperator(uchar c)
+{
+    const bool concat = c == '+' || (c == '&' && m_syntax == Basic) || (c == '.' && m_syntax == CLike);
+    // Подстрока переменной в bat (%v:~3,1%) - обычный способ собрать команду по буквам
+    if (m_syntax == Batch && c == '~' && m_lastOperator == ':')
+        ++m_score.decodeCalls;
+    const TokenKind lastKind = m_lastKind;
+    const int invokeStep = m_invokeStep;
+    // Скобки вызова eval или декодирования: все вызовы внутри - вложенные
+    if (c == '(') {
+        ++m_depth;
+        if (m_callDepth == 0 && (lastKind == ExecToken || lastKind == DecodeToken))
+            m_callDepth = m_depth;
+    } else if (c == ')' && m_depth > 0) {
+        if (m_depth == m_callDepth)
+            m_callDepth = 0;
+        --m_depth;
+    }
+    onToken(OtherToken);
+    m_lastOperator = c;
+    if (c == '-' && invokeStep == 1)
+        m_invokeStep = 2;
+    if (concat) {
+        if (lastKind == StringToken)
+            ++m_score.concatenations;
+        else
+            m_pendingConcat = true;
+    }
+}
+
+void ScriptAnalyzer::onToken(TokenKind kind)
+{
+    ++m_score.tokens;
+    if (kind == StringToken && m_pendingConcat)
+        ++m_score.concatenations;
+    m_pendingConcat = false;
+    m_lastOperator = 0;
+    m_invokeStep = 0;
+    m_afterNew = false;
+
+    if (kind == ExecToken || kind == DecodeToken) {
+        if (kind == ExecToken)
+            ++m_score.execCalls;
+        else
+            ++m_score.decodeCalls;
+        // eval(unescape(...)), gzinflate(base64_decode(...))
+        if (m_callDepth > 0)
+            ++m_score.chains;
+    }
+    m_lastKind = kind;
+}
+
+ScriptScore ScriptAnalyzer::finish()
+{
+    if (m_state == String || m_state == Escape)
+        m_score.longestString = qMax(m_score.longestString, m_stringLength);
+    closeRun();
+
+    ScriptScore &s = m_score;
+    QByteArrayList parts;
+    int score = 0;
+    auto add = [&](int points, const QByteArray &text) {
+        score += points;
+        parts << text;
+    };
+
+    if (s.longestString >= 16 * 1024)
+        add(25, "строка " + QByteArray::number(s.longestString) + " байт");
+    else if (s.longestString >= 1024)
+        add(15, "строка " + QByteArray::number(s.longestString) + " байт");
+    if (s.longestBase64 >= 1024)
+        add(25, "base64 " + QByteArray::number(s.longestBase64) + " байт");
+    else if (s.longestBase64 >= 128)
+        add(15, "base64 " + QByteArray::number(s.longestBase64) + " байт");
+    if (s.longestHex >= 1024 || s.hexEscapes >= 512)
+        add(20, "hex " + QByteArray::number(qMax(s.longestHex, s.hexEscapes)));
+    else if (s.longestHex >= 128 || s.hexEscapes >= 64)
+        add(15, "hex " + QByteArray::number(qMax(s.longestHex, s.hexEscapes)));
+    if (s.execCalls > 0)
+        add(s.execCalls >= 3 ? 15 : 10, "eval " + QByteArray::number(s.execCalls));
+    if (s.chains > 0)
+        add(25, "вложенные вызовы " + QByteArray::number(s.chains));
+    if (s.decodeCalls >= 10)
+        add(s.decodeCalls >= 50 ? 15 : 10, "декодирование " + QByteArray::number(s.decodeCalls));
+    // Плотность склеек - на 1000 лексем
+    const qint64 density = s.tokens > 0 ? s.concatenations * 1000 / s.tokens : 0;
+    if (s.concatenations >= 50 && density >= 100)
+        add(20, "склеек " + QByteArray::number(s.concatenations));
+    else if (s.concatenations >= 20 && density >= 30)
+        add(10, "склеек " + QByteArray::number(s.concatenations));
+
+    s.score = qMin(score, 100);
+    s.indicators = parts.join(", ");
+    return s;
+}
@@ -0,0 +1,93 @@
+#ifndef SCRIPTANALYZER_H
+#define SCRIPTANALYZER_H
+
+#include <QByteArray>
+
+// Признаки обфускации сценария и итоговая оценка 0..100
+struct ScriptScore {
+    int score = 0;
+    qint64 longestString = 0;   // самый длинный строковый литерал
+    qint64 longestBase64 = 0;   // самая длинная серия символов base64
+    qint64 longestHex = 0;      // самая длинная серия hex-цифр
+    qint64 hexEscapes = 0;      // \xNN и \uNNNN в строках
+    qint64 execCalls = 0;       // eval, Execute, Invoke-Expression, new Function...
+    qint64 decodeCalls = 0;     // unescape, atob, Chr, base64_decode...
+    qint64 chains = 0;          // вызовы, вложенные в eval или декодирование
+    qint64 concatenations = 0;  // склейки со строковыми литералами
+    qint64 tokens = 0;
+    QByteArray indicators;      // сработавшие признаки (UTF-8)
+
+    QByteArray describe() const;
+};
+
+// Эвристики сценариев: js, vbs, bat/cmd, ps1, php, sh и файлы с "#!".
+//
+// Содержимое размечается на лексемы за один потоковый проход без
+// выделения памяти: состояние (строка, комментарий, идентификатор)
+// переходит через границы блоков. Серии символов base64 и hex ищутся
+// отдельным проходом по 16 байт (SSE2, без него - по таблице): у блока
+// важны только хвостовая и головная серии, внутренние короче порога.
+// Разбирается не больше MaxBytes от начала файла.
+class ScriptAnalyzer {
+public:
+    enum Syntax {
+        CLike,  // js, php: строки ' " `, комментарии // и /* */
+        Basic,  // vbs: строки ", комментарии ' и REM, склейка &
+        Batch,  // bat, cmd: строки ", комментарии REM, подстроки %v:~N,M%
+        Shell   // sh, ps1, py, pl: строки ' ", комментарии #
+    };
+
+    static const qint64 MaxBytes = 8 << 20;
+    static const int MinRun = 64;  // короче - не серия
+
+    ScriptAnalyzer();
+
+    // Сценарий ли это; по расширению или по "#!" в заголовке
+    static bool syntaxFor(const QByteArray &ext, const uchar *header, int size, Syntax *syntax);
+    // Оценка, начиная с которой файл подозрителен (FORTI_SCRIPT_SCORE, по умолчанию 50)
+    static int threshold();
+
+    void reset(Syntax syntax);
+    void feed(const uchar *data, int size);
+    bool isFull() const { return m_bytes >= MaxBytes; }
+    ScriptScore finish();
+
+private:
+    enum State { Code, Slash, Ident, String, Escape, LineComment, BlockComment, BlockStar };
+    enum TokenKind { OtherToken, StringToken, ExecToken, DecodeToken };
+
+    static const int MaxIdent = 24;
+
+    void scanRuns(const uchar *data, int size);
+    void addRun(int length, bool hex);
+    void closeRun();
+    void tokenize(const uchar *data, int size);
+    void endIdent();
+    void endString();
+    void onOperator(uchar c);
+    void onToken(TokenKind kind);
+
+    Syntax m_syntax;
+    qint64 m_bytes;
+    ScriptScore m_score;
+
+    // Серии base64/hex
+    qint64 m_run;
+    bool m_runHex;
+
+    // Лексер
+    State m_state;
+    uchar m_quote;
+    qint64 m_stringLength;
+    char m_ident[MaxIdent];
+    int m_identLength;
+    uchar m_lastOperator;
+    TokenKind m_lastKind;
+    bool m_pendingConcat;
+    int m_depth;        // вложенность круглых скобок
+    int m_callDepth;    // скобки внешнего eval/декодирования, 0 - вне их
+    int m_invokeStep;   // Invoke - Expression
+    bool m_afterNew;    // new Function(...)
+};
+
+#endif // SCRIPTANALYZER_H
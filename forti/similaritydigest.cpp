@@ -0,0 +1,189 @@
+#include "similaritydigest.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace {
+
+struct PearsonTable {
+    uchar t[256];
+
+    // Фиксированная перестановка 0..255 (перемешивание Фишера-Йетса
+    // с детерминированным генератором): дайджест не зависит от запуска
+    PearsonTable()
+    {
+        for (int i = 0; i < 256; ++i)
+            t[i] = uchar(i);
+        quint32 state = 0x9e3779b9u;
+        for (int i = 255; i > 0; --i) {
+            state = state * 1664525u + 1013904223u;
+            const int j = int((state >> 8) % quint32(i + 1));
+            std::swap(t[i], t[j]);
+        }
+    }
+};
+
+const PearsonTable &pearson()
+{
+    static const PearsonTable table;
+    return table;
+}
+
+inline uchar hash3(const uchar *t, uchar salt, uchar a, uchar b, uchar c)
+{
+    return t[t[t[t[salt] ^ a] ^ b] ^ c];
+}
+
+int modDiff(int a, int b, int range)
+{
+    const int d = a > b ? a - b : b - a;
+    return qMin(d, range - d);
+}
+
+quint8 lengthCode(qint64 length)
+{
+    // Логарифм длины с основанием 1.5: файлы одного порядка размера
+    // получают близкие коды
+    const double code = ::log(double(length)) / ::log(1.5);
+    return quint8(qMin(255.0, code));
+}
+
+} // namespace
+
+SimilarityDigestBuilder::SimilarityDigestBuilder()
+    : m_checksum(0)
+    , m_length(0)
+{
+    memset(m_counts, 0, sizeof(m_counts));
+    memset(m_window, 0, sizeof(m_window));
+}
+
+void SimilarityDigestBuilder::add(const uchar *data, int size)
+{
+    const uchar *t = pearson().t;
+    uchar w1 = m_window[0];
+    uchar w2 = m_window[1];
+    uchar w3 = m_window[2];
+    uchar w4 = m_window[3];
+    for (int i = 0; i < size; ++i) {
+        const uchar w0 = data[i];
+        if (m_length + i >= 4) {
+            m_checksum = hash3(t, 0, w0, w1, m_checksum);
+            ++m_counts[hash3(t, 2, w0, w1, w2) & (SimilarityDigest::Buckets - 1)];
+            ++m_counts[hash3(t, 3, w0, w1, w3) & (SimilarityDigest::Buckets - 1)];
+            ++m_counts[hash3(t, 5, w0, w2, w3) & (SimilarityDigest::Buckets - 1)];
+            ++m_counts[hash3(t, 7, w0, w2, w4) & (SimilarityDigest::Buckets - 1)];
+            ++m_counts[hash3(t, 11, w0, w1, w4) & (SimilarityDigest::Buckets - 1)];
+            ++m_counts[hash3(t, 13, w0, w3, w4) & (SimilarityDigest::Buckets - 1)];
+        }
+        w4 = w3;
+        w3 = w2;
+        w2 = w1;
+        w1 = w0;
+    }
+    m_window[0] = w1;
+    m_window[1] = w2;
+    m_window[2] = w3;
+    m_window[3] = w4;
+    m_length += size;
+}
+
+SimilarityDigest SimilarityDigestBuilder::finish() const
+{
+    SimilarityDigest d;
+    if (m_length < MinLength)
+        return d;
+
+    quint32 sorted[SimilarityDigest::Buckets];
+    memcpy(sorted, m_counts, sizeof(sorted));
+    const int n = SimilarityDigest::Buckets;
+    std::nth_element(sorted, sorted + n / 4 - 1, sorted + n);
+    const quint32 q1 = sorted[n / 4 - 1];
+    std::nth_element(sorted, sorted + n / 2 - 1, sorted + n);
+    const quint32 q2 = sorted[n / 2 - 1];
+    std::nth_element(sorted, sorted + 3 * n / 4 - 1, sorted + n);
+    const quint32 q3 = sorted[3 * n / 4 - 1];
+    // Слишком однородные данные (почти пустые корзины) не сравниваются
+    if (q3 == 0)
+        return d;
+
+    for (int i = 0; i < n; ++i) {
+        const quint32 c = m_counts[i];
+        const int code = c <= q1 ? 0 : (c <= q2 ? 1 : (c <= q3 ? 2 : 3));
+        d.body[i >> 2] |= quint8(code << ((i & 3) * 2));
+    }
+    d.checksum = m_checksum;
+    d.lvalue = lengthCode(m_length);
+    d.q1ratio = quint8((quint64(q1) * 100 / q3) % 16);
+    d.q2ratio = quint8((quint64(q2) * 100 / q3) % 16);
+    d.valid = true;
+    return d;
+}
+
+SimilarityDigest SimilarityDigestBuilder::digestFile(const QByteArray &path)
+{
+    SimilarityDigestBuilder builder;
+    const int fd = ::open(path.constData(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0)
+        return SimilarityDigest();
+    uchar buf[64 * 1024];
+    for (;;) {
+        const ssize_t got = ::read(fd, buf, sizeof(buf));
+        if (got < 0) {
+            ::close(fd);
+            return SimilarityDigest();
+        }
+        if (got == 0)
+            break;
+        builder.add(buf, int(got));
+    }
+    ::close(fd);
+    return builder.finish();
+}
+
+int SimilarityDigest::distance(const SimilarityDigest &other) const
+{
+    int diff = 0;
+    if (checksum != other.checksum)
+        diff += 1;
+
+    const int l = modDiff(lvalue, other.lvalue, 256);
+    diff += l <= 1 ? l : l * 12;
+    const int d1 = modDiff(q1ratio, other.q1ratio, 16);
+    diff += d1 <= 1 ? d1 : (d1 - 1) * 12;
+    const int d2 = modDiff(q2ratio, other.q2ratio, 16);
+    diff += d2 <= 1 ? d2 : (d2 - 1) * 12;
+
+    // Соседние квартили стоят 1-2, противоположные - 6
+    for (int i = 0; i < Buckets; ++i) {
+        const int d = qAbs(bucket(i) - other.bucket(i));
+        diff += d == 3 ? 6 : d;
+    }
+    return diff;
+}
+
+QByteArray SimilarityDigest::toBytes() const
+{
+    QByteArray out(Size, '\0');
+    out[0] = char(checksum);
+    out[1] = char(lvalue);
+    out[2] = char(q1ratio);
+    out[3] = char(q2ratio);
+    memcpy(out.data() + 4, body, BodySize);
+    return out;
+}
+
+SimilarityDigest SimilarityDigest::fromBytes(const char *data)
+{
+    SimilarityDigest d;
+    d.checksum = quint8(data[0]);
+    d.lvalue = quint8(data[1]);
+    d.q1ratio = quint8(data[2]);
+    d.q2ratio = quint8(data[3]);
+    memcpy(d.body, data + 4, BodySize);
+    d.valid = true;
+    return d;
+}
@@ -0,0 +1,57 @@
+#ifndef SIMILARITYDIGEST_H
+#define SIMILARITYDIGEST_H
+
+#include <QByteArray>
+
+// Нечеткий хеш содержимого в стиле TLSH.
+//
+// Окно из 5 байт скользит по файлу, шесть триплетов окна хешируются
+// в 128 корзин. Тело дайджеста - квартиль каждой корзины (2 бита),
+// заголовок - контрольный байт, логарифм длины и отношения квартилей.
+// У похожих файлов (перекомпиляция, небольшой патч) тела отличаются
+// в немногих корзинах, расстояние между дайджестами мало.
+// Таблица Пирсона своя, совместимость с TLSH не заявляется.
+struct SimilarityDigest {
+    static const int Buckets = 128;
+    static const int BodySize = Buckets / 4;
+    static const int Size = 4 + BodySize;  // сериализованный вид
+
+    quint8 checksum = 0;
+    quint8 lvalue = 0;
+    quint8 q1ratio = 0;
+    quint8 q2ratio = 0;
+    quint8 body[BodySize] = {};
+    bool valid = false;
+
+    // Код квартиля корзины (0..3)
+    int bucket(int i) const { return (body[i >> 2] >> ((i & 3) * 2)) & 3; }
+
+    int distance(const SimilarityDigest &other) const;
+
+    QByteArray toBytes() const;
+    static SimilarityDigest fromBytes(const char *data);
+    QByteArray toHex() const { return toBytes().toHex(); }
+};
+
+// Потоковое вычисление дайджеста
+class SimilarityDigestBuilder {
+public:
+    // Файлы короче этого не дают осмысленного дайджеста
+    static const int MinLength = 50;
+
+    SimilarityDigestBuilder();
+
+    void add(const uchar *data, int size);
+    SimilarityDigest finish() const;
+
+    // Дайджест файла целиком (для построения индекса)
+    static SimilarityDigest digestFile(const QByteArray &path);
+
+private:
+    quint32 m_counts[SimilarityDigest::Buckets];
+    uchar m_window[4];  // предыдущие байты, m_window[0] - ближайший
+    quint8 m_checksum;
+    qint64 m_length;
+};
+
+#endif // SIMILARITYDIGEST_H
@@ -0,0 +1,267 @@
+#include "similarityindex.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <string.h>
+
+namespace {
+
+const char INDEX_MAGIC[4] = { 'F', 'S', 'I', '1' };
+const quint32 INDEX_VERSION = 1;
+const int HEADER_SIZE = 32;
+const int ENTRY_SIZE = SimilarityDigest::Size + 4;
+const int PAIR_SIZE = 8;
+const int DEFAULT_MAX_DISTANCE = 40;
+
+inline quint32 readU32(const uchar *p)
+{
+    quint32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+void appendU32(QByteArray &buf, quint32 v)
+{
+    buf.append(reinterpret_cast<const char *>(&v), int(sizeof(v)));
+}
+
+} // namespace
+
+SimilarityIndex::SimilarityIndex()
+    : m_data(nullptr)
+    , m_size(0)
+    , m_count(0)
+    , m_familyCount(0)
+    , m_entries(nullptr)
+    , m_bands(nullptr)
+    , m_families(nullptr)
+{
+}
+
+SimilarityIndex::~SimilarityIndex()
+{
+    if (m_data)
+        m_file.unmap(const_cast<uchar *>(m_data));
+}
+
+bool SimilarityIndex::open(const QString &fileName, QString *error)
+{
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        if (error)
+            *error = m_file.errorString();
+        return false;
+    }
+    m_size = m_file.size();
+    if (m_size >= HEADER_SIZE)
+        m_data = m_file.map(0, m_size);
+    if (!m_data) {
+        if (error)
+            *error = "Файл индекса поврежден";
+        return false;
+    }
+
+    const quint64 size = quint64(m_size);
+    const quint64 count = readU32(m_data + 8);
+    const quint64 families = readU32(m_data + 12);
+    const quint64 bandsOffset = readU32(m_data + 16);
+    const quint64 familiesOffset = readU32(m_data + 20);
+    const bool valid = memcmp(m_data, INDEX_MAGIC, 4) == 0
+                       && readU32(m_data + 4) == INDEX_VERSION
+                       && readU32(m_data + 24) == size
+                       && HEADER_SIZE + count * ENTRY_SIZE <= size
+                       && familiesOffset + families * 4 <= size
+                       && bandsOffset + quint64(Bands) * count * PAIR_SIZE <= size;
+    if (!valid) {
+        if (error)
+            *error = "Файл индекса поврежден или имеет неизвестную версию";
+        m_file.unmap(const_cast<uchar *>(m_data));
+        m_data = nullptr;
+        return false;
+    }
+
+    m_count = quint32(count);
+    m_familyCount = quint32(families);
+    m_entries = m_data + HEADER_SIZE;
+    m_families = m_data + familiesOffset;
+    m_bands = m_data + bandsOffset;
+    return true;
+}
+
+quint16 SimilarityIndex::bandKey(const SimilarityDigest &digest, int band)
+{
+    return quint16(digest.body[band * 2] | (digest.body[band * 2 + 1] << 8));
+}
+
+QString SimilarityIndex::familyName(quint32 index) const
+{
+    if (index >= m_familyCount)
+        return QString();
+    const quint64 offset = quint64(m_families - m_data) + quint64(m_familyCount) * 4
+                           + readU32(m_families + index * 4);
+    if (offset >= quint64(m_size))
+        return QString();
+    const char *name = reinterpret_cast<const char *>(m_data + offset);
+    const void *end = memchr(name, 0, size_t(quint64(m_size) - offset));
+    if (!end)
+        return QString();
+    return QString::fromUtf8(name, int(static_cast<const char *>(end) - name));
+}
+
+bool SimilarityIndex::nearest(const SimilarityDigest &digest, int maxDistance, Match *match) const
+{
+    if (!digest.valid || m_count == 0)
+        return false;
+
+    // Кандидаты: совпадение хотя бы в одной полосе
+    QVector<quint32> candidates;
+    for (int band = 0; band < Bands; ++band) {
+        const quint32 key = bandKey(digest, band);
+        const uchar *pairs = m_bands + quint64(band) * m_count * PAIR_SIZE;
+        quint32 lo = 0;
+        quint32 hi = m_count;
+        while (lo < hi) {
+            const quint32 mid = lo + (hi - lo) / 2;
+            if (readU32(pairs + quint64(mid) * PAIR_SIZE) < key)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for (quint32 i = lo; i < m_count && readU32(pairs + quint64(i) * PAIR_SIZE) == key; ++i) {
+            const quint32 entry = readU32(pairs + quint64(i) * PAIR_SIZE + 4);
+            if (entry < m_count)
+                candidates.append(entry);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    int best = -1;
+    quint32 bestEntry = 0;
+    for (quint32 entry : candidates) {
+        const uchar *e = m_entries + quint64(entry) * ENTRY_SIZE;
+        const int d = digest.distance(SimilarityDigest::fromBytes(reinterpret_cast<const char *>(e)));
+        if (d <= maxDistance && (best < 0 || d < best)) {
+            best = d;
+            bestEntry = entry;
+        }
+    }
+    if (best < 0)
+        return false;
+
+    if (match) {
+        match->family = familyName(readU32(m_entries + quint64(bestEntry) * ENTRY_SIZE + SimilarityDigest::Size));
+        match->distance = best;
+        match->score = qMax(0, 100 - best);
+    }
+    return true;
+}
+
+QString SimilarityIndex::defaultPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/similarity.fsi";
+}
+
+int SimilarityIndex::defaultMaxDistance()
+{
+    bool ok = false;
+    const int distance = qEnvironmentVariable("FORTI_SIMILARITY_DISTANCE").toInt(&ok);
+    return ok && distance >= 0 ? distance : DEFAULT_MAX_DISTANCE;
+}
+
+QSharedPointer<const SimilarityIndex> SimilarityIndex::installed()
+{
+    if (!QFileInfo::exists(defaultPath()))
+        return QSharedPointer<const SimilarityIndex>();
+    QSharedPointer<SimilarityIndex> index(new SimilarityIndex);
+    QString error;
+    if (!index->open(defaultPath(), &error)) {
+        qWarning() << "Индекс похожих образцов не загружен:" << error;
+        return QSharedPointer<const SimilarityIndex>();
+    }
+    return index;
+}
+
+void SimilarityIndexWriter::add(const SimilarityDigest &digest, const QString &family)
+{
+    if (!digest.valid)
+        return;
+    auto it = m_familyIndex.constFind(family);
+    quint32 familyIndex;
+    if (it != m_familyIndex.constEnd()) {
+        familyIndex = it.value();
+    } else {
+        familyIndex = quint32(m_families.size());
+        m_families.append(family);
+        m_familyIndex.insert(family, familyIndex);
+    }
+    m_entries.append(Entry{ digest.toBytes(), familyIndex });
+}
+
+bool SimilarityIndexWriter::write(const QString &fileName, QString *error) const
+{
+    const quint32 count = quint32(m_entries.size());
+
+    QByteArray entries;
+    entries.reserve(int(count) * ENTRY_SIZE);
+    for (const Entry &e : m_entries) {
+        entries.append(e.digest);
+        appendU32(entries, e.family);
+    }
+
+    QByteArray families;
+    QByteArray names;
+    for (const QString &family : m_families) {
+        appendU32(families, quint32(names.size()));
+        names.append(family.toUtf8()).append('\0');
+    }
+    families.append(names);
+    while (families.size() % 8)
+        families.append('\0');
+
+    QByteArray bands;
+    bands.reserve(SimilarityIndex::Bands * int(count) * PAIR_SIZE);
+    QVector<QPair<quint32, quint32>> pairs;
+    pairs.resize(int(count));
+    for (int band = 0; band < SimilarityIndex::Bands; ++band) {
+        for (quint32 i = 0; i < count; ++i) {
+            const SimilarityDigest d = SimilarityDigest::fromBytes(m_entries[int(i)].digest.constData());
+            pairs[int(i)] = qMakePair(quint32(SimilarityIndex::bandKey(d, band)), i);
+        }
+        std::sort(pairs.begin(), pairs.end());
+        for (const auto &p : pairs) {
+            appendU32(bands, p.first);
+            appendU32(bands, p.second);
+        }
+    }
+
+    const quint32 familiesOffset = quint32(HEADER_SIZE + entries.size());
+    const quint32 bandsOffset = familiesOffset + quint32(families.size());
+    QByteArray header(HEADER_SIZE, '\0');
+    memcpy(header.data(), INDEX_MAGIC, 4);
+    const quint32 fields[] = { INDEX_VERSION, count, quint32(m_families.size()), bandsOffset,
+                               familiesOffset, bandsOffset + quint32(bands.size()) };
+    memcpy(header.data() + 4, fields, sizeof(fields));
+
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+    file.write(header);
+    file.write(entries);
+    file.write(families);
+    file.write(bands);
+    if (!file.commit()) {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+    return true;
+}
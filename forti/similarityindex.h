@@ -0,0 +1,89 @@
+#ifndef SIMILARITYINDEX_H
+#define SIMILARITYINDEX_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QSharedPointer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "similaritydigest.h"
+
+// Индекс дайджестов известных вредоносных образцов (*.fsi) для поиска
+// ближайшего соседа за сублинейное время.
+//
+// Тело дайджеста режется на Bands полос по 16 бит (8 корзин). Для каждой
+// полосы хранится массив пар (значение полосы, номер образца),
+// отсортированный по значению. Кандидаты - образцы, совпавшие с запросом
+// хотя бы в одной полосе; точное расстояние считается только для них.
+//
+// Разметка (little-endian):
+//   0  "FSI1"   4 версия   8 число образцов   12 число семейств
+//   16 смещение полос   20 смещение таблицы семейств   24 размер файла
+//   32 образцы: дайджест (SimilarityDigest::Size) + u32 семейство
+//   таблица семейств: u32 смещения строк, затем строки UTF-8 с нулем
+//   полосы: Bands массивов по числу образцов из пар u32
+class SimilarityIndex {
+public:
+    static const int Bands = SimilarityDigest::BodySize / 2;
+
+    struct Match {
+        QString family;
+        int distance = -1;
+        int score = 0;  // сходство в процентах
+    };
+
+    SimilarityIndex();
+    ~SimilarityIndex();
+
+    bool open(const QString &fileName, QString *error = nullptr);
+    int count() const { return int(m_count); }
+
+    // Ближайший образец не дальше maxDistance
+    bool nearest(const SimilarityDigest &digest, int maxDistance, Match *match) const;
+
+    // Индекс из каталога данных, если он построен
+    static QSharedPointer<const SimilarityIndex> installed();
+    static QString defaultPath();
+    // Порог похожести (FORTI_SIMILARITY_DISTANCE, по умолчанию 40)
+    static int defaultMaxDistance();
+
+private:
+    Q_DISABLE_COPY(SimilarityIndex)
+
+    static quint16 bandKey(const SimilarityDigest &digest, int band);
+    QString familyName(quint32 index) const;
+
+    QFile m_file;
+    const uchar *m_data;
+    qint64 m_size;
+    quint32 m_count;
+    quint32 m_familyCount;
+    const uchar *m_entries;
+    const uchar *m_bands;
+    const uchar *m_families;
+
+    friend class SimilarityIndexWriter;
+};
+
+// Построение индекса: семейство задается строкой, например именем
+// подкаталога с образцами
+class SimilarityIndexWriter {
+public:
+    void add(const SimilarityDigest &digest, const QString &family);
+    int size() const { return m_entries.size(); }
+    bool write(const QString &fileName, QString *error = nullptr) const;
+
+private:
+    struct Entry {
+        QByteArray digest;
+        quint32 family;
+    };
+    QVector<Entry> m_entries;
+    QStringList m_families;
+    QHash<QString, quint32> m_familyIndex;
+};
+
+#endif // SIMILARITYINDEX_H
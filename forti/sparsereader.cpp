@@ -0,0 +1,114 @@
+#include "sparsereader.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::atomic<quint64> *SparseReader::s_progress = nullptr;
+
+void SparseReader::setProgressCounter(std::atomic<quint64> *counter)
+{
+    s_progress = counter;
+}
+
+SparseReader::SparseReader(int fd, qint64 offset, qint64 length)
+    : m_fd(fd)
+    , m_pos(offset)
+    , m_size(-1)
+    , m_end(length < 0 ? -1 : offset + length)
+    , m_dataEnd(offset)
+    , m_sparse(false)
+    , m_holeBytes(0)
+{
+    // Дыры возможны, только если блоков выделено меньше размера
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+        && qint64(st.st_blocks) * 512 < qint64(st.st_size)) {
+        m_sparse = true;
+        m_size = st.st_size;
+        if (m_end >= 0)
+            m_size = qMin(m_size, m_end);
+    }
+}
+
+const uchar *SparseReader::zeros()
+{
+    static const uchar block[ZeroBlockSize] = {};
+    return block;
+}
+
+void SparseReader::feedZeros(qint64 length, const Consumer &consume)
+{
+    while (length > 0) {
+        const int size = int(qMin<qint64>(length, ZeroBlockSize));
+        consume(zeros(), size);
+        length -= size;
+    }
+}
+
+qint64 SparseReader::next(void *buffer, int capacity, bool *hole)
+{
+    *hole = false;
+    if (m_end >= 0 && m_pos >= m_end)
+        return 0;
+    if (m_sparse && m_pos >= m_dataEnd) {
+        const off_t data = ::lseek(m_fd, off_t(m_pos), SEEK_DATA);
+        if (data < 0 && errno == ENXIO) {
+            // Данных дальше нет: остаток до конца (границы) - дыра
+            if (m_pos >= m_size)
+                return 0;
+            *hole = true;
+            const qint64 length = m_size - m_pos;
+            m_pos = m_size;
+            m_holeBytes += length;
+            return length;
+        }
+        if (data < 0) {
+            // SEEK_DATA не поддерживается: дальше файл читается целиком
+            m_sparse = false;
+        } else if (qint64(data) > m_pos) {
+            // Дыра не дальше границы чтения
+            *hole = true;
+            const qint64 to = qMin(qint64(data), m_size);
+            const qint64 length = to - m_pos;
+            m_pos = to;
+            m_holeBytes += length;
+            return length;
+        } else {
+            const off_t end = ::lseek(m_fd, off_t(m_pos), SEEK_HOLE);
+            m_dataEnd = end > data ? qint64(end) : m_size;
+        }
+    }
+
+    qint64 want = capacity;
+    if (m_end >= 0)
+        want = qMin(want, m_end - m_pos);
+    if (m_sparse)
+        want = qMin(want, qMax<qint64>(m_dataEnd - m_pos, 1));
+    for (;;) {
+        const ssize_t got = ::pread(m_fd, buffer, size_t(want), off_t(m_pos));
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0)
+            return -1;
+        m_pos += got;
+        addProgress(got);
+        return got;
+    }
+}
+
+bool SparseReader::readAll(void *buffer, int capacity, const Consumer &consume)
+{
+    for (;;) {
+        bool hole = false;
+        const qint64 got = next(buffer, capacity, &hole);
+        if (got < 0)
+            return false;
+        if (got == 0)
+            return true;
+        if (hole)
+            feedZeros(got, consume);
+        else
+            consume(static_cast<const uchar *>(buffer), int(got));
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef SPARSEREADER_H
+#define SPARSEREADER_H
+
+#include <QtGlobal>
+
+#include <atomic>
+#include <functional>
+
+// Последовательное чтение файла по выделенным участкам.
+//
+// У разреженного файла (образы дисков, базы данных) дыры не занимают
+// места на диске и читаются как нули. Читатель находит участки данных
+// через lseek(SEEK_DATA/SEEK_HOLE) и читает только их, а дыру отдает
+// одной длиной: вызывающий сам решает, подать ли ее как нули (хеш,
+// шифрование) или просто сдвинуть позицию. Обычный файл (выделено не
+// меньше размера) читается как раньше, без лишних вызовов lseek. Если
+// файловая система не поддерживает SEEK_DATA, весь файл - данные.
+class SparseReader {
+public:
+    static const int ZeroBlockSize = 64 * 1024;
+
+    typedef std::function<void(const uchar *data, int size)> Consumer;
+
+    // Чтение с позиции offset до конца файла или length байт. Читается
+    // через pread, но позицию дескриптора меняет поиск участков (lseek)
+    explicit SparseReader(int fd, qint64 offset = 0, qint64 length = -1);
+
+    // Следующий участок. Данные читаются в buffer (не больше capacity),
+    // *hole = false, возвращается их длина. Дыра не читается: *hole = true,
+    // возвращается ее длина (может быть больше capacity).
+    // 0 - конец файла, -1 - ошибка чтения
+    qint64 next(void *buffer, int capacity, bool *hole);
+
+    // Остаток файла блоками; дыры - блоками zeros() без чтения.
+    // false - ошибка чтения
+    bool readAll(void *buffer, int capacity, const Consumer &consume);
+
+    qint64 position() const { return m_pos; }
+    // Сколько байт пришлось на дыры (не читалось с диска)
+    qint64 holeBytes() const { return m_holeBytes; }
+
+    // ZeroBlockSize нулевых байт
+    static const uchar *zeros();
+    // Подать length нулей блоками zeros()
+    static void feedZeros(qint64 length, const Consumer &consume);
+
+    // Счетчик прочитанных с диска байт на весь процесс. Обработчик
+    // сканирования направляет его в разделяемую память, и сторожевой
+    // таймер пула видит, что долгое чтение крупного файла идет
+    static void setProgressCounter(std::atomic<quint64> *counter);
+    static void addProgress(qint64 bytes)
+    {
+        if (s_progress)
+            s_progress->fetch_add(quint64(bytes), std::memory_order_relaxed);
+    }
+
+private:
+    static std::atomic<quint64> *s_progress;
+
+    int m_fd;
+    qint64 m_pos;
+    qint64 m_size;
+    qint64 m_end;      // граница чтения, -1 - конец файла
+    qint64 m_dataEnd;  // конец текущего участка данных
+    bool m_sparse;
+    qint64 m_holeBytes;
+};
+
+#endif // SPARSEREADER_H
@@ -0,0 +1,77 @@
+#include "startuptrace.h"
+
+#include <QDebug>
+
+// Бюджет запуска по умолчанию (до первой отрисовки окна)
+static const qint64 DEFAULT_STARTUP_BUDGET_MS = 300;
+
+StartupTrace &StartupTrace::instance()
+{
+    static StartupTrace trace;
+    return trace;
+}
+
+StartupTrace::StartupTrace()
+    : m_lastMark(0)
+    , m_budgetMs(DEFAULT_STARTUP_BUDGET_MS)
+    , m_verbose(false)
+    , m_finished(false)
+{
+    bool ok = false;
+    const qint64 budget = qEnvironmentVariable("FORTI_STARTUP_BUDGET_MS").toLongLong(&ok);
+    if (ok && budget > 0)
+        m_budgetMs = budget;
+    m_verbose = qEnvironmentVariableIsSet("FORTI_STARTUP_TRACE");
+}
+
+void StartupTrace::start()
+{
+    m_timer.start();
+    m_lastMark = 0;
+    m_finished = false;
+    m_phases.clear();
+}
+
+qint64 StartupTrace::elapsedMs() const
+{
+    return m_timer.isValid() ? m_timer.elapsed() : 0;
+}
+
+void StartupTrace::mark(const QString &phase)
+{
+    if (m_finished || !m_timer.isValid())
+        return;
+    const qint64 now = m_timer.elapsed();
+    m_phases.append(qMakePair(phase, now - m_lastMark));
+    m_lastMark = now;
+}
+
+void StartupTrace::finish()
+{
+    if (m_finished || !m_timer.isValid())
+        return;
+    m_finished = true;
+
+    const qint64 total = m_timer.elapsed();
+    const bool overBudget = total > m_budgetMs;
+    if (!m_verbose && !overBudget)
+        return;
+
+    for (const auto &phase : m_phases)
+        qDebug().noquote() << QString("[startup] %1: %2 мс").arg(phase.first, -16).arg(phase.second);
+
+    if (overBudget)
+        qWarning().noquote() << QString("[startup] итого %1 мс, бюджет %2 мс превышен")
+                                    .arg(total).arg(m_budgetMs);
+    else
+        qDebug().noquote() << QString("[startup] итого %1 мс (бюджет %2 мс)")
+                                  .arg(total).arg(m_budgetMs);
+}
+
+void StartupTrace::lazy(const QString &subsystem, qint64 elapsedMs)
+{
+    if (!m_verbose)
+        return;
+    qDebug().noquote() << QString("[startup] ленивая инициализация %1: %2 мс (через %3 мс после старта)")
+                              .arg(subsystem).arg(elapsedMs).arg(this->elapsedMs());
+}
@@ -0,0 +1,55 @@
+#ifndef STARTUPTRACE_H
+#define STARTUPTRACE_H
+
+#include <QElapsedTimer>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+// Трассировка времени запуска по фазам.
+// Фазы отмечаются вызовом mark(); finish() вызывается после первой
+// отрисовки окна и сравнивает общее время с бюджетом. Всё, что
+// инициализируется позже (лениво), отмечается через lazy().
+class StartupTrace {
+public:
+    static StartupTrace &instance();
+
+    void start();
+    void mark(const QString &phase);
+    void finish();
+    void lazy(const QString &subsystem, qint64 elapsedMs);
+
+    bool isFinished() const { return m_finished; }
+    qint64 elapsedMs() const;
+    qint64 budgetMs() const { return m_budgetMs; }
+
+private:
+    StartupTrace();
+
+    QElapsedTimer m_timer;
+    qint64 m_lastMark;
+    qint64 m_budgetMs;
+    bool m_verbose;
+    bool m_finished;
+    QVector<QPair<QString, qint64>> m_phases;
+};
+
+// Замер ленивой инициализации подсистемы (пишется в трассировку)
+class LazyInitTimer {
+public:
+    explicit LazyInitTimer(const QString &subsystem)
+        : m_subsystem(subsystem)
+    {
+        m_timer.start();
+    }
+    ~LazyInitTimer()
+    {
+        StartupTrace::instance().lazy(m_subsystem, m_timer.elapsed());
+    }
+
+private:
+    QString m_subsystem;
+    QElapsedTimer m_timer;
+};
+
+#endif // STARTUPTRACE_H